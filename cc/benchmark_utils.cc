@@ -0,0 +1,52 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/benchmark_utils.h"
+
+#include <memory>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "cc/constants.h"
+#include "cc/file/path.h"
+#include "cc/file/utils.h"
+#include "cc/logging.h"
+#include "cc/sgf.h"
+
+namespace minigo {
+
+std::vector<std::vector<Move>> LoadBenchmarkGames() {
+  auto dir =
+      file::JoinPath("cc/testdata/benchmark", absl::StrCat(kN, "x", kN));
+  std::vector<std::string> files;
+  MG_CHECK(file::ListDir(dir, &files)) << "couldn't list " << dir;
+
+  std::vector<std::vector<Move>> games;
+  for (const auto& f : files) {
+    auto path = file::JoinPath(dir, f);
+    std::string contents;
+    MG_CHECK(file::ReadFile(path, &contents)) << "couldn't read " << path;
+
+    sgf::Ast ast;
+    MG_CHECK(ast.Parse(contents))
+        << "couldn't parse " << path << ": " << ast.error();
+    std::vector<std::unique_ptr<sgf::Node>> trees;
+    MG_CHECK(sgf::GetTrees(ast, &trees) && !trees.empty()) << path;
+    games.push_back(trees[0]->ExtractMainLine());
+  }
+  MG_CHECK(!games.empty()) << "no games found in " << dir;
+  return games;
+}
+
+}  // namespace minigo
@@ -0,0 +1,31 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_BENCHMARK_UTILS_H_
+#define CC_BENCHMARK_UTILS_H_
+
+#include <vector>
+
+#include "cc/move.h"
+
+namespace minigo {
+
+// Returns the main line of each of the games in cc/testdata/benchmark for the
+// current board size. The path is relative to the runfiles root, so benchmarks
+// that call LoadBenchmarkGames must be run with `bazel run`.
+std::vector<std::vector<Move>> LoadBenchmarkGames();
+
+}  // namespace minigo
+
+#endif  // CC_BENCHMARK_UTILS_H_
@@ -14,12 +14,15 @@
 
 #include "cc/dual_net/lite_dual_net.h"
 
+#include <algorithm>
+
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "cc/constants.h"
 #include "cc/file/path.h"
 #include "cc/logging.h"
+#include "cc/memory_accounting.h"
 #include "cc/platform/utils.h"
 #include "tensorflow/lite/context.h"
 #include "tensorflow/lite/interpreter.h"
@@ -70,6 +73,9 @@ class LiteDualNet : public Model {
 
   BackedTensor<float> unquantized_policy_;
   BackedTensor<float> unquantized_value_;
+
+  memory::TrackedBytes<memory::Category::kModelArena> arena_bytes_;
+  memory::TrackedBytes<memory::Category::kModelBuffers> buffer_bytes_;
 };
 
 LiteDualNet::LiteDualNet(std::string graph_path,
@@ -136,6 +142,23 @@ void LiteDualNet::Reserve(int capacity) {
   unquantized_policy_.resize(capacity, 1, 1, kNumMoves);
   unquantized_value_.resize(capacity, 1, 1, 1);
 
+  // The interpreter's arena reuses memory between tensors whose lifetimes
+  // don't overlap, so the sum of the arena allocated tensors is an upper
+  // bound on the arena's size.
+  int64_t arena_bytes = 0;
+  for (size_t i = 0; i < interpreter_->tensors_size(); ++i) {
+    const auto* tensor = interpreter_->tensor(i);
+    if (tensor->allocation_type == kTfLiteArenaRw ||
+        tensor->allocation_type == kTfLiteArenaRwPersistent) {
+      arena_bytes += tensor->bytes;
+    }
+  }
+  arena_bytes_.Set(arena_bytes);
+
+  // The unquantized buffers only ever grow.
+  int64_t buffer_bytes = capacity * (kNumMoves + 1) * sizeof(float);
+  buffer_bytes_.Set(std::max(buffer_bytes_.bytes(), buffer_bytes));
+
   batch_capacity_ = capacity;
 }
 
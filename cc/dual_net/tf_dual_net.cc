@@ -27,15 +27,16 @@
 #include "cc/constants.h"
 #include "cc/file/path.h"
 #include "cc/logging.h"
+#include "cc/memory_accounting.h"
 #include "cc/model/buffered_model.h"
 #include "cc/thread_safe_queue.h"
+#include "cc/tracing.h"
 #include "tensorflow/core/framework/graph.pb.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/public/session.h"
-#include "wtf/macros.h"
 
 #if MINIGO_ENABLE_GPU
 #include "tensorflow/core/common_runtime/gpu/gpu_init.h"
@@ -79,6 +80,10 @@ class TfDualNet : public Model {
   std::vector<tensorflow::Tensor> outputs_;
   const std::string graph_path_;
   int batch_capacity_ = 0;
+
+  // Memory used by the feed & fetch tensors. Memory allocated internally by
+  // the session isn't visible to us.
+  memory::TrackedBytes<memory::Category::kModelBuffers> buffer_bytes_;
 };
 
 TfDualNet::TfDualNet(const std::string& graph_path,
@@ -126,6 +131,12 @@ void TfDualNet::RunMany(const std::vector<const ModelInput*>& inputs,
     TF_CHECK_OK(session_->Run(inputs_, output_names_, {}, &outputs_));
   }
 
+  int64_t buffer_bytes = inputs_[0].second.TotalBytes();
+  for (const auto& output : outputs_) {
+    buffer_bytes += output.TotalBytes();
+  }
+  buffer_bytes_.Set(buffer_bytes);
+
   Tensor<float> policy(batch_capacity_, 1, 1, kNumMoves,
                        outputs_[0].flat<float>().data());
   Tensor<float> value(batch_capacity_, 1, 1, 1,
@@ -27,12 +27,12 @@
 #include "cc/file/path.h"
 #include "cc/logging.h"
 #include "cc/model/buffered_model.h"
+#include "cc/tracing.h"
 #include "tensorflow/core/framework/graph.pb.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/lib/core/status.h"
 #include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/protobuf.h"
-#include "wtf/macros.h"
 
 using tensorflow::DT_FLOAT;
 using tensorflow::Env;
@@ -150,6 +150,15 @@ void TpuDualNet::RunManyImpl(std::string* model_name) {
     TF_CHECK_OK(session_->Run(inputs_, output_names_, {}, &outputs_));
   }
 
+  int64_t buffer_bytes = 0;
+  for (const auto& input : inputs_) {
+    buffer_bytes += input.second.TotalBytes();
+  }
+  for (const auto& output : outputs_) {
+    buffer_bytes += output.TotalBytes();
+  }
+  buffer_bytes_.Set(buffer_bytes);
+
   // Copy the policy and value out of the output tensors.
   for (size_t i = 0; i < num_features; ++i) {
     size_t replica = i / batch_size;
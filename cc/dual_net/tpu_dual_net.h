@@ -21,6 +21,7 @@
 #include <vector>
 
 #include "cc/constants.h"
+#include "cc/memory_accounting.h"
 #include "cc/model.h"
 #include "cc/random.h"
 #include "cc/thread_safe_queue.h"
@@ -53,6 +54,9 @@ class TpuDualNet : public Model {
   size_t batch_capacity_ = 0;
   const int num_replicas_;
   const std::string graph_path_;
+
+  // Memory used by the feed & fetch tensors.
+  memory::TrackedBytes<memory::Category::kModelBuffers> buffer_bytes_;
 };
 
 class TpuDualNetFactory : public ModelFactory {
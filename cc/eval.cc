@@ -28,6 +28,7 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "cc/constants.h"
@@ -42,6 +43,7 @@
 #include "cc/model/batching_model.h"
 #include "cc/model/model.h"
 #include "cc/random.h"
+#include "cc/sprt.h"
 #include "cc/tf_utils.h"
 #include "cc/zobrist.h"
 #include "gflags/gflags.h"
@@ -72,6 +74,24 @@ DEFINE_string(model, "",
               "engine=lite, the model should be .tflite flatbuffer.");
 DEFINE_string(model_two, "", "Descriptor for the second model");
 DEFINE_int32(parallel_games, 32, "Number of games to play in parallel.");
+DEFINE_int32(num_games, 0,
+             "Total number of games to play. Defaults to parallel_games. If "
+             "sprt is true, the evaluation may stop before all games have been "
+             "played.");
+
+// Early stopping flags.
+DEFINE_bool(sprt, false,
+            "If true, stop the evaluation as soon as a sequential probability "
+            "ratio test decides whether model is stronger than model_two. "
+            "Games still in flight when a decision is reached are cancelled.");
+DEFINE_double(sprt_elo0, 0,
+              "SPRT null hypothesis: model is sprt_elo0 Elo stronger than "
+              "model_two.");
+DEFINE_double(sprt_elo1, 35,
+              "SPRT alternative hypothesis: model is sprt_elo1 Elo stronger "
+              "than model_two.");
+DEFINE_double(sprt_alpha, 0.05, "SPRT false positive rate.");
+DEFINE_double(sprt_beta, 0.05, "SPRT false negative rate.");
 
 // Output flags.
 DEFINE_string(output_bigtable, "",
@@ -172,35 +192,47 @@ class Evaluator {
 
     ParseOptionsFromFlags(&game_options_, &player_options_);
 
-    int num_games = FLAGS_parallel_games;
-    for (int thread_id = 0; thread_id < num_games; ++thread_id) {
-      bool swap_models = (thread_id & 1) != 0;
-      threads_.emplace_back(std::bind(&Evaluator::ThreadRun, this, thread_id,
-                                      swap_models ? &model_b : &model_a,
-                                      swap_models ? &model_a : &model_b));
+    MG_CHECK(FLAGS_parallel_games >= 1);
+    num_games_ = FLAGS_num_games == 0 ? FLAGS_parallel_games : FLAGS_num_games;
+    MG_CHECK(num_games_ >= FLAGS_parallel_games)
+        << "if num_games is set, it must be >= parallel_games";
+
+    if (FLAGS_sprt) {
+      Sprt::Options sprt_options;
+      sprt_options.elo0 = FLAGS_sprt_elo0;
+      sprt_options.elo1 = FLAGS_sprt_elo1;
+      sprt_options.alpha = FLAGS_sprt_alpha;
+      sprt_options.beta = FLAGS_sprt_beta;
+      absl::MutexLock lock(&mutex_);
+      sprt_ = absl::make_unique<Sprt>(sprt_options);
+    }
+
+    for (int thread_id = 0; thread_id < FLAGS_parallel_games; ++thread_id) {
+      threads_.emplace_back(
+          std::bind(&Evaluator::ThreadRun, this, thread_id, &model_a, &model_b));
     }
     for (auto& t : threads_) {
       t.join();
     }
 
-    MG_LOG(INFO) << "Evaluated " << num_games << " games, total time "
+    MG_LOG(INFO) << "Evaluated " << num_finished_games_ << " games ("
+                 << num_cancelled_games_ << " cancelled), total time "
                  << (absl::Now() - start_time);
 
     MG_LOG(INFO) << FormatWinStatsTable(
         {{model_a.name(), model_a.GetWinStats()},
          {model_b.name(), model_b.GetWinStats()}});
+
+    absl::MutexLock lock(&mutex_);
+    if (sprt_ != nullptr) {
+      MG_LOG(INFO) << model_a.name() << " vs " << model_b.name() << ": "
+                   << sprt_->ToString();
+    }
   }
 
  private:
-  void ThreadRun(int thread_id, EvaluatedModel* black_model,
-                 EvaluatedModel* white_model) {
-    // Only print the board using ANSI colors if stderr is sent to the
-    // terminal.
-    const bool use_ansi_colors = FdSupportsAnsiColors(fileno(stderr));
-
-    // The player and other_player reference this pointer.
-    std::unique_ptr<Model> model;
-
+  void ThreadRun(int thread_id, EvaluatedModel* model_a,
+                 EvaluatedModel* model_b) {
     std::vector<std::string> bigtable_spec =
         absl::StrSplit(FLAGS_output_bigtable, ',');
     bool use_bigtable = bigtable_spec.size() == 3;
@@ -210,6 +242,27 @@ class Evaluator {
       return;
     }
 
+    for (;;) {
+      int game_index = num_started_games_++;
+      if (game_index >= num_games_ || stop_) {
+        break;
+      }
+      // Alternate which model plays black.
+      bool swap_models = (game_index & 1) != 0;
+      PlayGame(thread_id, model_a, swap_models ? model_b : model_a,
+               swap_models ? model_a : model_b, bigtable_spec);
+    }
+
+    MG_LOG(INFO) << "Thread " << thread_id << " stopping";
+  }
+
+  void PlayGame(int thread_id, const EvaluatedModel* model_a,
+                EvaluatedModel* black_model, EvaluatedModel* white_model,
+                const std::vector<std::string>& bigtable_spec) {
+    // Only print the board using ANSI colors if stderr is sent to the
+    // terminal.
+    const bool use_ansi_colors = FdSupportsAnsiColors(fileno(stderr));
+
     Game game(black_model->name(), white_model->name(), game_options_);
 
     const bool verbose = thread_id == 0;
@@ -221,7 +274,15 @@ class Evaluator {
     BatchingModelFactory::StartGame(black->model(), white->model());
     auto* curr_player = black.get();
     auto* next_player = white.get();
+    bool cancelled = false;
     while (!game.game_over() && !curr_player->root()->at_move_limit()) {
+      if (stop_) {
+        // The evaluation has already been decided, there's no point finishing
+        // this game.
+        cancelled = true;
+        break;
+      }
+
       if (curr_player->root()->position.n() >= kMinPassAliveMoves &&
           curr_player->root()->position.CalculateWholeBoardPassAlive()) {
         // Play pass moves to end the game.
@@ -251,11 +312,21 @@ class Evaluator {
     }
     BatchingModelFactory::EndGame(black->model(), white->model());
 
-    if (game.result() > 0) {
-      black_model->UpdateWinStats(game);
-    } else {
-      white_model->UpdateWinStats(game);
+    if (cancelled) {
+      num_cancelled_games_ += 1;
+      MG_LOG(INFO) << "Thread " << thread_id << " cancelled game at move "
+                   << game.num_moves();
+      return;
+    }
+
+    auto* winner = game.result() > 0 ? black_model : white_model;
+    if (!RecordResult(winner, winner == model_a, game)) {
+      num_cancelled_games_ += 1;
+      MG_LOG(INFO) << "Thread " << thread_id
+                   << " discarded game finished after the SPRT decision";
+      return;
     }
+    num_finished_games_ += 1;
 
     if (verbose) {
       MG_LOG(INFO) << game.result_string();
@@ -274,15 +345,34 @@ class Evaluator {
       WriteSgf(FLAGS_sgf_dir, output_name, game, true);
     }
 
-    if (use_bigtable) {
+    if (bigtable_spec.size() == 3) {
       const auto& gcp_project_name = bigtable_spec[0];
       const auto& instance_name = bigtable_spec[1];
       const auto& table_name = bigtable_spec[2];
       tf_utils::WriteEvalRecord(gcp_project_name, instance_name, table_name,
                                 game, output_name, FLAGS_bigtable_tag);
     }
+  }
 
-    MG_LOG(INFO) << "Thread " << thread_id << " stopping";
+  // Records the result of a finished game in the winner's stats and the SPRT
+  // (if enabled), and signals all threads to stop once the test reaches a
+  // decision. Games that finish after the decision are discarded, so that the
+  // win stats and the SPRT always count the same games. Returns false if the
+  // game was discarded.
+  bool RecordResult(EvaluatedModel* winner, bool a_won, const Game& game) {
+    absl::MutexLock lock(&mutex_);
+    if (stop_) {
+      return false;
+    }
+    winner->UpdateWinStats(game);
+    if (sprt_ != nullptr) {
+      sprt_->Update(a_won);
+      if (sprt_->decision() != Sprt::Decision::kContinue) {
+        MG_LOG(INFO) << "Stopping early: " << sprt_->ToString();
+        stop_ = true;
+      }
+    }
+    return true;
   }
 
   Game::Options game_options_;
@@ -290,6 +380,17 @@ class Evaluator {
   std::vector<std::thread> threads_;
   std::atomic<size_t> game_id_{0};
 
+  int num_games_ = 0;
+  std::atomic<int> num_started_games_{0};
+  std::atomic<int> num_finished_games_{0};
+  std::atomic<int> num_cancelled_games_{0};
+
+  // Set when the SPRT has reached a decision and all games should stop.
+  std::atomic<bool> stop_{false};
+
+  absl::Mutex mutex_;
+  std::unique_ptr<Sprt> sprt_ GUARDED_BY(&mutex_);
+
   const ModelDescriptor desc_a_;
   const ModelDescriptor desc_b_;
   std::vector<std::unique_ptr<BatchingModelFactory>> batchers_;
@@ -21,6 +21,20 @@
 
 namespace minigo {
 
+namespace {
+
+// Returns the approximate number of bytes used by `move`.
+size_t MemoryUsage(const Game::Move& move) {
+  size_t bytes = sizeof(move) + move.comment.capacity() +
+                 move.models.capacity() * sizeof(std::string);
+  for (const auto& model : move.models) {
+    bytes += model.capacity();
+  }
+  return bytes;
+}
+
+}  // namespace
+
 std::ostream& operator<<(std::ostream& os, const Game::Options& options) {
   os << "resign_threshold:" << options.resign_threshold
      << " resign_enabled:" << options.resign_enabled << " komi:" << options.komi
@@ -44,6 +58,7 @@ void Game::NewGame() {
   game_over_ = false;
   moves_.clear();
   comment_.clear();
+  history_bytes_.Set(0);
 }
 
 void Game::AddComment(const std::string& comment) {
@@ -75,6 +90,7 @@ void Game::AddMove(Color color, Coord c, const Position& position,
   move->comment = std::move(comment);
   move->models = std::move(models);
   move->search_pi = search_pi;
+  history_bytes_.Add(MemoryUsage(*move));
 }
 
 void Game::MarkLastMoveAsTrainable() {
@@ -84,6 +100,7 @@ void Game::MarkLastMoveAsTrainable() {
 
 void Game::UndoMove() {
   MG_CHECK(!moves_.empty());
+  history_bytes_.Add(-static_cast<int64_t>(MemoryUsage(*moves_.back())));
   moves_.pop_back();
   game_over_ = false;
 }
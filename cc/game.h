@@ -24,6 +24,7 @@
 #include "cc/color.h"
 #include "cc/constants.h"
 #include "cc/coord.h"
+#include "cc/memory_accounting.h"
 #include "cc/position.h"
 
 namespace minigo {
@@ -159,6 +160,9 @@ class Game {
   std::string result_string_;
   std::string comment_;
   std::vector<std::unique_ptr<Move>> moves_;
+
+  // Memory used by moves_.
+  memory::TrackedBytes<memory::Category::kGameHistory> history_bytes_;
 };
 
 template <typename T>
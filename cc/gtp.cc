@@ -20,6 +20,7 @@
 #include "cc/dual_net/factory.h"
 #include "cc/file/path.h"
 #include "cc/gtp_client.h"
+#include "cc/gtp_server.h"
 #include "cc/init.h"
 #include "cc/minigui_gtp_client.h"
 #include "cc/zobrist.h"
@@ -27,15 +28,29 @@
 
 // GTP flags.
 DEFINE_bool(minigui, false, "Enable Minigui GTP extensions");
+DEFINE_bool(server, false,
+            "If true, serve multiple concurrent GTP sessions multiplexed over "
+            "stdin & stdout. Each input line must be prefixed by a session ID "
+            "and each response is prefixed by the ID of the session it "
+            "belongs to. See gtp_server.h for details.");
+DEFINE_int32(max_sessions, 64,
+             "If server is true, the maximum number of concurrent sessions.");
 
 // Game options flags.
 DEFINE_int32(
     ponder_limit, 0,
     "If non-zero and in GTP mode, the number times of times to perform tree "
     "search while waiting for the opponent to play.");
+DEFINE_int32(ponder_replies, 0,
+             "If non-zero, focus pondering on this many of the opponent's "
+             "most likely replies, searching each as its own subtree.");
 DEFINE_bool(courtesy_pass, false,
             "If true, always pass if the opponent passes.");
 DEFINE_double(resign_threshold, -0.999, "Resign threshold.");
+DEFINE_int32(root_parallelism, 1,
+             "If greater than 1, the number of independent searches to run in "
+             "parallel for each genmove. Their root visit counts are merged "
+             "to pick the move.");
 
 // Tree search flags.
 DEFINE_int32(num_readouts, 100,
@@ -61,6 +76,17 @@ DEFINE_double(
 DEFINE_double(decay_factor, 0.98,
               "If time_limit is non-zero, the decay factor used to shorten the "
               "amount of time spent thinking as the game progresses.");
+DEFINE_bool(adaptive_time, false,
+            "If true and seconds_per_move is non-zero, stop thinking early "
+            "when the best move is settled and spend the time saved thinking "
+            "longer about moves where the top two candidates are close.");
+DEFINE_double(max_time_extension, 2.0,
+              "If adaptive_time is true, the maximum factor by which the time "
+              "spent thinking about a single move may be extended.");
+DEFINE_int32(tree_memory_budget_mb, 0,
+             "If non-zero, the approximate maximum size of the search tree in "
+             "MB. When exceeded, the least visited subtrees are collapsed so "
+             "that long analysis sessions with pondering use bounded memory.");
 
 // Inference flags.
 DEFINE_string(model, "",
@@ -87,10 +113,15 @@ void Gtp() {
   player_options.seconds_per_move = FLAGS_seconds_per_move;
   player_options.time_limit = FLAGS_time_limit;
   player_options.decay_factor = FLAGS_decay_factor;
+  player_options.adaptive_time = FLAGS_adaptive_time;
+  player_options.max_time_extension = FLAGS_max_time_extension;
+  player_options.tree_memory_budget_mb = FLAGS_tree_memory_budget_mb;
 
   GtpClient::Options client_options;
   client_options.ponder_limit = FLAGS_ponder_limit;
+  client_options.ponder_replies = FLAGS_ponder_replies;
   client_options.courtesy_pass = FLAGS_courtesy_pass;
+  client_options.root_parallelism = FLAGS_root_parallelism;
   // Disable tree reuse and rely on the inference cache when running in Minigui
   // mode: we don't want to pollute the tree when investigating variations.
   client_options.tree_reuse = !FLAGS_minigui;
@@ -106,12 +137,29 @@ void Gtp() {
     MG_LOG(INFO) << "Will cache up to " << capacity
                  << " inferences, using roughly " << FLAGS_cache_size_mb
                  << "MB.\n";
-    inference_cache = std::make_shared<ThreadSafeInferenceCache>(capacity, 1);
+    // In server mode, the cache is shared between all sessions: shard it to
+    // reduce lock contention.
+    int num_shards = FLAGS_server ? FLAGS_max_sessions : 1;
+    inference_cache =
+        std::make_shared<ThreadSafeInferenceCache>(capacity, num_shards);
   } else {
     MG_LOG(WARNING) << "cache_size_mb == 0 results in poor performance in GTP "
                        "mode because tree reuse is disabled.";
   }
 
+  if (FLAGS_server) {
+    MG_CHECK(!FLAGS_minigui) << "Minigui mode isn't supported in server mode";
+    MG_CHECK(FLAGS_root_parallelism == 1)
+        << "Root parallelism isn't supported in server mode";
+    GtpServer::Options server_options;
+    server_options.max_sessions = FLAGS_max_sessions;
+    GtpServer server(std::move(model_factory), std::move(inference_cache),
+                     model_desc.model, game_options, player_options,
+                     client_options, server_options);
+    server.Run(&std::cin, &std::cout);
+    return;
+  }
+
   std::unique_ptr<GtpClient> client;
   if (FLAGS_minigui) {
     client = absl::make_unique<MiniguiGtpClient>(
@@ -15,6 +15,7 @@
 #include "cc/gtp_client.h"
 
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <iostream>
 #include <limits>
@@ -22,15 +23,28 @@
 #include <utility>
 
 #include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
+#include "absl/strings/str_format.h"
+#include "cc/algorithm.h"
 #include "cc/constants.h"
 #include "cc/file/utils.h"
 #include "cc/logging.h"
+#include "cc/memory_accounting.h"
+#include "cc/model/batching_model.h"
 #include "cc/sgf.h"
 
 namespace minigo {
 
+namespace {
+
+// Time spent on a move when a player's clock has run out. A seconds_per_move
+// of zero would fall back to a search limited by the number of readouts.
+constexpr float kMinSecondsPerMove = 0.01;
+
+}  // namespace
+
 GtpClient::GtpClient(std::unique_ptr<ModelFactory> model_factory,
                      std::shared_ptr<InferenceCache> inference_cache,
                      const std::string& model_descriptor,
@@ -40,11 +54,34 @@ GtpClient::GtpClient(std::unique_ptr<ModelFactory> model_factory,
     : model_factory_(std::move(model_factory)),
       inference_cache_(inference_cache),
       options_(client_options) {
+  MG_CHECK(options_.root_parallelism >= 1);
+  if (options_.root_parallelism > 1) {
+    // Run the inferences of all the root parallel searches through the same
+    // batcher.
+    model_factory_ =
+        absl::make_unique<BatchingModelFactory>(std::move(model_factory_));
+  }
+
   auto model = model_factory_->NewModel(model_descriptor);
   game_ = absl::make_unique<Game>(model->name(), model->name(), game_options);
 
-  // Create the main player. Its model doesn't run through the batcher used for
-  // background inferences.
+  for (int i = 1; i < options_.root_parallelism; ++i) {
+    auto helper_options = player_options;
+    if (helper_options.random_seed != Random::kUniqueSeed) {
+      helper_options.random_seed += i;
+    }
+    helper_games_.push_back(
+        absl::make_unique<Game>(model->name(), model->name(), game_options));
+    // The helpers don't use the inference cache: it averages the results of
+    // all the symmetries evaluated for a position, so sharing it would undo
+    // the diversity that comes from each search choosing its own symmetries.
+    helpers_.push_back(absl::make_unique<MctsPlayer>(
+        model_factory_->NewModel(model_descriptor), nullptr,
+        helper_games_.back().get(), helper_options));
+  }
+
+  // Create the main player. When searching with root parallelism, its model
+  // runs through the same batcher as the helpers' models.
   player_ = absl::make_unique<MctsPlayer>(std::move(model), inference_cache,
                                           game_.get(), player_options);
 
@@ -59,30 +96,24 @@ GtpClient::GtpClient(std::unique_ptr<ModelFactory> model_factory,
   RegisterCmd("known_command", &GtpClient::HandleKnownCommand);
   RegisterCmd("komi", &GtpClient::HandleKomi);
   RegisterCmd("list_commands", &GtpClient::HandleListCommands);
+  RegisterCmd("load_tree", &GtpClient::HandleLoadTree);
   RegisterCmd("loadsgf", &GtpClient::HandleLoadsgf);
+  RegisterCmd("memory_stats", &GtpClient::HandleMemoryStats);
   RegisterCmd("name", &GtpClient::HandleName);
   RegisterCmd("play", &GtpClient::HandlePlay);
   RegisterCmd("ponder", &GtpClient::HandlePonder);
   RegisterCmd("readouts", &GtpClient::HandleReadouts);
+  RegisterCmd("save_tree", &GtpClient::HandleSaveTree);
   RegisterCmd("showboard", &GtpClient::HandleShowboard);
+  RegisterCmd("time_left", &GtpClient::HandleTimeLeft);
+  RegisterCmd("time_settings", &GtpClient::HandleTimeSettings);
   RegisterCmd("undo", &GtpClient::HandleUndo);
 }
 
 GtpClient::~GtpClient() = default;
 
 void GtpClient::Run() {
-  // Perform a warm-up inference: ML frameworks like TensorFlow often perform
-  // lazy initialization, causing the first inference to take substantially
-  // longer than subsequent ones, which can interfere with time keeping.
-  MG_LOG(INFO) << "Warming up...";
-  Position position(Color::kBlack);
-  ModelOutput output;
-  ModelInput input;
-  input.sym = symmetry::kIdentity;
-  input.position_history.push_back(&position);
-  std::vector<const ModelInput*> inputs = {&input};
-  std::vector<ModelOutput*> outputs = {&output};
-  player_->model()->RunMany(inputs, &outputs, nullptr);
+  WarmUp();
   MG_LOG(INFO) << "GTP engine ready";
 
   // Start a background thread that pushes lines read from stdin into the
@@ -104,14 +135,33 @@ void GtpClient::Run() {
   stdin_thread.detach();
 
   NewGame();
+  ProcessCmds(&running);
+  running = false;
+}
 
-  while (running) {
+void GtpClient::WarmUp() {
+  // Perform a warm-up inference: ML frameworks like TensorFlow often perform
+  // lazy initialization, causing the first inference to take substantially
+  // longer than subsequent ones, which can interfere with time keeping.
+  MG_LOG(INFO) << "Warming up...";
+  Position position(Color::kBlack);
+  ModelOutput output;
+  ModelInput input;
+  input.sym = symmetry::kIdentity;
+  input.position_history.push_back(&position);
+  std::vector<const ModelInput*> inputs = {&input};
+  std::vector<ModelOutput*> outputs = {&output};
+  player_->model()->RunMany(inputs, &outputs, nullptr);
+}
+
+void GtpClient::ProcessCmds(const std::atomic<bool>* running) {
+  while (*running) {
     std::string line;
 
     // If there's a command waiting on stdin, process it.
     if (stdin_queue_.TryPop(&line)) {
       auto response = HandleCmd(line);
-      std::cout << response << std::flush;
+      WriteResponse(response);
       if (response.done) {
         break;
       }
@@ -125,18 +175,23 @@ void GtpClient::Run() {
       // when stdin is closed with ctrl-C.
       if (stdin_queue_.PopWithTimeout(&line, absl::Seconds(1))) {
         auto response = HandleCmd(line);
-        std::cout << response << std::flush;
+        WriteResponse(response);
         if (response.done) {
           break;
         }
       }
     }
   }
-  running = false;
+}
+
+void GtpClient::WriteResponse(const Response& response) {
+  std::cout << response << std::flush;
 }
 
 void GtpClient::NewGame() {
   player_->NewGame();
+  ResetClocks();
+  ponder_replies_.clear();
   MaybeStartPondering();
 }
 
@@ -150,6 +205,61 @@ void GtpClient::MaybeStartPondering() {
   }
 }
 
+void GtpClient::ResetClocks() {
+  Clock clock;
+  if (main_time_ > 0) {
+    clock.time_left = main_time_;
+  } else {
+    clock.time_left = byo_yomi_time_;
+    clock.stones_left = byo_yomi_stones_;
+  }
+  clocks_.fill(clock);
+}
+
+void GtpClient::AdvanceClock(Color color, absl::Duration elapsed) {
+  if (main_time_ == 0 && byo_yomi_time_ == 0) {
+    return;
+  }
+  auto& clock = GetClock(color);
+  float seconds = absl::ToDoubleSeconds(elapsed);
+  clock.time_left = std::max(0.0f, clock.time_left - seconds);
+  bool period_over = clock.stones_left == 0 ? clock.time_left == 0
+                                            : --clock.stones_left == 0;
+  if (period_over && byo_yomi_time_ > 0) {
+    clock.time_left = byo_yomi_time_;
+    clock.stones_left = byo_yomi_stones_;
+  }
+}
+
+void GtpClient::UpdateTimeControl() {
+  if (main_time_ == 0 && byo_yomi_time_ == 0) {
+    return;
+  }
+
+  const auto& clock = GetClock(player_->root()->position.to_play());
+  auto options = player_->options();
+  float seconds;
+  if (clock.stones_left > 0) {
+    // Split the byo-yomi period's time between the stones left to play.
+    seconds = clock.time_left / clock.stones_left;
+  } else {
+    // Spend a fixed fraction of the main time left, so that the time per move
+    // decays geometrically as the main time runs down. When there's byo-yomi
+    // to fall back on, no move needs to be played faster than a byo-yomi
+    // move.
+    seconds = clock.time_left * (1 - options.decay_factor);
+    if (byo_yomi_time_ > 0) {
+      seconds = std::max(seconds, byo_yomi_time_ / byo_yomi_stones_);
+    }
+  }
+
+  // The clock already accounts for the time used by earlier moves, so the
+  // player mustn't budget the game's time itself.
+  options.seconds_per_move = std::max(seconds, kMinSecondsPerMove);
+  options.time_limit = 0;
+  player_->SetOptions(options);
+}
+
 bool GtpClient::MaybePonder() {
   if (player_->root()->game_over() || ponder_type_ == PonderType::kOff ||
       ponder_limit_reached_) {
@@ -174,6 +284,15 @@ bool GtpClient::MaybePonder() {
 }
 
 void GtpClient::Ponder() {
+  // Pondering can continue indefinitely, so keep the tree within its memory
+  // budget.
+  player_->EnforceTreeMemoryBudget();
+
+  if (options_.ponder_replies > 0) {
+    PonderReplies();
+    return;
+  }
+
   // Remember the number of reads at the root.
   int n = player_->root()->N();
 
@@ -184,6 +303,83 @@ void GtpClient::Ponder() {
   ponder_read_count_ += player_->root()->N() - n;
 }
 
+void GtpClient::PonderReplies() {
+  auto* root = player_->root();
+  if (!root->HasFlag(MctsNode::Flag::kExpanded)) {
+    // We need the root's priors to know which replies are likely.
+    int n = root->N();
+    player_->TreeSearch(1, n + 1);
+    ponder_read_count_ += root->N() - n;
+    return;
+  }
+
+  // Rank the legal replies by visit count, then by prior.
+  std::vector<Coord> replies;
+  for (int i = 0; i < kNumMoves; ++i) {
+    if (root->position.legal_move(i)) {
+      replies.push_back(i);
+    }
+  }
+  if (replies.empty()) {
+    return;
+  }
+  auto num_replies =
+      std::min<size_t>(options_.ponder_replies, replies.size());
+  std::partial_sort(replies.begin(), replies.begin() + num_replies,
+                    replies.end(), [root](Coord a, Coord b) {
+                      if (root->child_N(a) != root->child_N(b)) {
+                        return root->child_N(a) > root->child_N(b);
+                      }
+                      return root->child_P(a) > root->child_P(b);
+                    });
+  replies.resize(num_replies);
+  ponder_replies_ = replies;
+
+  // Split the batch between the replies in proportion to their priors,
+  // searching each reply at least once. A reply that appears multiple times
+  // in ponder_roots_ has multiple leaves selected from it.
+  float prior_sum = 0;
+  for (Coord c : replies) {
+    prior_sum += root->child_P(c);
+  }
+  int batch_size = std::max<int>(player_->options().virtual_losses,
+                                 static_cast<int>(num_replies));
+  ponder_roots_.clear();
+  for (Coord c : replies) {
+    float weight = prior_sum > 0 ? root->child_P(c) / prior_sum
+                                 : 1.0f / num_replies;
+    int num_leaves = std::max(1, static_cast<int>(batch_size * weight + 0.5f));
+    auto* child = root->MaybeAddChild(c);
+    ponder_roots_.insert(ponder_roots_.end(), num_leaves, child);
+  }
+
+  // The results are propagated up to the root, so that its N stays equal to
+  // the total number of reads made under it.
+  int n = root->N();
+  player_->MultiRootTreeSearch(ponder_roots_, root, 1,
+                               std::numeric_limits<int>::max());
+  ponder_read_count_ += root->N() - n;
+}
+
+void GtpClient::UpdatePonderReplyStats(Coord c) {
+  if (ponder_replies_.empty()) {
+    return;
+  }
+  bool predicted = std::find(ponder_replies_.begin(), ponder_replies_.end(),
+                             c) != ponder_replies_.end();
+  int reused = player_->root()->child_N(c);
+  num_ponder_replies_ += 1;
+  num_predicted_replies_ += predicted ? 1 : 0;
+  num_reused_readouts_ += reused;
+  ponder_replies_.clear();
+
+  MG_LOG(INFO) << "Ponder: reply " << c.ToGtp()
+               << (predicted ? " was" : " wasn't") << " pre-searched, "
+               << reused << " readouts reused; " << num_predicted_replies_
+               << "/" << num_ponder_replies_ << " replies pre-searched, "
+               << num_reused_readouts_ << " readouts reused in total";
+}
+
 GtpClient::Response GtpClient::ReplaySgf(
     const std::vector<std::unique_ptr<sgf::Node>>& trees) {
   if (!trees.empty()) {
@@ -340,6 +536,10 @@ GtpClient::Response GtpClient::HandleGenmove(CmdArgs args) {
 
   // TODO(tommadams): Handle out of turn moves.
 
+  auto start = absl::Now();
+  Color to_play = player_->root()->position.to_play();
+  UpdateTimeControl();
+
   Coord c = Coord::kInvalid;
   if (options_.courtesy_pass && player_->root()->move == Coord::kPass) {
     c = Coord::kPass;
@@ -347,16 +547,155 @@ GtpClient::Response GtpClient::HandleGenmove(CmdArgs args) {
     if (!options_.tree_reuse) {
       player_->ClearChildren();
     }
-    c = player_->SuggestMove(player_->options().num_readouts);
+    if (helpers_.empty()) {
+      c = player_->SuggestMove(player_->options().num_readouts);
+    } else {
+      c = RootParallelSuggestMove();
+    }
   }
   MG_LOG(INFO) << player_->root()->Describe();
+  if (player_->options().seconds_per_move > 0) {
+    MG_LOG(INFO) << "Time overshoot: " << player_->GetTimeOvershootStats();
+  }
+  AdvanceClock(to_play, absl::Now() - start);
   MG_CHECK(player_->PlayMove(c));
+  ponder_replies_.clear();
 
   MaybeStartPondering();
 
   return Response::Ok(c.ToGtp());
 }
 
+Coord GtpClient::RootParallelSuggestMove() {
+  SyncHelpers();
+
+  std::vector<MctsPlayer*> players = {player_.get()};
+  for (auto& helper : helpers_) {
+    players.push_back(helper.get());
+  }
+
+  // All players are active clients of the batcher while searching, so each
+  // batch holds one request from every search.
+  for (auto* player : players) {
+    BatchingModelFactory::StartGame(player->model(), player->model());
+  }
+
+  // The helpers search until they have performed the same number of readouts
+  // as player_ or, for timed searches, until player_ has finished.
+  bool timed = player_->options().seconds_per_move > 0;
+  std::atomic<bool> main_done{false};
+  std::vector<std::thread> threads;
+  for (auto& helper : helpers_) {
+    auto* player = helper.get();
+    threads.emplace_back([player, timed, &main_done]() {
+      // Keep the helper's tree within its memory budget and update the moves
+      // its search is restricted from, as SuggestMove does for player_.
+      player->PrepareSearch();
+
+      // Each helper mixes its own Dirichlet noise into the root priors so that
+      // the searches explore different moves.
+      player->InjectNoise(kDirichletAlpha);
+      const auto& options = player->options();
+      int target = player->root()->N() + options.num_readouts;
+      while (timed ? !main_done : player->root()->N() < target) {
+        player->TreeSearch(options.virtual_losses,
+                           timed ? std::numeric_limits<int>::max() : target);
+      }
+      BatchingModelFactory::EndGame(player->model(), player->model());
+    });
+  }
+
+  player_->SuggestMove(player_->options().num_readouts);
+  BatchingModelFactory::EndGame(player_->model(), player_->model());
+  main_done = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // Pick the move to play (or resign) from the merged root statistics of all
+  // the searches.
+  std::vector<const MctsPlayer*> helpers(players.begin() + 1, players.end());
+  Coord c = player_->SuggestMergedMove(helpers);
+
+  // Log the most visited moves after merging. The search that visited each
+  // move the most provides the move's principal variation.
+  std::array<float, kNumMoves> merged_N{};
+  std::array<float, kNumMoves> merged_W{};
+  std::array<const MctsPlayer*, kNumMoves> pv_players;
+  for (int i = 0; i < kNumMoves; ++i) {
+    pv_players[i] = player_.get();
+    for (const auto* player : players) {
+      merged_N[i] += player->root()->child_N(i);
+      merged_W[i] += player->root()->child_W(i);
+      if (player->root()->child_N(i) > pv_players[i]->root()->child_N(i)) {
+        pv_players[i] = player;
+      }
+    }
+  }
+  std::array<int, kNumMoves> ranked;
+  for (int i = 0; i < kNumMoves; ++i) {
+    ranked[i] = i;
+  }
+  int num_ranked = std::min(8, kNumMoves);
+  std::partial_sort(ranked.begin(), ranked.begin() + num_ranked, ranked.end(),
+                    [&merged_N](int a, int b) {
+                      return merged_N[a] > merged_N[b];
+                    });
+  std::string report = absl::StrFormat(
+      "Merged %d root parallel searches\nmove :     N      Q  PV",
+      players.size());
+  for (int i = 0; i < num_ranked && merged_N[ranked[i]] > 0; ++i) {
+    Coord move = ranked[i];
+    const auto* pv_root = pv_players[move]->root();
+    std::vector<std::string> pv = {move.ToGtp()};
+    auto it = pv_root->children.find(move);
+    if (it != pv_root->children.end()) {
+      for (Coord c : it->second->MostVisitedPath()) {
+        pv.push_back(c.ToGtp());
+      }
+    }
+    absl::StrAppendFormat(&report, "\n%-5s: %5d % .3f  %s", move.ToGtp(),
+                          static_cast<int>(merged_N[move]),
+                          merged_W[move] / (1 + merged_N[move]),
+                          absl::StrJoin(pv, " "));
+  }
+  MG_LOG(INFO) << report;
+
+  return c;
+}
+
+void GtpClient::SyncHelpers() {
+  for (size_t i = 0; i < helpers_.size(); ++i) {
+    auto* helper = helpers_[i].get();
+    auto* helper_game = helper_games_[i].get();
+
+    // Undo the helper's moves back to the point where its game diverges from
+    // game_, then play the rest of game_'s moves. This preserves the helper's
+    // tree when the games agree.
+    int num_common = 0;
+    while (num_common < helper_game->num_moves() &&
+           num_common < game_->num_moves() &&
+           helper_game->GetMove(num_common)->c ==
+               game_->GetMove(num_common)->c) {
+      num_common += 1;
+    }
+    while (helper_game->num_moves() > num_common) {
+      MG_CHECK(helper->UndoMove());
+    }
+    for (int j = num_common; j < game_->num_moves(); ++j) {
+      MG_CHECK(helper->PlayMove(game_->GetMove(j)->c));
+    }
+    if (!options_.tree_reuse) {
+      helper->ClearChildren();
+    }
+
+    // Copy player_'s options, keeping the helper's own random seed.
+    auto options = player_->options();
+    options.random_seed = helper->options().random_seed;
+    helper->SetOptions(options);
+  }
+}
+
 GtpClient::Response GtpClient::HandleKnownCommand(CmdArgs args) {
   auto response = CheckArgsExact(1, args);
   if (!response.ok) {
@@ -422,6 +761,53 @@ GtpClient::Response GtpClient::HandleLoadsgf(CmdArgs args) {
   return ReplaySgf(trees);
 }
 
+// Reports the approximate memory used by each subsystem of the whole process,
+// not just this client, as one "<category> <bytes>" line per category.
+// Usage: memory_stats
+GtpClient::Response GtpClient::HandleMemoryStats(CmdArgs args) {
+  auto response = CheckArgsExact(0, args);
+  if (!response.ok) {
+    return response;
+  }
+  std::vector<std::string> lines;
+  for (int i = 0; i < memory::kNumCategories; ++i) {
+    auto category = static_cast<memory::Category>(i);
+    lines.push_back(absl::StrCat(memory::GetName(category), " ",
+                                 memory::GetBytes(category)));
+  }
+  response.str = absl::StrJoin(lines, "\n");
+  return response;
+}
+
+// Restores a search tree written by save_tree. The tree must have been saved
+// at the current position, so a game that's resumed in a new process should
+// be replayed up to that position first.
+// Usage: load_tree PATH [MIN_VISITS]
+// Subtrees with fewer than MIN_VISITS visits aren't restored.
+GtpClient::Response GtpClient::HandleLoadTree(CmdArgs args) {
+  auto response = CheckArgsRange(1, 2, args);
+  if (!response.ok) {
+    return response;
+  }
+
+  int min_visits = 0;
+  if (args.size() == 2 &&
+      (!absl::SimpleAtoi(args[1], &min_visits) || min_visits < 0)) {
+    return Response::Error("couldn't parse ", args[1], " as an integer >= 0");
+  }
+
+  std::string contents;
+  if (!file::ReadFile(std::string(args[0]), &contents)) {
+    return Response::Error("cannot load file");
+  }
+
+  ponder_replies_.clear();
+  if (!player_->LoadTree(contents, min_visits)) {
+    return Response::Error("cannot load tree");
+  }
+  return Response::Ok();
+}
+
 GtpClient::Response GtpClient::HandleName(CmdArgs args) {
   auto response = CheckArgsExact(0, args);
   if (!response.ok) {
@@ -458,6 +844,10 @@ GtpClient::Response GtpClient::HandlePlay(CmdArgs args) {
     return Response::Error("illegal move");
   }
 
+  // The reply stats must be read from the root before the move is played.
+  if (c != Coord::kResign && player_->root()->position.legal_move(c)) {
+    UpdatePonderReplyStats(c);
+  }
   if (!player_->PlayMove(c)) {
     return Response::Error("illegal move");
   }
@@ -535,6 +925,22 @@ GtpClient::Response GtpClient::HandleReadouts(CmdArgs args) {
   return Response::Ok();
 }
 
+// Saves the search tree below the current position to a file.
+// Usage: save_tree PATH
+GtpClient::Response GtpClient::HandleSaveTree(CmdArgs args) {
+  auto response = CheckArgsExact(1, args);
+  if (!response.ok) {
+    return response;
+  }
+
+  std::string contents;
+  player_->root()->SerializeTree(&contents);
+  if (!file::WriteFile(std::string(args[0]), contents)) {
+    return Response::Error("cannot save file");
+  }
+  return Response::Ok();
+}
+
 GtpClient::Response GtpClient::HandleShowboard(CmdArgs args) {
   auto response = CheckArgsExact(0, args);
   if (!response.ok) {
@@ -544,6 +950,76 @@ GtpClient::Response GtpClient::HandleShowboard(CmdArgs args) {
       absl::StrCat("\n", player_->root()->position.ToPrettyString(false)));
 }
 
+// Sets the time left on a player's clock. `stones` is the number of stones
+// left to play in the current byo-yomi period, or 0 during main time.
+// Usage: time_left <color> <time> <stones>
+GtpClient::Response GtpClient::HandleTimeLeft(CmdArgs args) {
+  auto response = CheckArgsExact(3, args);
+  if (!response.ok) {
+    return response;
+  }
+
+  Color color;
+  if (std::tolower(args[0][0]) == 'b') {
+    color = Color::kBlack;
+  } else if (std::tolower(args[0][0]) == 'w') {
+    color = Color::kWhite;
+  } else {
+    return Response::Error("expected b or w for player color, got ", args[0]);
+  }
+
+  int time, stones;
+  if (!absl::SimpleAtoi(args[1], &time) ||
+      !absl::SimpleAtoi(args[2], &stones) || time < 0 || stones < 0) {
+    return Response::Error("couldn't parse time left: ",
+                           absl::StrJoin(args, " "));
+  }
+
+  auto& clock = GetClock(color);
+  clock.time_left = time;
+  clock.stones_left = stones;
+  UpdateTimeControl();
+
+  return Response::Ok();
+}
+
+GtpClient::Response GtpClient::HandleTimeSettings(CmdArgs args) {
+  auto response = CheckArgsExact(3, args);
+  if (!response.ok) {
+    return response;
+  }
+
+  int main_time, byo_yomi_time, byo_yomi_stones;
+  if (!absl::SimpleAtoi(args[0], &main_time) ||
+      !absl::SimpleAtoi(args[1], &byo_yomi_time) ||
+      !absl::SimpleAtoi(args[2], &byo_yomi_stones) || main_time < 0 ||
+      byo_yomi_time < 0 || byo_yomi_stones < 0) {
+    return Response::Error("couldn't parse time settings: ",
+                           absl::StrJoin(args, " "));
+  }
+
+  if (byo_yomi_time > 0 && byo_yomi_stones == 0) {
+    return Response::Error("byo-yomi time requires byo-yomi stones");
+  }
+
+  // Zero main and byo-yomi time means no time limit, in which case we fall
+  // back to a fixed number of readouts.
+  main_time_ = main_time;
+  byo_yomi_time_ = byo_yomi_time;
+  byo_yomi_stones_ = byo_yomi_stones;
+  ResetClocks();
+  if (main_time == 0 && byo_yomi_time == 0) {
+    auto options = player_->options();
+    options.seconds_per_move = 0;
+    options.time_limit = 0;
+    player_->SetOptions(options);
+  } else {
+    UpdateTimeControl();
+  }
+
+  return Response::Ok();
+}
+
 GtpClient::Response GtpClient::HandleUndo(CmdArgs args) {
   auto response = CheckArgsExact(0, args);
   if (!response.ok) {
@@ -553,6 +1029,7 @@ GtpClient::Response GtpClient::HandleUndo(CmdArgs args) {
   if (!player_->UndoMove()) {
     return Response::Error("cannot undo");
   }
+  ponder_replies_.clear();
   if (!options_.tree_reuse) {
     player_->root()->ClearChildren();
   }
@@ -15,6 +15,8 @@
 #ifndef CC_GTP_CLIENT_H_
 #define CC_GTP_CLIENT_H_
 
+#include <array>
+#include <atomic>
 #include <deque>
 #include <functional>
 #include <map>
@@ -50,6 +52,14 @@ class GtpClient {
     // GTP command.
     int ponder_limit = 0;
 
+    // If non-zero, pondering focuses on the opponent's most likely replies
+    // instead of searching from the current root: each ponder batch is split
+    // between the top ponder_replies replies (ranked by visits, then prior)
+    // in proportion to their priors, and each reply is searched as the root
+    // of its own subtree. This means the tree carried over when the opponent
+    // plays one of these replies is much deeper.
+    int ponder_replies = 0;
+
     // If true, we will always pass if the opponent passes.
     bool courtesy_pass = false;
 
@@ -58,6 +68,16 @@ class GtpClient {
     // If false, all children of the current root will be deleted before each
     // move is played.
     bool tree_reuse = true;
+
+    // If greater than 1, each genmove runs this many independent searches of
+    // the current position in parallel ("root parallelism"). Each search has
+    // its own tree and uses a different random seed for choosing inference
+    // symmetries and, for all but the main search, for the Dirichlet noise
+    // injected into its root. All searches share one inference batcher so
+    // that each batch is root_parallelism times larger. The root statistics of
+    // all searches are merged, and the move is picked (or the engine
+    // resigns) from the merged statistics as it would be for a single search.
+    int root_parallelism = 1;
   };
 
   GtpClient(std::unique_ptr<ModelFactory> model_factory,
@@ -91,6 +111,7 @@ class GtpClient {
 
     static Response Done() {
       Response response;
+      response.ok = true;
       response.done = true;
       return response;
     }
@@ -127,6 +148,18 @@ class GtpClient {
 
   using CmdArgs = const std::vector<absl::string_view>&;
 
+  // Performs a single inference to give the inference engine a chance to
+  // perform any lazy initialization before time-critical searches start.
+  void WarmUp();
+
+  // Processes GTP commands read from stdin_queue_ until `running` becomes
+  // false or a "quit" command is received, pondering while waiting for
+  // commands if enabled.
+  void ProcessCmds(const std::atomic<bool>* running);
+
+  // Writes the response to a GTP command to stdout.
+  virtual void WriteResponse(const Response& response);
+
   // Helper to register a GTP command handler.
   // Templated to allow commands from subclasses to be registered.
   template <typename T>
@@ -146,6 +179,13 @@ class GtpClient {
 
   virtual void Ponder();
 
+  // Implements Ponder when options_.ponder_replies is non-zero.
+  void PonderReplies();
+
+  // Updates & logs the statistics on how well pondering predicted the
+  // opponent's reply. Must be called before the reply `c` is played.
+  void UpdatePonderReplyStats(Coord c);
+
   // Replay a loaded SGF game.
   // Called by HandleLoadSgf after the SGF file has been loaded and parsed, and
   // a new game has been started.
@@ -174,13 +214,51 @@ class GtpClient {
   virtual Response HandleKomi(CmdArgs args);
   virtual Response HandleListCommands(CmdArgs args);
   virtual Response HandleLoadsgf(CmdArgs args);
+  virtual Response HandleLoadTree(CmdArgs args);
+  virtual Response HandleMemoryStats(CmdArgs args);
   virtual Response HandleName(CmdArgs args);
   virtual Response HandlePlay(CmdArgs args);
   virtual Response HandlePonder(CmdArgs args);
   virtual Response HandleReadouts(CmdArgs args);
+  virtual Response HandleSaveTree(CmdArgs args);
   virtual Response HandleShowboard(CmdArgs args);
+  virtual Response HandleTimeLeft(CmdArgs args);
+  virtual Response HandleTimeSettings(CmdArgs args);
   virtual Response HandleUndo(CmdArgs args);
 
+  // The time a player has left, as set by time_settings and updated by
+  // time_left and by the time spent in genmove.
+  struct Clock {
+    // Time left in the current period.
+    float time_left = 0;
+
+    // Number of stones to play in the current byo-yomi period, or 0 during
+    // main time.
+    int stones_left = 0;
+  };
+
+  Clock& GetClock(Color color) {
+    return clocks_[color == Color::kBlack ? 0 : 1];
+  }
+
+  // Resets both players' clocks to the start of the time control.
+  void ResetClocks();
+
+  // Deducts `elapsed` from the clock of `color`, moving on to the next
+  // byo-yomi period when the current one is over.
+  void AdvanceClock(Color color, absl::Duration elapsed);
+
+  // If a time control was set by time_settings, sets player_'s time for its
+  // next move from the clock of the color to play.
+  void UpdateTimeControl();
+
+  // Runs the root parallel search for genmove when root_parallelism > 1 and
+  // returns the move to play.
+  Coord RootParallelSuggestMove();
+
+  // Brings the helper players up to date with player_'s game and options.
+  void SyncHelpers();
+
   // Utilities for processing SGF files.
   Response ParseSgf(const std::string& sgf_str,
                     std::vector<std::unique_ptr<sgf::Node>>* trees);
@@ -190,6 +268,12 @@ class GtpClient {
   std::unique_ptr<MctsPlayer> player_;
   std::unique_ptr<Game> game_;
 
+  // Additional players that search in parallel with player_ during genmove
+  // if options_.root_parallelism > 1. Each helper has its own Game, which
+  // is brought up to date with game_ before every search.
+  std::vector<std::unique_ptr<Game>> helper_games_;
+  std::vector<std::unique_ptr<MctsPlayer>> helpers_;
+
   // There are two kinds of pondering supported:
   //   kReadLimited: pondering will run for a maximum number of reads.
   //   kTimeLimited: pondering will run for a maximum number of seconds.
@@ -204,6 +288,20 @@ class GtpClient {
   absl::Time ponder_time_limit_ = absl::InfinitePast();
   bool ponder_limit_reached_ = false;
 
+  // The replies searched by PonderReplies from the current root.
+  std::vector<Coord> ponder_replies_;
+  std::vector<MctsNode*> ponder_roots_;
+  int num_ponder_replies_ = 0;
+  int num_predicted_replies_ = 0;
+  int64_t num_reused_readouts_ = 0;
+
+  // The time control set by time_settings. There is no time control if both
+  // main_time_ and byo_yomi_time_ are zero.
+  float main_time_ = 0;
+  float byo_yomi_time_ = 0;
+  int byo_yomi_stones_ = 0;
+  std::array<Clock, 2> clocks_;
+
   Options options_;
 
   absl::flat_hash_map<std::string, std::function<Response(CmdArgs)>>
@@ -0,0 +1,252 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/gtp_client.h"
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "cc/dual_net/fake_dual_net.h"
+#include "cc/zobrist.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+// Creates FakeDualNets that prefer C3, then D4, then E5.
+class PriorModelFactory : public ModelFactory {
+ public:
+  PriorModelFactory() {
+    priors_.fill(0.001);
+    priors_[Coord::FromGtp("C3")] = 0.5;
+    priors_[Coord::FromGtp("D4")] = 0.3;
+    priors_[Coord::FromGtp("E5")] = 0.1;
+  }
+
+  std::unique_ptr<Model> NewModel(const std::string& descriptor) override {
+    return absl::make_unique<FakeDualNet>(priors_, 0);
+  }
+
+ private:
+  std::array<float, kNumMoves> priors_;
+};
+
+// Exposes GtpClient's pondering state for testing.
+class TestableGtpClient : public GtpClient {
+ public:
+  explicit TestableGtpClient(const GtpClient::Options& client_options)
+      : GtpClient(absl::make_unique<PriorModelFactory>(), nullptr, "fake",
+                  Game::Options(), PlayerOptions(), client_options) {}
+
+  static MctsPlayer::Options PlayerOptions() {
+    MctsPlayer::Options options;
+    options.random_seed = 17;
+    options.virtual_losses = 8;
+    return options;
+  }
+
+  using GtpClient::AdvanceClock;
+  using GtpClient::GetClock;
+  using GtpClient::HandleCmd;
+  using GtpClient::PonderReplies;
+  using GtpClient::UpdatePonderReplyStats;
+
+  using GtpClient::num_ponder_replies_;
+  using GtpClient::num_predicted_replies_;
+  using GtpClient::num_reused_readouts_;
+  using GtpClient::player_;
+  using GtpClient::ponder_read_count_;
+  using GtpClient::ponder_replies_;
+};
+
+class GtpClientTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    GtpClient::Options options;
+    options.ponder_replies = 3;
+    client_ = absl::make_unique<TestableGtpClient>(options);
+  }
+
+  std::unique_ptr<TestableGtpClient> client_;
+};
+
+TEST_F(GtpClientTest, PonderReplies) {
+  const auto* root = client_->player_->root();
+
+  // The first call just expands the root.
+  client_->PonderReplies();
+  EXPECT_EQ(1, root->N());
+  EXPECT_TRUE(client_->ponder_replies_.empty());
+
+  for (int i = 0; i < 10; ++i) {
+    client_->PonderReplies();
+  }
+
+  // The replies with the highest priors are searched.
+  auto replies = client_->ponder_replies_;
+  std::sort(replies.begin(), replies.end());
+  std::vector<Coord> expected = {Coord::FromGtp("C3"), Coord::FromGtp("D4"),
+                                 Coord::FromGtp("E5")};
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(expected, replies);
+
+  // The reads made from the replies are counted by the root.
+  float sum_N = 0;
+  for (int i = 0; i < kNumMoves; ++i) {
+    sum_N += root->child_N(i);
+  }
+  for (Coord c : expected) {
+    EXPECT_LT(0, root->child_N(c));
+  }
+  EXPECT_EQ(root->N(), sum_N + 1);
+  EXPECT_EQ(root->N(), client_->ponder_read_count_);
+  EXPECT_LT(root->child_N(Coord::FromGtp("D4")),
+            root->child_N(Coord::FromGtp("C3")));
+}
+
+TEST_F(GtpClientTest, UpdatePonderReplyStats) {
+  const auto* root = client_->player_->root();
+
+  // Nothing is recorded if there was no pondering.
+  client_->UpdatePonderReplyStats(Coord::FromGtp("C3"));
+  EXPECT_EQ(0, client_->num_ponder_replies_);
+
+  for (int i = 0; i < 4; ++i) {
+    client_->PonderReplies();
+  }
+  int reused = root->child_N(Coord::FromGtp("C3"));
+  ASSERT_LT(0, reused);
+
+  // Playing a pre-searched reply reuses its readouts.
+  ASSERT_TRUE(client_->HandleCmd("play b C3").ok);
+  EXPECT_EQ(1, client_->num_ponder_replies_);
+  EXPECT_EQ(1, client_->num_predicted_replies_);
+  EXPECT_EQ(reused, client_->num_reused_readouts_);
+  EXPECT_TRUE(client_->ponder_replies_.empty());
+
+  // Playing a reply that wasn't pre-searched.
+  for (int i = 0; i < 4; ++i) {
+    client_->PonderReplies();
+  }
+  const auto& replies = client_->ponder_replies_;
+  Coord c = Coord::FromGtp("A1");
+  while (std::find(replies.begin(), replies.end(), c) != replies.end()) {
+    c = c + 1;
+  }
+  ASSERT_TRUE(client_->HandleCmd("play w " + c.ToGtp()).ok);
+  EXPECT_EQ(2, client_->num_ponder_replies_);
+  EXPECT_EQ(1, client_->num_predicted_replies_);
+  EXPECT_EQ(reused, client_->num_reused_readouts_);
+}
+
+TEST_F(GtpClientTest, TimeSettings) {
+  const auto& options = client_->player_->options();
+  auto decay_factor = options.decay_factor;
+
+  // Sudden death: spend a fixed fraction of the main time left.
+  ASSERT_TRUE(client_->HandleCmd("time_settings 600 0 0").ok);
+  EXPECT_FLOAT_EQ(600 * (1 - decay_factor), options.seconds_per_move);
+  EXPECT_EQ(0, options.time_limit);
+
+  // Byo-yomi only: split each period between its stones.
+  ASSERT_TRUE(client_->HandleCmd("time_settings 0 30 5").ok);
+  EXPECT_FLOAT_EQ(6, options.seconds_per_move);
+  EXPECT_EQ(0, options.time_limit);
+
+  // Main time and byo-yomi: moves in main time are never played faster than
+  // byo-yomi moves.
+  ASSERT_TRUE(client_->HandleCmd("time_settings 600 30 1").ok);
+  EXPECT_FLOAT_EQ(30, options.seconds_per_move);
+  EXPECT_EQ(0, options.time_limit);
+  ASSERT_TRUE(client_->HandleCmd("time_settings 6000 30 1").ok);
+  EXPECT_FLOAT_EQ(6000 * (1 - decay_factor), options.seconds_per_move);
+
+  // No time limit.
+  ASSERT_TRUE(client_->HandleCmd("time_settings 0 0 0").ok);
+  EXPECT_EQ(0, options.seconds_per_move);
+  EXPECT_EQ(0, options.time_limit);
+
+  EXPECT_FALSE(client_->HandleCmd("time_settings 0 30 0").ok);
+  EXPECT_FALSE(client_->HandleCmd("time_settings -1 0 0").ok);
+}
+
+TEST_F(GtpClientTest, TimeLeft) {
+  const auto& options = client_->player_->options();
+  auto decay_factor = options.decay_factor;
+
+  // The time per move is set from the clock of the player to play.
+  ASSERT_TRUE(client_->HandleCmd("time_settings 600 0 0").ok);
+  ASSERT_TRUE(client_->HandleCmd("time_left b 100 0").ok);
+  EXPECT_FLOAT_EQ(100 * (1 - decay_factor), options.seconds_per_move);
+  ASSERT_TRUE(client_->HandleCmd("time_left w 50 0").ok);
+  EXPECT_FLOAT_EQ(100 * (1 - decay_factor), options.seconds_per_move);
+
+  ASSERT_TRUE(client_->HandleCmd("time_settings 600 30 5").ok);
+  ASSERT_TRUE(client_->HandleCmd("time_left b 12 3").ok);
+  EXPECT_FLOAT_EQ(4, options.seconds_per_move);
+
+  // A player whose clock has run out still plays.
+  ASSERT_TRUE(client_->HandleCmd("time_settings 600 0 0").ok);
+  ASSERT_TRUE(client_->HandleCmd("time_left b 0 0").ok);
+  EXPECT_LT(0, options.seconds_per_move);
+
+  EXPECT_FALSE(client_->HandleCmd("time_left x 10 0").ok);
+  EXPECT_FALSE(client_->HandleCmd("time_left b -1 0").ok);
+  EXPECT_FALSE(client_->HandleCmd("time_left b 10").ok);
+}
+
+TEST_F(GtpClientTest, AdvanceClock) {
+  const auto& black = client_->GetClock(Color::kBlack);
+  const auto& white = client_->GetClock(Color::kWhite);
+
+  // Main time runs out into byo-yomi.
+  ASSERT_TRUE(client_->HandleCmd("time_settings 5 10 2").ok);
+  client_->AdvanceClock(Color::kBlack, absl::Seconds(2));
+  EXPECT_FLOAT_EQ(3, black.time_left);
+  EXPECT_EQ(0, black.stones_left);
+  client_->AdvanceClock(Color::kBlack, absl::Seconds(4));
+  EXPECT_FLOAT_EQ(10, black.time_left);
+  EXPECT_EQ(2, black.stones_left);
+
+  // A new byo-yomi period starts once its stones have been played.
+  client_->AdvanceClock(Color::kBlack, absl::Seconds(3));
+  EXPECT_FLOAT_EQ(7, black.time_left);
+  EXPECT_EQ(1, black.stones_left);
+  client_->AdvanceClock(Color::kBlack, absl::Seconds(3));
+  EXPECT_FLOAT_EQ(10, black.time_left);
+  EXPECT_EQ(2, black.stones_left);
+
+  // Each player has their own clock.
+  EXPECT_FLOAT_EQ(5, white.time_left);
+  EXPECT_EQ(0, white.stones_left);
+
+  // Without byo-yomi, the clock stops at zero.
+  ASSERT_TRUE(client_->HandleCmd("time_settings 5 0 0").ok);
+  client_->AdvanceClock(Color::kWhite, absl::Seconds(6));
+  EXPECT_EQ(0, white.time_left);
+  EXPECT_EQ(0, white.stones_left);
+}
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  return RUN_ALL_TESTS();
+}
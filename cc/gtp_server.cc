@@ -0,0 +1,226 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/gtp_server.h"
+
+#include <atomic>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "cc/logging.h"
+
+namespace minigo {
+
+namespace {
+
+// Forwards NewModel calls to a factory that's shared between all sessions.
+class SharedModelFactory : public ModelFactory {
+ public:
+  explicit SharedModelFactory(std::shared_ptr<ModelFactory> impl)
+      : impl_(std::move(impl)) {}
+
+  std::unique_ptr<Model> NewModel(const std::string& descriptor) override {
+    return impl_->NewModel(descriptor);
+  }
+
+ private:
+  std::shared_ptr<ModelFactory> impl_;
+};
+
+// Returns true if the GTP command `cmd` (excluding the session ID) is a "quit"
+// command.
+bool IsQuitCmd(absl::string_view cmd) {
+  std::vector<absl::string_view> args =
+      absl::StrSplit(cmd, absl::ByAnyChar(" \t\r\n"), absl::SkipWhitespace());
+  int cmd_id;
+  if (!args.empty() && absl::SimpleAtoi(args[0], &cmd_id)) {
+    args.erase(args.begin());
+  }
+  return !args.empty() && args[0] == "quit";
+}
+
+}  // namespace
+
+// A single GTP session. Commands are pushed onto the session's queue by the
+// server and processed on the session's own thread.
+class GtpServer::Session : public GtpClient {
+ public:
+  Session(GtpServer* server, std::string id)
+      : GtpClient(absl::make_unique<SharedModelFactory>(server->model_factory_),
+                  server->inference_cache_, server->model_descriptor_,
+                  server->game_options_, server->player_options_,
+                  server->client_options_),
+        server_(server),
+        id_(std::move(id)) {}
+
+  ~Session() override { Join(); }
+
+  void Start() {
+    thread_ = std::thread([this]() {
+      WarmUp();
+      NewGame();
+      ProcessCmds(&running_);
+      finished_ = true;
+    });
+  }
+
+  void Join() {
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+  }
+
+  void PushCmd(std::string cmd) { stdin_queue_.Push(std::move(cmd)); }
+
+  bool finished() const { return finished_; }
+
+ private:
+  void WriteResponse(const Response& response) override {
+    std::ostringstream oss;
+    oss << response;
+    server_->Write(id_, oss.str());
+  }
+
+  // The session only counts as an active client of the shared batcher while
+  // it's searching. Otherwise, a session waiting for its opponent's move would
+  // prevent the batcher from running small batches for the other sessions.
+  Response HandleGenmove(CmdArgs args) override {
+    BatchingModelFactory::StartGame(player_->model(), player_->model());
+    auto response = GtpClient::HandleGenmove(args);
+    BatchingModelFactory::EndGame(player_->model(), player_->model());
+    return response;
+  }
+
+  void Ponder() override {
+    BatchingModelFactory::StartGame(player_->model(), player_->model());
+    GtpClient::Ponder();
+    BatchingModelFactory::EndGame(player_->model(), player_->model());
+  }
+
+  GtpServer* server_;
+  const std::string id_;
+  std::atomic<bool> running_{true};
+  std::atomic<bool> finished_{false};
+  std::thread thread_;
+};
+
+GtpServer::GtpServer(std::unique_ptr<ModelFactory> model_factory,
+                     std::shared_ptr<InferenceCache> inference_cache,
+                     const std::string& model_descriptor,
+                     const Game::Options& game_options,
+                     const MctsPlayer::Options& player_options,
+                     const GtpClient::Options& client_options,
+                     const Options& server_options)
+    : model_factory_(
+          std::make_shared<BatchingModelFactory>(std::move(model_factory))),
+      inference_cache_(std::move(inference_cache)),
+      model_descriptor_(model_descriptor),
+      game_options_(game_options),
+      player_options_(player_options),
+      client_options_(client_options),
+      options_(server_options) {
+  MG_CHECK(options_.max_sessions > 0);
+}
+
+GtpServer::~GtpServer() = default;
+
+void GtpServer::Run(std::istream* input, std::ostream* output) {
+  {
+    absl::MutexLock lock(&output_mutex_);
+    output_ = output;
+  }
+  MG_LOG(INFO) << "GTP server ready, accepting up to " << options_.max_sessions
+               << " sessions";
+
+  std::string line;
+  while (std::getline(*input, line)) {
+    HandleLine(line);
+    ReapClosedSessions(false);
+  }
+
+  // The input was closed: let all sessions finish processing their pending
+  // commands, then shut them down.
+  MG_LOG(INFO) << "Input closed, shutting down " << sessions_.size()
+               << " sessions";
+  for (auto& kv : sessions_) {
+    kv.second->PushCmd("quit");
+    closed_sessions_.push_back(std::move(kv.second));
+  }
+  sessions_.clear();
+  ReapClosedSessions(true);
+
+  for (const auto& kv : model_factory_->FlushStats()) {
+    MG_LOG(INFO) << "Inference stats for " << kv.first << ": "
+                 << kv.second.num_inferences << " inferences in "
+                 << kv.second.batch_size.count() << " batches ("
+                 << kv.second.num_small_batches << " small), mean batch size "
+                 << kv.second.batch_size.mean();
+  }
+}
+
+void GtpServer::HandleLine(const std::string& line) {
+  std::pair<absl::string_view, absl::string_view> parts = absl::StrSplit(
+      line, absl::MaxSplits(absl::ByAnyChar(" \t"), 1), absl::SkipWhitespace());
+  auto session_id = parts.first;
+  auto cmd = parts.second;
+  if (session_id.empty()) {
+    return;
+  }
+
+  auto it = sessions_.find(session_id);
+  if (it == sessions_.end()) {
+    if (static_cast<int>(sessions_.size()) >= options_.max_sessions) {
+      Write(session_id, "? too many sessions\n\n");
+      return;
+    }
+    MG_LOG(INFO) << "Starting session " << session_id;
+    auto session = absl::make_unique<Session>(this, std::string(session_id));
+    session->Start();
+    it = sessions_.emplace(std::string(session_id), std::move(session)).first;
+  }
+
+  it->second->PushCmd(std::string(cmd));
+
+  // Remove the session immediately on quit so that subsequent commands with
+  // the same ID start a new session.
+  if (IsQuitCmd(cmd)) {
+    MG_LOG(INFO) << "Closing session " << session_id;
+    closed_sessions_.push_back(std::move(it->second));
+    sessions_.erase(it);
+  }
+}
+
+void GtpServer::Write(absl::string_view session_id,
+                      absl::string_view response) {
+  absl::MutexLock lock(&output_mutex_);
+  *output_ << session_id << " " << response << std::flush;
+}
+
+void GtpServer::ReapClosedSessions(bool wait) {
+  auto it = closed_sessions_.begin();
+  while (it != closed_sessions_.end()) {
+    if (wait || (*it)->finished()) {
+      (*it)->Join();
+      it = closed_sessions_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+}  // namespace minigo
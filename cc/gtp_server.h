@@ -0,0 +1,107 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_GTP_SERVER_H_
+#define CC_GTP_SERVER_H_
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "cc/game.h"
+#include "cc/gtp_client.h"
+#include "cc/mcts_player.h"
+#include "cc/model/batching_model.h"
+#include "cc/model/inference_cache.h"
+
+namespace minigo {
+
+// Serves many concurrent GTP sessions from a single process, multiplexed over
+// one input and one output stream.
+//
+// Every input line is of the form "<session_id> <gtp command>", where
+// session_id is any token that doesn't contain whitespace. A session is
+// created the first time its ID is seen and is closed by a "quit" command.
+// Each response is written as "<session_id> <gtp response>". Responses from
+// different sessions may be interleaved but a single response is always
+// written atomically.
+//
+// Each session runs on its own thread with its own Game and MctsPlayer. All
+// sessions share the same inference cache and their inferences are run
+// through a shared BatchingModelFactory, so concurrent searches are batched
+// together. A session only counts as an active client of the batcher while it
+// is searching (during genmove or pondering), so idle sessions waiting for
+// their opponent never stall the batches of other sessions. Requests are
+// batched in arrival order and every search submits the same number of leaves
+// per request, so each searching session gets an equal share of every batch.
+class GtpServer {
+ public:
+  struct Options {
+    // Maximum number of concurrent sessions.
+    int max_sessions = 64;
+  };
+
+  GtpServer(std::unique_ptr<ModelFactory> model_factory,
+            std::shared_ptr<InferenceCache> inference_cache,
+            const std::string& model_descriptor,
+            const Game::Options& game_options,
+            const MctsPlayer::Options& player_options,
+            const GtpClient::Options& client_options,
+            const Options& server_options);
+  ~GtpServer();
+
+  // Reads commands from `input` and writes responses to `output` until
+  // `input` is closed. All open sessions are closed before Run returns.
+  void Run(std::istream* input, std::ostream* output);
+
+ private:
+  class Session;
+
+  // Dispatches a single line of input to the session it's addressed to,
+  // creating the session if necessary.
+  void HandleLine(const std::string& line);
+
+  // Writes a response from the session `session_id`.
+  void Write(absl::string_view session_id, absl::string_view response)
+      LOCKS_EXCLUDED(&output_mutex_);
+
+  // Joins the threads of closed sessions that have finished processing their
+  // commands. If `wait` is true, waits for all closed sessions to finish.
+  void ReapClosedSessions(bool wait);
+
+  std::shared_ptr<BatchingModelFactory> model_factory_;
+  std::shared_ptr<InferenceCache> inference_cache_;
+  const std::string model_descriptor_;
+  const Game::Options game_options_;
+  const MctsPlayer::Options player_options_;
+  const GtpClient::Options client_options_;
+  const Options options_;
+
+  absl::flat_hash_map<std::string, std::unique_ptr<Session>> sessions_;
+
+  // Sessions that received a "quit" command and whose threads haven't been
+  // joined yet.
+  std::vector<std::unique_ptr<Session>> closed_sessions_;
+
+  absl::Mutex output_mutex_;
+  std::ostream* output_ GUARDED_BY(&output_mutex_) = nullptr;
+};
+
+}  // namespace minigo
+
+#endif  // CC_GTP_SERVER_H_
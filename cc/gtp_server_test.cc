@@ -0,0 +1,162 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/gtp_server.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "cc/dual_net/fake_dual_net.h"
+#include "cc/zobrist.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+// Runs a GtpServer on the given input and returns the responses written,
+// split into one string per response.
+std::vector<std::string> RunServer(const std::string& input, int max_sessions) {
+  Game::Options game_options;
+  MctsPlayer::Options player_options;
+  player_options.inject_noise = false;
+  player_options.soft_pick = false;
+  player_options.num_readouts = 16;
+  player_options.virtual_losses = 4;
+  GtpClient::Options client_options;
+  GtpServer::Options server_options;
+  server_options.max_sessions = max_sessions;
+
+  GtpServer server(absl::make_unique<FakeDualNetFactory>(), nullptr, "fake",
+                   game_options, player_options, client_options,
+                   server_options);
+
+  std::istringstream in(input);
+  std::ostringstream out;
+  server.Run(&in, &out);
+
+  return absl::StrSplit(out.str(), "\n\n", absl::SkipEmpty());
+}
+
+// Returns all the responses that were sent to the session `session_id`.
+std::vector<std::string> GetResponses(const std::vector<std::string>& all,
+                                      const std::string& session_id) {
+  std::vector<std::string> result;
+  for (const auto& response : all) {
+    if (absl::StartsWith(response, session_id + " ")) {
+      result.push_back(response.substr(session_id.size() + 1));
+    }
+  }
+  return result;
+}
+
+TEST(GtpServerTest, MultipleSessions) {
+  auto responses = RunServer(
+      "a 1 name\n"
+      "b 1 name\n"
+      "a 2 genmove b\n"
+      "b 2 play b pass\n"
+      "b 3 genmove w\n"
+      "a 3 quit\n"
+      "b 4 quit\n",
+      2);
+
+  auto a = GetResponses(responses, "a");
+  ASSERT_EQ(3, a.size());
+  EXPECT_EQ("=1 minigo-fake", a[0]);
+  EXPECT_TRUE(absl::StartsWith(a[1], "=2 "));
+  EXPECT_EQ("=3", a[2]);
+
+  auto b = GetResponses(responses, "b");
+  ASSERT_EQ(4, b.size());
+  EXPECT_EQ("=1 minigo-fake", b[0]);
+  EXPECT_EQ("=2", b[1]);
+  EXPECT_TRUE(absl::StartsWith(b[2], "=3 "));
+  EXPECT_EQ("=4", b[3]);
+}
+
+TEST(GtpServerTest, TooManySessions) {
+  auto responses = RunServer(
+      "a name\n"
+      "b name\n"
+      "a quit\n"
+      "b name\n",
+      1);
+
+  auto a = GetResponses(responses, "a");
+  ASSERT_EQ(2, a.size());
+  EXPECT_EQ("= minigo-fake", a[0]);
+  EXPECT_EQ("=", a[1]);
+
+  // The first command from session "b" is rejected because session "a" is
+  // still open. Once "a" has quit, "b" can be started. Closing the input
+  // implicitly quits all open sessions.
+  auto b = GetResponses(responses, "b");
+  ASSERT_EQ(3, b.size());
+  EXPECT_EQ("? too many sessions", b[0]);
+  EXPECT_EQ("= minigo-fake", b[1]);
+  EXPECT_EQ("=", b[2]);
+}
+
+TEST(GtpServerTest, MemoryStats) {
+  auto responses = RunServer(
+      "a 1 genmove b\n"
+      "a 2 memory_stats\n",
+      1);
+
+  auto a = GetResponses(responses, "a");
+  ASSERT_EQ(3, a.size());
+  ASSERT_TRUE(absl::StartsWith(a[1], "=2 ")) << a[1];
+  std::vector<std::string> lines = absl::StrSplit(a[1].substr(3), '\n');
+  ASSERT_EQ(6, lines.size());
+  std::vector<absl::string_view> tree = absl::StrSplit(lines[0], ' ');
+  ASSERT_EQ(2, tree.size());
+  EXPECT_EQ("tree", tree[0]);
+  int64_t tree_bytes;
+  ASSERT_TRUE(absl::SimpleAtoi(tree[1], &tree_bytes));
+  EXPECT_LT(0, tree_bytes);
+  EXPECT_TRUE(absl::StartsWith(lines[2], "game_history ")) << lines[2];
+}
+
+TEST(GtpServerTest, TimeSettings) {
+  auto responses = RunServer(
+      "a 1 time_settings 10 0 0\n"
+      "a 2 time_settings 0 5 0\n"
+      "a 3 time_settings 0 0 0\n"
+      "a 4 time_left b 30 0\n"
+      "a 5 time_left b 30\n",
+      1);
+
+  auto a = GetResponses(responses, "a");
+  ASSERT_EQ(6, a.size());
+  EXPECT_EQ("=1", a[0]);
+  EXPECT_TRUE(absl::StartsWith(a[1], "?2 "));
+  EXPECT_EQ("=3", a[2]);
+  EXPECT_EQ("=4", a[3]);
+  EXPECT_TRUE(absl::StartsWith(a[4], "?5 "));
+  EXPECT_EQ("=", a[5]);
+}
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  return RUN_ALL_TESTS();
+}
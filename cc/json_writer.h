@@ -0,0 +1,110 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_JSON_WRITER_H_
+#define CC_JSON_WRITER_H_
+
+#include <cmath>
+#include <string>
+#include <type_traits>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+
+namespace minigo {
+
+// Minimal streaming JSON writer that appends to a caller-owned string, so
+// that the string's capacity can be reused between documents. The writer
+// doesn't validate that the sequence of calls produces well-formed JSON.
+class JsonWriter {
+ public:
+  explicit JsonWriter(std::string* out) : out_(out) {}
+
+  void BeginObject() {
+    Separator();
+    out_->push_back('{');
+    need_comma_ = false;
+  }
+
+  void EndObject() {
+    out_->push_back('}');
+    need_comma_ = true;
+  }
+
+  void BeginArray() {
+    Separator();
+    out_->push_back('[');
+    need_comma_ = false;
+  }
+
+  void EndArray() {
+    out_->push_back(']');
+    need_comma_ = true;
+  }
+
+  void Key(absl::string_view key) {
+    String(key);
+    out_->push_back(':');
+    need_comma_ = false;
+  }
+
+  // Escapes quotes, backslashes & control characters. Other characters are
+  // written as is.
+  void String(absl::string_view str) {
+    Separator();
+    out_->push_back('"');
+    for (char c : str) {
+      if (c == '"' || c == '\\') {
+        out_->push_back('\\');
+        out_->push_back(c);
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        absl::StrAppend(out_, "\\u00",
+                        absl::Hex(static_cast<int>(c), absl::kZeroPad2));
+      } else {
+        out_->push_back(c);
+      }
+    }
+    out_->push_back('"');
+    need_comma_ = true;
+  }
+
+  // JSON has no representation for NaN or infinity, so non-finite floating
+  // point values are written as null.
+  template <typename T>
+  void Number(T x) {
+    static_assert(std::is_arithmetic<T>::value, "T must be a number");
+    Separator();
+    if (std::is_floating_point<T>::value &&
+        !std::isfinite(static_cast<double>(x))) {
+      out_->append("null");
+    } else {
+      absl::StrAppend(out_, x);
+    }
+    need_comma_ = true;
+  }
+
+ private:
+  void Separator() {
+    if (need_comma_) {
+      out_->push_back(',');
+    }
+  }
+
+  std::string* out_;
+  bool need_comma_ = false;
+};
+
+}  // namespace minigo
+
+#endif  // CC_JSON_WRITER_H_
@@ -0,0 +1,81 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/json_writer.h"
+
+#include <limits>
+#include <string>
+
+#include "cc/json.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+TEST(JsonWriterTest, Nesting) {
+  std::string out;
+  JsonWriter writer(&out);
+  writer.BeginObject();
+  writer.Key("a");
+  writer.Number(1);
+  writer.Key("b");
+  writer.BeginArray();
+  writer.Number(2);
+  writer.BeginArray();
+  writer.EndArray();
+  writer.String("x");
+  writer.EndArray();
+  writer.Key("c");
+  writer.BeginObject();
+  writer.EndObject();
+  writer.EndObject();
+  EXPECT_EQ(R"({"a":1,"b":[2,[],"x"],"c":{}})", out);
+}
+
+TEST(JsonWriterTest, AppendsToOutput) {
+  std::string out = "mg-update:";
+  JsonWriter writer(&out);
+  writer.BeginArray();
+  writer.Number(1);
+  writer.EndArray();
+  EXPECT_EQ("mg-update:[1]", out);
+}
+
+TEST(JsonWriterTest, EscapesStrings) {
+  std::string out;
+  JsonWriter writer(&out);
+  writer.String("a\"b\\c\nd\x01");
+  EXPECT_EQ(R"("a\"b\\c\u000ad\u0001")", out);
+  EXPECT_EQ("a\"b\\c\nd\x01", nlohmann::json::parse(out));
+}
+
+TEST(JsonWriterTest, NonFiniteNumbersAreNull) {
+  std::string out;
+  JsonWriter writer(&out);
+  writer.BeginArray();
+  writer.Number(0.5f);
+  writer.Number(std::numeric_limits<float>::quiet_NaN());
+  writer.Number(std::numeric_limits<double>::infinity());
+  writer.Number(-std::numeric_limits<float>::infinity());
+  writer.Number(std::numeric_limits<int>::max());
+  writer.EndArray();
+  EXPECT_EQ("[0.5,null,null,null,2147483647]", out);
+
+  auto j = nlohmann::json::parse(out);
+  ASSERT_EQ(5, j.size());
+  EXPECT_TRUE(j[1].is_null());
+}
+
+}  // namespace
+}  // namespace minigo
@@ -14,13 +14,23 @@
 
 #include "cc/logging.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/memory/memory.h"
 #include "absl/debugging/stacktrace.h"
 #include "absl/debugging/symbolize.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 
 namespace minigo {
 namespace internal {
@@ -32,6 +42,225 @@ absl::Mutex* mutex() {
   return m;
 }
 
+std::atomic<bool> async_enabled{false};
+std::atomic<bool> async_started{false};
+
+// How often the background thread writes asynchronous messages.
+constexpr absl::Duration kFlushInterval = absl::Milliseconds(10);
+
+struct Message {
+  int64_t timestamp_ns;
+  std::string text;
+};
+
+// A single-producer, single-consumer lock-free ring buffer of log messages.
+// The producer is the thread that owns the buffer and the consumer is
+// whichever thread holds the AsyncLogger's flush mutex.
+class MessageBuffer {
+ public:
+  explicit MessageBuffer(size_t capacity)
+      : capacity_(capacity), data_(new char[capacity]) {}
+
+  size_t capacity() const { return capacity_; }
+
+  uint64_t num_dropped() const {
+    return num_dropped_.load(std::memory_order_relaxed);
+  }
+
+  // Called by the producer. Returns false and drops the message if there
+  // isn't enough room in the buffer.
+  bool TryPush(int64_t timestamp_ns, const std::string& text) {
+    Header header = {timestamp_ns, text.size()};
+    auto size = sizeof(header) + text.size();
+    auto head = head_.load(std::memory_order_relaxed);
+    auto tail = tail_.load(std::memory_order_acquire);
+    if (size > capacity_ - (head - tail)) {
+      num_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    Write(head, &header, sizeof(header));
+    Write(head + sizeof(header), text.data(), text.size());
+    head_.store(head + size, std::memory_order_release);
+    return true;
+  }
+
+  // Called by the consumer. Appends all the messages in the buffer to
+  // `messages`.
+  void PopAll(std::vector<Message>* messages) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto head = head_.load(std::memory_order_acquire);
+    while (tail < head) {
+      Header header;
+      Read(tail, &header, sizeof(header));
+      tail += sizeof(header);
+      Message message = {header.timestamp_ns, std::string(header.size, ' ')};
+      Read(tail, &message.text[0], header.size);
+      tail += header.size;
+      messages->push_back(std::move(message));
+    }
+    tail_.store(tail, std::memory_order_release);
+  }
+
+  // Set to false when the owning thread exits, after which the buffer can be
+  // reused by a new thread.
+  std::atomic<bool> in_use{true};
+
+  // Number of dropped messages already reported by the consumer.
+  uint64_t num_dropped_reported = 0;
+
+ private:
+  struct Header {
+    int64_t timestamp_ns;
+    size_t size;
+  };
+
+  void Write(uint64_t pos, const void* src, size_t size) {
+    auto offset = pos % capacity_;
+    auto n = std::min(size, capacity_ - offset);
+    memcpy(data_.get() + offset, src, n);
+    memcpy(data_.get(), static_cast<const char*>(src) + n, size - n);
+  }
+
+  void Read(uint64_t pos, void* dst, size_t size) const {
+    auto offset = pos % capacity_;
+    auto n = std::min(size, capacity_ - offset);
+    memcpy(dst, data_.get() + offset, n);
+    memcpy(static_cast<char*>(dst) + n, data_.get(), size - n);
+  }
+
+  const size_t capacity_;
+  std::unique_ptr<char[]> data_;
+  std::atomic<uint64_t> num_dropped_{0};
+
+  // Total number of bytes ever written & read. Kept on separate cache lines
+  // so that the producer and consumer don't contend.
+  alignas(64) std::atomic<uint64_t> head_{0};
+  alignas(64) std::atomic<uint64_t> tail_{0};
+};
+
+class AsyncLogger {
+ public:
+  static AsyncLogger* Get() {
+    static auto* logger = new AsyncLogger();
+    return logger;
+  }
+
+  // Starts the background thread if it isn't already running.
+  void Start(size_t buffer_size) {
+    absl::MutexLock lock(&buffers_mutex_);
+    buffer_size_ = std::max<size_t>(buffer_size, 1);
+    if (started_) {
+      return;
+    }
+    started_ = true;
+    // The thread runs until the process exits, so it's detached rather than
+    // joined. Pending messages are written at exit by the atexit handler.
+    std::thread([this]() {
+      for (;;) {
+        absl::SleepFor(kFlushInterval);
+        Flush();
+      }
+    }).detach();
+    std::atexit([]() { AsyncLogger::Get()->Flush(); });
+  }
+
+  void Log(std::string text) {
+    auto timestamp_ns = absl::GetCurrentTimeNanos();
+    GetThreadBuffer()->TryPush(timestamp_ns, text);
+  }
+
+  void Flush() {
+    absl::MutexLock lock(&flush_mutex_);
+    messages_.clear();
+    uint64_t num_dropped = 0;
+    for (auto* buffer : GetBuffers()) {
+      buffer->PopAll(&messages_);
+      auto buffer_dropped = buffer->num_dropped();
+      num_dropped += buffer_dropped - buffer->num_dropped_reported;
+      buffer->num_dropped_reported = buffer_dropped;
+    }
+    if (messages_.empty() && num_dropped == 0) {
+      return;
+    }
+
+    // Each buffer's messages are already in order, so a stable sort keeps
+    // messages logged by a thread in order even if their timestamps aren't.
+    std::stable_sort(messages_.begin(), messages_.end(),
+                     [](const Message& a, const Message& b) {
+                       return a.timestamp_ns < b.timestamp_ns;
+                     });
+
+    absl::MutexLock stderr_lock(mutex());
+    for (const auto& message : messages_) {
+      std::cerr << message.text << '\n';
+    }
+    if (num_dropped != 0) {
+      std::cerr << "[W] logging: dropped " << num_dropped
+                << " log messages because the log buffer was full\n";
+    }
+    std::cerr << std::flush;
+  }
+
+  uint64_t num_dropped() {
+    uint64_t result = 0;
+    for (auto* buffer : GetBuffers()) {
+      result += buffer->num_dropped();
+    }
+    return result;
+  }
+
+ private:
+  // Releases the thread's buffer when the thread exits.
+  struct ThreadBufferHolder {
+    ~ThreadBufferHolder() {
+      if (buffer != nullptr) {
+        buffer->in_use.store(false, std::memory_order_release);
+      }
+    }
+    MessageBuffer* buffer = nullptr;
+  };
+
+  // Returns the calling thread's buffer, reusing the buffer of a thread that
+  // has exited if there is one.
+  MessageBuffer* GetThreadBuffer() {
+    static thread_local ThreadBufferHolder holder;
+    if (holder.buffer == nullptr) {
+      absl::MutexLock lock(&buffers_mutex_);
+      for (const auto& buffer : buffers_) {
+        if (buffer->capacity() == buffer_size_ &&
+            !buffer->in_use.load(std::memory_order_acquire)) {
+          buffer->in_use.store(true, std::memory_order_relaxed);
+          holder.buffer = buffer.get();
+          break;
+        }
+      }
+      if (holder.buffer == nullptr) {
+        buffers_.push_back(absl::make_unique<MessageBuffer>(buffer_size_));
+        holder.buffer = buffers_.back().get();
+      }
+    }
+    return holder.buffer;
+  }
+
+  std::vector<MessageBuffer*> GetBuffers() {
+    absl::MutexLock lock(&buffers_mutex_);
+    std::vector<MessageBuffer*> result;
+    for (const auto& buffer : buffers_) {
+      result.push_back(buffer.get());
+    }
+    return result;
+  }
+
+  absl::Mutex buffers_mutex_;
+  bool started_ GUARDED_BY(&buffers_mutex_) = false;
+  size_t buffer_size_ GUARDED_BY(&buffers_mutex_) = 0;
+  std::vector<std::unique_ptr<MessageBuffer>> buffers_
+      GUARDED_BY(&buffers_mutex_);
+
+  absl::Mutex flush_mutex_;
+  std::vector<Message> messages_ GUARDED_BY(&flush_mutex_);
+};
+
 void DumpStackTrace(std::ostream* os) {
   void* stack[64];
   int depth = absl::GetStackTrace(stack, 64, 1);
@@ -86,6 +315,13 @@ LogStream::LogStream(const char* file, int line, LogLevel level)
 }
 
 LogStream::~LogStream() {
+  if (level_ == LogLevel::FATAL) {
+    logging::Flush();
+  } else if (logging::IsAsyncEnabled()) {
+    AsyncLogger::Get()->Log(stream_.str());
+    return;
+  }
+
   {
     absl::MutexLock lock(mutex());
     std::cerr << stream_.rdbuf() << '\n';
@@ -104,5 +340,53 @@ CheckFailStream::CheckFailStream(const char* cond, const char* file, int line)
   impl_ << "check failed: " << cond << '\n';
 }
 
+bool LogRateLimiter::ShouldLogEveryN(int n) {
+  return count_.fetch_add(1, std::memory_order_relaxed) % n == 0;
+}
+
+bool LogRateLimiter::ShouldLogEveryNSec(double seconds) {
+  auto now_ns = absl::GetCurrentTimeNanos();
+  auto next_log_ns = next_log_ns_.load(std::memory_order_relaxed);
+  if (now_ns < next_log_ns) {
+    return false;
+  }
+  // If several threads race to log, only one of them wins.
+  return next_log_ns_.compare_exchange_strong(
+      next_log_ns, now_ns + static_cast<int64_t>(seconds * 1e9),
+      std::memory_order_relaxed);
+}
+
 }  // namespace internal
+
+namespace logging {
+
+void EnableAsync(size_t buffer_size) {
+  internal::AsyncLogger::Get()->Start(buffer_size);
+  internal::async_started = true;
+  internal::async_enabled = true;
+}
+
+void DisableAsync() {
+  internal::async_enabled = false;
+  Flush();
+}
+
+bool IsAsyncEnabled() {
+  return internal::async_enabled.load(std::memory_order_relaxed);
+}
+
+void Flush() {
+  if (internal::async_started) {
+    internal::AsyncLogger::Get()->Flush();
+  }
+}
+
+uint64_t GetNumDroppedMessages() {
+  if (!internal::async_started) {
+    return 0;
+  }
+  return internal::AsyncLogger::Get()->num_dropped();
+}
+
+}  // namespace logging
 }  // namespace minigo
@@ -15,12 +15,55 @@
 #ifndef CC_LOGGING_H_
 #define CC_LOGGING_H_
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <sstream>
 
 #include "absl/base/attributes.h"
 #include "absl/base/optimization.h"
 
 namespace minigo {
+namespace logging {
+
+// By default, MG_LOG writes each message to stderr before returning, which
+// can stall the logging thread for a long time when stderr is slow or other
+// threads are logging at the same time.
+//
+// Once asynchronous logging is enabled, each thread appends its messages to
+// its own fixed size lock-free ring buffer, and a background thread
+// periodically writes them to stderr. Messages logged from different threads
+// are written approximately in the order they were logged. Logging a message
+// never blocks (except for a short lock the first time each thread logs):
+// messages that don't fit in the thread's buffer are dropped and counted.
+//
+// FATAL messages are always written synchronously, after flushing any pending
+// asynchronous messages.
+//
+// Asynchronous logging is best suited to long running batch jobs like
+// selfplay. It shouldn't be used by binaries like the GTP engine whose
+// clients expect log messages to be written before a response is sent.
+//
+// `buffer_size` is the size in bytes of each thread's buffer. Changing it
+// only affects threads that haven't logged anything yet.
+void EnableAsync(size_t buffer_size = 1 << 18);
+
+// Disables asynchronous logging and writes any pending messages.
+void DisableAsync();
+
+// Returns true if asynchronous logging is enabled.
+bool IsAsyncEnabled();
+
+// Writes all pending asynchronous messages to stderr, blocking until they're
+// written.
+void Flush();
+
+// Returns the number of asynchronous messages dropped because the logging
+// thread's buffer was full.
+uint64_t GetNumDroppedMessages();
+
+}  // namespace logging
+
 namespace internal {
 
 enum class LogLevel {
@@ -83,6 +126,30 @@ class CheckNoOpStream {
   operator bool() { return true; }
 };
 
+// LogRateLimiter is used by the MG_LOG_EVERY_N and MG_LOG_EVERY_N_SEC macros
+// to limit how often a log statement writes its message. Each call site has
+// its own LogRateLimiter.
+class LogRateLimiter {
+ public:
+  // Returns true for the first call and every n'th call after that.
+  bool ShouldLogEveryN(int n);
+
+  // Returns true for the first call and for calls made at least `seconds`
+  // after the last call that returned true.
+  bool ShouldLogEveryNSec(double seconds);
+
+ private:
+  std::atomic<int64_t> count_{0};
+  std::atomic<int64_t> next_log_ns_{0};
+};
+
+// LogStreamVoidify is used in the MG_LOG_EVERY_N and MG_LOG_EVERY_N_SEC macros
+// in the same way as CheckStreamVoidify is used in MG_CHECK.
+class LogStreamVoidify {
+ public:
+  void operator&(const LogStream&) {}
+};
+
 // CheckStreamVoidify is used in the MG_CHECK macro to convert the result of
 // CheckFailStream logging to void. The & operator is used because it has a
 // precedence lower than << but higher than ?:
@@ -99,6 +166,27 @@ class CheckStreamVoidify {
   ::minigo::internal::LogStream(__FILE__, __LINE__, \
                                 ::minigo::internal::LogLevel::level)
 
+// MG_LOG_EVERY_N(level, n) logs the first message and every n'th message
+// after that. MG_LOG_EVERY_N_SEC(level, seconds) logs at most one message
+// every `seconds` seconds. Messages that aren't logged cost little more than
+// an atomic operation: the message isn't formatted.
+// The lambda gives each call site its own LogRateLimiter.
+#define MG_LOG_RATE_LIMITER                                 \
+  ([]() {                                                   \
+    static ::minigo::internal::LogRateLimiter rate_limiter; \
+    return &rate_limiter;                                   \
+  }())
+
+#define MG_LOG_EVERY_N(level, n)                               \
+  !MG_LOG_RATE_LIMITER->ShouldLogEveryN((n))                   \
+      ? (void)0                                                \
+      : ::minigo::internal::LogStreamVoidify() & MG_LOG(level)
+
+#define MG_LOG_EVERY_N_SEC(level, seconds)                     \
+  !MG_LOG_RATE_LIMITER->ShouldLogEveryNSec((seconds))          \
+      ? (void)0                                                \
+      : ::minigo::internal::LogStreamVoidify() & MG_LOG(level)
+
 // MG_CHECK(cond) and MG_DCHECK(cond) halt the program, printing the current
 // the given condition `cond` is not true. MG_CHECK is always enabled, MG_DCHECK
 // is only enabled for debug builds (i.e. when NDEBUG is not defined).
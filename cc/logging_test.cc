@@ -0,0 +1,104 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/logging.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+TEST(LoggingTest, EveryN) {
+  testing::internal::CaptureStderr();
+  for (int i = 0; i < 9; ++i) {
+    MG_LOG_EVERY_N(INFO, 3) << "line " << i;
+  }
+  EXPECT_EQ("line 0\nline 3\nline 6\n", testing::internal::GetCapturedStderr());
+}
+
+TEST(LoggingTest, EveryNSec) {
+  testing::internal::CaptureStderr();
+  for (int i = 0; i < 5; ++i) {
+    MG_LOG_EVERY_N_SEC(INFO, 1000) << "line " << i;
+  }
+  EXPECT_EQ("line 0\n", testing::internal::GetCapturedStderr());
+}
+
+TEST(LoggingTest, Async) {
+  constexpr int kNumThreads = 4;
+  constexpr int kNumLines = 100;
+
+  testing::internal::CaptureStderr();
+  logging::EnableAsync();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([i]() {
+      for (int j = 0; j < kNumLines; ++j) {
+        MG_LOG(INFO) << i << " " << j;
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  logging::DisableAsync();
+  auto output = testing::internal::GetCapturedStderr();
+
+  // Every line should be written, and the lines from each thread should be
+  // written in order.
+  std::vector<int> next_line(kNumThreads, 0);
+  for (auto line : absl::StrSplit(output, '\n', absl::SkipEmpty())) {
+    std::vector<absl::string_view> parts = absl::StrSplit(line, ' ');
+    ASSERT_EQ(2, parts.size()) << line;
+    int thread_id, line_id;
+    ASSERT_TRUE(absl::SimpleAtoi(parts[0], &thread_id));
+    ASSERT_TRUE(absl::SimpleAtoi(parts[1], &line_id));
+    ASSERT_LE(0, thread_id);
+    ASSERT_GT(kNumThreads, thread_id);
+    EXPECT_EQ(next_line[thread_id]++, line_id);
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    EXPECT_EQ(kNumLines, next_line[i]);
+  }
+}
+
+TEST(LoggingTest, AsyncDropsMessagesThatDontFit) {
+  auto num_dropped = logging::GetNumDroppedMessages();
+
+  testing::internal::CaptureStderr();
+  logging::EnableAsync(256);
+  // Log from a new thread so that the message is written to a buffer with the
+  // new size.
+  std::thread([]() {
+    MG_LOG(INFO) << std::string(1000, 'x');
+    MG_LOG(INFO) << "small";
+  }).join();
+  logging::DisableAsync();
+  auto output = testing::internal::GetCapturedStderr();
+
+  EXPECT_EQ(num_dropped + 1, logging::GetNumDroppedMessages());
+  EXPECT_TRUE(absl::StrContains(output, "small\n")) << output;
+  EXPECT_FALSE(absl::StrContains(output, "xxx")) << output;
+  EXPECT_TRUE(absl::StrContains(output, "dropped 1 log messages")) << output;
+}
+
+}  // namespace
+}  // namespace minigo
@@ -0,0 +1,442 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for the MCTS search internals, run over search trees grown to
+// 1k, 10k and 100k nodes using random priors and values.
+// Besides the usual timings, every benchmark reports the number of heap
+// allocations per item processed.
+//
+// Run with:
+//   bazel run -c opt --define=board_size=9 cc:mcts_benchmark
+//   bazel run -c opt cc:mcts_benchmark
+// Note that the 100k node trees take about 1GB of memory on 19x19.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "absl/base/attributes.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
+#include "benchmark/benchmark.h"
+#include "cc/constants.h"
+#include "cc/dual_net/random_dual_net.h"
+#include "cc/game.h"
+#include "cc/mcts_node.h"
+#include "cc/mcts_player.h"
+#include "cc/position.h"
+#include "cc/random.h"
+#include "cc/zobrist.h"
+
+// Counts every heap allocation made by the benchmark. The array and nothrow
+// forms of operator new & delete forward to these by default. The operators
+// aren't inlined so that GCC doesn't mistake the std::free calls for frees of
+// memory that was allocated with new.
+std::atomic<int64_t> num_allocations{0};
+
+ABSL_ATTRIBUTE_NOINLINE void* operator new(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = std::malloc(size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+ABSL_ATTRIBUTE_NOINLINE void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+ABSL_ATTRIBUTE_NOINLINE void operator delete(void* ptr, size_t size) noexcept {
+  std::free(ptr);
+}
+
+namespace minigo {
+namespace {
+
+constexpr uint64_t kSeed = 614944751;
+
+// Number of leaves in each batch, where a benchmark runs batches.
+constexpr int kBatchSize = 64;
+
+int64_t NumAllocations() {
+  return num_allocations.load(std::memory_order_relaxed);
+}
+
+void SetCounters(benchmark::State& state, int64_t num_items,
+                 int64_t num_allocs) {
+  state.SetItemsProcessed(num_items);
+  state.counters["allocs/item"] =
+      static_cast<double>(num_allocs) / std::max<int64_t>(1, num_items);
+}
+
+// A search tree grown to at least a given number of nodes by a search that
+// uses random priors and values.
+class Tree {
+ public:
+  explicit Tree(int num_nodes)
+      : root_(&root_stats_, Position(Color::kBlack)), rnd_(kSeed, 1) {
+    for (auto& probs : probs_) {
+      rnd_.Uniform(&probs);
+    }
+    while (root_.CalculateTreeStats().num_nodes < num_nodes) {
+      for (int i = 0; i < 1000; ++i) {
+        auto* leaf = root_.SelectLeaf();
+        Incorporate(leaf, &root_);
+      }
+    }
+
+    // Sample the nodes that the benchmarks run over from the expanded nodes
+    // that have more than one visit and from the leaves.
+    std::vector<MctsNode*> expanded;
+    std::vector<MctsNode*> leaves;
+    std::vector<MctsNode*> pending = {&root_};
+    while (!pending.empty()) {
+      auto* node = pending.back();
+      pending.pop_back();
+      if (node->HasFlag(MctsNode::Flag::kExpanded) && node->N() > 1) {
+        expanded.push_back(node);
+      }
+      if (node->children.empty() && !node->game_over() &&
+          !node->at_move_limit()) {
+        leaves.push_back(node);
+      }
+      for (const auto& kv : node->children) {
+        pending.push_back(kv.second.get());
+      }
+    }
+    Sample(expanded, kMaxExpanded, &expanded_);
+    Sample(leaves, kBatchSize, &leaves_);
+
+    // Remember the stats of every node between the sampled leaves and the
+    // root, so that ResetLeafPaths can undo the values backed up from them.
+    for (auto* leaf : leaves_) {
+      for (auto* node = leaf; node != nullptr; node = node->parent) {
+        if (!saved_stats_.emplace(node->stats, *node->stats).second) {
+          break;
+        }
+      }
+    }
+  }
+
+  // Expands the leaf using one of the random priors and backs up a random
+  // value.
+  void Incorporate(MctsNode* leaf, MctsNode* up_to) {
+    float value = 2 * rnd_() - 1;
+    if (leaf->game_over() || leaf->at_move_limit()) {
+      leaf->IncorporateEndGameResult(value, up_to);
+    } else {
+      leaf->IncorporateResults(0, probs_[num_incorporated_++ % probs_.size()],
+                               value, up_to);
+    }
+  }
+
+  // Restores the stats of the nodes between the sampled leaves and the root
+  // to their values when the tree was built. Benchmarks that back up values
+  // from the leaves call this between iterations, so that every iteration
+  // runs on the same tree instead of one whose visit counts keep growing.
+  void ResetLeafPaths() {
+    for (const auto& kv : saved_stats_) {
+      *kv.first = kv.second;
+    }
+  }
+
+  MctsNode* root() { return &root_; }
+
+  // Up to kMaxExpanded expanded nodes with more than one visit.
+  const std::vector<MctsNode*>& expanded() const { return expanded_; }
+
+  // Up to kBatchSize nodes without children that aren't terminal.
+  const std::vector<MctsNode*>& leaves() const { return leaves_; }
+
+ private:
+  static constexpr int kMaxExpanded = 1024;
+
+  // Appends up to `n` nodes to `sample`, spread evenly over `nodes`.
+  static void Sample(const std::vector<MctsNode*>& nodes, size_t n,
+                     std::vector<MctsNode*>* sample) {
+    size_t stride = std::max<size_t>(1, nodes.size() / n);
+    for (size_t i = 0; i < nodes.size() && sample->size() < n; i += stride) {
+      sample->push_back(nodes[i]);
+    }
+  }
+
+  MctsNode::EdgeStats root_stats_;
+  MctsNode root_;
+  Random rnd_;
+  std::array<std::array<float, kNumMoves>, 16> probs_;
+  int num_incorporated_ = 0;
+  std::vector<MctsNode*> expanded_;
+  std::vector<MctsNode*> leaves_;
+  absl::flat_hash_map<MctsNode::EdgeStats*, MctsNode::EdgeStats> saved_stats_;
+};
+
+// Returns the tree for the benchmark's first argument. Only the most recently
+// used tree is kept alive, because the large trees use a lot of memory.
+Tree* GetTree(benchmark::State& state) {
+  static std::unique_ptr<Tree> tree;
+  static int tree_size = 0;
+  int num_nodes = state.range(0);
+  if (tree == nullptr || tree_size != num_nodes) {
+    tree.reset();
+    tree = absl::make_unique<Tree>(num_nodes);
+    tree_size = num_nodes;
+  }
+  return tree.get();
+}
+
+void TreeSizes(benchmark::internal::Benchmark* b) {
+  for (int num_nodes : {1000, 10000, 100000}) {
+    b->Arg(num_nodes);
+  }
+}
+
+// Selects batches of leaves, applying a virtual loss to each leaf as a
+// batched search does. The virtual losses are reverted after each batch.
+void BM_SelectLeaf(benchmark::State& state) {
+  auto* tree = GetTree(state);
+  auto* root = tree->root();
+
+  std::vector<MctsNode*> leaves;
+  int64_t num_allocs = NumAllocations();
+  for (auto _ : state) {
+    auto* leaf = root->SelectLeaf();
+    leaf->AddVirtualLoss(root);
+    leaves.push_back(leaf);
+    if (leaves.size() == kBatchSize) {
+      for (auto* l : leaves) {
+        l->RevertVirtualLoss(root);
+      }
+      leaves.clear();
+    }
+  }
+  for (auto* l : leaves) {
+    l->RevertVirtualLoss(root);
+  }
+  SetCounters(state, state.iterations(), NumAllocations() - num_allocs);
+}
+BENCHMARK(BM_SelectLeaf)->Apply(TreeSizes);
+
+// Expands a batch of leaves and backs up their values to the root. Before
+// each batch, the leaves are unexpanded so that they can be expanded again,
+// and the values backed up by the previous batch are undone.
+void BM_IncorporateResults(benchmark::State& state) {
+  auto* tree = GetTree(state);
+  const auto& leaves = tree->leaves();
+
+  int64_t num_allocs = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (auto* leaf : leaves) {
+      leaf->edges = {};
+      leaf->ClearFlag(MctsNode::Flag::kExpanded);
+    }
+    tree->ResetLeafPaths();
+    state.ResumeTiming();
+
+    int64_t start_allocs = NumAllocations();
+    for (auto* leaf : leaves) {
+      tree->Incorporate(leaf, tree->root());
+    }
+    num_allocs += NumAllocations() - start_allocs;
+  }
+  tree->ResetLeafPaths();
+  SetCounters(state, state.iterations() * leaves.size(), num_allocs);
+}
+BENCHMARK(BM_IncorporateResults)->Apply(TreeSizes);
+
+// Backs up a value from each leaf in a batch to the root. The backed up values
+// are undone between batches.
+void BM_BackupValue(benchmark::State& state) {
+  auto* tree = GetTree(state);
+  const auto& leaves = tree->leaves();
+
+  int64_t num_allocs = 0;
+  float value = 0.5;
+  for (auto _ : state) {
+    state.PauseTiming();
+    tree->ResetLeafPaths();
+    state.ResumeTiming();
+
+    int64_t start_allocs = NumAllocations();
+    for (auto* leaf : leaves) {
+      leaf->BackupValue(value, tree->root());
+      value = -value;
+    }
+    num_allocs += NumAllocations() - start_allocs;
+  }
+  tree->ResetLeafPaths();
+  SetCounters(state, state.iterations() * leaves.size(), num_allocs);
+}
+BENCHMARK(BM_BackupValue)->Apply(TreeSizes);
+
+// Adds then reverts a virtual loss on each leaf in a batch.
+void BM_AddRevertVirtualLoss(benchmark::State& state) {
+  auto* tree = GetTree(state);
+  const auto& leaves = tree->leaves();
+
+  int64_t num_allocs = NumAllocations();
+  for (auto _ : state) {
+    for (auto* leaf : leaves) {
+      leaf->AddVirtualLoss(tree->root());
+    }
+    for (auto* leaf : leaves) {
+      leaf->RevertVirtualLoss(tree->root());
+    }
+  }
+  SetCounters(state, state.iterations() * leaves.size(),
+              NumAllocations() - num_allocs);
+}
+BENCHMARK(BM_AddRevertVirtualLoss)->Apply(TreeSizes);
+
+// Adds a child to each of a batch of expanded nodes, then removes the children
+// again, so the time includes destroying the children. If the second argument
+// is non-zero, the parents' canonical symmetries are cleared so that each
+// child has to calculate its own.
+void BM_MaybeAddChild(benchmark::State& state) {
+  auto* tree = GetTree(state);
+  bool calculate_symmetry = state.range(1) != 0;
+
+  // For each parent, choose a legal move that isn't already a child.
+  std::vector<std::pair<MctsNode*, Coord>> batch;
+  for (auto* node : tree->expanded()) {
+    for (int c = 0; c < kN * kN; ++c) {
+      if (node->position.legal_move(c) && !node->children.contains(c)) {
+        batch.emplace_back(node, c);
+        break;
+      }
+    }
+    if (batch.size() == kBatchSize) {
+      break;
+    }
+  }
+
+  std::vector<std::pair<uint8_t, symmetry::Symmetry>> original_symmetries;
+  for (const auto& p : batch) {
+    original_symmetries.emplace_back(p.first->flags,
+                                     p.first->canonical_symmetry);
+    if (calculate_symmetry) {
+      p.first->ClearFlag(MctsNode::Flag::kHasCanonicalSymmetry);
+    }
+  }
+
+  int64_t num_allocs = NumAllocations();
+  for (auto _ : state) {
+    for (const auto& p : batch) {
+      benchmark::DoNotOptimize(p.first->MaybeAddChild(p.second));
+    }
+    for (const auto& p : batch) {
+      p.first->children.erase(p.second);
+    }
+  }
+  SetCounters(state, state.iterations() * batch.size(),
+              NumAllocations() - num_allocs);
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    batch[i].first->flags = original_symmetries[i].first;
+    batch[i].first->canonical_symmetry = original_symmetries[i].second;
+  }
+}
+BENCHMARK(BM_MaybeAddChild)->Apply([](benchmark::internal::Benchmark* b) {
+  for (int num_nodes : {1000, 10000, 100000}) {
+    b->Args({num_nodes, 0});
+    b->Args({num_nodes, 1});
+  }
+});
+
+void BM_CalculateRankedChildInfo(benchmark::State& state) {
+  auto* tree = GetTree(state);
+  const auto& nodes = tree->expanded();
+
+  int64_t num_allocs = NumAllocations();
+  for (auto _ : state) {
+    for (const auto* node : nodes) {
+      benchmark::DoNotOptimize(node->CalculateRankedChildInfo());
+    }
+  }
+  SetCounters(state, state.iterations() * nodes.size(),
+              NumAllocations() - num_allocs);
+}
+BENCHMARK(BM_CalculateRankedChildInfo)->Apply(TreeSizes);
+
+// Runs MctsPlayer::TreeSearch with a RandomDualNet, starting from a tree with
+// the given number of nodes. The tree is rebuilt whenever it has grown by
+// 10%, so that the tree size stays close to the requested one.
+void BM_TreeSearch(benchmark::State& state) {
+  int num_nodes = state.range(0);
+
+  Game::Options game_options;
+  Game game("b", "w", game_options);
+  MctsPlayer::Options player_options;
+  player_options.inject_noise = false;
+  player_options.random_seed = kSeed;
+  player_options.virtual_losses = 8;
+  MctsPlayer player(RandomDualNetFactory(kSeed).NewModel("agz:0.4:0.4"),
+                    nullptr, &game, player_options);
+
+  auto grow_tree = [&]() {
+    player.NewGame();
+    while (player.root()->CalculateTreeStats().num_nodes < num_nodes) {
+      for (int i = 0; i < 100; ++i) {
+        player.TreeSearch(player_options.virtual_losses,
+                          std::numeric_limits<int>::max());
+      }
+    }
+  };
+  grow_tree();
+
+  int64_t num_readouts = 0;
+  int64_t num_allocs = 0;
+  int num_readouts_since_grown = 0;
+  for (auto _ : state) {
+    int start_N = player.root()->N();
+    int64_t start_allocs = NumAllocations();
+    player.TreeSearch(player_options.virtual_losses,
+                      std::numeric_limits<int>::max());
+    num_allocs += NumAllocations() - start_allocs;
+    num_readouts_since_grown += player.root()->N() - start_N;
+
+    if (num_readouts_since_grown >= num_nodes / 10) {
+      state.PauseTiming();
+      num_readouts += num_readouts_since_grown;
+      num_readouts_since_grown = 0;
+      grow_tree();
+      state.ResumeTiming();
+    }
+  }
+  num_readouts += num_readouts_since_grown;
+
+  state.counters["readouts/s"] = benchmark::Counter(
+      static_cast<double>(num_readouts), benchmark::Counter::kIsRate);
+  state.counters["allocs/readout"] =
+      static_cast<double>(num_allocs) / std::max<int64_t>(1, num_readouts);
+}
+BENCHMARK(BM_TreeSearch)->Apply(TreeSizes);
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  ::benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -16,6 +16,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <functional>
 #include <tuple>
 #include <utility>
@@ -23,6 +24,7 @@
 #include "absl/strings/str_format.h"
 #include "cc/algorithm.h"
 #include "cc/logging.h"
+#include "cc/memory_accounting.h"
 
 namespace minigo {
 
@@ -52,13 +54,212 @@ class ZobristHistory : public Position::ZobristHistory {
 
 constexpr int kSuperKoCacheStride = 8;
 
+// Tree snapshots written by SerializeTree start with kTreeMagic and
+// kTreeVersion. Multi-byte values are little endian.
+constexpr char kTreeMagic[] = "MGTS";
+constexpr uint32_t kTreeVersion = 1;
+
+// Flags that are written to tree snapshots: all other flags describe
+// transient search state.
+constexpr uint8_t kSerializedFlags =
+    static_cast<uint8_t>(MctsNode::Flag::kExpanded) |
+    static_cast<uint8_t>(MctsNode::Flag::kHasCanonicalSymmetry);
+
+class TreeWriter {
+ public:
+  explicit TreeWriter(std::string* out) : out_(out) {}
+
+  void WriteBytes(absl::string_view bytes) {
+    out_->append(bytes.data(), bytes.size());
+  }
+
+  void WriteUint(uint64_t x, int num_bytes) {
+    for (int i = 0; i < num_bytes; ++i) {
+      out_->push_back(static_cast<char>((x >> (8 * i)) & 0xff));
+    }
+  }
+
+  void WriteFloat(float f) {
+    uint32_t x;
+    static_assert(sizeof(x) == sizeof(f), "unexpected float size");
+    memcpy(&x, &f, sizeof(x));
+    WriteUint(x, sizeof(x));
+  }
+
+  void WriteNode(const MctsNode& node) {
+    WriteUint(node.flags & kSerializedFlags, 1);
+    WriteUint(node.canonical_symmetry, 1);
+
+    // Only the edges that have been visited or have a prior are written.
+    int num_edges = 0;
+    for (const auto& e : node.edges) {
+      num_edges += HasStats(e);
+    }
+    WriteUint(num_edges, 2);
+    for (int i = 0; i < kNumMoves; ++i) {
+      const auto& e = node.edges[i];
+      if (HasStats(e)) {
+        WriteUint(i, 2);
+        WriteFloat(e.N);
+        WriteFloat(e.W);
+        WriteFloat(e.P);
+        WriteFloat(e.original_P);
+      }
+    }
+
+    WriteUint(node.children.size(), 2);
+    for (const auto& kv : node.children) {
+      WriteUint(kv.first, 2);
+      WriteNode(*kv.second);
+    }
+  }
+
+ private:
+  static bool HasStats(const MctsNode::EdgeStats& e) {
+    return e.N != 0 || e.W != 0 || e.P != 0 || e.original_P != 0;
+  }
+
+  std::string* out_;
+};
+
+class TreeReader {
+ public:
+  TreeReader(absl::string_view data, float min_N)
+      : data_(data), min_N_(min_N) {}
+
+  bool done() const { return data_.empty(); }
+
+  bool ReadBytes(size_t num_bytes, absl::string_view* bytes) {
+    if (data_.size() < num_bytes) {
+      return false;
+    }
+    *bytes = data_.substr(0, num_bytes);
+    data_.remove_prefix(num_bytes);
+    return true;
+  }
+
+  template <typename T>
+  bool ReadUint(int num_bytes, T* x) {
+    absl::string_view bytes;
+    if (!ReadBytes(num_bytes, &bytes)) {
+      return false;
+    }
+    uint64_t result = 0;
+    for (int i = 0; i < num_bytes; ++i) {
+      result |= static_cast<uint64_t>(static_cast<uint8_t>(bytes[i]))
+                << (8 * i);
+    }
+    *x = static_cast<T>(result);
+    return true;
+  }
+
+  bool ReadFloat(float* f) {
+    uint32_t x;
+    if (!ReadUint(sizeof(x), &x)) {
+      return false;
+    }
+    memcpy(f, &x, sizeof(x));
+    return true;
+  }
+
+  // Reads a node written by TreeWriter::WriteNode into `node`. If `node` is
+  // null, the node and its children are read and discarded.
+  bool ReadNode(MctsNode* node) {
+    uint8_t flags, sym;
+    int num_edges;
+    if (!ReadUint(1, &flags) || !ReadUint(1, &sym) ||
+        !ReadUint(2, &num_edges)) {
+      return false;
+    }
+    if ((flags & ~kSerializedFlags) != 0 || sym >= symmetry::kNumSymmetries) {
+      MG_LOG(ERROR) << "invalid node flags or symmetry";
+      return false;
+    }
+    if (node != nullptr) {
+      node->flags = flags;
+      node->canonical_symmetry = static_cast<symmetry::Symmetry>(sym);
+    }
+
+    for (int i = 0; i < num_edges; ++i) {
+      int c;
+      MctsNode::EdgeStats e;
+      if (!ReadUint(2, &c) || !ReadFloat(&e.N) || !ReadFloat(&e.W) ||
+          !ReadFloat(&e.P) || !ReadFloat(&e.original_P)) {
+        return false;
+      }
+      if (c >= kNumMoves) {
+        MG_LOG(ERROR) << "invalid edge move " << c;
+        return false;
+      }
+      if (node != nullptr) {
+        node->edges[c] = e;
+      }
+    }
+
+    int num_children;
+    if (!ReadUint(2, &num_children)) {
+      return false;
+    }
+    for (int i = 0; i < num_children; ++i) {
+      int c;
+      if (!ReadUint(2, &c)) {
+        return false;
+      }
+      if (c >= kNumMoves) {
+        MG_LOG(ERROR) << "invalid child move " << c;
+        return false;
+      }
+
+      // Children with too few visits are skipped: their edge stats are kept,
+      // so they're recreated the next time they are selected.
+      MctsNode* child = nullptr;
+      if (node != nullptr && node->edges[c].N >= min_N_) {
+        if (!node->position.legal_move(c) || node->children.contains(c)) {
+          MG_LOG(ERROR) << "child move " << c << " can't be played";
+          return false;
+        }
+        child = node->MaybeAddChild(c);
+      }
+      if (!ReadNode(child)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  absl::string_view data_;
+  const float min_N_;
+};
+
+// Adds `sign` times the memory used by `node` to the tree and superko cache
+// memory accounting categories. Tree nodes are created and destroyed at a high
+// rate, so they use batched updates rather than holding TrackedBytes.
+void AccountMemory(const MctsNode& node, int64_t sign) {
+  int64_t superko_bytes = node.SuperkoCacheMemoryUsage();
+  int64_t tree_bytes = node.MemoryUsage() - superko_bytes;
+  memory::AddBatched(memory::Category::kTree, sign * tree_bytes);
+  memory::AddBatched(memory::Category::kSuperkoCache, sign * superko_bytes);
+}
+
+// Accounts for a resize of `node`'s children map, which used `old_bytes`
+// before the resize.
+void AccountChildMapResize(const MctsNode& node, int64_t old_bytes) {
+  int64_t new_bytes = node.ChildMapMemoryUsage();
+  if (new_bytes != old_bytes) {
+    memory::AddBatched(memory::Category::kTree, new_bytes - old_bytes);
+  }
+}
+
 }  // namespace
 
 MctsNode::MctsNode(EdgeStats* stats, const Position& position)
     : parent(nullptr),
       stats(stats),
       move(Coord::kInvalid),
-      position(position) {}
+      position(position) {
+  AccountMemory(*this, 1);
+}
 
 MctsNode::MctsNode(MctsNode* parent, Coord move)
     : parent(parent),
@@ -123,6 +324,29 @@ MctsNode::MctsNode(MctsNode* parent, Coord move)
       superko_cache->insert(node->position.stone_hash());
     }
   }
+
+  AccountMemory(*this, 1);
+}
+
+MctsNode::~MctsNode() { AccountMemory(*this, -1); }
+
+MctsNode& MctsNode::operator=(MctsNode&& other) {
+  AccountMemory(*this, -1);
+  AccountMemory(other, -1);
+  parent = other.parent;
+  stats = other.stats;
+  move = other.move;
+  flags = other.flags;
+  canonical_symmetry = other.canonical_symmetry;
+  edges = other.edges;
+  children = std::move(other.children);
+  position = std::move(other.position);
+  num_virtual_losses_applied = other.num_virtual_losses_applied;
+  pending_backup = other.pending_backup;
+  superko_cache = std::move(other.superko_cache);
+  AccountMemory(*this, 1);
+  AccountMemory(other, 1);
+  return *this;
 }
 
 Coord MctsNode::GetMostVisitedMove(bool restrict_in_bensons) const {
@@ -182,6 +406,31 @@ Coord MctsNode::GetMostVisitedMove(bool restrict_in_bensons) const {
   return c;
 }
 
+void MctsNode::GetTopTwoChildren(Coord* first, Coord* second) const {
+  int a = 0;
+  int b = 1;
+  if (child_N(b) > child_N(a)) {
+    std::swap(a, b);
+  }
+  for (int i = 2; i < kNumMoves; ++i) {
+    if (child_N(i) > child_N(a)) {
+      b = a;
+      a = i;
+    } else if (child_N(i) > child_N(b)) {
+      b = i;
+    }
+  }
+  *first = a;
+  *second = b;
+}
+
+bool MctsNode::CanMostVisitedMoveChange(int num_readouts) const {
+  Coord first = Coord::kInvalid;
+  Coord second = Coord::kInvalid;
+  GetTopTwoChildren(&first, &second);
+  return child_N(second) + num_readouts >= child_N(first);
+}
+
 void MctsNode::ReshapeFinalVisits(bool restrict_in_bensons) {
   // Since we aren't actually disallowing *reads* of bensons moves, only their
   // selection, we get the most visited move regardless of bensons status and
@@ -351,7 +600,7 @@ void MctsNode::InjectNoise(const std::array<float, kNumMoves>& noise,
   }
 }
 
-MctsNode* MctsNode::SelectLeaf() {
+MctsNode* MctsNode::SelectLeaf(absl::Span<const Coord> excluded_moves) {
   auto* node = this;
   for (;;) {
     // If a node has never been evaluated, we have no basis to select a child.
@@ -366,6 +615,9 @@ MctsNode* MctsNode::SelectLeaf() {
     }
 
     auto child_action_score = node->CalculateChildActionScore();
+    for (Coord c : excluded_moves) {
+      child_action_score[c] -= 1000.0f;
+    }
     auto best_move = ArgMax(child_action_score);
     node = node->MaybeAddChild(best_move);
   }
@@ -374,6 +626,14 @@ MctsNode* MctsNode::SelectLeaf() {
 void MctsNode::IncorporateResults(float value_init_penalty,
                                   absl::Span<const float> move_probabilities,
                                   float value, MctsNode* up_to) {
+  if (Expand(value_init_penalty, move_probabilities, value)) {
+    BackupValue(value, up_to);
+  }
+}
+
+bool MctsNode::Expand(float value_init_penalty,
+                      absl::Span<const float> move_probabilities,
+                      float value) {
   MG_DCHECK(move_probabilities.size() == kNumMoves);
   // A finished game should not be going through this code path, it should
   // directly call BackupValue on the result of the game.
@@ -382,7 +642,7 @@ void MctsNode::IncorporateResults(float value_init_penalty,
   // If the node has already been selected for the next inference batch, we
   // shouldn't 'expand' it again.
   if (HasFlag(Flag::kExpanded)) {
-    return;
+    return false;
   }
 
   float policy_scalar = 0;
@@ -444,7 +704,7 @@ void MctsNode::IncorporateResults(float value_init_penalty,
     // assign.
     edges[i].W += reduced_value;
   }
-  BackupValue(value, up_to);
+  return true;
 }
 
 void MctsNode::IncorporateEndGameResult(float value, MctsNode* up_to) {
@@ -465,11 +725,71 @@ void MctsNode::BackupValue(float value, MctsNode* up_to) {
   }
 }
 
-void MctsNode::AddVirtualLoss(MctsNode* up_to) {
+void MctsNode::BackupBatch(absl::Span<const BatchedBackup> batch) {
+  // Leaves whose results are backed up to different nodes are backed up
+  // separately. Usually, all the leaves in a batch share the same `up_to`.
+  std::vector<MctsNode*> up_tos;
+  std::vector<MctsNode*> nodes;
+  for (const auto& first : batch) {
+    auto* up_to = first.up_to;
+    if (std::find(up_tos.begin(), up_tos.end(), up_to) != up_tos.end()) {
+      continue;
+    }
+    up_tos.push_back(up_to);
+
+    // Accumulate each leaf's update on the leaf, and mark all the nodes on
+    // the leaf's path that haven't already been marked by a previous leaf.
+    nodes.clear();
+    for (const auto& b : batch) {
+      if (b.up_to != up_to) {
+        continue;
+      }
+      auto& pending = b.leaf->pending_backup;
+      if (b.has_value) {
+        pending.N += 1;
+        pending.W += b.value;
+      }
+      pending.virtual_loss += b.virtual_loss;
+      pending.num_virtual_losses += 1;
+      for (auto* node = b.leaf; !node->HasFlag(Flag::kPendingBackup);
+           node = node->parent) {
+        node->SetFlag(Flag::kPendingBackup);
+        nodes.push_back(node);
+        if (node == up_to) {
+          break;
+        }
+      }
+    }
+
+    // Apply the updates from the deepest node up, adding each node's total
+    // update to its parent's.
+    std::sort(nodes.begin(), nodes.end(), [](MctsNode* a, MctsNode* b) {
+      return a->position.n() > b->position.n();
+    });
+    for (auto* node : nodes) {
+      auto& pending = node->pending_backup;
+      node->stats->N += pending.N;
+      node->stats->W += pending.W;
+      node->stats->virtual_loss -= pending.virtual_loss;
+      node->num_virtual_losses_applied -= pending.num_virtual_losses;
+      if (node != up_to) {
+        auto& parent_pending = node->parent->pending_backup;
+        parent_pending.N += pending.N;
+        parent_pending.W += pending.W;
+        parent_pending.virtual_loss += pending.virtual_loss;
+        parent_pending.num_virtual_losses += pending.num_virtual_losses;
+      }
+      pending = {};
+      node->ClearFlag(Flag::kPendingBackup);
+    }
+  }
+}
+
+void MctsNode::AddVirtualLoss(MctsNode* up_to, float loss) {
   auto* node = this;
   for (;;) {
     ++node->num_virtual_losses_applied;
-    node->stats->W += node->position.to_play() == Color::kBlack ? 1 : -1;
+    node->stats->virtual_loss += loss;
     if (node == up_to) {
       return;
     }
@@ -477,11 +797,11 @@ void MctsNode::AddVirtualLoss(MctsNode* up_to) {
   }
 }
 
-void MctsNode::RevertVirtualLoss(MctsNode* up_to) {
+void MctsNode::RevertVirtualLoss(MctsNode* up_to, float loss) {
   auto* node = this;
   for (;;) {
     --node->num_virtual_losses_applied;
-    node->stats->W -= node->position.to_play() == Color::kBlack ? 1 : -1;
+    node->stats->virtual_loss -= loss;
     if (node == up_to) {
       return;
     }
@@ -490,14 +810,18 @@ void MctsNode::RevertVirtualLoss(MctsNode* up_to) {
 }
 
 void MctsNode::PruneChildren(Coord c) {
+  auto old_bytes = ChildMapMemoryUsage();
   auto child = std::move(children[c]);
   children.clear();
   children[c] = std::move(child);
+  AccountChildMapResize(*this, old_bytes);
 }
 
 void MctsNode::ClearChildren() {
   // I _think_ this is all the state we need to clear...
+  auto old_bytes = ChildMapMemoryUsage();
   children.clear();
+  AccountChildMapResize(*this, old_bytes);
   edges = {};
   *stats = {};
   ClearFlag(Flag::kExpanded);
@@ -517,7 +841,9 @@ std::array<float, kNumMoves> MctsNode::CalculateChildActionScore() const {
 MctsNode* MctsNode::MaybeAddChild(Coord c) {
   auto it = children.find(c);
   if (it == children.end()) {
+    auto old_bytes = ChildMapMemoryUsage();
     it = children.emplace(c, absl::make_unique<MctsNode>(this, c)).first;
+    AccountChildMapResize(*this, old_bytes);
   }
   return it->second.get();
 }
@@ -531,6 +857,7 @@ MctsNode::TreeStats MctsNode::CalculateTreeStats() const {
     stats.num_leaf_nodes += node.N() <= 1;
     stats.max_depth = std::max(depth, stats.max_depth);
     stats.depth_sum += depth;
+    stats.num_bytes += node.MemoryUsage();
 
     for (const auto& child : node.children) {
       traverse(*child.second.get(), depth + 1);
@@ -542,13 +869,95 @@ MctsNode::TreeStats MctsNode::CalculateTreeStats() const {
   return stats;
 }
 
+size_t MctsNode::MemoryUsage() const {
+  return sizeof(*this) + ChildMapMemoryUsage() + SuperkoCacheMemoryUsage();
+}
+
+size_t MctsNode::ChildMapMemoryUsage() const {
+  // Abseil's hash containers store one control byte per slot in addition to
+  // the slot itself.
+  return children.capacity() * (sizeof(decltype(children)::value_type) + 1);
+}
+
+size_t MctsNode::SuperkoCacheMemoryUsage() const {
+  if (superko_cache == nullptr) {
+    return 0;
+  }
+  return sizeof(SuperkoCache) +
+         superko_cache->capacity() * (sizeof(zobrist::Hash) + 1);
+}
+
+void MctsNode::SerializeTree(std::string* out) const {
+  TreeWriter writer(out);
+  writer.WriteBytes(absl::string_view(kTreeMagic, 4));
+  writer.WriteUint(kTreeVersion, 4);
+  writer.WriteUint(kN, 4);
+  writer.WriteUint(position.stone_hash(), sizeof(zobrist::Hash));
+  writer.WriteUint(position.n(), 4);
+  writer.WriteUint(position.to_play() == Color::kBlack ? 0 : 1, 1);
+  writer.WriteFloat(N());
+  writer.WriteFloat(W());
+  writer.WriteNode(*this);
+}
+
+bool MctsNode::DeserializeTree(absl::string_view data, float min_N) {
+  MG_CHECK(num_virtual_losses_applied == 0);
+
+  // Unlike ClearChildren, this keeps the prior of the edge leading to this
+  // node.
+  auto clear = [this]() {
+    auto old_bytes = ChildMapMemoryUsage();
+    children.clear();
+    AccountChildMapResize(*this, old_bytes);
+    edges = {};
+    stats->N = 0;
+    stats->W = 0;
+    ClearFlag(Flag::kExpanded);
+  };
+  clear();
+
+  TreeReader reader(data, min_N);
+  absl::string_view magic;
+  uint32_t version, board_size;
+  zobrist::Hash stone_hash;
+  int n, to_play;
+  if (!reader.ReadBytes(4, &magic) || !reader.ReadUint(4, &version) ||
+      !reader.ReadUint(4, &board_size) ||
+      !reader.ReadUint(sizeof(stone_hash), &stone_hash) ||
+      !reader.ReadUint(4, &n) || !reader.ReadUint(1, &to_play)) {
+    MG_LOG(ERROR) << "truncated tree snapshot";
+    return false;
+  }
+  if (magic != absl::string_view(kTreeMagic, 4) || version != kTreeVersion) {
+    MG_LOG(ERROR) << "not a tree snapshot, or unsupported version";
+    return false;
+  }
+  if (board_size != kN || stone_hash != position.stone_hash() ||
+      n != position.n() ||
+      to_play != (position.to_play() == Color::kBlack ? 0 : 1)) {
+    MG_LOG(ERROR) << "tree snapshot is for a different position";
+    return false;
+  }
+
+  EdgeStats root_stats;
+  if (!reader.ReadFloat(&root_stats.N) || !reader.ReadFloat(&root_stats.W) ||
+      !reader.ReadNode(this) || !reader.done()) {
+    MG_LOG(ERROR) << "corrupt tree snapshot";
+    clear();
+    return false;
+  }
+  stats->N = root_stats.N;
+  stats->W = root_stats.W;
+  return true;
+}
+
 std::string MctsNode::TreeStats::ToString() const {
   return absl::StrFormat(
       "%d nodes, %d leaf, %.1f average children\n"
-      "%.1f average depth, %d max depth\n",
+      "%.1f average depth, %d max depth, %.1f MB\n",
       num_nodes, num_leaf_nodes,
       1.0f * num_nodes / std::max(1, num_nodes - num_leaf_nodes),
-      1.0f * depth_sum / num_nodes, max_depth);
+      1.0f * depth_sum / num_nodes, max_depth, num_bytes / (1024.0 * 1024.0));
 }
 
 }  // namespace minigo
@@ -17,6 +17,7 @@
 
 #include <array>
 #include <cmath>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
@@ -25,6 +26,7 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/string_view.h"
 #include "absl/types/span.h"
 #include "cc/constants.h"
 #include "cc/inline_vector.h"
@@ -42,6 +44,9 @@ class MctsNode {
     int max_depth = 0;
     int depth_sum = 0;
 
+    // Approximate memory used by the tree, see MemoryUsage.
+    int64_t num_bytes = 0;
+
     std::string ToString() const;
   };
 
@@ -50,6 +55,27 @@ class MctsNode {
     float W = 0;
     float P = 0;
     float original_P = 0;
+
+    // Total weight of the virtual losses applied to the edge. Virtual losses
+    // are tracked separately from W so that they only affect the action score
+    // and reverting them doesn't require W to be written again.
+    float virtual_loss = 0;
+  };
+
+  // The result of a single leaf in a batch of leaves backed up by
+  // BackupBatch.
+  struct BatchedBackup {
+    MctsNode* leaf;
+    MctsNode* up_to;
+
+    // If false, only the virtual loss is reverted. This is the case for
+    // leaves that were selected more than once: the value is only backed up
+    // for the first.
+    bool has_value;
+    float value;
+
+    // The weight of the virtual loss that was applied to the leaf.
+    float virtual_loss;
   };
 
   // Information about a child. Returned by CalculateRankedChildInfo.
@@ -70,6 +96,12 @@ class MctsNode {
   // Constructor for child nodes.
   MctsNode(MctsNode* parent, Coord move);
 
+  ~MctsNode();
+
+  // Unlike the default move assignment, keeps the memory accounting of both
+  // nodes up to date.
+  MctsNode& operator=(MctsNode&& other);
+
   float N() const { return stats->N; }
   float W() const { return stats->W; }
   float P() const { return stats->P; }
@@ -105,6 +137,9 @@ class MctsNode {
 
     // Node has a valid canonical symmetry.
     kHasCanonicalSymmetry = (1 << 1),
+
+    // Node has updates pending in a call to BackupBatch.
+    kPendingBackup = (1 << 2),
   };
 
   void SetFlag(Flag flag) { flags |= static_cast<uint8_t>(flag); }
@@ -117,6 +152,14 @@ class MctsNode {
   // action score.
   Coord GetMostVisitedMove(bool restrict_in_bensons = false) const;
 
+  // Finds the two children with the largest visit counts, N. Ties are broken
+  // in favor of the child with the lower index.
+  void GetTopTwoChildren(Coord* first, Coord* second) const;
+
+  // Returns true if the most visited child could be caught up by another
+  // child after `num_readouts` more readouts.
+  bool CanMostVisitedMoveChange(int num_readouts) const;
+
   std::string Describe() const;
   std::string MostVisitedPathString() const;
   std::vector<Coord> MostVisitedPath() const;
@@ -132,19 +175,38 @@ class MctsNode {
   // If inference is being batched and SelectLeaf chooses a node that has
   // already been added to the batch (IncorporateResults has not yet been
   // called), then SelectLeaf will return that same node.
-  MctsNode* SelectLeaf();
+  // Moves in `excluded_moves` are treated as illegal at every node visited
+  // during selection. The caller must ensure that kPass isn't excluded.
+  MctsNode* SelectLeaf(absl::Span<const Coord> excluded_moves = {});
 
+  // Expands the node and backs up the value as far as `up_to`. Does nothing if
+  // the node is already expanded.
   void IncorporateResults(float value_init_penalty,
                           absl::Span<const float> move_probabilities,
                           float value, MctsNode* up_to);
 
+  // Expands the node without backing up the value. Returns false if the node
+  // was already expanded.
+  bool Expand(float value_init_penalty,
+              absl::Span<const float> move_probabilities, float value);
+
+  // Backs up the values of a batch of leaves and reverts their virtual
+  // losses. This is equivalent to calling BackupValue (for the leaves that
+  // have a value) and RevertVirtualLoss on each leaf in turn, except that the
+  // updates are accumulated per node so that the stats of each node on the
+  // leaves' paths are only written once, no matter how many of the leaves
+  // share it.
+  static void BackupBatch(absl::Span<const BatchedBackup> batch);
+
   void IncorporateEndGameResult(float value, MctsNode* up_to);
 
   void BackupValue(float value, MctsNode* up_to);
 
-  void AddVirtualLoss(MctsNode* up_to);
+  // Adds a virtual loss of weight `loss` to this node and all its ancestors up
+  // to `up_to`. RevertVirtualLoss must be called with the same weight.
+  void AddVirtualLoss(MctsNode* up_to, float loss = 1);
 
-  void RevertVirtualLoss(MctsNode* up_to);
+  void RevertVirtualLoss(MctsNode* up_to, float loss = 1);
 
   // Remove all children from the node except c.
   void PruneChildren(Coord c);
@@ -159,9 +221,10 @@ class MctsNode {
 
   float CalculateSingleMoveChildActionScore(float to_play, float U_common,
                                             int i) const {
-    float Q = child_Q(i);
+    // Virtual losses count as losses for the player to play.
+    float Q = (child_W(i) * to_play - edges[i].virtual_loss) / (1 + child_N(i));
     float U = U_common * child_P(i) / (1 + child_N(i));
-    return Q * to_play + U - 1000.0f * !position.legal_move(i);
+    return Q + U - 1000.0f * !position.legal_move(i);
   }
 
   MctsNode* MaybeAddChild(Coord c);
@@ -169,6 +232,29 @@ class MctsNode {
   // Calculate and print statistics about the tree.
   TreeStats CalculateTreeStats() const;
 
+  // Returns the approximate number of bytes used by this node, not including
+  // its children.
+  size_t MemoryUsage() const;
+
+  // Returns the part of MemoryUsage that's used by the children map.
+  size_t ChildMapMemoryUsage() const;
+
+  // Returns the part of MemoryUsage that's used by the superko cache.
+  size_t SuperkoCacheMemoryUsage() const;
+
+  // Appends a compact binary snapshot of the subtree rooted at this node to
+  // `out`. Only the search state is written: the moves, edge stats, flags and
+  // canonical symmetry of each node. Positions are rebuilt on load by
+  // replaying the moves. Must not be called during a search.
+  void SerializeTree(std::string* out) const;
+
+  // Replaces the subtree rooted at this node with a snapshot written by
+  // SerializeTree from a node with the same position. Children whose visit
+  // count is less than `min_N` are not created, though their edge stats are
+  // still restored. Returns false if `data` is corrupt or was written for a
+  // different position, in which case the node is left cleared.
+  bool DeserializeTree(absl::string_view data, float min_N = 0);
+
   // Parent node.
   MctsNode* parent;
 
@@ -201,6 +287,15 @@ class MctsNode {
   // Number of virtual losses on this node.
   int num_virtual_losses_applied = 0;
 
+  // Updates accumulated by BackupBatch for this node.
+  struct PendingBackup {
+    float N = 0;
+    float W = 0;
+    float virtual_loss = 0;
+    int num_virtual_losses = 0;
+  };
+  PendingBackup pending_backup;
+
   // Each position contains a Zobrist hash of its stones, which can be used for
   // superko detection. In order to accelerate superko detection, caches of all
   // ancestor positions are added at regular depths in the search tree. This
@@ -16,8 +16,11 @@
 
 #include <array>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include "absl/memory/memory.h"
+#include "cc/memory_accounting.h"
 #include "cc/position.h"
 #include "cc/random.h"
 #include "cc/test_utils.h"
@@ -322,6 +325,51 @@ TEST(MctsNodeTest, AddChildIdempotency) {
   EXPECT_EQ(1, root.children.size());
 }
 
+TEST(MctsNodeTest, MemoryAccounting) {
+  auto initial_bytes = memory::GetBytes(memory::Category::kTree);
+  {
+    MctsNode::EdgeStats root_stats;
+    TestablePosition board("");
+    MctsNode root(&root_stats, board);
+    auto root_bytes = memory::GetBytes(memory::Category::kTree);
+    EXPECT_LT(initial_bytes, root_bytes);
+
+    root.MaybeAddChild(Coord::FromGtp("B9"));
+    root.MaybeAddChild(Coord::FromGtp("C9"));
+    auto children_bytes = memory::GetBytes(memory::Category::kTree);
+    EXPECT_LT(root_bytes, children_bytes);
+
+    // Clearing the children keeps the child map's buckets around, so we can
+    // only check that the children themselves are no longer accounted for.
+    root.ClearChildren();
+    EXPECT_GT(children_bytes, memory::GetBytes(memory::Category::kTree));
+
+    // Replacing a node by move assignment accounts for both nodes.
+    root.MaybeAddChild(Coord::FromGtp("B9"));
+    root = MctsNode(&root_stats, board);
+    EXPECT_EQ(root_bytes, memory::GetBytes(memory::Category::kTree));
+  }
+  EXPECT_EQ(initial_bytes, memory::GetBytes(memory::Category::kTree));
+}
+
+TEST(MctsNodeTest, MemoryAccountingAcrossThreads) {
+  auto initial_bytes = memory::GetBytes(memory::Category::kTree);
+
+  // Nodes are accounted in batches per thread: the bytes of a tree built on
+  // another thread are added to the totals when the thread exits.
+  MctsNode::EdgeStats root_stats;
+  std::unique_ptr<MctsNode> root;
+  std::thread thread([&]() {
+    root = absl::make_unique<MctsNode>(&root_stats, TestablePosition(""));
+    root->MaybeAddChild(Coord::FromGtp("B9"));
+  });
+  thread.join();
+  EXPECT_LT(initial_bytes, memory::GetBytes(memory::Category::kTree));
+
+  root.reset();
+  EXPECT_EQ(initial_bytes, memory::GetBytes(memory::Category::kTree));
+}
+
 TEST(MctsNodeTest, NeverSelectIllegalMoves) {
   std::array<float, kNumMoves> probs;
   for (float& prob : probs) {
@@ -383,6 +431,124 @@ TEST(MctsNodeTest, DontTraverseUnexpandedChild) {
   EXPECT_EQ(leaf1, leaf2);  // assert we didn't go below the first leaf.
 }
 
+// Verifies that BackupBatch updates the tree in the same way as backing up
+// each leaf and reverting its virtual loss in turn.
+TEST(MctsNodeTest, BackupBatch) {
+  std::array<float, kNumMoves> probs;
+  for (int i = 0; i < kNumMoves; ++i) {
+    probs[i] = 0.001f * (1 + i % 7);
+  }
+
+  // Build two identical trees: one is backed up leaf by leaf and the other is
+  // backed up by BackupBatch.
+  auto board = TestablePosition("", Color::kBlack);
+  MctsNode::EdgeStats stats_a, stats_b;
+  MctsNode root_a(&stats_a, board);
+  MctsNode root_b(&stats_b, board);
+  for (int i = 0; i < 20; ++i) {
+    float value = 0.1f * (i % 5);
+    root_a.SelectLeaf()->IncorporateResults(0.0, probs, value, &root_a);
+    root_b.SelectLeaf()->IncorporateResults(0.0, probs, value, &root_b);
+  }
+
+  // Select a batch of leaves, which may include duplicates.
+  std::vector<MctsNode::BatchedBackup> batch;
+  std::vector<MctsNode*> leaves_a;
+  for (int i = 0; i < 16; ++i) {
+    auto* leaf_a = root_a.SelectLeaf();
+    auto* leaf_b = root_b.SelectLeaf();
+    ASSERT_EQ(leaf_a->position.stone_hash(), leaf_b->position.stone_hash());
+    leaf_a->AddVirtualLoss(&root_a, 1.5);
+    leaf_b->AddVirtualLoss(&root_b, 1.5);
+    leaves_a.push_back(leaf_a);
+    batch.push_back({leaf_b, &root_b, false, 0.2f * (i % 3) - 0.2f, 1.5});
+  }
+  EXPECT_EQ(16, root_a.num_virtual_losses_applied);
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    auto& b = batch[i];
+    leaves_a[i]->IncorporateResults(0.0, probs, b.value, &root_a);
+    leaves_a[i]->RevertVirtualLoss(&root_a, 1.5);
+    b.has_value = b.leaf->Expand(0.0, probs, b.value);
+  }
+  MctsNode::BackupBatch(batch);
+
+  EXPECT_EQ(0, CountPendingVirtualLosses(&root_a));
+  EXPECT_EQ(0, CountPendingVirtualLosses(&root_b));
+  EXPECT_EQ(root_a.N(), root_b.N());
+  EXPECT_NEAR(root_a.W(), root_b.W(), 1e-5);
+  for (int i = 0; i < kNumMoves; ++i) {
+    EXPECT_EQ(root_a.child_N(i), root_b.child_N(i));
+    EXPECT_NEAR(root_a.child_W(i), root_b.child_W(i), 1e-5);
+    EXPECT_NEAR(0, root_b.edges[i].virtual_loss, 1e-5);
+  }
+}
+
+// Checks that the subtree rooted at `b` has the same search state as the one
+// rooted at `a`, ignoring the subtrees of `a` whose visit count is less than
+// `min_N`.
+void ExpectSameTree(const MctsNode& a, const MctsNode& b, float min_N) {
+  EXPECT_EQ(a.position.stone_hash(), b.position.stone_hash());
+  EXPECT_EQ(a.flags, b.flags);
+  EXPECT_EQ(a.canonical_symmetry, b.canonical_symmetry);
+  for (int i = 0; i < kNumMoves; ++i) {
+    EXPECT_EQ(a.child_N(i), b.child_N(i));
+    EXPECT_EQ(a.child_W(i), b.child_W(i));
+    EXPECT_EQ(a.child_P(i), b.child_P(i));
+    EXPECT_EQ(a.child_original_P(i), b.child_original_P(i));
+  }
+  int num_children = 0;
+  for (const auto& kv : a.children) {
+    if (kv.second->N() < min_N) {
+      continue;
+    }
+    num_children += 1;
+    auto it = b.children.find(kv.first);
+    ASSERT_NE(b.children.end(), it);
+    ExpectSameTree(*kv.second, *it->second, min_N);
+  }
+  EXPECT_EQ(num_children, b.children.size());
+}
+
+TEST(MctsNodeTest, SerializeTree) {
+  Random rnd(614944751, 0);
+  std::array<float, kNumMoves> probs;
+  rnd.Uniform(0, 1, &probs);
+
+  auto board = TestablePosition("", Color::kBlack);
+  MctsNode::EdgeStats stats_a;
+  MctsNode root_a(&stats_a, board);
+  for (int i = 0; i < 200; ++i) {
+    auto* leaf = root_a.SelectLeaf();
+    leaf->IncorporateResults(0.0, probs, 2 * rnd() - 1, &root_a);
+  }
+
+  std::string snapshot;
+  root_a.SerializeTree(&snapshot);
+
+  for (float min_N : {0.0f, 4.0f}) {
+    MctsNode::EdgeStats stats_b;
+    MctsNode root_b(&stats_b, board);
+    ASSERT_TRUE(root_b.DeserializeTree(snapshot, min_N));
+    EXPECT_EQ(root_a.N(), root_b.N());
+    EXPECT_EQ(root_a.W(), root_b.W());
+    ExpectSameTree(root_a, root_b, min_N);
+  }
+
+  // Snapshots can only be loaded at the position they were saved from, and
+  // corrupt snapshots leave the node cleared.
+  MctsNode::EdgeStats stats_c;
+  MctsNode root_c(&stats_c, TestablePosition("", Color::kWhite));
+  EXPECT_FALSE(root_c.DeserializeTree(snapshot));
+
+  MctsNode::EdgeStats stats_d;
+  MctsNode root_d(&stats_d, board);
+  EXPECT_FALSE(root_d.DeserializeTree(snapshot.substr(0, snapshot.size() / 2)));
+  EXPECT_EQ(0, root_d.N());
+  EXPECT_TRUE(root_d.children.empty());
+  EXPECT_FALSE(root_d.HasFlag(MctsNode::Flag::kExpanded));
+}
+
 // Verifies that action score is used as a tie-breaker to choose between moves
 // with the same visit count when selecting the best one.
 // This test uses raw indices here instead of GTP coords to make it clear that
@@ -419,6 +585,25 @@ TEST(MctsNodeTest, GetMostVisitedPath) {
   EXPECT_EQ(Coord(16), root.GetMostVisitedMove());
 }
 
+TEST(MctsNodeTest, CanMostVisitedMoveChange) {
+  MctsNode::EdgeStats root_stats;
+  auto board = TestablePosition("", Color::kBlack);
+  MctsNode root(&root_stats, board);
+  root.edges[3].N = 10;
+  root.edges[7].N = 40;
+  root.edges[Coord::kPass].N = 25;
+
+  Coord first, second;
+  root.GetTopTwoChildren(&first, &second);
+  EXPECT_EQ(Coord(7), first);
+  EXPECT_EQ(Coord::kPass, second);
+
+  // Pass needs 15 more readouts to draw level with the leader.
+  EXPECT_FALSE(root.CanMostVisitedMoveChange(0));
+  EXPECT_FALSE(root.CanMostVisitedMoveChange(14));
+  EXPECT_TRUE(root.CanMostVisitedMoveChange(15));
+}
+
 TEST(MctsNodeTest, GetMostVisitedBensonRestriction) {
   std::array<float, kNumMoves> probs;
   for (float& prob : probs) {
@@ -437,6 +622,39 @@ TEST(MctsNodeTest, GetMostVisitedBensonRestriction) {
   EXPECT_NE(root.GetMostVisitedMove(false), root.GetMostVisitedMove(true));
 }
 
+TEST(MctsNodeTest, SelectLeafExcludedMoves) {
+  std::array<float, kNumMoves> probs;
+  for (float& prob : probs) {
+    prob = 0.001;
+  }
+  probs[0] = 0.9;  // A9, a bensons point, has a much higher prior.
+  MctsNode::EdgeStats root_stats;
+  auto board = TestablePosition(kSomeBensonsBoard, Color::kBlack);
+  MctsNode root(&root_stats, board);
+
+  std::vector<Coord> excluded_moves;
+  auto pass_alive_regions = board.CalculatePassAliveRegions();
+  for (int i = 0; i < kN * kN; ++i) {
+    if (pass_alive_regions[i] != Color::kEmpty && board.stones()[i].empty()) {
+      excluded_moves.push_back(i);
+    }
+  }
+  ASSERT_FALSE(excluded_moves.empty());
+
+  for (int i = 0; i < 20; i++) {
+    root.SelectLeaf(excluded_moves)->IncorporateResults(0.0, probs, 0, &root);
+  }
+
+  // None of the excluded moves should have been visited, at any depth.
+  for (Coord c : excluded_moves) {
+    EXPECT_EQ(0, root.child_N(c));
+    for (const auto& kv : root.children) {
+      EXPECT_EQ(0, kv.second->child_N(c));
+    }
+  }
+  EXPECT_EQ(20, root.N());
+}
+
 // Pass is still a valid choice, with or without removing pass-alive areas.
 TEST(MctsNodeTest, BensonRestrictionStillPasses) {
   MctsNode::EdgeStats root_stats;
@@ -15,34 +15,82 @@
 #include "cc/mcts_player.h"
 
 #include <algorithm>
+#include <cmath>
 #include <cstdlib>
+#include <limits>
 #include <sstream>
 #include <utility>
 
+#include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_join.h"
 #include "absl/time/clock.h"
 #include "cc/logging.h"
+#include "cc/metrics.h"
 #include "cc/random.h"
 
 namespace minigo {
 
+namespace {
+
+// Collapses the children of `node` with at most `max_N` visits, apart from
+// the nodes in `keep`, until `bytes_to_free` bytes have been freed. Returns
+// the memory used by what remains of `node`'s subtree. Increments
+// `num_evicted` by the number of children collapsed and `num_remaining` by the
+// number of children that could still be collapsed with a larger `max_N`.
+int64_t EvictSubtrees(MctsNode* node, float max_N,
+                      const absl::flat_hash_set<const MctsNode*>& keep,
+                      int64_t* bytes_to_free, int* num_evicted,
+                      int* num_remaining) {
+  int64_t bytes = 0;
+  for (auto it = node->children.begin(); it != node->children.end();) {
+    auto* child = it->second.get();
+    bool kept = keep.contains(child);
+    if (!kept && child->N() <= max_N && *bytes_to_free > 0) {
+      *bytes_to_free -= child->CalculateTreeStats().num_bytes;
+      node->children.erase(it++);
+      *num_evicted += 1;
+      continue;
+    }
+    if (!kept) {
+      *num_remaining += 1;
+    }
+    bytes += EvictSubtrees(child, max_N, keep, bytes_to_free, num_evicted,
+                           num_remaining);
+    ++it;
+  }
+  return bytes + node->MemoryUsage();
+}
+
+}  // namespace
+
 std::ostream& operator<<(std::ostream& os, const MctsPlayer::Options& options) {
   os << " inject_noise:" << options.inject_noise
      << " soft_pick:" << options.soft_pick
      << " value_init_penalty:" << options.value_init_penalty
      << " policy_softmax_temp:" << options.policy_softmax_temp
      << " virtual_losses:" << options.virtual_losses
+     << " adaptive_virtual_losses:" << options.adaptive_virtual_losses
+     << " max_virtual_losses:" << options.max_virtual_losses
+     << " max_virtual_loss_weight:" << options.max_virtual_loss_weight
      << " num_readouts:" << options.num_readouts
      << " seconds_per_move:" << options.seconds_per_move
      << " time_limit:" << options.time_limit
      << " decay_factor:" << options.decay_factor
+     << " adaptive_time:" << options.adaptive_time
+     << " max_time_extension:" << options.max_time_extension
      << " fastplay_frequency:" << options.fastplay_frequency
      << " fastplay_readouts:" << options.fastplay_readouts
      << " target_pruning:" << options.target_pruning
      << " restrict_in_bensons:" << options.restrict_in_bensons
+     << " prune_readouts:" << options.prune_readouts
+     << " tree_memory_budget_mb:" << options.tree_memory_budget_mb
+     << " gumbel_root:" << options.gumbel_root
+     << " gumbel_num_considered:" << options.gumbel_num_considered
+     << " gumbel_c_visit:" << options.gumbel_c_visit
+     << " gumbel_c_scale:" << options.gumbel_c_scale
      << " random_seed:" << options.random_seed << std::flush;
   return os;
 }
@@ -96,6 +144,10 @@ void MctsPlayer::InitializeGame(const Position& position) {
   root_stats_ = {};
   game_root_ = MctsNode(&root_stats_, position);
   root_ = &game_root_;
+  time_bank_ = absl::ZeroDuration();
+  tree_bytes_ = 0;
+  num_leaves_since_tree_measured_ = 0;
+  last_search_used_gumbel_ = false;
   game_->NewGame();
 }
 
@@ -106,15 +158,26 @@ bool MctsPlayer::UndoMove() {
     return false;
   }
   root_ = root_->parent;
+  last_search_used_gumbel_ = false;
   game_->UndoMove();
   return true;
 }
 
 Coord MctsPlayer::SuggestMove(int new_readouts, bool inject_noise,
                               bool restrict_in_bensons) {
-  auto start = absl::Now();
+  auto start = Now();
+
+  // Gumbel root search is only used for searches limited by a fixed number of
+  // readouts, and replaces the Dirichlet noise.
+  bool gumbel = options_.gumbel_root && options_.seconds_per_move <= 0;
+  last_search_used_gumbel_ = gumbel;
 
-  if (inject_noise) {
+  PrepareSearch(restrict_in_bensons);
+  num_batches_ = 0;
+  num_batch_leaves_ = 0;
+  num_batch_duplicates_ = 0;
+
+  if (inject_noise && !gumbel) {
     InjectNoise(kDirichletAlpha);
   }
 
@@ -128,13 +191,72 @@ Coord MctsPlayer::SuggestMove(int new_readouts, bool inject_noise,
           TimeRecommendation(root_->position.n(), seconds_per_move,
                              options_.time_limit, options_.decay_factor);
     }
-    while (absl::Now() - start < absl::Seconds(seconds_per_move)) {
-      TreeSearch(options_.virtual_losses, target_readouts);
+    auto budget = absl::Seconds(seconds_per_move);
+    auto deadline = start + budget;
+    auto max_deadline = deadline;
+    if (options_.adaptive_time) {
+      auto max_extension = budget * (options_.max_time_extension - 1);
+      max_deadline += std::max(absl::ZeroDuration(),
+                               std::min(max_extension, time_bank_));
     }
+
+    // The root is always expanded so that there's at least a prior to pick a
+    // move from.
+    MaybeExpandRoot();
+    int start_N = root_->N();
+
+    // Stop searching as soon as the next batch of inferences isn't expected
+    // to complete before the deadline. Any batch that is still queued when the
+    // deadline passes is cancelled.
+    for (;;) {
+      auto now = Now();
+      if (now + inference_latency_ >= deadline) {
+        if (deadline < max_deadline && TopMovesAreClose()) {
+          deadline = max_deadline;
+          continue;
+        }
+        break;
+      }
+
+      if (options_.adaptive_time && root_->N() > start_N) {
+        // Project how many more readouts we have time for at the current
+        // rate, and stop if they can't change the outcome.
+        double rate =
+            (root_->N() - start_N) / absl::ToDoubleSeconds(now - start);
+        int remaining_readouts =
+            static_cast<int>(rate * absl::ToDoubleSeconds(deadline - now));
+        if (!root_->CanMostVisitedMoveChange(remaining_readouts)) {
+          break;
+        }
+      }
+
+      SelectLeaves(NumLeavesPerBatch(), target_readouts);
+      ProcessLeaves(deadline);
+    }
+    auto end = Now();
+    time_overshoots_.push_back(end - deadline);
+    if (options_.adaptive_time) {
+      time_bank_ += budget - (end - start);
+    }
+  } else if (gumbel) {
+    // The moves excluded by restrict_in_bensons are never considered, so the
+    // move chosen by the search can always be played.
+    Coord c = GumbelRootSearch(new_readouts);
+    if (ShouldResign()) {
+      return Coord::kResign;
+    }
+    return c;
   } else {
     // Use a fixed number of reads.
+    bool prune = options_.prune_readouts &&
+                 root_->position.n() >= temperature_cutoff_;
     while (root_->N() < target_readouts) {
-      TreeSearch(options_.virtual_losses, target_readouts);
+      if (prune &&
+          !root_->CanMostVisitedMoveChange(target_readouts - root_->N())) {
+        num_readouts_saved_ += target_readouts - root_->N();
+        break;
+      }
+      TreeSearch(NumLeavesPerBatch(), target_readouts);
     }
   }
   if (ShouldResign()) {
@@ -144,6 +266,33 @@ Coord MctsPlayer::SuggestMove(int new_readouts, bool inject_noise,
   return PickMove(restrict_in_bensons);
 }
 
+Coord MctsPlayer::SuggestMergedMove(
+    absl::Span<const MctsPlayer* const> others) {
+  // The merged visits aren't backed by any subtree below the root, so the
+  // root's statistics are restored once the move has been picked. Otherwise
+  // they would skew later searches of the reused tree.
+  auto edges = root_->edges;
+  auto stats = *root_->stats;
+  for (const auto* other : others) {
+    const auto* other_root = other->root();
+    MG_CHECK(other_root->position.stone_hash() == root_->position.stone_hash());
+    for (int i = 0; i < kNumMoves; ++i) {
+      root_->edges[i].N += other_root->child_N(i);
+      root_->edges[i].W += other_root->child_W(i);
+      root_->stats->N += other_root->child_N(i);
+      root_->stats->W += other_root->child_W(i);
+    }
+  }
+
+  Coord c = Coord::kResign;
+  if (!ShouldResign()) {
+    c = PickMove(restrict_search_in_bensons_);
+  }
+  root_->edges = edges;
+  *root_->stats = stats;
+  return c;
+}
+
 Coord MctsPlayer::PickMove(bool restrict_in_bensons) {
   if (root_->position.n() >= temperature_cutoff_) {
     auto c = root_->GetMostVisitedMove(restrict_in_bensons);
@@ -185,13 +334,306 @@ void MctsPlayer::TreeSearch(int num_leaves, int max_num_reads) {
   ProcessLeaves();
 }
 
+void MctsPlayer::PrepareSearch(bool restrict_in_bensons) {
+  EnforceTreeMemoryBudget();
+  UpdatePassAliveMoves(restrict_in_bensons);
+}
+
+void MctsPlayer::EnforceTreeMemoryBudget() {
+  if (options_.tree_memory_budget_mb <= 0) {
+    return;
+  }
+
+  // The tree is only measured once it may have exceeded the budget. Each leaf
+  // is charged twice the size of a node, which covers the growth of its
+  // parent's children map and superko cache.
+  int64_t budget = static_cast<int64_t>(options_.tree_memory_budget_mb) << 20;
+  int64_t max_bytes = tree_bytes_ + 2 * static_cast<int64_t>(sizeof(MctsNode)) *
+                                        num_leaves_since_tree_measured_;
+  if (max_bytes <= budget) {
+    return;
+  }
+  num_leaves_since_tree_measured_ = 0;
+  tree_bytes_ = game_root_.CalculateTreeStats().num_bytes;
+
+  // Shrink the tree to 3/4 of the budget, so that it has to grow by at least a
+  // quarter of the budget before it's measured again.
+  int64_t target_bytes = budget / 4 * 3;
+  if (tree_bytes_ <= target_bytes) {
+    return;
+  }
+
+  absl::flat_hash_set<const MctsNode*> keep;
+  for (const auto* node = root_; node != nullptr; node = node->parent) {
+    keep.insert(node);
+  }
+
+  // Collapse the least visited subtrees first, doubling the visit count
+  // threshold until the tree fits.
+  auto original_bytes = tree_bytes_;
+  int num_evicted = 0;
+  for (float max_N = 0; tree_bytes_ > target_bytes;
+       max_N = std::max(1.0f, 2 * max_N)) {
+    int num_remaining = 0;
+    int64_t bytes_to_free = tree_bytes_ - target_bytes;
+    tree_bytes_ = EvictSubtrees(&game_root_, max_N, keep, &bytes_to_free,
+                                &num_evicted, &num_remaining);
+    if (num_remaining == 0) {
+      break;
+    }
+  }
+  MG_LOG(INFO) << absl::StreamFormat(
+      "Collapsed %d subtrees to fit the tree memory budget: %.1fMB -> %.1fMB",
+      num_evicted, original_bytes / (1024.0 * 1024.0),
+      tree_bytes_ / (1024.0 * 1024.0));
+}
+
+bool MctsPlayer::LoadTree(absl::string_view snapshot, float min_N) {
+  bool ok = root_->DeserializeTree(snapshot, min_N);
+
+  // The loaded tree wasn't built by selecting leaves, so it must be measured
+  // to be accounted for by the tree memory budget.
+  if (options_.tree_memory_budget_mb > 0) {
+    tree_bytes_ = game_root_.CalculateTreeStats().num_bytes;
+    num_leaves_since_tree_measured_ = 0;
+    EnforceTreeMemoryBudget();
+  }
+  return ok;
+}
+
+void MctsPlayer::MultiRootTreeSearch(absl::Span<MctsNode* const> roots,
+                                     MctsNode* up_to, int num_leaves,
+                                     int max_num_reads) {
+  tree_search_inferences_.clear();
+  num_duplicate_leaves_ = 0;
+  for (auto* root : roots) {
+    SelectLeavesFrom(root, up_to, num_leaves, max_num_reads);
+  }
+  ProcessLeaves();
+}
+
 void MctsPlayer::InjectNoise(float dirichlet_alpha) {
   MaybeExpandRoot();
   std::array<float, kNumMoves> noise;
-  rnd_.Dirichlet(kDirichletAlpha, &noise);
+  rnd_.Dirichlet(dirichlet_alpha, &noise);
+  for (Coord c : GetExcludedMoves(root_)) {
+    noise[c] = 0;
+  }
   root_->InjectNoise(noise, options_.noise_mix);
 }
 
+Coord MctsPlayer::GumbelRootSearch(int num_readouts) {
+  MaybeExpandRoot();
+
+  // Sample the moves to consider without replacement from the prior using the
+  // Gumbel-top-k trick: take the top k moves by gumbel + logit.
+  std::array<float, kNumMoves> gumbel;
+  rnd_.Uniform(&gumbel);
+  std::array<bool, kNumMoves> excluded = {};
+  for (Coord c : GetExcludedMoves(root_)) {
+    excluded[c] = true;
+  }
+  std::array<float, kNumMoves> score;
+  std::vector<Coord> moves;
+  for (int i = 0; i < kNumMoves; ++i) {
+    if (!root_->position.legal_move(i) || excluded[i]) {
+      continue;
+    }
+    float u = std::min(std::max(gumbel[i], 1e-20f), 1 - 1e-7f);
+    score[i] = -std::log(-std::log(u)) +
+               std::log(std::max(root_->child_original_P(i), 1e-12f));
+    moves.push_back(i);
+  }
+  // Pass is always legal, so there's at least one move to consider.
+  MG_CHECK(!moves.empty());
+
+  auto by_score = [&score](Coord a, Coord b) { return score[a] > score[b]; };
+  int num_considered = std::min<int>(
+      std::max(options_.gumbel_num_considered, 1), moves.size());
+  std::partial_sort(moves.begin(), moves.begin() + num_considered, moves.end(),
+                    by_score);
+  moves.resize(num_considered);
+
+  if (moves.size() == 1) {
+    SearchRootChildren(moves, num_readouts);
+    return moves[0];
+  }
+
+  // Sequential halving: split the readouts evenly between the remaining moves
+  // in each phase, then discard the worse half of the moves.
+  int num_phases = static_cast<int>(std::ceil(std::log2(moves.size())));
+  while (moves.size() > 1) {
+    int num_visits =
+        std::max<int>(1, num_readouts / (num_phases * moves.size()));
+    SearchRootChildren(moves, num_visits);
+
+    float sigma_scale = GumbelSigmaScale();
+    std::vector<std::pair<float, Coord>> ranked;
+    ranked.reserve(moves.size());
+    for (Coord c : moves) {
+      ranked.emplace_back(score[c] + sigma_scale * NormalizedChildQ(c), c);
+    }
+    std::sort(ranked.begin(), ranked.end(),
+              [](const std::pair<float, Coord>& a,
+                 const std::pair<float, Coord>& b) {
+                return a.first > b.first;
+              });
+    moves.resize((moves.size() + 1) / 2);
+    for (size_t i = 0; i < moves.size(); ++i) {
+      moves[i] = ranked[i].second;
+    }
+  }
+  return moves[0];
+}
+
+void MctsPlayer::SearchRootChildren(const std::vector<Coord>& moves,
+                                    int num_visits) {
+  std::vector<std::pair<MctsNode*, int>> targets;
+  targets.reserve(moves.size());
+  for (Coord c : moves) {
+    auto* child = root_->MaybeAddChild(c);
+    targets.emplace_back(child, child->N() + num_visits);
+  }
+
+  // Select leaves below all the children that still need visits in a single
+  // batch.
+  for (;;) {
+    tree_search_inferences_.clear();
+    num_duplicate_leaves_ = 0;
+    bool done = true;
+    for (const auto& target : targets) {
+      auto* child = target.first;
+      int remaining = target.second - child->N();
+      if (remaining <= 0) {
+        continue;
+      }
+      done = false;
+      SelectLeavesFrom(child, root_,
+                       std::min(remaining, NumLeavesPerBatch()),
+                       target.second);
+    }
+    if (done) {
+      break;
+    }
+    ProcessLeaves();
+  }
+}
+
+float MctsPlayer::NormalizedChildQ(Coord c) const {
+  float to_play = root_->position.to_play() == Color::kBlack ? 1 : -1;
+  float N = root_->child_N(c);
+  float q = N > 0 ? root_->child_W(c) / N : 0;
+  return (to_play * q + 1) / 2;
+}
+
+float MctsPlayer::GumbelSigmaScale() const {
+  float max_N = 0;
+  for (int i = 0; i < kNumMoves; ++i) {
+    max_N = std::max(max_N, root_->child_N(i));
+  }
+  return (options_.gumbel_c_visit + max_N) * options_.gumbel_c_scale;
+}
+
+void MctsPlayer::CalculateGumbelPolicy(
+    std::array<float, kNumMoves>* pi) const {
+  // The network's raw value isn't stored separately, so use the root's Q as
+  // the value estimate for the mixed value.
+  float to_play = root_->position.to_play() == Color::kBlack ? 1 : -1;
+  float value = (to_play * root_->Q() + 1) / 2;
+
+  // The policy only covers the moves the search could have chosen.
+  std::array<bool, kNumMoves> considered;
+  for (int i = 0; i < kNumMoves; ++i) {
+    considered[i] = root_->position.legal_move(i);
+  }
+  for (Coord c : GetExcludedMoves(root_)) {
+    considered[c] = false;
+  }
+
+  // Calculate the mixed value estimate used as the completed Q of unvisited
+  // moves: an interpolation between the value estimate and the prior-weighted
+  // Q of the visited moves.
+  float sum_N = 0;
+  float sum_visited_P = 0;
+  float sum_visited_PQ = 0;
+  for (int i = 0; i < kNumMoves; ++i) {
+    if (!considered[i]) {
+      continue;
+    }
+    float P = root_->child_original_P(i);
+    if (root_->child_N(i) > 0) {
+      sum_N += root_->child_N(i);
+      sum_visited_P += P;
+      sum_visited_PQ += P * NormalizedChildQ(i);
+    }
+  }
+  float mixed_value = value;
+  if (sum_visited_P > 0) {
+    mixed_value =
+        (value + sum_N * sum_visited_PQ / sum_visited_P) / (1 + sum_N);
+  }
+
+  // pi = softmax(logit + sigma(completed Q)) over the legal moves.
+  float sigma_scale = GumbelSigmaScale();
+  float max_logit = -std::numeric_limits<float>::infinity();
+  for (int i = 0; i < kNumMoves; ++i) {
+    if (!considered[i]) {
+      continue;
+    }
+    float q = root_->child_N(i) > 0 ? NormalizedChildQ(i) : mixed_value;
+    (*pi)[i] = std::log(std::max(root_->child_original_P(i), 1e-12f)) +
+               sigma_scale * q;
+    max_logit = std::max(max_logit, (*pi)[i]);
+  }
+  float sum = 0;
+  for (int i = 0; i < kNumMoves; ++i) {
+    if (!considered[i]) {
+      (*pi)[i] = 0;
+      continue;
+    }
+    (*pi)[i] = std::exp((*pi)[i] - max_logit);
+    sum += (*pi)[i];
+  }
+  for (int i = 0; i < kNumMoves; ++i) {
+    (*pi)[i] /= sum;
+  }
+}
+
+void MctsPlayer::UpdatePassAliveMoves(bool restrict_in_bensons) {
+  restrict_search_in_bensons_ = restrict_in_bensons;
+  if (!restrict_in_bensons) {
+    return;
+  }
+
+  const auto& position = root_->position;
+  if (has_pass_alive_moves_ &&
+      pass_alive_stone_hash_ == position.stone_hash()) {
+    return;
+  }
+
+  has_pass_alive_moves_ = true;
+  pass_alive_stone_hash_ = position.stone_hash();
+  pass_alive_moves_.clear();
+  auto pass_alive_regions = position.CalculatePassAliveRegions();
+  for (int i = 0; i < kN * kN; ++i) {
+    if (pass_alive_regions[i] != Color::kEmpty &&
+        position.stones()[i].empty()) {
+      pass_alive_moves_.push_back(i);
+    }
+  }
+}
+
+absl::Span<const Coord> MctsPlayer::GetExcludedMoves(
+    const MctsNode* start) const {
+  // The pass-alive moves are only valid for searches that start from the
+  // root they were calculated for.
+  if (!restrict_search_in_bensons_ || start != root_ ||
+      pass_alive_stone_hash_ != root_->position.stone_hash()) {
+    return {};
+  }
+  return pass_alive_moves_;
+}
+
 void MctsPlayer::MaybeExpandRoot() {
   if (!root_->HasFlag(MctsNode::Flag::kExpanded)) {
     SelectLeaves(1, root_->N() + 1);
@@ -201,18 +643,34 @@ void MctsPlayer::MaybeExpandRoot() {
 
 void MctsPlayer::SelectLeaves(int num_leaves, int max_num_reads) {
   tree_search_inferences_.clear();
+  num_duplicate_leaves_ = 0;
+  SelectLeavesFrom(root_, root_, num_leaves, max_num_reads);
+}
+
+void MctsPlayer::SelectLeavesFrom(MctsNode* start, MctsNode* up_to,
+                                  int num_leaves, int max_num_reads) {
+  static auto* select_hist = metrics::GetHistogram(
+      "mcts_select_leaves_us", "Time taken to select each batch of leaves.");
+  static auto* num_readouts_counter = metrics::GetCounter(
+      "mcts_readouts_total", "Number of leaves selected by tree search.");
+  metrics::ScopedTimer timer(select_hist);
+
   ModelOutput cached_output;
+  int num_readouts = 0;
 
   int max_cache_misses = num_leaves * 2;
   int num_selected = 0;
   int num_cache_misses = 0;
-  while (num_cache_misses < max_cache_misses && root_->N() < max_num_reads) {
-    auto* leaf = root_->SelectLeaf();
+  auto excluded_moves = GetExcludedMoves(start);
+  while (num_cache_misses < max_cache_misses && start->N() < max_num_reads) {
+    auto* leaf = start->SelectLeaf(excluded_moves);
+    num_leaves_since_tree_measured_ += 1;
+    num_readouts += 1;
 
     if (leaf->game_over() || leaf->at_move_limit()) {
       float value =
           leaf->position.CalculateScore(game_->options().komi) > 0 ? 1 : -1;
-      leaf->IncorporateEndGameResult(value, root_);
+      leaf->IncorporateEndGameResult(value, up_to);
       ++num_cache_misses;
       continue;
     }
@@ -230,7 +688,7 @@ void MctsPlayer::SelectLeaves(int num_leaves, int max_num_reads) {
                                    &cached_output)) {
         leaf->IncorporateResults(options_.value_init_penalty,
                                  cached_output.policy, cached_output.value,
-                                 root_);
+                                 up_to);
         continue;
       }
     }
@@ -238,7 +696,7 @@ void MctsPlayer::SelectLeaves(int num_leaves, int max_num_reads) {
     ++num_cache_misses;
 
     tree_search_inferences_.emplace_back(cache_key, canonical_sym,
-                                         inference_sym, leaf);
+                                         inference_sym, up_to, leaf);
 
     auto& input = tree_search_inferences_.back().input;
     input.sym = inference_sym;
@@ -253,16 +711,22 @@ void MctsPlayer::SelectLeaves(int num_leaves, int max_num_reads) {
       }
     }
 
-    leaf->AddVirtualLoss(root_);
+    if (leaf->num_virtual_losses_applied > 0) {
+      // The leaf is already waiting for inference.
+      num_duplicate_leaves_ += 1;
+    }
+    leaf->AddVirtualLoss(up_to, virtual_loss_weight_);
     if (++num_selected == num_leaves) {
       // We found enough leaves.
       break;
     }
-    if (leaf == root_) {
-      // If the root is a leaf, we can't possibly find any other leaves.
+    if (leaf == start) {
+      // If the start node is a leaf, we can't possibly find any other
+      // leaves.
       break;
     }
   }
+  num_readouts_counter->Increment(num_readouts);
 }
 
 bool MctsPlayer::ShouldResign() const {
@@ -274,6 +738,76 @@ void MctsPlayer::SetTreeSearchCallback(TreeSearchCallback cb) {
   tree_search_cb_ = std::move(cb);
 }
 
+bool MctsPlayer::TopMovesAreClose() const {
+  // The search is considered unsettled if the runner-up has nearly as many
+  // visits as the leader, or if the leader's value has dropped below the
+  // runner-up's.
+  constexpr float kCloseVisitRatio = 0.75f;
+
+  Coord first = Coord::kInvalid;
+  Coord second = Coord::kInvalid;
+  root_->GetTopTwoChildren(&first, &second);
+  if (root_->child_N(second) == 0) {
+    return false;
+  }
+  if (root_->child_N(second) >= kCloseVisitRatio * root_->child_N(first)) {
+    return true;
+  }
+  float to_play = root_->position.to_play() == Color::kBlack ? 1 : -1;
+  return to_play * root_->child_Q(second) > to_play * root_->child_Q(first);
+}
+
+std::string MctsPlayer::GetTimeOvershootStats() const {
+  if (time_overshoots_.empty()) {
+    return "no timed searches";
+  }
+  auto sorted = time_overshoots_;
+  std::sort(sorted.begin(), sorted.end());
+  auto percentile = [&sorted](double p) {
+    auto idx = std::min(sorted.size() - 1,
+                        static_cast<size_t>(p * sorted.size()));
+    return absl::ToDoubleMilliseconds(sorted[idx]);
+  };
+  return absl::StrFormat(
+      "n=%d p50=%.1fms p90=%.1fms p99=%.1fms max=%.1fms cancelled=%d",
+      sorted.size(), percentile(0.5), percentile(0.9), percentile(0.99),
+      absl::ToDoubleMilliseconds(sorted.back()), num_cancelled_batches_);
+}
+
+std::string MctsPlayer::GetVirtualLossStats() const {
+  if (num_batches_ == 0) {
+    return "no batches";
+  }
+  return absl::StrFormat(
+      "batches=%d leaves/batch=%.1f duplicates=%.1f%% leaves=%d weight=%.2f",
+      num_batches_, static_cast<float>(num_batch_leaves_) / num_batches_,
+      100.0f * num_batch_duplicates_ / std::max(1, num_batch_leaves_),
+      NumLeavesPerBatch(), virtual_loss_weight_);
+}
+
+void MctsPlayer::AdaptVirtualLosses(int num_leaves, int num_duplicates) {
+  constexpr float kMaxDuplicateFraction = 0.125f;
+  constexpr float kMinDuplicateFraction = 0.05f;
+
+  int n = NumLeavesPerBatch();
+  float duplicate_fraction = static_cast<float>(num_duplicates) / num_leaves;
+  if (duplicate_fraction > kMaxDuplicateFraction) {
+    if (virtual_loss_weight_ < options_.max_virtual_loss_weight) {
+      virtual_loss_weight_ = std::min(options_.max_virtual_loss_weight,
+                                      1.5f * virtual_loss_weight_);
+    } else {
+      n = std::max(1, n / 2);
+    }
+  } else if (duplicate_fraction <= kMinDuplicateFraction) {
+    if (virtual_loss_weight_ > 1) {
+      virtual_loss_weight_ = std::max(1.0f, virtual_loss_weight_ / 1.5f);
+    } else {
+      n = std::min(options_.max_virtual_losses, n + std::max(1, n / 8));
+    }
+  }
+  num_leaves_per_batch_ = n;
+}
+
 std::string MctsPlayer::GetModelsUsedForInference() const {
   std::vector<std::string> parts;
   parts.reserve(inferences_.size());
@@ -309,12 +843,14 @@ bool MctsPlayer::PlayMove(Coord c, bool is_trainable) {
     return false;
   }
 
-  // Adjust the visits before adding the move's search_pi to the Game.
-  if (is_trainable && options_.target_pruning) {
+  // Adjust the visits before adding the move's search_pi to the Game. Gumbel
+  // root search doesn't use the visit counts as its training target.
+  if (is_trainable && options_.target_pruning && !last_search_used_gumbel_) {
     root_->ReshapeFinalVisits(options_.restrict_in_bensons);
   }
 
   UpdateGame(c);
+  last_search_used_gumbel_ = false;
 
   if (is_trainable && c != Coord::kResign) {
     game_->MarkLastMoveAsTrainable();
@@ -357,26 +893,33 @@ void MctsPlayer::UpdateGame(Coord c) {
         absl::StrCat("models:", absl::StrJoin(models, ","), "\n", comment);
   }
 
-  // Convert child visit counts to a probability distribution, pi.
   std::array<float, kNumMoves> search_pi;
-  if (root_->position.n() < temperature_cutoff_) {
-    // Squash counts before normalizing to match softpick behavior in PickMove.
+  if (last_search_used_gumbel_) {
+    // Gumbel root search uses the improved policy as its training target.
+    CalculateGumbelPolicy(&search_pi);
+  } else {
+    // Convert child visit counts to a probability distribution, pi.
+    if (root_->position.n() < temperature_cutoff_) {
+      // Squash counts before normalizing to match softpick behavior in
+      // PickMove.
+      for (int i = 0; i < kNumMoves; ++i) {
+        search_pi[i] =
+            std::pow(root_->child_N(i), options_.policy_softmax_temp);
+      }
+    } else {
+      for (int i = 0; i < kNumMoves; ++i) {
+        search_pi[i] = root_->child_N(i);
+      }
+    }
+    // Normalize counts.
+    float sum = 0;
     for (int i = 0; i < kNumMoves; ++i) {
-      search_pi[i] = std::pow(root_->child_N(i), options_.policy_softmax_temp);
+      sum += search_pi[i];
     }
-  } else {
     for (int i = 0; i < kNumMoves; ++i) {
-      search_pi[i] = root_->child_N(i);
+      search_pi[i] /= sum;
     }
   }
-  // Normalize counts.
-  float sum = 0;
-  for (int i = 0; i < kNumMoves; ++i) {
-    sum += search_pi[i];
-  }
-  for (int i = 0; i < kNumMoves; ++i) {
-    search_pi[i] /= sum;
-  }
 
   // Update the game history.
   game_->AddMove(root_->position.to_play(), c, root_->position,
@@ -384,7 +927,15 @@ void MctsPlayer::UpdateGame(Coord c) {
 }
 
 // TODO(tommadams): move this up to below SelectLeaves.
-void MctsPlayer::ProcessLeaves() {
+void MctsPlayer::ProcessLeaves(absl::Time deadline) {
+  static auto* inference_hist = metrics::GetHistogram(
+      "mcts_inference_us",
+      "Latency of each batch of inferences made by tree search, including "
+      "time spent waiting for the batch to fill up.");
+  static auto* backup_hist = metrics::GetHistogram(
+      "mcts_backup_us",
+      "Time taken to expand each batch of leaves and back up their values.");
+
   if (tree_search_inferences_.empty()) {
     return;
   }
@@ -397,7 +948,35 @@ void MctsPlayer::ProcessLeaves() {
   }
 
   // Run inference.
-  model_->RunMany(input_ptrs_, &output_ptrs_, &inference_model_);
+  auto inference_start = Now();
+  if (tree_mutex_ != nullptr) {
+    tree_mutex_->Unlock();
+  }
+  bool ran = model_->RunManyWithDeadline(input_ptrs_, &output_ptrs_,
+                                         &inference_model_, deadline);
+  if (tree_mutex_ != nullptr) {
+    tree_mutex_->Lock();
+  }
+  if (!ran) {
+    // The inference was cancelled because it didn't start before the
+    // deadline: discard the leaves.
+    for (auto& inference : tree_search_inferences_) {
+      inference.leaf->RevertVirtualLoss(inference.up_to, virtual_loss_weight_);
+    }
+    tree_search_inferences_.clear();
+    num_cancelled_batches_ += 1;
+    return;
+  }
+
+  // Track a moving average of the inference latency, including any time spent
+  // waiting for a batch to fill up.
+  auto latency = Now() - inference_start;
+  inference_hist->RecordDuration(latency);
+  if (inference_latency_ == absl::ZeroDuration()) {
+    inference_latency_ = latency;
+  } else {
+    inference_latency_ = 0.9 * inference_latency_ + 0.1 * latency;
+  }
 
   // Record some information about the inference.
   if (!inference_model_.empty()) {
@@ -409,6 +988,8 @@ void MctsPlayer::ProcessLeaves() {
   }
 
   // Incorporate the inference outputs back into tree search.
+  auto backup_start = absl::Now();
+  backups_.clear();
   for (auto& inference : tree_search_inferences_) {
     auto& output = inference.output;
 
@@ -419,11 +1000,22 @@ void MctsPlayer::ProcessLeaves() {
                               inference.inference_sym, &output);
     }
 
-    // Propagate the results back up the tree to the root.
     auto* leaf = inference.leaf;
-    leaf->IncorporateResults(options_.value_init_penalty, output.policy,
-                             output.value, root_);
-    leaf->RevertVirtualLoss(root_);
+    bool expanded = leaf->Expand(options_.value_init_penalty, output.policy,
+                                 output.value);
+    backups_.push_back({leaf, inference.up_to, expanded, output.value,
+                        virtual_loss_weight_});
+  }
+
+  // Propagate the results back up the tree to the root of the search.
+  MctsNode::BackupBatch(backups_);
+  backup_hist->RecordDuration(absl::Now() - backup_start);
+
+  num_batches_ += 1;
+  num_batch_leaves_ += tree_search_inferences_.size();
+  num_batch_duplicates_ += num_duplicate_leaves_;
+  if (options_.adaptive_virtual_losses) {
+    AdaptVirtualLosses(tree_search_inferences_.size(), num_duplicate_leaves_);
   }
 
   if (tree_search_cb_ != nullptr) {
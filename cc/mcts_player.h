@@ -23,7 +23,11 @@
 #include <vector>
 
 #include "absl/memory/memory.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "cc/algorithm.h"
 #include "cc/constants.h"
 #include "cc/game.h"
@@ -33,6 +37,7 @@
 #include "cc/position.h"
 #include "cc/random.h"
 #include "cc/symmetries.h"
+#include "cc/zobrist.h"
 
 namespace minigo {
 
@@ -58,6 +63,22 @@ class MctsPlayer {
 
     int virtual_losses = 8;
 
+    // If true, the number of leaves SuggestMove selects per batch and the
+    // weight of each virtual loss adapt to the search, starting from
+    // virtual_losses leaves and a weight of 1. After each batch:
+    //   - If many of the batch's leaves were duplicates (the same leaf
+    //     selected more than once), the search is too narrow for the batch
+    //     size. The virtual loss weight is increased to spread the leaves out
+    //     and once it reaches max_virtual_loss_weight, the number of leaves
+    //     per batch is halved instead.
+    //   - If almost none were, the weight decays back to 1. Once it's 1, the
+    //     search is wide enough to fill larger batches without much
+    //     redundancy and the number of leaves grows towards
+    //     max_virtual_losses.
+    bool adaptive_virtual_losses = false;
+    int max_virtual_losses = 64;
+    float max_virtual_loss_weight = 4;
+
     // Random seed & stream used for random permutations.
     uint64_t random_seed = Random::kUniqueSeed;
 
@@ -82,6 +103,16 @@ class MctsPlayer {
     // of time spent thinking as the game progresses.
     float decay_factor = 0.98;
 
+    // If true and seconds_per_move is non-zero, adapt the time spent on each
+    // move to how settled the search is: stop early once the most visited
+    // move can't be overtaken in the remaining time, and keep searching for
+    // up to max_time_extension times the recommended time while the top two
+    // moves are close. Extensions are paid for with time saved on earlier
+    // moves, so the total time spent in a game stays within the sum of the
+    // recommended times (and therefore within time_limit).
+    bool adaptive_time = false;
+    float max_time_extension = 2;
+
     // "Playout Cap Oscillation" as per the KataGo paper.
     // If fastplay_frequency > 0, tree search is modified as follows:
     //   - Each move is either a "low-readout" fast move, or a full, slow move.
@@ -108,6 +139,44 @@ class MctsPlayer {
     // passes have been played (by anyone).  It will also zero out any visits
     // the pass-alive points may have gotten.
     bool restrict_in_bensons = false;
+
+    // If true, searches limited by a fixed number of readouts stop as soon as
+    // the remaining readouts can't change the most visited move. This distorts
+    // the visit counts of the other moves, so it shouldn't be enabled for
+    // moves that are used as training targets. Moves before the temperature
+    // cutoff are never pruned because they are picked using the visit
+    // distribution.
+    bool prune_readouts = false;
+
+    // If non-zero, the approximate maximum amount of memory in MB that the
+    // search tree may use. See EnforceTreeMemoryBudget.
+    int tree_memory_budget_mb = 0;
+
+    // If true, searches limited by a fixed number of readouts use Gumbel root
+    // search with sequential halving instead of PUCT at the root, as per
+    // "Policy improvement by planning with Gumbel" (Danihelka et al. 2022):
+    //   - gumbel_num_considered moves are sampled without replacement from
+    //     the prior using the Gumbel-top-k trick. This replaces the Dirichlet
+    //     noise, so inject_noise is ignored.
+    //   - The readouts are split evenly between the sampled moves over
+    //     log2(gumbel_num_considered) rounds. After each round, the half of
+    //     the moves with the highest gumbel + logit + sigma(Q) are kept.
+    //   - The moves excluded by SuggestMove's restrict_in_bensons are never
+    //     sampled and have zero probability in the training target.
+    //   - The move played is the last remaining move and the search_pi
+    //     training target is the improved policy softmax(logit +
+    //     sigma(completed Q)), where unvisited moves use the mixed value
+    //     estimate of the root.
+    // Below the root, leaves are selected by PUCT as usual. This gives a
+    // useful training target from far fewer readouts than PUCT with noise.
+    bool gumbel_root = false;
+    int gumbel_num_considered = 16;
+
+    // Parameters of the monotonic transform sigma(q) = (gumbel_c_visit +
+    // max_N) * gumbel_c_scale * q applied to Q values normalized to [0, 1].
+    float gumbel_c_visit = 50;
+    float gumbel_c_scale = 1.0;
+
     friend std::ostream& operator<<(std::ostream& ios, const Options& options);
   };
 
@@ -128,8 +197,20 @@ class MctsPlayer {
 
   void NewGame();
 
+  // Searches for the best move to play. If `restrict_in_bensons` is true,
+  // neither the search nor the move picked play in the root's pass-alive
+  // regions.
   Coord SuggestMove(int new_readouts, bool inject_noise = false,
                     bool restrict_in_bensons = false);
+
+  // Picks a move as SuggestMove does, but from the sum of this player's root
+  // child statistics and those of `others`, which must have searched the same
+  // position. Resigns if the merged value is below the resign threshold, and
+  // uses the restrict_in_bensons passed to the last call to SuggestMove. The
+  // root's statistics are left unchanged. Used to combine the results of root
+  // parallel searches.
+  Coord SuggestMergedMove(absl::Span<const MctsPlayer* const> others);
+
   // Plays the move at point c.
   // If game is non-null, adds a new move to the game's move history and sets
   // the game over state if appropriate.
@@ -143,12 +224,32 @@ class MctsPlayer {
 
   void SetTreeSearchCallback(TreeSearchCallback cb);
 
+  // If set, the caller must hold `mutex` exclusively while calling any of the
+  // player's methods. Tree search releases the mutex while it waits for each
+  // batch of inferences, which don't modify the tree, so that other threads
+  // can take a reader lock to inspect the tree without slowing down the
+  // search.
+  void SetTreeMutex(absl::Mutex* mutex) { tree_mutex_ = mutex; }
+
   void ClearChildren() { root_->ClearChildren(); }
 
   // Returns a string containing the list of all models used for inference, and
   // which moves they were used for.
   std::string GetModelsUsedForInference() const;
 
+  // Returns a summary of how far searches limited by seconds_per_move overran
+  // their deadline (negative values mean the search finished early), and how
+  // many batches were cancelled because they didn't start before the deadline.
+  std::string GetTimeOvershootStats() const;
+
+  // Returns a summary of the batches run by the last call to SuggestMove: the
+  // number of leaves per batch, the fraction of duplicate leaves and the
+  // current adaptive virtual loss state.
+  std::string GetVirtualLossStats() const;
+
+  // Total number of readouts skipped because of options_.prune_readouts.
+  int num_readouts_saved() const { return num_readouts_saved_; }
+
   // Returns the root of the current search tree, i.e. the current board state.
   // TODO(tommadams): Remove mutable access to the root once MiniguiGtpPlayer
   // no longer calls SelectLeaves directly.
@@ -164,10 +265,51 @@ class MctsPlayer {
 
   void TreeSearch(int num_leaves, int max_num_reads);
 
+  // Inject noise into the root node.
+  void InjectNoise(float dirichlet_alpha);
+
+  // Performs the upkeep that SuggestMove does before each search: enforces the
+  // tree memory budget and updates the moves that the search is restricted
+  // from playing. Must be called before searching each move with TreeSearch
+  // directly, for example by root parallel helpers.
+  void PrepareSearch(bool restrict_in_bensons = false);
+
+  // If the tree may have grown larger than options_.tree_memory_budget_mb,
+  // collapses the least visited subtrees back into the edge statistics of
+  // their parents until the tree uses at most 3/4 of the budget. The N, W
+  // and P of a collapsed child are kept, and its subtree is rebuilt if the
+  // search visits the child again. The root and its ancestors are never
+  // collapsed.
+  // Invalidates all pointers to nodes that aren't the root or its ancestors,
+  // so it must only be called between searches.
+  void EnforceTreeMemoryBudget();
+
+  // Replaces the search tree below the root with a snapshot written by
+  // MctsNode::SerializeTree, skipping subtrees with fewer than `min_N` visits.
+  // Returns false if the snapshot is corrupt or wasn't written for the root's
+  // position, in which case the root is left unexpanded.
+  // Invalidates all pointers to nodes below the root.
+  bool LoadTree(absl::string_view snapshot, float min_N);
+
+  // Performs a single batch of tree search from each of the given nodes, which
+  // must all be part of this player's tree. Up to `num_leaves` leaves are
+  // selected under each node (stopping once the node has `max_num_reads`) and
+  // inference is run on all of them in a single RunMany call.
+  // The results of every search are propagated back up as far as `up_to`,
+  // which must be one of the nodes or a common ancestor of them all. This
+  // keeps each node's N equal to the total number of reads made under it,
+  // including the reads made by searches that started from its descendants.
+  void MultiRootTreeSearch(absl::Span<MctsNode* const> roots, MctsNode* up_to,
+                           int num_leaves, int max_num_reads);
+
   // Protected methods that get exposed for testing.
  protected:
   Coord PickMove(bool restrict_in_bensons = false);
 
+  // Returns the current time. Timed searches measure their budget and the
+  // inference latency with Now, so tests can override it with a fake clock.
+  virtual absl::Time Now() const { return absl::Now(); }
+
  private:
   // State that tracks which model is used for each inference.
   struct InferenceInfo {
@@ -216,8 +358,48 @@ class MctsPlayer {
     }
   }
 
-  // Inject noise into the root node.
-  void InjectNoise(float dirichlet_alpha);
+  // Returns true if the two most visited children of the root are close
+  // enough that the search should be extended if time allows.
+  bool TopMovesAreClose() const;
+
+  // Updates the moves that searches from the root are restricted from
+  // playing. If `restrict_in_bensons` is true, these are the empty points in
+  // the root position's Benson's pass-alive regions, otherwise there are none.
+  void UpdatePassAliveMoves(bool restrict_in_bensons);
+
+  // Returns the moves that a search starting from `start` should never select
+  // as the first move.
+  absl::Span<const Coord> GetExcludedMoves(const MctsNode* start) const;
+
+  // Performs a Gumbel root search of `num_readouts` readouts and returns the
+  // move to play. See Options::gumbel_root for details.
+  Coord GumbelRootSearch(int num_readouts);
+
+  // Searches each child `moves` of the root until it has been visited
+  // `num_visits` more times.
+  void SearchRootChildren(const std::vector<Coord>& moves, int num_visits);
+
+  // Returns the Q of the root's child `c` from the perspective of the player
+  // to play at the root, normalized to [0, 1].
+  float NormalizedChildQ(Coord c) const;
+
+  // Returns the scale of the monotonic transform sigma(q) applied to
+  // normalized Q values by Gumbel root search.
+  float GumbelSigmaScale() const;
+
+  // Calculates the Gumbel improved policy at the root.
+  void CalculateGumbelPolicy(std::array<float, kNumMoves>* pi) const;
+
+  // Returns the number of leaves SuggestMove should select per batch.
+  int NumLeavesPerBatch() const {
+    return num_leaves_per_batch_ > 0 ? num_leaves_per_batch_
+                                     : options_.virtual_losses;
+  }
+
+  // Adapts the number of leaves per batch and the virtual loss weight to a
+  // batch of `num_leaves` leaves, `num_duplicates` of which were duplicates.
+  // See Options::adaptive_virtual_losses.
+  void AdaptVirtualLosses(int num_leaves, int num_duplicates);
 
   // Expand the root node if necessary.
   // In order to correctly count the number of reads performed or to inject
@@ -238,10 +420,21 @@ class MctsPlayer {
   // choose the same leaf multiple times.
   void SelectLeaves(int num_inferences, int max_num_reads);
 
+  // Like SelectLeaves but searches from `start` instead of root_ and appends
+  // the selected leaves to `tree_search_inferences_`. The results of the
+  // search are propagated back up the tree as far as `up_to`, which must be
+  // `start` or one of its ancestors. The search stops once `start` has
+  // `max_num_reads`. Moves are only excluded from the search if `start` is
+  // the root.
+  void SelectLeavesFrom(MctsNode* start, MctsNode* up_to, int num_inferences,
+                        int max_num_reads);
+
   // Run inference on the contents of `inferences_` that was previously
   // populated by a call to SelectLeaves, and propagate the results back up the
   // tree to the root.
-  void ProcessLeaves();
+  // If the inference hasn't started by `deadline`, it is cancelled and the
+  // selected leaves are discarded.
+  void ProcessLeaves(absl::Time deadline = absl::InfiniteFuture());
 
   void UpdateGame(Coord c);
 
@@ -272,24 +465,81 @@ class MctsPlayer {
   struct TreeSearchInference {
     TreeSearchInference(InferenceCache::Key cache_key,
                         symmetry::Symmetry canonical_sym,
-                        symmetry::Symmetry inference_sym, MctsNode* leaf)
+                        symmetry::Symmetry inference_sym, MctsNode* up_to,
+                        MctsNode* leaf)
         : cache_key(cache_key),
           canonical_sym(canonical_sym),
           inference_sym(inference_sym),
+          up_to(up_to),
           leaf(leaf) {}
     InferenceCache::Key cache_key;
     symmetry::Symmetry canonical_sym;
     symmetry::Symmetry inference_sym;
+    // The node up to which the inference results are propagated.
+    MctsNode* up_to;
     MctsNode* leaf;
     ModelInput input;
     ModelOutput output;
   };
 
   std::vector<TreeSearchInference> tree_search_inferences_;
+  std::vector<MctsNode::BatchedBackup> backups_;
   std::vector<const ModelInput*> input_ptrs_;
   std::vector<ModelOutput*> output_ptrs_;
 
   TreeSearchCallback tree_search_cb_ = nullptr;
+  absl::Mutex* tree_mutex_ = nullptr;
+
+  // Moving average of the time taken for a call to RunMany, used to predict
+  // whether another batch of inferences can complete before a deadline.
+  absl::Duration inference_latency_;
+
+  // For each search limited by seconds_per_move, the time by which the search
+  // overran its deadline.
+  std::vector<absl::Duration> time_overshoots_;
+  int num_cancelled_batches_ = 0;
+
+  // If options_.adaptive_time is true, the recommended time not spent on
+  // earlier moves in the game, which may be spent extending later searches.
+  absl::Duration time_bank_;
+
+  int num_readouts_saved_ = 0;
+
+  // Adaptive virtual loss state, see Options::adaptive_virtual_losses. If
+  // num_leaves_per_batch_ is 0, options_.virtual_losses is used.
+  int num_leaves_per_batch_ = 0;
+  float virtual_loss_weight_ = 1;
+
+  // Number of leaves in tree_search_inferences_ that were selected more than
+  // once.
+  int num_duplicate_leaves_ = 0;
+
+  // Memory used by the tree the last time it was measured by
+  // EnforceTreeMemoryBudget, and the number of leaves selected since then.
+  // Each leaf selection adds at most one node to the tree.
+  int64_t tree_bytes_ = 0;
+  int num_leaves_since_tree_measured_ = 0;
+
+  // True if the root's current search statistics come from a Gumbel root
+  // search, in which case the training target for the move played is the
+  // improved policy instead of the visit counts. Reset when a move is played.
+  bool last_search_used_gumbel_ = false;
+
+  // Stats about the batches run by the current call to SuggestMove.
+  int num_batches_ = 0;
+  int num_batch_leaves_ = 0;
+  int num_batch_duplicates_ = 0;
+
+  // Empty points in the pass-alive regions of the root position, excluded from
+  // the search when SuggestMove is called with restrict_in_bensons. Neither
+  // player gains anything from playing in a pass-alive region, so the regions
+  // stay pass-alive throughout a search that excludes them. Pass-alive regions
+  // only depend on the stones on the board, so they're only recalculated when
+  // the root's stone hash changes.
+  bool restrict_search_in_bensons_ = false;
+  bool has_pass_alive_moves_ = false;
+  zobrist::Hash pass_alive_stone_hash_ = 0;
+  std::vector<Coord> pass_alive_moves_;
 
   // Random number combined with each Position's Zobrist hash in order to
   // deterministically choose the symmetry to apply when performing inference.
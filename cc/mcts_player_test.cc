@@ -14,16 +14,20 @@
 
 #include "cc/mcts_player.h"
 
+#include <cmath>
 #include <limits>
 #include <memory>
 #include <string>
 #include <utility>
 
 #include "absl/memory/memory.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
 #include "cc/algorithm.h"
 #include "cc/color.h"
 #include "cc/constants.h"
 #include "cc/dual_net/fake_dual_net.h"
+#include "cc/model/model.h"
 #include "cc/position.h"
 #include "cc/test_utils.h"
 #include "gtest/gtest.h"
@@ -85,6 +89,13 @@ class TestablePlayer : public MctsPlayer {
   using MctsPlayer::TreeSearch;
   using MctsPlayer::UndoMove;
 
+  // Makes the player read the time from `now` instead of the system clock.
+  void set_clock(const absl::Time* now) { now_ = now; }
+
+  absl::Time Now() const override {
+    return now_ != nullptr ? *now_ : MctsPlayer::Now();
+  }
+
   ModelOutput Run(const ModelInput& input) {
     ModelOutput output;
     std::vector<const ModelInput*> inputs = {&input};
@@ -92,6 +103,9 @@ class TestablePlayer : public MctsPlayer {
     model()->RunMany(inputs, &outputs, nullptr);
     return output;
   }
+
+ private:
+  const absl::Time* now_ = nullptr;
 };
 
 class MctsPlayerTest : public ::testing::Test {
@@ -166,6 +180,121 @@ TEST_F(MctsPlayerTest, TimeRecommendation) {
   EXPECT_GT(0.0001, TimeRecommendation(1000, 5, 100, 0.98));
 }
 
+// A model whose policy strongly prefers a single move when the root is at an
+// even move number and is uniform otherwise, so that a search from an even
+// position quickly settles and a search from an odd position doesn't.
+// Each batch of inferences advances the fake clock `now` by `latency`, so
+// that timed searches are deterministic.
+class AlternatingModel : public Model {
+ public:
+  AlternatingModel(absl::Time* now, absl::Duration latency)
+      : Model("alternating", FeatureDescriptor::Create<AgzFeatures>(), 1),
+        now_(now),
+        latency_(latency) {}
+
+  void RunMany(const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs,
+               std::string* model_name) override {
+    *now_ += latency_;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      // The first position in the history is the current one: the search
+      // root or one of its descendants.
+      const auto* position = inputs[i]->position_history[0];
+      auto* output = (*outputs)[i];
+      if (position->n() % 2 == 0) {
+        output->policy.fill(0.01f / kNumMoves);
+        output->policy[Coord(4, 4)] += 0.99f;
+      } else {
+        output->policy.fill(1.0f / kNumMoves);
+      }
+      output->value = 0;
+    }
+    if (model_name != nullptr) {
+      *model_name = "alternating";
+    }
+  }
+
+ private:
+  absl::Time* now_;
+  absl::Duration latency_;
+};
+
+// Plays with an AlternatingModel on a fake clock.
+class AdaptiveTimeTest : public MctsPlayerTest {
+ protected:
+  void CreatePlayer(const MctsPlayer::Options& options) {
+    player_ = absl::make_unique<TestablePlayer>(
+        absl::make_unique<AlternatingModel>(&now_, kLatency), game_.get(),
+        options);
+    player_->set_clock(&now_);
+  }
+
+  // Returns how long the player takes to suggest a move on the fake clock.
+  // The number of readouts is large enough that the search is only limited by
+  // time.
+  absl::Duration TimeSuggestMove() {
+    auto start = now_;
+    player_->SuggestMove(1 << 30);
+    return now_ - start;
+  }
+
+  static constexpr absl::Duration kLatency = absl::Milliseconds(1);
+  absl::Time now_ = absl::UnixEpoch();
+  std::unique_ptr<TestablePlayer> player_;
+};
+
+constexpr absl::Duration AdaptiveTimeTest::kLatency;
+
+TEST_F(AdaptiveTimeTest, ExtendsCloseSearches) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.inject_noise = false;
+  options.seconds_per_move = 0.1;
+  options.adaptive_time = true;
+  options.max_time_extension = 2;
+  auto budget = absl::Seconds(options.seconds_per_move);
+  CreatePlayer(options);
+
+  // From an even position, the leader is safe long before the deadline.
+  auto settled_time = TimeSuggestMove();
+  EXPECT_LT(settled_time, 0.8 * budget);
+  ASSERT_TRUE(player_->PlayMove(Coord(4, 4)));
+
+  // From an odd position, the top moves stay close and the search is extended
+  // using the time saved on the first move, but no further.
+  auto unsettled_time = TimeSuggestMove();
+  EXPECT_GT(unsettled_time, budget + 0.5 * (budget - settled_time));
+  EXPECT_LE(unsettled_time, 2 * budget - settled_time);
+}
+
+TEST_F(AdaptiveTimeTest, StaysWithinTimeLimit) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.inject_noise = false;
+  options.seconds_per_move = 0.1;
+  options.time_limit = 0.6;
+  options.decay_factor = 0.9;
+  options.adaptive_time = true;
+  options.max_time_extension = 4;
+  CreatePlayer(options);
+
+  // Alternate between moves that save time and moves that spend it: the time
+  // spent on the whole game never exceeds the sum of the recommended times,
+  // which is itself within the time limit.
+  constexpr int kNumMoves = 8;
+  auto total_time = absl::ZeroDuration();
+  auto total_recommended = absl::ZeroDuration();
+  for (int i = 0; i < kNumMoves; ++i) {
+    total_recommended += absl::Seconds(
+        TimeRecommendation(i, options.seconds_per_move, options.time_limit,
+                           options.decay_factor));
+    total_time += TimeSuggestMove();
+    EXPECT_LE(total_time, total_recommended) << i;
+    ASSERT_TRUE(player_->PlayMove(player_->root()->GetMostVisitedMove()));
+  }
+  EXPECT_LT(total_recommended, absl::Seconds(options.time_limit));
+}
+
 TEST_F(MctsPlayerTest, InjectNoise) {
   MctsPlayer::Options options;
   auto player = CreateBasicPlayer(options);
@@ -253,6 +382,36 @@ TEST_F(MctsPlayerTest, PickMoveSoft) {
   EXPECT_NEAR(100, count_3_0, 50);
 }
 
+// Verify that the search stops early when the remaining readouts can't change
+// the most visited move.
+TEST_F(MctsPlayerTest, PruneReadouts) {
+  std::array<float, kNumMoves> probs;
+  for (auto& p : probs) {
+    p = 0.0001;
+  }
+  probs[Coord(4, 4)] = 0.99;
+
+  for (bool prune_readouts : {false, true}) {
+    MctsPlayer::Options options;
+    options.random_seed = 17;
+    options.soft_pick = false;
+    options.inject_noise = false;
+    options.prune_readouts = prune_readouts;
+    TestablePlayer player(probs, 0, game_.get(), options);
+
+    auto move = player.SuggestMove(400);
+    EXPECT_EQ(Coord(4, 4), move);
+    if (prune_readouts) {
+      EXPECT_LT(player.root()->N(), 400);
+      EXPECT_GT(player.num_readouts_saved(), 0);
+      EXPECT_LE(400, player.root()->N() + player.num_readouts_saved());
+    } else {
+      EXPECT_LE(400, player.root()->N());
+      EXPECT_EQ(0, player.num_readouts_saved());
+    }
+  }
+}
+
 TEST_F(MctsPlayerTest, DontPassIfLosing) {
   auto player = CreateAlmostDonePlayer();
   auto* root = player->root();
@@ -517,6 +676,326 @@ TEST_F(MctsPlayerTest, UndoMove) {
   EXPECT_EQ(1, game_->num_moves());
 }
 
+TEST_F(MctsPlayerTest, MultiRootTreeSearch) {
+  auto player =
+      absl::make_unique<TestablePlayer>(game_.get(), MctsPlayer::Options());
+  ASSERT_TRUE(player->PlayMove(Coord::FromGtp("E5")));
+  ASSERT_TRUE(player->PlayMove(Coord::FromGtp("C3")));
+  auto* leaf = player->root();
+  auto* middle = leaf->parent;
+  auto* start = middle->parent;
+
+  // The results of all the searches are propagated up to `start`, so each
+  // node's N includes the reads made from its descendants.
+  std::vector<MctsNode*> roots = {middle, leaf};
+  for (int i = 0; i < 4; ++i) {
+    player->MultiRootTreeSearch(roots, start, 1, 100);
+  }
+  EXPECT_LE(4, leaf->N());
+  EXPECT_LE(leaf->N() + 4, middle->N());
+  EXPECT_EQ(middle->N(), start->N());
+  EXPECT_EQ(0, leaf->num_virtual_losses_applied);
+  EXPECT_EQ(0, start->num_virtual_losses_applied);
+
+  // MultiRootTreeSearch doesn't change the player's root.
+  EXPECT_EQ(leaf, player->root());
+}
+
+// Returns the percentage of duplicate leaves from the player's virtual loss
+// stats.
+float GetDuplicatePercentage(const TestablePlayer& player) {
+  const std::string key = "duplicates=";
+  auto stats = player.GetVirtualLossStats();
+  auto pos = stats.find(key);
+  if (pos == std::string::npos) {
+    return -1;
+  }
+  return std::stof(stats.substr(pos + key.size()));
+}
+
+TEST_F(MctsPlayerTest, SuggestMergedMove) {
+  Coord a = Coord::FromGtp("C3");
+  Coord b = Coord::FromGtp("G7");
+  std::array<float, kNumMoves> main_probs;
+  std::array<float, kNumMoves> helper_probs;
+  main_probs.fill(0.001);
+  helper_probs.fill(0.001);
+  main_probs[a] = 0.9;
+  helper_probs[b] = 0.9;
+
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.soft_pick = false;
+  Game::Options game_options;
+  game_options.resign_enabled = false;
+  game_ = absl::make_unique<Game>("b", "w", game_options);
+  Game helper_game("b", "w", game_options);
+  TestablePlayer player(main_probs, 0, game_.get(), options);
+  TestablePlayer helper(helper_probs, 0, &helper_game, options);
+
+  // On its own, the main search would play a.
+  EXPECT_EQ(a, player.SuggestMove(16));
+  while (helper.root()->N() < 64) {
+    helper.TreeSearch(1, 64);
+  }
+
+  // The move is picked from the sum of the searches' statistics.
+  auto edges = player.root()->edges;
+  float root_N = player.root()->N();
+  float root_W = player.root()->W();
+  EXPECT_EQ(b, player.SuggestMergedMove({&helper}));
+
+  // The root's statistics are left unchanged, so that they still match the
+  // tree below it.
+  for (int i = 0; i < kNumMoves; ++i) {
+    EXPECT_EQ(edges[i].N, player.root()->child_N(i)) << i;
+    EXPECT_EQ(edges[i].W, player.root()->child_W(i)) << i;
+  }
+  EXPECT_EQ(root_N, player.root()->N());
+  EXPECT_EQ(root_W, player.root()->W());
+  EXPECT_EQ(a, player.root()->GetMostVisitedMove());
+}
+
+TEST_F(MctsPlayerTest, SuggestMergedMoveResigns) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  Game::Options game_options;
+  game_options.resign_threshold = -0.5;
+  game_ = absl::make_unique<Game>("b", "w", game_options);
+  Game helper_game("b", "w", game_options);
+  std::array<float, kNumMoves> probs;
+  probs.fill(1.0 / kNumMoves);
+  TestablePlayer player(probs, 0, game_.get(), options);
+  TestablePlayer helper(probs, -0.9, &helper_game, options);
+
+  // The main search alone doesn't resign, but the merged value is below the
+  // resign threshold.
+  EXPECT_NE(Coord::kResign, player.SuggestMove(16));
+  while (helper.root()->N() < 64) {
+    helper.TreeSearch(1, 64);
+  }
+  EXPECT_EQ(Coord::kResign, player.SuggestMergedMove({&helper}));
+}
+
+TEST_F(MctsPlayerTest, AdaptiveVirtualLosses) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.inject_noise = false;
+  options.virtual_losses = 8;
+  options.max_virtual_losses = 32;
+
+  // A flat model makes the search wide, so the number of leaves per batch
+  // grows to the maximum.
+  std::array<float, kNumMoves> flat_probs;
+  for (auto& p : flat_probs) {
+    p = 1.0f / kNumMoves;
+  }
+  {
+    options.adaptive_virtual_losses = true;
+    TestablePlayer player(flat_probs, 0, game_.get(), options);
+    player.SuggestMove(400);
+    auto stats = player.GetVirtualLossStats();
+    EXPECT_NE(std::string::npos, stats.find("leaves=32 weight=1.00")) << stats;
+    EXPECT_EQ(0, CountPendingVirtualLosses(player.root()));
+  }
+
+  // A model that heavily favors a single move in every position makes the
+  // search narrow, so many of the leaves in each batch are duplicates. The
+  // adaptive search selects fewer of them.
+  std::array<float, kNumMoves> sharp_probs;
+  for (int i = 0; i < kNumMoves; ++i) {
+    sharp_probs[i] = std::pow(0.1f, i);
+  }
+  float duplicates[2];
+  for (bool adaptive : {false, true}) {
+    options.adaptive_virtual_losses = adaptive;
+    TestablePlayer player(sharp_probs, 0, game_.get(), options);
+    player.SuggestMove(400);
+    duplicates[adaptive] = GetDuplicatePercentage(player);
+    ASSERT_LE(0, duplicates[adaptive]);
+    EXPECT_EQ(0, CountPendingVirtualLosses(player.root()));
+  }
+  EXPECT_LT(duplicates[1], duplicates[0]);
+}
+
+// Searches restricted by Benson's pass-alive regions never visit them.
+TEST_F(MctsPlayerTest, RestrictSearchInBensons) {
+  auto board = TestablePosition(kAlmostDoneBoard, Color::kBlack);
+  auto pass_alive_regions = board.CalculatePassAliveRegions();
+  Coord pass_alive_move = Coord::kInvalid;
+  for (int i = 0; i < kN * kN; ++i) {
+    if (pass_alive_regions[i] != Color::kEmpty && board.legal_move(i)) {
+      pass_alive_move = i;
+      break;
+    }
+  }
+  ASSERT_NE(Coord::kInvalid, pass_alive_move);
+
+  std::array<float, kNumMoves> probs;
+  for (auto& p : probs) {
+    p = 0.001;
+  }
+  probs[pass_alive_move] = 0.9;
+
+  for (bool restrict_in_bensons : {false, true}) {
+    MctsPlayer::Options options;
+    options.random_seed = 17;
+    options.soft_pick = false;
+    TestablePlayer player(probs, 0, game_.get(), options);
+    player.InitializeGame(board);
+
+    player.SuggestMove(100, true, restrict_in_bensons);
+    if (restrict_in_bensons) {
+      EXPECT_EQ(0, player.root()->child_N(pass_alive_move));
+    } else {
+      EXPECT_LT(0, player.root()->child_N(pass_alive_move));
+    }
+  }
+}
+
+TEST_F(MctsPlayerTest, GumbelRoot) {
+  // The prior strongly favors E5, so no other move's Gumbel sample can
+  // plausibly outweigh it.
+  std::array<float, kNumMoves> probs;
+  for (auto& p : probs) {
+    p = 1e-6;
+  }
+  probs[Coord(4, 4)] = 0.9;
+
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.inject_noise = false;
+  options.gumbel_root = true;
+  options.gumbel_num_considered = 8;
+  TestablePlayer player(probs, 0, game_.get(), options);
+
+  // Sequential halving never spends more than the requested readouts, plus
+  // one to expand the root.
+  auto move = player.SuggestMove(64);
+  EXPECT_EQ(Coord(4, 4), move);
+  EXPECT_LE(player.root()->N(), 65);
+
+  // The considered moves are all visited.
+  int num_visited = 0;
+  for (int i = 0; i < kNumMoves; ++i) {
+    if (player.root()->child_N(i) > 0) {
+      num_visited += 1;
+    }
+  }
+  EXPECT_EQ(8, num_visited);
+
+  // The training target is the improved policy, which is a valid distribution
+  // over the legal moves.
+  ASSERT_TRUE(player.PlayMove(move, true));
+  const auto& search_pi = game_->GetMove(0)->search_pi;
+  float sum = 0;
+  for (int i = 0; i < kNumMoves; ++i) {
+    EXPECT_LE(0, search_pi[i]);
+    sum += search_pi[i];
+  }
+  EXPECT_NEAR(1, sum, 1e-4);
+  EXPECT_EQ(Coord(4, 4), ArgMax(search_pi));
+
+  // No virtual losses should be pending.
+  EXPECT_EQ(0, CountPendingVirtualLosses(player.root()->parent));
+}
+
+TEST_F(MctsPlayerTest, GumbelRootTimedSearch) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.soft_pick = false;
+  options.gumbel_root = true;
+  options.seconds_per_move = 0.05;
+  TestablePlayer player(game_.get(), options);
+
+  // Timed searches don't use Gumbel root search, so the training target is
+  // the visit counts.
+  player.SuggestMove(10000);
+  std::array<float, kNumMoves> child_N;
+  float sum_N = 0;
+  for (int i = 0; i < kNumMoves; ++i) {
+    child_N[i] = player.root()->child_N(i);
+    sum_N += child_N[i];
+  }
+  ASSERT_LT(0, sum_N);
+  ASSERT_TRUE(player.PlayMove(Coord::FromGtp("E5"), true));
+  const auto& search_pi = game_->GetMove(0)->search_pi;
+  for (int i = 0; i < kNumMoves; ++i) {
+    EXPECT_FLOAT_EQ(child_N[i] / sum_N, search_pi[i]) << i;
+  }
+}
+
+TEST_F(MctsPlayerTest, GumbelRootRestrictInBensons) {
+  auto board = TestablePosition(kAlmostDoneBoard, Color::kBlack);
+  auto pass_alive_regions = board.CalculatePassAliveRegions();
+  Coord pass_alive_move = Coord::kInvalid;
+  for (int i = 0; i < kN * kN; ++i) {
+    if (pass_alive_regions[i] != Color::kEmpty && board.legal_move(i)) {
+      pass_alive_move = i;
+      break;
+    }
+  }
+  ASSERT_NE(Coord::kInvalid, pass_alive_move);
+
+  std::array<float, kNumMoves> probs;
+  for (auto& p : probs) {
+    p = 1e-6;
+  }
+  probs[pass_alive_move] = 0.9;
+
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.gumbel_root = true;
+  options.gumbel_num_considered = 4;
+  TestablePlayer player(probs, 0, game_.get(), options);
+  player.InitializeGame(board);
+
+  // The pass-alive move is never considered, so the move chosen by the
+  // search is played.
+  auto move = player.SuggestMove(32, false, true);
+  EXPECT_NE(pass_alive_move, move);
+  EXPECT_LT(0, player.root()->child_N(move));
+  EXPECT_EQ(0, player.root()->child_N(pass_alive_move));
+
+  // The training target excludes the pass-alive move too.
+  ASSERT_TRUE(player.PlayMove(move, true));
+  const auto& search_pi = game_->GetMove(game_->num_moves() - 1)->search_pi;
+  EXPECT_EQ(0, search_pi[pass_alive_move]);
+  EXPECT_EQ(move, ArgMax(search_pi));
+}
+
+TEST_F(MctsPlayerTest, TreeMemoryBudget) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.tree_memory_budget_mb = 1;
+  int64_t budget = 1 << 20;
+  auto player = absl::make_unique<TestablePlayer>(game_.get(), options);
+  ASSERT_TRUE(player->PlayMove(Coord::FromGtp("E5")));
+  auto* root = player->root();
+  auto* parent = root->parent;
+
+  std::array<float, kNumMoves> child_N;
+  for (int i = 0; i < 200; ++i) {
+    player->TreeSearch(8, std::numeric_limits<int>::max());
+    for (int j = 0; j < kNumMoves; ++j) {
+      child_N[j] = root->child_N(j);
+    }
+    player->EnforceTreeMemoryBudget();
+
+    // Collapsing subtrees doesn't change the root or the edge statistics.
+    EXPECT_EQ(root, player->root());
+    EXPECT_EQ(parent, root->parent);
+    for (int j = 0; j < kNumMoves; ++j) {
+      EXPECT_EQ(child_N[j], root->child_N(j));
+    }
+    EXPECT_GE(budget, parent->CalculateTreeStats().num_bytes);
+  }
+  // The search performed enough readouts for the tree to exceed the budget
+  // several times over.
+  EXPECT_LE(200 * 8, root->N());
+  EXPECT_LT(2 * budget, root->N() * static_cast<int64_t>(sizeof(MctsNode)));
+}
+
 // Soft pick won't work correctly if none of the points on the board have been
 // visited (for example, if a model puts all its reads into pass). This is the
 // only case where soft pick should return kPass.
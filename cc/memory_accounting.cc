@@ -0,0 +1,122 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/memory_accounting.h"
+
+#include <array>
+#include <atomic>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "cc/metrics.h"
+
+namespace minigo {
+namespace memory {
+
+namespace {
+
+constexpr const char* kNames[kNumCategories] = {
+    "tree",           "superko_cache", "game_history",
+    "inference_cache", "model_buffers", "model_arena",
+};
+
+// Like metrics::Counter, the totals are sharded so that threads building
+// their own search trees don't contend.
+struct alignas(64) Shard {
+  std::array<std::atomic<int64_t>, kNumCategories> bytes{};
+};
+
+std::array<Shard, metrics::kNumShards>* GetShards() {
+  static auto* shards = []() {
+    auto* result = new std::array<Shard, metrics::kNumShards>();
+    metrics::Registry::Get()->AddCollector([](metrics::Registry* registry) {
+      for (int i = 0; i < kNumCategories; ++i) {
+        auto category = static_cast<Category>(i);
+        registry
+            ->GetGauge(absl::StrCat("memory_bytes{category=\"", kNames[i],
+                                    "\"}"),
+                       "Approximate bytes of memory used, by category.")
+            ->Set(GetBytes(category));
+      }
+    });
+    return result;
+  }();
+  return shards;
+}
+
+// Deltas passed to AddBatched that haven't been added to the shards yet.
+struct PendingBytes {
+  ~PendingBytes() { Flush(); }
+
+  void Flush() {
+    for (int i = 0; i < kNumCategories; ++i) {
+      if (bytes[i] != 0) {
+        internal::Add(static_cast<Category>(i), bytes[i]);
+        bytes[i] = 0;
+      }
+    }
+  }
+
+  std::array<int64_t, kNumCategories> bytes{};
+};
+
+thread_local PendingBytes pending_bytes;
+
+}  // namespace
+
+namespace internal {
+
+void Add(Category category, int64_t delta) {
+  auto& shard = (*GetShards())[metrics::internal::GetShardIndex()];
+  shard.bytes[static_cast<int>(category)].fetch_add(delta,
+                                                    std::memory_order_relaxed);
+}
+
+}  // namespace internal
+
+void AddBatched(Category category, int64_t delta) {
+  auto& bytes = pending_bytes.bytes[static_cast<int>(category)];
+  bytes += delta;
+  if (bytes >= kBatchBytes || bytes <= -kBatchBytes) {
+    internal::Add(category, bytes);
+    bytes = 0;
+  }
+}
+
+const char* GetName(Category category) {
+  return kNames[static_cast<int>(category)];
+}
+
+int64_t GetBytes(Category category) {
+  pending_bytes.Flush();
+  int64_t result = 0;
+  for (const auto& shard : *GetShards()) {
+    result += shard.bytes[static_cast<int>(category)].load(
+        std::memory_order_relaxed);
+  }
+  return result;
+}
+
+std::string FormatStats() {
+  std::string result;
+  for (int i = 0; i < kNumCategories; ++i) {
+    auto bytes = GetBytes(static_cast<Category>(i));
+    absl::StrAppendFormat(&result, "%s%s: %.1fMB", i == 0 ? "" : "  ",
+                          kNames[i], bytes / (1024.0 * 1024.0));
+  }
+  return result;
+}
+
+}  // namespace memory
+}  // namespace minigo
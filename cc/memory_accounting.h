@@ -0,0 +1,123 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_MEMORY_ACCOUNTING_H_
+#define CC_MEMORY_ACCOUNTING_H_
+
+#include <cstdint>
+#include <string>
+
+namespace minigo {
+namespace memory {
+
+// Approximate accounting of the memory used by each of Minigo's major
+// subsystems, to help track down where the memory goes when a process grows
+// larger than expected.
+//
+// Objects that own memory hold a TrackedBytes member for the category they
+// belong to, and keep it up to date as their memory use changes. Objects that
+// are created & destroyed at a high rate, like MctsNodes, instead report their
+// changes through AddBatched. The totals for each category are exported as
+// `memory_bytes{category="..."}` gauges by the metrics library, and can be
+// formatted with FormatStats.
+enum class Category {
+  // MctsNodes and their child maps, not including superko caches.
+  kTree,
+
+  // The superko caches stored at regular depths in the search trees.
+  kSuperkoCache,
+
+  // The moves, positions & search results stored by Game.
+  kGameHistory,
+
+  // Inference cache entries.
+  kInferenceCache,
+
+  // Input & output buffers used to run batches of inferences.
+  kModelBuffers,
+
+  // Memory arenas owned by inference engines, e.g. TensorFlow Lite's.
+  kModelArena,
+};
+
+constexpr int kNumCategories = 6;
+
+namespace internal {
+
+void Add(Category category, int64_t delta);
+
+}  // namespace internal
+
+// Adds `delta` bytes to the total for `category`. The caller is responsible
+// for removing the bytes again when the memory is freed.
+// To avoid an atomic update for every call, deltas are accumulated per thread
+// and only added to the shared totals once they reach kBatchBytes, when the
+// thread exits, or when the thread calls GetBytes. The totals can therefore
+// lag behind by up to kBatchBytes for each thread.
+constexpr int64_t kBatchBytes = 256 * 1024;
+void AddBatched(Category category, int64_t delta);
+
+// Returns the name of `category`, e.g. "tree".
+const char* GetName(Category category);
+
+// Returns the total number of bytes currently accounted to `category`,
+// including the calling thread's batched updates.
+int64_t GetBytes(Category category);
+
+// Returns the bytes used by each category in a single line, e.g.
+// "tree: 512.0MB  superko_cache: 3.1MB  ...".
+std::string FormatStats();
+
+// The number of bytes of memory that an object accounts to a category.
+// The bytes are removed from the category's total when the TrackedBytes is
+// destroyed. TrackedBytes is movable but not copyable.
+template <Category C>
+class TrackedBytes {
+ public:
+  TrackedBytes() = default;
+  ~TrackedBytes() { Set(0); }
+
+  // Moving a TrackedBytes transfers its bytes, leaving the category's total
+  // unchanged.
+  TrackedBytes(TrackedBytes&& other) : bytes_(other.bytes_) {
+    other.bytes_ = 0;
+  }
+  TrackedBytes& operator=(TrackedBytes&& other) {
+    if (this != &other) {
+      Set(0);
+      bytes_ = other.bytes_;
+      other.bytes_ = 0;
+    }
+    return *this;
+  }
+
+  void Set(int64_t bytes) {
+    if (bytes != bytes_) {
+      internal::Add(C, bytes - bytes_);
+      bytes_ = bytes;
+    }
+  }
+
+  void Add(int64_t delta) { Set(bytes_ + delta); }
+
+  int64_t bytes() const { return bytes_; }
+
+ private:
+  int64_t bytes_ = 0;
+};
+
+}  // namespace memory
+}  // namespace minigo
+
+#endif  // CC_MEMORY_ACCOUNTING_H_
@@ -0,0 +1,328 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "cc/file/utils.h"
+#include "cc/json.h"
+#include "cc/logging.h"
+
+namespace minigo {
+namespace metrics {
+
+namespace internal {
+
+int GetShardIndex() {
+  static std::atomic<int> next_index{0};
+  static thread_local int index =
+      next_index.fetch_add(1, std::memory_order_relaxed) % kNumShards;
+  return index;
+}
+
+}  // namespace internal
+
+namespace {
+
+// Splits a metric name like `foo{bar="baz"}` into its base name `foo` and
+// its labels `bar="baz"`.
+std::pair<absl::string_view, absl::string_view> SplitLabels(
+    absl::string_view name) {
+  auto pos = name.find('{');
+  if (pos == absl::string_view::npos) {
+    return {name, {}};
+  }
+  MG_CHECK(absl::EndsWith(name, "}")) << name;
+  return {name.substr(0, pos), name.substr(pos + 1, name.size() - pos - 2)};
+}
+
+// Returns `base` with `labels` and an optional `extra_label`.
+std::string WithLabels(absl::string_view base, absl::string_view labels,
+                       absl::string_view extra_label = {}) {
+  if (labels.empty() && extra_label.empty()) {
+    return std::string(base);
+  }
+  auto separator = !labels.empty() && !extra_label.empty() ? "," : "";
+  return absl::StrCat(base, "{", labels, separator, extra_label, "}");
+}
+
+constexpr double kPercentiles[] = {50, 90, 99};
+
+}  // namespace
+
+int64_t Counter::value() const {
+  int64_t result = 0;
+  for (const auto& shard : shards_) {
+    result += shard.value.load(std::memory_order_relaxed);
+  }
+  return result;
+}
+
+int Distribution::BucketIndex(int64_t value) {
+  value = std::max<int64_t>(0, std::min(value, kMaxValue));
+  if (value < kSubBuckets) {
+    return static_cast<int>(value);
+  }
+  int exponent = 63 - __builtin_clzll(value);
+  int shift = exponent - kSubBucketBits;
+  int sub_bucket = static_cast<int>(value >> shift) & (kSubBuckets - 1);
+  return kSubBuckets * (shift + 1) + sub_bucket;
+}
+
+int64_t Distribution::BucketLowerBound(int index) {
+  if (index < kSubBuckets) {
+    return index;
+  }
+  int shift = index / kSubBuckets - 1;
+  int sub_bucket = index % kSubBuckets;
+  return static_cast<int64_t>(kSubBuckets + sub_bucket) << shift;
+}
+
+int64_t Distribution::Percentile(double p) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  // The rank of the value we're looking for, in the range [1, count_].
+  auto rank =
+      std::max<int64_t>(1, static_cast<int64_t>(p / 100 * count_ + 0.5));
+  int64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      // Return the middle of the bucket.
+      auto lower = BucketLowerBound(i);
+      auto upper = i + 1 < kNumBuckets ? BucketLowerBound(i + 1) : lower + 1;
+      return lower + (upper - lower - 1) / 2;
+    }
+  }
+  return kMaxValue;
+}
+
+Distribution Histogram::GetSnapshot() const {
+  Distribution result;
+  for (const auto& shard : shards_) {
+    result.count_ += shard.count.load(std::memory_order_relaxed);
+    result.sum_ += shard.sum.load(std::memory_order_relaxed);
+    for (int i = 0; i < Distribution::kNumBuckets; ++i) {
+      result.buckets_[i] += shard.buckets[i].load(std::memory_order_relaxed);
+    }
+  }
+  return result;
+}
+
+Registry* Registry::Get() {
+  static auto* registry = new Registry();
+  return registry;
+}
+
+Registry::Metric* Registry::GetMetric(absl::string_view name,
+                                      absl::string_view help, Type type) {
+  auto it = metrics_.find(std::string(name));
+  if (it == metrics_.end()) {
+    it = metrics_.emplace(std::string(name), Metric()).first;
+    it->second.type = type;
+    it->second.help = std::string(help);
+  }
+  MG_CHECK(it->second.type == type)
+      << "metric " << name << " was registered with a different type";
+  return &it->second;
+}
+
+Counter* Registry::GetCounter(absl::string_view name, absl::string_view help) {
+  absl::MutexLock lock(&mutex_);
+  auto* metric = GetMetric(name, help, Type::kCounter);
+  if (metric->counter == nullptr) {
+    metric->counter = absl::make_unique<Counter>();
+  }
+  return metric->counter.get();
+}
+
+Gauge* Registry::GetGauge(absl::string_view name, absl::string_view help) {
+  absl::MutexLock lock(&mutex_);
+  auto* metric = GetMetric(name, help, Type::kGauge);
+  if (metric->gauge == nullptr) {
+    metric->gauge = absl::make_unique<Gauge>();
+  }
+  return metric->gauge.get();
+}
+
+Histogram* Registry::GetHistogram(absl::string_view name,
+                                  absl::string_view help) {
+  absl::MutexLock lock(&mutex_);
+  auto* metric = GetMetric(name, help, Type::kHistogram);
+  if (metric->histogram == nullptr) {
+    metric->histogram = absl::make_unique<Histogram>();
+  }
+  return metric->histogram.get();
+}
+
+void Registry::AddCollector(std::function<void(Registry*)> collector) {
+  absl::MutexLock lock(&mutex_);
+  collectors_.push_back(std::move(collector));
+}
+
+void Registry::RunCollectors() {
+  // Collectors update metrics through the registry, so they must be run
+  // without holding the lock.
+  std::vector<std::function<void(Registry*)>> collectors;
+  {
+    absl::MutexLock lock(&mutex_);
+    collectors = collectors_;
+  }
+  for (const auto& collector : collectors) {
+    collector(this);
+  }
+}
+
+std::string Registry::ExportPrometheus() {
+  RunCollectors();
+  absl::MutexLock lock(&mutex_);
+  std::string result;
+  absl::string_view prev_base;
+  for (const auto& kv : metrics_) {
+    const auto& metric = kv.second;
+    absl::string_view base, labels;
+    std::tie(base, labels) = SplitLabels(kv.first);
+
+    if (base != prev_base) {
+      const char* type = "counter";
+      if (metric.type == Type::kGauge) {
+        type = "gauge";
+      } else if (metric.type == Type::kHistogram) {
+        type = "summary";
+      }
+      absl::StrAppend(&result, "# HELP ", base, " ", metric.help, "\n",
+                      "# TYPE ", base, " ", type, "\n");
+      prev_base = base;
+    }
+
+    switch (metric.type) {
+      case Type::kCounter:
+        absl::StrAppend(&result, kv.first, " ", metric.counter->value(), "\n");
+        break;
+      case Type::kGauge:
+        absl::StrAppend(&result, kv.first, " ", metric.gauge->value(), "\n");
+        break;
+      case Type::kHistogram: {
+        auto snapshot = metric.histogram->GetSnapshot();
+        for (auto p : kPercentiles) {
+          auto quantile = absl::StrCat("quantile=\"", p / 100, "\"");
+          absl::StrAppend(&result, WithLabels(base, labels, quantile), " ",
+                          snapshot.Percentile(p), "\n");
+        }
+        absl::StrAppend(&result, WithLabels(absl::StrCat(base, "_sum"), labels),
+                        " ", snapshot.sum(), "\n",
+                        WithLabels(absl::StrCat(base, "_count"), labels), " ",
+                        snapshot.count(), "\n");
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+std::string Registry::ExportJson(absl::Time now) {
+  RunCollectors();
+  absl::MutexLock lock(&mutex_);
+  nlohmann::json values = nlohmann::json::object();
+  for (const auto& kv : metrics_) {
+    const auto& metric = kv.second;
+    switch (metric.type) {
+      case Type::kCounter:
+        values[kv.first] = metric.counter->value();
+        break;
+      case Type::kGauge:
+        values[kv.first] = metric.gauge->value();
+        break;
+      case Type::kHistogram: {
+        auto snapshot = metric.histogram->GetSnapshot();
+        nlohmann::json j = {
+            {"count", snapshot.count()},
+            {"sum", snapshot.sum()},
+        };
+        for (auto p : kPercentiles) {
+          j[absl::StrCat("p", p)] = snapshot.Percentile(p);
+        }
+        values[kv.first] = std::move(j);
+        break;
+      }
+    }
+  }
+  nlohmann::json j = {
+      {"time", absl::FormatTime(absl::RFC3339_full, now, absl::UTCTimeZone())},
+      {"metrics", std::move(values)},
+  };
+  return j.dump();
+}
+
+Exporter::Exporter(std::string path, absl::Duration interval,
+                   Registry* registry)
+    : path_(std::move(path)),
+      interval_(interval),
+      registry_(registry),
+      json_(absl::EndsWith(path_, ".jsonl")) {
+  thread_ = std::thread([this]() {
+    absl::MutexLock lock(&mutex_);
+    while (!mutex_.AwaitWithTimeout(absl::Condition(&stop_), interval_)) {
+      mutex_.Unlock();
+      Export();
+      mutex_.Lock();
+    }
+  });
+}
+
+Exporter::~Exporter() {
+  {
+    absl::MutexLock lock(&mutex_);
+    stop_ = true;
+  }
+  thread_.join();
+  Export();
+}
+
+void Exporter::Export() {
+  if (json_) {
+    // Appending isn't supported by the file utils, so JSON lines can only be
+    // written to local files.
+    auto line = registry_->ExportJson(absl::Now());
+    auto* f = fopen(path_.c_str(), "a");
+    if (f == nullptr) {
+      MG_LOG(ERROR) << "error opening " << path_ << " for appending";
+      return;
+    }
+    fprintf(f, "%s\n", line.c_str());
+    fclose(f);
+  } else {
+    // Write to a temporary file and rename it over the target, which is
+    // atomic on POSIX, so that a textfile collector never reads a partially
+    // written file.
+    auto tmp_path = absl::StrCat(path_, ".tmp");
+    if (!file::WriteFile(tmp_path, registry_->ExportPrometheus())) {
+      MG_LOG(ERROR) << "error writing metrics to " << tmp_path;
+      return;
+    }
+    if (std::rename(tmp_path.c_str(), path_.c_str()) != 0) {
+      MG_LOG(ERROR) << "error renaming " << tmp_path << " to " << path_;
+    }
+  }
+}
+
+}  // namespace metrics
+}  // namespace minigo
@@ -0,0 +1,277 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_METRICS_H_
+#define CC_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace minigo {
+namespace metrics {
+
+// A lightweight, always-on metrics library.
+//
+// Metrics are created through a Registry and live as long as it does, so call
+// sites typically look up their metrics once and cache the pointers:
+//
+//   static auto* num_batches = metrics::GetCounter(
+//       "batcher_batches_total", "Number of batches run by the batcher.");
+//   num_batches->Increment();
+//
+// Counters and histograms are sharded: every thread updates its own shard
+// with relaxed atomic operations, so updates from different threads don't
+// contend. Reading a metric sums its shards.
+//
+// A metric's name may end with a Prometheus style set of labels, e.g.
+// `inference_cache_hits_total{shard="3"}`. Metrics that only differ in their
+// labels are exported together.
+
+// Number of shards that counters and histograms are split across.
+constexpr int kNumShards = 16;
+
+namespace internal {
+
+// Returns the shard that the calling thread updates.
+int GetShardIndex();
+
+}  // namespace internal
+
+// A monotonically increasing count.
+class Counter {
+ public:
+  void Increment(int64_t delta = 1) {
+    shards_[internal::GetShardIndex()].value.fetch_add(
+        delta, std::memory_order_relaxed);
+  }
+
+  int64_t value() const;
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<int64_t> value{0};
+  };
+  std::array<Shard, kNumShards> shards_;
+};
+
+// A value that can go up and down.
+class Gauge {
+ public:
+  void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+  double value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<double> value_{0};
+};
+
+// A distribution of non-negative integer values, e.g. durations in
+// microseconds or batch sizes.
+// Values are counted in log-linear buckets, like an HDR histogram: each power
+// of two is split into kSubBuckets equal width buckets, so percentiles are
+// accurate to within 1 / kSubBuckets of the true value. Values larger than
+// kMaxValue are counted as kMaxValue.
+// Distribution isn't thread safe: use a Histogram to record values from
+// multiple threads.
+class Distribution {
+ public:
+  static constexpr int kSubBucketBits = 4;
+  static constexpr int kSubBuckets = 1 << kSubBucketBits;
+  static constexpr int kMaxValueBits = 40;
+  static constexpr int64_t kMaxValue = (int64_t(1) << kMaxValueBits) - 1;
+  static constexpr int kNumBuckets =
+      kSubBuckets * (kMaxValueBits - kSubBucketBits + 1);
+
+  // Returns the bucket that `value` is counted in.
+  static int BucketIndex(int64_t value);
+
+  // Returns the smallest value counted in bucket `index`.
+  static int64_t BucketLowerBound(int index);
+
+  void Record(int64_t value) {
+    count_ += 1;
+    sum_ += value;
+    buckets_[BucketIndex(value)] += 1;
+  }
+
+  // Records `d` in microseconds.
+  void RecordDuration(absl::Duration d) {
+    Record(absl::ToInt64Microseconds(d));
+  }
+
+  // Returns the value at percentile `p`, in the range [0, 100].
+  int64_t Percentile(double p) const;
+
+  int64_t count() const { return count_; }
+  int64_t sum() const { return sum_; }
+  double mean() const { return count_ == 0 ? 0 : double(sum_) / count_; }
+
+ private:
+  friend class Histogram;
+
+  int64_t count_ = 0;
+  int64_t sum_ = 0;
+  std::array<int64_t, kNumBuckets> buckets_{};
+};
+
+// A thread safe Distribution.
+class Histogram {
+ public:
+  void Record(int64_t value) {
+    auto& shard = shards_[internal::GetShardIndex()];
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+    shard.buckets[Distribution::BucketIndex(value)].fetch_add(
+        1, std::memory_order_relaxed);
+  }
+
+  // Records `d` in microseconds.
+  void RecordDuration(absl::Duration d) {
+    Record(absl::ToInt64Microseconds(d));
+  }
+
+  Distribution GetSnapshot() const;
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<int64_t> count{0};
+    std::atomic<int64_t> sum{0};
+    std::array<std::atomic<int64_t>, Distribution::kNumBuckets> buckets{};
+  };
+  std::array<Shard, kNumShards> shards_;
+};
+
+// Records the lifetime of the ScopedTimer in a histogram, in microseconds.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Histogram* histogram)
+      : histogram_(histogram), start_(absl::Now()) {}
+  ~ScopedTimer() { histogram_->RecordDuration(absl::Now() - start_); }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+ private:
+  Histogram* histogram_;
+  absl::Time start_;
+};
+
+// A collection of named metrics.
+// The Get* methods return the existing metric if one with the same name has
+// already been created; it's an error to create two metrics of different
+// types with the same name.
+class Registry {
+ public:
+  // Returns the registry used by the free functions below.
+  static Registry* Get();
+
+  Counter* GetCounter(absl::string_view name, absl::string_view help);
+  Gauge* GetGauge(absl::string_view name, absl::string_view help);
+  Histogram* GetHistogram(absl::string_view name, absl::string_view help);
+
+  // Registers a function that's called before every export, for metrics
+  // whose values are cheaper to compute on demand than to keep up to date,
+  // e.g. gauges derived from other counters.
+  void AddCollector(std::function<void(Registry*)> collector);
+
+  // Returns all metrics in the Prometheus text exposition format. Histograms
+  // are exported as summaries with 50th, 90th & 99th percentiles.
+  std::string ExportPrometheus();
+
+  // Returns all metrics as a single line of JSON, timestamped with `now`.
+  std::string ExportJson(absl::Time now);
+
+ private:
+  enum class Type {
+    kCounter,
+    kGauge,
+    kHistogram,
+  };
+
+  struct Metric {
+    Type type;
+    std::string help;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  Metric* GetMetric(absl::string_view name, absl::string_view help, Type type)
+      EXCLUSIVE_LOCKS_REQUIRED(&mutex_);
+
+  void RunCollectors() LOCKS_EXCLUDED(&mutex_);
+
+  absl::Mutex mutex_;
+
+  // Ordered by name so that metrics that only differ in their labels are
+  // exported next to each other.
+  std::map<std::string, Metric> metrics_ GUARDED_BY(&mutex_);
+
+  std::vector<std::function<void(Registry*)>> collectors_ GUARDED_BY(&mutex_);
+};
+
+inline Counter* GetCounter(absl::string_view name, absl::string_view help) {
+  return Registry::Get()->GetCounter(name, help);
+}
+
+inline Gauge* GetGauge(absl::string_view name, absl::string_view help) {
+  return Registry::Get()->GetGauge(name, help);
+}
+
+inline Histogram* GetHistogram(absl::string_view name,
+                               absl::string_view help) {
+  return Registry::Get()->GetHistogram(name, help);
+}
+
+// Periodically writes the metrics in a registry to a local file.
+// If `path` ends in ".jsonl", a line of JSON is appended to the file on every
+// export. Otherwise the file is atomically replaced with the Prometheus text
+// format, e.g. for the node exporter's textfile collector.
+class Exporter {
+ public:
+  Exporter(std::string path, absl::Duration interval,
+           Registry* registry = Registry::Get());
+
+  // Stops the export thread and writes the metrics one last time.
+  ~Exporter();
+
+  void Export();
+
+ private:
+  const std::string path_;
+  const absl::Duration interval_;
+  Registry* const registry_;
+  const bool json_;
+
+  absl::Mutex mutex_;
+  bool stop_ GUARDED_BY(&mutex_) = false;
+  std::thread thread_;
+};
+
+}  // namespace metrics
+}  // namespace minigo
+
+#endif  // CC_METRICS_H_
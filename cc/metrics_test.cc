@@ -0,0 +1,189 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_split.h"
+#include "cc/file/path.h"
+#include "cc/file/utils.h"
+#include "cc/json.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace metrics {
+namespace {
+
+TEST(MetricsTest, CounterSumsAllThreads) {
+  Counter counter;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&counter]() {
+      for (int j = 0; j < 1000; ++j) {
+        counter.Increment();
+      }
+      counter.Increment(10);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(8 * 1010, counter.value());
+}
+
+TEST(MetricsTest, HistogramBuckets) {
+  // Small values have a bucket each.
+  for (int i = 0; i < Distribution::kSubBuckets; ++i) {
+    EXPECT_EQ(i, Distribution::BucketIndex(i));
+    EXPECT_EQ(i, Distribution::BucketLowerBound(i));
+  }
+
+  // Larger values are counted in buckets whose width is at most 1/kSubBuckets
+  // of their lower bound.
+  for (int64_t v = 1; v <= Distribution::kMaxValue; v = v * 3 + 1) {
+    auto index = Distribution::BucketIndex(v);
+    auto lower = Distribution::BucketLowerBound(index);
+    auto upper = Distribution::BucketLowerBound(index + 1);
+    EXPECT_LE(lower, v);
+    EXPECT_LT(v, upper);
+    EXPECT_LE((upper - lower) * Distribution::kSubBuckets,
+              std::max<int64_t>(lower, Distribution::kSubBuckets));
+  }
+
+  EXPECT_EQ(0, Distribution::BucketIndex(-5));
+  EXPECT_EQ(Distribution::kNumBuckets - 1,
+            Distribution::BucketIndex(Distribution::kMaxValue));
+  EXPECT_EQ(Distribution::kNumBuckets - 1,
+            Distribution::BucketIndex(Distribution::kMaxValue + 1));
+}
+
+TEST(MetricsTest, HistogramPercentiles) {
+  Histogram histogram;
+  for (int i = 1; i <= 1000; ++i) {
+    histogram.Record(i);
+  }
+  auto snapshot = histogram.GetSnapshot();
+  EXPECT_EQ(1000, snapshot.count());
+  EXPECT_EQ(500500, snapshot.sum());
+  EXPECT_NEAR(500.5, snapshot.mean(), 1e-6);
+  EXPECT_NEAR(500, snapshot.Percentile(50), 500 / Distribution::kSubBuckets);
+  EXPECT_NEAR(990, snapshot.Percentile(99), 990 / Distribution::kSubBuckets);
+  EXPECT_EQ(1, snapshot.Percentile(0));
+
+  EXPECT_EQ(0, Histogram().GetSnapshot().Percentile(50));
+}
+
+TEST(MetricsTest, RegistryReturnsExistingMetrics) {
+  Registry registry;
+  auto* a = registry.GetCounter("a", "help");
+  EXPECT_EQ(a, registry.GetCounter("a", "help"));
+  EXPECT_NE(a, registry.GetCounter("a{x=\"1\"}", "help"));
+  EXPECT_DEATH(registry.GetGauge("a", "help"), "different type");
+}
+
+TEST(MetricsTest, ExportPrometheus) {
+  Registry registry;
+  registry.GetCounter("requests_total{shard=\"0\"}", "Requests.")
+      ->Increment(3);
+  registry.GetCounter("requests_total{shard=\"1\"}", "Requests.")
+      ->Increment(4);
+  registry.GetGauge("size", "Size.")->Set(2.5);
+  registry.GetHistogram("latency_us", "Latency.")->Record(7);
+
+  EXPECT_EQ(
+      "# HELP latency_us Latency.\n"
+      "# TYPE latency_us summary\n"
+      "latency_us{quantile=\"0.5\"} 7\n"
+      "latency_us{quantile=\"0.9\"} 7\n"
+      "latency_us{quantile=\"0.99\"} 7\n"
+      "latency_us_sum 7\n"
+      "latency_us_count 1\n"
+      "# HELP requests_total Requests.\n"
+      "# TYPE requests_total counter\n"
+      "requests_total{shard=\"0\"} 3\n"
+      "requests_total{shard=\"1\"} 4\n"
+      "# HELP size Size.\n"
+      "# TYPE size gauge\n"
+      "size 2.5\n",
+      registry.ExportPrometheus());
+}
+
+TEST(MetricsTest, ExportJson) {
+  Registry registry;
+  registry.GetCounter("requests_total{shard=\"0\"}", "Requests.")
+      ->Increment(3);
+  registry.GetHistogram("latency_us", "Latency.")->Record(7);
+
+  auto line = registry.ExportJson(absl::FromUnixSeconds(0));
+  EXPECT_FALSE(absl::StrContains(line, "\n"));
+
+  auto j = nlohmann::json::parse(line);
+  EXPECT_EQ("1970-01-01T00:00:00+00:00", j["time"]);
+  EXPECT_EQ(3, j["metrics"]["requests_total{shard=\"0\"}"]);
+  EXPECT_EQ(1, j["metrics"]["latency_us"]["count"]);
+  EXPECT_EQ(7, j["metrics"]["latency_us"]["p99"]);
+}
+
+TEST(MetricsTest, Collectors) {
+  Registry registry;
+  int num_calls = 0;
+  registry.AddCollector([&num_calls](Registry* r) {
+    r->GetGauge("num_calls", "Calls.")->Set(++num_calls);
+  });
+
+  EXPECT_EQ(
+      "# HELP num_calls Calls.\n"
+      "# TYPE num_calls gauge\n"
+      "num_calls 1\n",
+      registry.ExportPrometheus());
+  auto j = nlohmann::json::parse(registry.ExportJson(absl::Now()));
+  EXPECT_EQ(2, j["metrics"]["num_calls"]);
+}
+
+TEST(MetricsTest, Exporter) {
+  Registry registry;
+  auto* counter = registry.GetCounter("requests_total", "Requests.");
+
+  // The exporter writes the metrics one last time when it's destroyed.
+  auto prom_path = file::JoinPath(::testing::TempDir(), "metrics.prom");
+  auto json_path = file::JoinPath(::testing::TempDir(), "metrics.jsonl");
+  remove(json_path.c_str());
+  for (int i = 1; i <= 2; ++i) {
+    counter->Increment();
+    Exporter prom(prom_path, absl::Hours(1), &registry);
+    Exporter json(json_path, absl::Hours(1), &registry);
+  }
+
+  std::string contents;
+  ASSERT_TRUE(file::ReadFile(prom_path, &contents));
+  EXPECT_EQ(registry.ExportPrometheus(), contents);
+  EXPECT_FALSE(file::ReadFile(prom_path + ".tmp", &contents));
+
+  ASSERT_TRUE(file::ReadFile(json_path, &contents));
+  std::vector<std::string> lines =
+      absl::StrSplit(contents, '\n', absl::SkipEmpty());
+  ASSERT_EQ(2, lines.size());
+  EXPECT_EQ(1, nlohmann::json::parse(lines[0])["metrics"]["requests_total"]);
+  EXPECT_EQ(2, nlohmann::json::parse(lines[1])["metrics"]["requests_total"]);
+}
+
+}  // namespace
+}  // namespace metrics
+}  // namespace minigo
@@ -33,6 +33,15 @@
 
 namespace minigo {
 
+namespace {
+
+// The win rate evaluator stops searching from a position once it has this many
+// reads. Leaves whose inference is cached don't count towards a batch, so this
+// bounds the reads that a single batch can make from each position.
+constexpr int kMaxEvalReadsPerPosition = 1024;
+
+}  // namespace
+
 MiniguiGtpClient::MiniguiGtpClient(
     std::unique_ptr<ModelFactory> model_factory,
     std::shared_ptr<ThreadSafeInferenceCache> inference_cache,
@@ -51,18 +60,24 @@ MiniguiGtpClient::MiniguiGtpClient(
 
   player_->SetTreeSearchCallback(
       std::bind(&MiniguiGtpClient::TreeSearchCb, this, std::placeholders::_1));
+  player_->SetTreeMutex(&tree_mutex_);
 
   variation_tree_ = absl::make_unique<VariationTree>();
 
-  int num_workers = 16;
+  int max_eval_batch_size = 64;
   int num_win_rate_evals = 8;
-  model_factory_ =
-      absl::make_unique<BatchingModelFactory>(std::move(model_factory_));
-  auto worker_options = player_options;
-  worker_options.virtual_losses = 1;
+  auto eval_options = player_options;
+  eval_options.virtual_losses = 1;
   win_rate_evaluator_ = absl::make_unique<WinRateEvaluator>(
-      num_workers, num_win_rate_evals, model_factory_.get(), inference_cache,
-      model_path, game_options, worker_options);
+      max_eval_batch_size, num_win_rate_evals,
+      model_factory_->NewModel(model_path), inference_cache, game_options,
+      eval_options);
+
+  // The search_reporter_ doesn't read any state until reports are enabled by
+  // a command, so it's safe for Run to start a new game without holding
+  // tree_mutex_.
+  search_reporter_ = absl::make_unique<SearchReporter>(this);
+  search_reporter_->Start();
 }
 
 MiniguiGtpClient::~MiniguiGtpClient() = default;
@@ -75,6 +90,7 @@ void MiniguiGtpClient::NewGame() {
 }
 
 void MiniguiGtpClient::Ponder() {
+  absl::MutexLock lock(&tree_mutex_);
   if (win_rate_evaluator_->all_nodes_have_at_least_one_read()) {
     GtpClient::Ponder();
   }
@@ -82,7 +98,11 @@ void MiniguiGtpClient::Ponder() {
 }
 
 GtpClient::Response MiniguiGtpClient::HandleCmd(const std::string& line) {
-  auto response = GtpClient::HandleCmd(line);
+  Response response;
+  {
+    absl::MutexLock lock(&tree_mutex_);
+    response = GtpClient::HandleCmd(line);
+  }
   // Write __GTP_CMD_DONE__ to stderr to signify that handling a GTP command is
   // done. The Minigui Python server waits for this magic string before it
   // consumes the output of each GTP command. This keeps the outputs written to
@@ -98,7 +118,7 @@ GtpClient::Response MiniguiGtpClient::HandleEcho(CmdArgs args) {
 }
 
 GtpClient::Response MiniguiGtpClient::HandleGenmove(CmdArgs args) {
-  ReportSearchStatus(nullptr, true);
+  search_reporter_->RequestTreeStats();
   auto response = GtpClient::HandleGenmove(args);
   if (response.ok) {
     variation_tree_->PlayMove(player_->root()->move);
@@ -129,6 +149,7 @@ GtpClient::Response MiniguiGtpClient::HandleReportSearchInterval(CmdArgs args) {
     return Response::Error("couldn't parse ", args[0], " as an integer >= 0");
   }
   report_search_interval_ = absl::Milliseconds(x);
+  search_reporter_->SetInterval(report_search_interval_);
 
   return Response::Ok();
 }
@@ -232,84 +253,16 @@ GtpClient::Response MiniguiGtpClient::ReplaySgf(
   return Response::Ok();
 }
 
-void MiniguiGtpClient::ReportSearchStatus(const MctsNode* leaf,
-                                          bool include_tree_stats) {
-  auto* root = player_->root();
-  auto sorted_child_info = root->CalculateRankedChildInfo();
-
-  nlohmann::json j = {
-      {"id", variation_tree_->current_node()->id},
-      {"n", root->N()},
-      {"q", root->Q()},
-  };
-
-  // TODO(tommadams): Make the number of child variations sent back
-  // configurable.
-  nlohmann::json variations;
-  for (int i = 0; i < 10; ++i) {
-    Coord c = sorted_child_info[i].c;
-    const auto child_it = root->children.find(c);
-    if (child_it == root->children.end() || root->child_N(c) == 0) {
-      break;
-    }
-
-    nlohmann::json moves = {c.ToGtp()};
-    const auto* node = child_it->second.get();
-    for (const auto c : node->MostVisitedPath()) {
-      moves.push_back(c.ToGtp());
-    }
-    variations[c.ToGtp()] = {
-        {"n", root->child_N(c)},
-        {"q", root->child_Q(c)},
-        {"moves", std::move(moves)},
-    };
-  }
-  if (!variations.empty()) {
-    j["variations"] = std::move(variations);
-  }
-
-  // Current live search variation.
-  if (leaf != nullptr) {
-    std::vector<const MctsNode*> live;
-    for (const auto* node = leaf; node != root; node = node->parent) {
-      live.push_back(node);
-    }
-    if (!live.empty()) {
-      std::reverse(live.begin(), live.end());
-      nlohmann::json moves;
-      for (const auto* node : live) {
-        moves.push_back(node->move.ToGtp());
-      }
-      j["variations"]["live"] = {
-          {"n", live.front()->N()},
-          {"q", live.front()->Q()},
-          {"moves", std::move(moves)},
-      };
-    }
-  }
-
-  // Child N.
-  auto& child_N = j["childN"];
-  for (const auto& edge : root->edges) {
-    child_N.push_back(static_cast<int>(edge.N));
-  }
-
-  // Child Q.
-  auto& child_Q = j["childQ"];
-  for (int i = 0; i < kNumMoves; ++i) {
-    child_Q.push_back(static_cast<int>(std::round(root->child_Q(i) * 1000)));
-  }
-
-  if (include_tree_stats) {
-    auto tree_stats = root->CalculateTreeStats();
-    j["treeStats"] = {
-        {"numNodes", tree_stats.num_nodes},
-        {"numLeafNodes", tree_stats.num_leaf_nodes},
-        {"maxDepth", tree_stats.max_depth},
-    };
+bool MiniguiGtpClient::SnapshotSearch(bool include_tree_stats,
+                                      SearchSnapshot* snapshot) {
+  absl::ReaderMutexLock lock(&tree_mutex_);
+  const auto* root = player_->root();
+  const auto& id = variation_tree_->current_node()->id;
+  if (!include_tree_stats && root->N() == snapshot->n && id == snapshot->id) {
+    return false;
   }
-
-  MG_LOG(INFO) << "mg-update:" << j.dump();
+  TakeSearchSnapshot(*root, id, live_moves_, include_tree_stats, snapshot);
+  return true;
 }
 
 void MiniguiGtpClient::ReportRootPosition() {
@@ -375,16 +328,79 @@ void MiniguiGtpClient::RefreshPendingWinRateEvals() {
   }
   std::reverse(variation.begin(), variation.end());
 
-  win_rate_evaluator_->SetCurrentVariation(std::move(variation));
+  if (!win_rate_evaluator_->SetCurrentVariation(std::move(variation))) {
+    MG_LOG(ERROR) << "couldn't play the current variation, only evaluating "
+                  << "the positions before the first illegal move";
+  }
 }
 
 void MiniguiGtpClient::TreeSearchCb(
     const std::vector<const MctsNode*>& leaves) {
-  if (!leaves.empty() && report_search_interval_ != absl::ZeroDuration()) {
-    auto now = absl::Now();
-    if (now - last_report_time_ > report_search_interval_) {
-      last_report_time_ = now;
-      ReportSearchStatus(leaves.back(), false);
+  // Only the path to the leaf is recorded here: the search_reporter_ takes
+  // the snapshot of the tree on its own thread.
+  if (leaves.empty() || report_search_interval_ == absl::ZeroDuration()) {
+    return;
+  }
+  live_moves_.clear();
+  const auto* root = player_->root();
+  for (const auto* node = leaves.back(); node != root; node = node->parent) {
+    live_moves_.push_back(node->move);
+  }
+  std::reverse(live_moves_.begin(), live_moves_.end());
+}
+
+MiniguiGtpClient::SearchReporter::SearchReporter(MiniguiGtpClient* client)
+    : client_(client) {}
+
+MiniguiGtpClient::SearchReporter::~SearchReporter() {
+  {
+    absl::MutexLock lock(&mutex_);
+    running_ = false;
+    wake_ = true;
+  }
+  Join();
+}
+
+void MiniguiGtpClient::SearchReporter::SetInterval(absl::Duration interval) {
+  absl::MutexLock lock(&mutex_);
+  interval_ = interval;
+  wake_ = true;
+}
+
+void MiniguiGtpClient::SearchReporter::RequestTreeStats() {
+  absl::MutexLock lock(&mutex_);
+  want_tree_stats_ = true;
+  wake_ = true;
+}
+
+void MiniguiGtpClient::SearchReporter::Run() {
+  auto last_report_time = absl::InfinitePast();
+  for (;;) {
+    bool include_tree_stats;
+    {
+      absl::MutexLock lock(&mutex_);
+      // Sleep until the next report is due, or until the interval changes or
+      // a report with tree stats is requested.
+      auto deadline = interval_ == absl::ZeroDuration()
+                          ? absl::InfiniteFuture()
+                          : last_report_time + interval_;
+      mutex_.AwaitWithDeadline(absl::Condition(&wake_), deadline);
+      if (!running_) {
+        break;
+      }
+      wake_ = false;
+      include_tree_stats = want_tree_stats_;
+      want_tree_stats_ = false;
+      if (!include_tree_stats && (interval_ == absl::ZeroDuration() ||
+                                  absl::Now() < last_report_time + interval_)) {
+        continue;
+      }
+    }
+
+    last_report_time = absl::Now();
+    if (client_->SnapshotSearch(include_tree_stats, &snapshot_)) {
+      formatter_.Format(snapshot_, &buffer_);
+      MG_LOG(INFO) << "mg-update:" << buffer_;
     }
   }
 }
@@ -447,22 +463,16 @@ bool MiniguiGtpClient::VariationTree::SelectNode(const std::string& id) {
 }
 
 MiniguiGtpClient::WinRateEvaluator::WinRateEvaluator(
-    int num_workers, int num_eval_reads, ModelFactory* model_factory,
+    int max_batch_size, int num_eval_reads, std::unique_ptr<Model> model,
     std::shared_ptr<ThreadSafeInferenceCache> inference_cache,
-    const std::string& model_path, const Game::Options& game_options,
+    const Game::Options& game_options,
     const MctsPlayer::Options& player_options)
-    : num_eval_reads_(num_eval_reads) {
+    : max_batch_size_(max_batch_size), num_eval_reads_(num_eval_reads) {
   MG_CHECK(inference_cache != nullptr);
-
-  for (int i = 0; i < num_workers; ++i) {
-    auto game = absl::make_unique<Game>("b", "w", game_options);
-    auto player = absl::make_unique<MctsPlayer>(
-        model_factory->NewModel(model_path), inference_cache, game.get(),
-        player_options);
-    workers_.push_back(absl::make_unique<Worker>(
-        std::move(game), std::move(player), &eval_queue_));
-    workers_.back()->Start();
-  }
+  game_ = absl::make_unique<Game>("b", "w", game_options);
+  player_ = absl::make_unique<MctsPlayer>(std::move(model), inference_cache,
+                                          game_.get(), player_options);
+  tree_nodes_.push_back(player_->root());
 }
 
 MiniguiGtpClient::WinRateEvaluator::~WinRateEvaluator() = default;
@@ -472,34 +482,82 @@ void MiniguiGtpClient::WinRateEvaluator::SetNumEvalReads(int num_eval_reads) {
   UpdateNodesToEval();
 }
 
-void MiniguiGtpClient::WinRateEvaluator::SetCurrentVariation(
+bool MiniguiGtpClient::WinRateEvaluator::SetCurrentVariation(
     std::vector<VariationTree::Node*> nodes) {
   variation_ = std::move(nodes);
+
+  // Update the player's tree to end at the last position in the variation.
+  // Only moves after the point where the new variation diverges from the
+  // previous one are undone, so the search tree for the common part of the
+  // two variations is preserved.
+  std::vector<Coord> moves;
+  if (!variation_.empty()) {
+    moves = variation_.back()->GetVariation();
+  }
+  size_t num_common = 0;
+  while (num_common < moves.size() && num_common < moves_.size() &&
+         moves[num_common] == moves_[num_common]) {
+    num_common += 1;
+  }
+  while (moves_.size() > num_common) {
+    MG_CHECK(player_->UndoMove());
+    moves_.pop_back();
+  }
+  bool ok = true;
+  for (size_t i = num_common; i < moves.size(); ++i) {
+    if (!player_->PlayMove(moves[i])) {
+      // Only evaluate the positions that could be reached.
+      variation_.resize(moves_.size() + 1);
+      ok = false;
+      break;
+    }
+    moves_.push_back(moves[i]);
+  }
+
+  tree_nodes_.resize(moves_.size() + 1);
+  auto* node = player_->root();
+  for (int i = static_cast<int>(moves_.size()); i >= 0; --i) {
+    tree_nodes_[i] = node;
+    node = node->parent;
+  }
+
   UpdateNodesToEval();
+  return ok;
 }
 
 void MiniguiGtpClient::WinRateEvaluator::EvalNodes() {
-  auto num_inferences = std::min(workers_.size(), to_eval_.size());
-  if (num_inferences == 0) {
+  auto batch_size = std::min<size_t>(max_batch_size_, to_eval_.size());
+  if (batch_size == 0) {
     return;
   }
 
-  // Inform each worker how many inferences we want to run in parallel.
-  // This allows the batcher to know how many inferences to expect.
-  for (size_t i = 0; i < num_inferences; ++i) {
-    workers_[i]->Prepare();
-  }
-
-  // Run win rate evaluation in parallel.
-  for (size_t i = 0; i < num_inferences; ++i) {
-    workers_[i]->EvalAsync(to_eval_.front());
+  batch_.clear();
+  roots_.clear();
+  for (size_t i = 0; i < batch_size; ++i) {
+    auto* node = to_eval_.front();
     to_eval_.pop_front();
+    batch_.push_back(node);
+    roots_.push_back(tree_nodes_[node->n]);
   }
 
-  // Wait for the workers to finish.
-  for (size_t i = 0; i < num_inferences; ++i) {
-    auto* node = eval_queue_.Pop();
-    // auto* node = workers_[i]->Wait();
+  // Search from all the positions at once, running a single inference batch.
+  // The results are propagated all the way up the tree, so the N of each
+  // position includes the reads made by searches from the positions after it.
+  player_->MultiRootTreeSearch(roots_, tree_nodes_[0],
+                               player_->options().virtual_losses,
+                               kMaxEvalReadsPerPosition);
+
+  for (size_t i = 0; i < batch_size; ++i) {
+    auto* node = batch_[i];
+    const auto* root = roots_[i];
+    nlohmann::json j = {
+        {"id", node->id},
+        {"n", root->N()},
+        {"q", root->Q()},
+    };
+    MG_LOG(INFO) << "mg-update:" << j.dump();
+
+    node->num_eval_reads = root->N();
     if (node->num_eval_reads < num_eval_reads_) {
       to_eval_.push_back(node);
     }
@@ -525,59 +583,4 @@ void MiniguiGtpClient::WinRateEvaluator::UpdateNodesToEval() {
             });
 }
 
-MiniguiGtpClient::WinRateEvaluator::Worker::Worker(
-    std::unique_ptr<Game> game, std::unique_ptr<MctsPlayer> player,
-    ThreadSafeQueue<VariationTree::Node*>* eval_queue)
-    : game_(std::move(game)),
-      player_(std::move(player)),
-      eval_queue_(eval_queue) {}
-
-MiniguiGtpClient::WinRateEvaluator::Worker::~Worker() {
-  absl::MutexLock lock(&mutex_);
-  MG_CHECK(!pending_.has_value());
-  pending_ = nullptr;
-  Join();
-}
-
-void MiniguiGtpClient::WinRateEvaluator::Worker::Prepare() {
-  BatchingModelFactory::StartGame(player_->model(), player_->model());
-}
-
-void MiniguiGtpClient::WinRateEvaluator::Worker::EvalAsync(
-    VariationTree::Node* node) {
-  absl::MutexLock lock(&mutex_);
-  MG_CHECK(!pending_.has_value());
-  pending_ = node;
-}
-
-void MiniguiGtpClient::WinRateEvaluator::Worker::Run() {
-  for (;;) {
-    absl::MutexLock lock(&mutex_);
-    mutex_.Await(absl::Condition(
-        &pending_, &absl::optional<VariationTree::Node*>::has_value));
-    auto* node = *pending_;
-    pending_.reset();
-    if (node == nullptr) {
-      break;
-    }
-
-    player_->NewGame();
-    for (auto c : node->GetVariation()) {
-      MG_CHECK(player_->PlayMove(c));
-    }
-    player_->TreeSearch(player_->options().virtual_losses, 1024);
-    BatchingModelFactory::EndGame(player_->model(), player_->model());
-
-    nlohmann::json j = {
-        {"id", node->id},
-        {"n", player_->root()->N()},
-        {"q", player_->root()->Q()},
-    };
-    MG_LOG(INFO) << "mg-update:" << j.dump();
-
-    node->num_eval_reads = player_->root()->N();
-    eval_queue_->Push(node);
-  }
-}
-
 }  // namespace minigo
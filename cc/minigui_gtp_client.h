@@ -15,6 +15,7 @@
 #ifndef CC_MINIGUI_GTP_CLIENT_H_
 #define CC_MINIGUI_GTP_CLIENT_H_
 
+#include <array>
 #include <deque>
 #include <map>
 #include <memory>
@@ -25,15 +26,15 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
-#include "absl/types/optional.h"
 #include "absl/types/span.h"
 #include "cc/color.h"
+#include "cc/constants.h"
 #include "cc/gtp_client.h"
-#include "cc/model/batching_model.h"
+#include "cc/minigui_search_report.h"
 #include "cc/model/model.h"
 #include "cc/thread.h"
-#include "cc/thread_safe_queue.h"
 
 namespace minigo {
 
@@ -49,7 +50,7 @@ class MiniguiGtpClient : public GtpClient {
 
   void NewGame() override;
 
- private:
+ protected:
   // A tree that tracks all variations played during one game.
   // This tree is persistent throughout a game, unlike the tree used for search.
   // The VariationTree maintains a current_node, which is always updated so that
@@ -116,21 +117,21 @@ class MiniguiGtpClient : public GtpClient {
   };
 
   // The WinRateEvaluator handles performing win rate evaluation for positions
-  // that run in parellel with conventionaly pondering.
+  // in the current variation, in between batches of conventional pondering.
   // For more accurate win rate evaluation, the WinRateEvaluator doesn't use
-  // virtual losses and runs inference on one leaf at a time. To improve
-  // efficiency, the WinRateEvaluator uses multiple MctsPlayers that all perform
-  // tree search in parallel, with each player performing win rate evaluation
-  // for a different position.
-  // It's a little depressing how much extra code had to be written to support
-  // background win rate evaluation, but there we are. Things would be a lot
-  // simpler if we had a nice fiber library.
+  // virtual losses and selects one leaf at a time from each position.
+  // All positions in the variation are nodes in a single search tree, so
+  // adjacent positions share the subtrees they have in common instead of
+  // each being searched from scratch. Each call to EvalNodes performs a
+  // multi-root search from the positions with the fewest reads, evaluating
+  // the leaves selected under all of them in a single inference batch. The
+  // results are backed up to the start of the variation, so the reads of
+  // each position include those made from the positions after it.
   class WinRateEvaluator {
    public:
-    WinRateEvaluator(int num_workers, int num_eval_reads,
-                     ModelFactory* model_factory,
+    WinRateEvaluator(int max_batch_size, int num_eval_reads,
+                     std::unique_ptr<Model> model,
                      std::shared_ptr<ThreadSafeInferenceCache> inference_cache,
-                     const std::string& model_path,
                      const Game::Options& game_options,
                      const MctsPlayer::Options& player_options);
     ~WinRateEvaluator();
@@ -140,53 +141,73 @@ class MiniguiGtpClient : public GtpClient {
     }
 
     void SetNumEvalReads(int num_eval_reads);
-    void SetCurrentVariation(std::vector<VariationTree::Node*> nodes);
+
+    // Sets the positions to evaluate, which must start from the empty board.
+    // Returns false if a move in the variation can't be played, in which case
+    // only the positions before that move are evaluated.
+    bool SetCurrentVariation(std::vector<VariationTree::Node*> nodes);
     void EvalNodes();
 
-    // private:
+   private:
     void UpdateNodesToEval();
 
-    class Worker : public Thread {
-     public:
-      Worker(std::unique_ptr<Game> game, std::unique_ptr<MctsPlayer> player,
-             ThreadSafeQueue<VariationTree::Node*>* eval_queue);
-      ~Worker();
-
-      // Prepare the worker for running evaluation.
-      // Prepare should be called on all workers that are about to perform eval
-      // before the Eval calls. This tells the inference batcher shared
-      // between workers how many inferences to expect.
-      void Prepare();
-
-      // Start running evaluation on the given Node.
-      // Each time Eval is called, the Worker resets the board and plays a
-      // game out to the given node, then performs tree search until a single
-      // inference is performed.
-      // Because the workers all share an inference cache, repeated Evals of
-      // the same node will result in an ever increasing number of nodes being
-      // expanded during the tree search, since cached hits don't count towards
-      // the number of inferences performed during the search.
-      // This does require that the inference cache is large enough to fit all
-      // the inferences performed during win rate evaluation for the current
-      // variation.
-      void EvalAsync(VariationTree::Node* node);
-
-     private:
-      void Run() override;
-
-      absl::Mutex mutex_;
-      absl::optional<VariationTree::Node*> pending_ GUARDED_BY(&mutex_);
-      std::unique_ptr<Game> game_;
-      std::unique_ptr<MctsPlayer> player_ GUARDED_BY(&mutex_);
-      std::vector<MctsNode*> leaves_;
-      ThreadSafeQueue<VariationTree::Node*>* eval_queue_;
-    };
-
+    // Maximum number of positions to evaluate in a single batch.
+    const int max_batch_size_;
     int num_eval_reads_ = 8;
-    std::vector<std::unique_ptr<Worker>> workers_;
+    std::unique_ptr<Game> game_;
+    std::unique_ptr<MctsPlayer> player_;
+
+    // The moves played by player_ to reach the last position in variation_.
+    std::vector<Coord> moves_;
+
+    // tree_nodes_[i] is the node in player_'s search tree for the position
+    // after i moves have been played, i.e. variation_[i].
+    std::vector<MctsNode*> tree_nodes_;
+
     std::deque<VariationTree::Node*> to_eval_;
     std::vector<VariationTree::Node*> variation_;
-    ThreadSafeQueue<VariationTree::Node*> eval_queue_;
+
+    // Scratch buffers used by EvalNodes.
+    std::vector<VariationTree::Node*> batch_;
+    std::vector<MctsNode*> roots_;
+  };
+
+ private:
+  // Reports the progress of the main tree search to Minigui from a
+  // background thread. Every report interval, the reporter takes a reader lock
+  // on the client's tree_mutex_, which the search releases while it waits for
+  // inferences, and snapshots the search tree. The snapshot is then formatted
+  // & written to stderr without holding the lock, so none of the reporting
+  // work is done on the search thread.
+  class SearchReporter : public Thread {
+   public:
+    explicit SearchReporter(MiniguiGtpClient* client);
+    ~SearchReporter() override;
+
+    // Sets the time between reports. Reports are only made periodically if
+    // the interval is non-zero.
+    void SetInterval(absl::Duration interval);
+
+    // Requests a report that includes the stats for the whole search tree.
+    // The report is made as soon as the tree can be read, regardless of the
+    // report interval.
+    void RequestTreeStats();
+
+   private:
+    void Run() override;
+
+    MiniguiGtpClient* const client_;
+
+    absl::Mutex mutex_;
+    absl::Duration interval_ GUARDED_BY(&mutex_);
+    bool want_tree_stats_ GUARDED_BY(&mutex_) = false;
+    bool wake_ GUARDED_BY(&mutex_) = false;
+    bool running_ GUARDED_BY(&mutex_) = true;
+
+    // State owned by the reporter thread.
+    SearchSnapshot snapshot_;
+    SearchReportFormatter formatter_;
+    std::string buffer_;
   };
 
   void Ponder() override;
@@ -203,10 +224,11 @@ class MiniguiGtpClient : public GtpClient {
   Response HandleSelectPosition(CmdArgs args);
   Response HandleWinrateEvals(CmdArgs args);
 
-  // Writes the search data for the tree search currently being performed to
-  // stderr. If leaf is non-null, the search path from root to leaf is also
-  // written.
-  void ReportSearchStatus(const MctsNode* leaf, bool include_tree_stats);
+  // Called by the search_reporter_ thread to copy the state of the search
+  // into snapshot. Returns false without taking a snapshot if the search
+  // hasn't made any progress since the previous snapshot, unless
+  // include_tree_stats is true.
+  bool SnapshotSearch(bool include_tree_stats, SearchSnapshot* snapshot);
 
   // Writes the position data for the node to stderr as a JSON object.
   void ReportRootPosition();
@@ -215,15 +237,24 @@ class MiniguiGtpClient : public GtpClient {
   void RefreshPendingWinRateEvals();
 
   // Callback invoked during the main tree search (not any of the
-  // WinRateEvaluator's searches). Calls ReportSearchStatus if the time since
-  // the time it called ReportSearchStatus is greater than
-  // report_search_interval_.
+  // WinRateEvaluator's searches). Records the path to the most recently
+  // selected leaf if search reports are enabled.
   void TreeSearchCb(const std::vector<const MctsNode*>& leaves);
 
   absl::Duration report_search_interval_;
-  absl::Time last_report_time_;
+
+  // Held by the GTP thread while it handles commands & ponders, except while
+  // the main tree search waits for inferences. The search_reporter_ takes a
+  // reader lock to read the search tree, variation_tree_ & live_moves_.
+  absl::Mutex tree_mutex_;
+
+  // The moves from the root to the leaf most recently selected by the main
+  // tree search.
+  std::vector<Coord> live_moves_ GUARDED_BY(&tree_mutex_);
+
   std::unique_ptr<VariationTree> variation_tree_;
   std::unique_ptr<WinRateEvaluator> win_rate_evaluator_;
+  std::unique_ptr<SearchReporter> search_reporter_;
 };
 
 }  // namespace minigo
@@ -0,0 +1,150 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/minigui_gtp_client.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_split.h"
+#include "cc/dual_net/fake_dual_net.h"
+#include "cc/json.h"
+#include "cc/zobrist.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+// Exposes MiniguiGtpClient's helper classes for testing.
+class TestableMiniguiGtpClient : public MiniguiGtpClient {
+ public:
+  using MiniguiGtpClient::VariationTree;
+  using MiniguiGtpClient::WinRateEvaluator;
+};
+
+using VariationTree = TestableMiniguiGtpClient::VariationTree;
+using WinRateEvaluator = TestableMiniguiGtpClient::WinRateEvaluator;
+
+class WinRateEvaluatorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    MctsPlayer::Options options;
+    options.virtual_losses = 1;
+    evaluator_ = absl::make_unique<WinRateEvaluator>(
+        64, 8, absl::make_unique<FakeDualNet>(),
+        std::make_shared<ThreadSafeInferenceCache>(1024, 1), Game::Options(),
+        options);
+  }
+
+  // Plays the moves from the start of the tree and returns the variation
+  // from the empty board to the resulting position.
+  std::vector<VariationTree::Node*> PlayVariation(
+      const std::vector<std::string>& moves) {
+    tree_.GoToStart();
+    for (const auto& move : moves) {
+      tree_.PlayMove(Coord::FromGtp(move, true));
+    }
+    std::vector<VariationTree::Node*> variation;
+    for (auto* node = tree_.current_node(); node != nullptr;
+         node = node->parent) {
+      variation.insert(variation.begin(), node);
+    }
+    return variation;
+  }
+
+  // Calls EvalNodes and returns the evaluation reported for each position,
+  // keyed by the position's id.
+  std::map<std::string, nlohmann::json> EvalNodes() {
+    testing::internal::CaptureStderr();
+    evaluator_->EvalNodes();
+    auto output = testing::internal::GetCapturedStderr();
+
+    std::map<std::string, nlohmann::json> result;
+    for (auto line : absl::StrSplit(output, '\n', absl::SkipEmpty())) {
+      const absl::string_view prefix = "mg-update:";
+      if (absl::StartsWith(line, prefix)) {
+        auto j = nlohmann::json::parse(line.substr(prefix.size()));
+        result[j["id"]] = j;
+      }
+    }
+    return result;
+  }
+
+  VariationTree tree_;
+  std::unique_ptr<WinRateEvaluator> evaluator_;
+};
+
+TEST_F(WinRateEvaluatorTest, AncestorsIncludeDescendantReads) {
+  auto variation = PlayVariation({"E5", "C3"});
+  ASSERT_TRUE(evaluator_->SetCurrentVariation(variation));
+
+  auto evals = EvalNodes();
+  ASSERT_EQ(3, evals.size());
+  int root_n = evals[variation[0]->id]["n"];
+  int middle_n = evals[variation[1]->id]["n"];
+  int leaf_n = evals[variation[2]->id]["n"];
+
+  // Each position is searched once. The reads made from a position are also
+  // counted by all the positions before it.
+  EXPECT_EQ(1, leaf_n);
+  EXPECT_EQ(2, middle_n);
+  EXPECT_EQ(3, root_n);
+
+  // Evaluation stops once every position has the requested number of reads.
+  int num_evals = 0;
+  while (!EvalNodes().empty()) {
+    ASSERT_GT(20, ++num_evals);
+  }
+  for (auto* node : variation) {
+    EXPECT_LE(8, node->num_eval_reads);
+  }
+}
+
+TEST_F(WinRateEvaluatorTest, IllegalMove) {
+  // The second E5 is illegal: only the positions before it are evaluated.
+  auto variation = PlayVariation({"E5", "C3", "E5", "D4"});
+  EXPECT_FALSE(evaluator_->SetCurrentVariation(variation));
+  auto evals = EvalNodes();
+  ASSERT_EQ(3, evals.size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(1, evals.count(variation[i]->id)) << i;
+  }
+
+  // Switching to a legal variation that shares the first moves works.
+  variation = PlayVariation({"E5", "C3", "D4"});
+  EXPECT_TRUE(evaluator_->SetCurrentVariation(variation));
+  evals = EvalNodes();
+  EXPECT_EQ(1, evals.count(variation.back()->id));
+}
+
+TEST_F(WinRateEvaluatorTest, MoveAfterGameOver) {
+  auto variation = PlayVariation({"pass", "pass", "E5"});
+  EXPECT_FALSE(evaluator_->SetCurrentVariation(variation));
+  auto evals = EvalNodes();
+  EXPECT_EQ(3, evals.size());
+  EXPECT_EQ(0, evals.count(variation.back()->id));
+}
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,237 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/minigui_search_report.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "absl/strings/string_view.h"
+#include "cc/json_writer.h"
+
+namespace minigo {
+
+namespace {
+
+// Maximum number of child variations included in each search report.
+// TODO(tommadams): Make the number of child variations sent back
+// configurable.
+constexpr int kMaxVariations = 10;
+
+// Appends the most visited path from node to path. Equivalent to
+// MctsNode::MostVisitedPath but reuses the path's storage.
+void AppendMostVisitedPath(const MctsNode* node, std::vector<Coord>* path) {
+  while (!node->children.empty()) {
+    Coord c = node->GetMostVisitedMove();
+    if (node->child_N(c) == 0) {
+      break;
+    }
+    path->push_back(c);
+    auto it = node->children.find(c);
+    if (it == node->children.end()) {
+      break;
+    }
+    node = it->second.get();
+  }
+}
+
+void WriteVariation(absl::string_view key, int n, float q,
+                    const std::vector<Coord>& moves, JsonWriter* writer) {
+  writer->Key(key);
+  writer->BeginObject();
+  writer->Key("n");
+  writer->Number(n);
+  writer->Key("q");
+  writer->Number(q);
+  writer->Key("moves");
+  writer->BeginArray();
+  for (const auto c : moves) {
+    writer->String(c.ToGtp());
+  }
+  writer->EndArray();
+  writer->EndObject();
+}
+
+// Writes the elements of values that differ from prev as a flattened array of
+// [index, value] pairs. Nothing is written if there are no differences.
+void WriteDiff(absl::string_view key,
+               const std::array<int, kNumMoves>& values,
+               const std::array<int, kNumMoves>& prev, JsonWriter* writer) {
+  if (values == prev) {
+    return;
+  }
+  writer->Key(key);
+  writer->BeginArray();
+  for (int i = 0; i < kNumMoves; ++i) {
+    if (values[i] != prev[i]) {
+      writer->Number(i);
+      writer->Number(values[i]);
+    }
+  }
+  writer->EndArray();
+}
+
+void WriteArray(absl::string_view key, const std::array<int, kNumMoves>& values,
+                JsonWriter* writer) {
+  writer->Key(key);
+  writer->BeginArray();
+  for (int x : values) {
+    writer->Number(x);
+  }
+  writer->EndArray();
+}
+
+}  // namespace
+
+void TakeSearchSnapshot(const MctsNode& root, const std::string& id,
+                        absl::Span<const Coord> live_moves,
+                        bool include_tree_stats, SearchSnapshot* snapshot) {
+  snapshot->id = id;
+  snapshot->n = root.N();
+  snapshot->q = root.Q();
+  for (int i = 0; i < kNumMoves; ++i) {
+    snapshot->child_N[i] = static_cast<int>(root.child_N(i));
+    snapshot->child_Q[i] = static_cast<int>(std::round(root.child_Q(i) * 1000));
+  }
+
+  // Select the most visited children. Only visited children are ranked and
+  // only the top kMaxVariations of those are sorted.
+  std::array<int, kNumMoves> ranked;
+  std::iota(ranked.begin(), ranked.end(), 0);
+  auto visited_end = std::partition(
+      ranked.begin(), ranked.end(),
+      [snapshot](int i) { return snapshot->child_N[i] > 0; });
+  int num_ranked = std::min<int>(kMaxVariations, visited_end - ranked.begin());
+  std::partial_sort(ranked.begin(), ranked.begin() + num_ranked, visited_end,
+                    [&root, snapshot](int a, int b) {
+                      if (snapshot->child_N[a] != snapshot->child_N[b]) {
+                        return snapshot->child_N[a] > snapshot->child_N[b];
+                      }
+                      return root.child_P(a) > root.child_P(b);
+                    });
+
+  if (static_cast<int>(snapshot->variations.size()) < num_ranked) {
+    snapshot->variations.resize(num_ranked);
+  }
+  snapshot->num_variations = 0;
+  for (int i = 0; i < num_ranked; ++i) {
+    Coord c = ranked[i];
+    const auto child_it = root.children.find(c);
+    if (child_it == root.children.end()) {
+      break;
+    }
+    auto& variation = snapshot->variations[snapshot->num_variations++];
+    variation.c = c;
+    variation.n = snapshot->child_N[c];
+    variation.q = root.child_Q(c);
+    variation.moves.clear();
+    variation.moves.push_back(c);
+    AppendMostVisitedPath(child_it->second.get(), &variation.moves);
+  }
+
+  // Current live search variation.
+  auto& live = snapshot->live;
+  live.moves.clear();
+  const MctsNode* node = &root;
+  for (Coord c : live_moves) {
+    auto it = node->children.find(c);
+    if (it == node->children.end()) {
+      break;
+    }
+    if (node == &root) {
+      live.n = root.child_N(c);
+      live.q = root.child_Q(c);
+    }
+    live.moves.push_back(c);
+    node = it->second.get();
+  }
+  snapshot->has_live = !live.moves.empty();
+
+  snapshot->has_tree_stats = include_tree_stats;
+  if (include_tree_stats) {
+    snapshot->tree_stats = root.CalculateTreeStats();
+  }
+
+  // Reports that include the tree stats are only made at the start of a
+  // genmove, so always send them in full.
+  snapshot->force_full = include_tree_stats;
+}
+
+SearchReportFormatter::SearchReportFormatter() {
+  prev_child_N_.fill(0);
+  prev_child_Q_.fill(0);
+}
+
+void SearchReportFormatter::Format(const SearchSnapshot& snapshot,
+                                   std::string* out) {
+  bool full = snapshot.force_full || snapshot.id != prev_id_ ||
+              num_delta_reports_ >= kMaxDeltaReports;
+
+  out->clear();
+  JsonWriter writer(out);
+  writer.BeginObject();
+  writer.Key("id");
+  writer.String(snapshot.id);
+  writer.Key("n");
+  writer.Number(snapshot.n);
+  writer.Key("q");
+  writer.Number(snapshot.q);
+
+  if (snapshot.num_variations > 0 || snapshot.has_live) {
+    writer.Key("variations");
+    writer.BeginObject();
+    for (int i = 0; i < snapshot.num_variations; ++i) {
+      const auto& variation = snapshot.variations[i];
+      WriteVariation(variation.c.ToGtp(), variation.n, variation.q,
+                     variation.moves, &writer);
+    }
+    if (snapshot.has_live) {
+      const auto& live = snapshot.live;
+      WriteVariation("live", live.n, live.q, live.moves, &writer);
+    }
+    writer.EndObject();
+  }
+
+  if (full) {
+    WriteArray("childN", snapshot.child_N, &writer);
+    WriteArray("childQ", snapshot.child_Q, &writer);
+    num_delta_reports_ = 0;
+  } else {
+    WriteDiff("childNDiff", snapshot.child_N, prev_child_N_, &writer);
+    WriteDiff("childQDiff", snapshot.child_Q, prev_child_Q_, &writer);
+    num_delta_reports_ += 1;
+  }
+  prev_id_ = snapshot.id;
+  prev_child_N_ = snapshot.child_N;
+  prev_child_Q_ = snapshot.child_Q;
+
+  if (snapshot.has_tree_stats) {
+    writer.Key("treeStats");
+    writer.BeginObject();
+    writer.Key("numNodes");
+    writer.Number(snapshot.tree_stats.num_nodes);
+    writer.Key("numLeafNodes");
+    writer.Number(snapshot.tree_stats.num_leaf_nodes);
+    writer.Key("maxDepth");
+    writer.Number(snapshot.tree_stats.max_depth);
+    writer.Key("numBytes");
+    writer.Number(snapshot.tree_stats.num_bytes);
+    writer.EndObject();
+  }
+
+  writer.EndObject();
+}
+
+}  // namespace minigo
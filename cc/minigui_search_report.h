@@ -0,0 +1,99 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_MINIGUI_SEARCH_REPORT_H_
+#define CC_MINIGUI_SEARCH_REPORT_H_
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "absl/types/span.h"
+#include "cc/constants.h"
+#include "cc/coord.h"
+#include "cc/mcts_node.h"
+
+namespace minigo {
+
+// A copy of the search statistics that are reported to Minigui. Snapshots are
+// reused between reports so that taking one doesn't allocate once the buffers
+// have grown to size.
+struct SearchSnapshot {
+  struct Variation {
+    Coord c = Coord::kInvalid;
+    int n = 0;
+    float q = 0;
+    std::vector<Coord> moves;
+  };
+
+  std::string id;
+  int n = 0;
+  float q = 0;
+  std::array<int, kNumMoves> child_N;
+
+  // Child Q values, scaled by 1000 and rounded to integers.
+  std::array<int, kNumMoves> child_Q;
+
+  // The principal variations of the most visited children, in rank order.
+  // Only the first num_variations elements are valid.
+  std::vector<Variation> variations;
+  int num_variations = 0;
+
+  // The path from the root to the most recently selected leaf.
+  bool has_live = false;
+  Variation live;
+
+  bool has_tree_stats = false;
+  MctsNode::TreeStats tree_stats;
+
+  // If true, the full childN & childQ arrays are written instead of just
+  // the values that changed since the previous report.
+  bool force_full = false;
+};
+
+// Copies the search statistics of the tree rooted at `root` into `snapshot`.
+// `live_moves` is the sequence of moves from the root to the most recently
+// selected leaf: the live variation stops at the first move that isn't in the
+// tree. Calculating the tree stats requires a walk over the whole tree, so is
+// optional.
+void TakeSearchSnapshot(const MctsNode& root, const std::string& id,
+                        absl::Span<const Coord> live_moves,
+                        bool include_tree_stats, SearchSnapshot* snapshot);
+
+// Formats search snapshots as the JSON objects written in Minigui's
+// "mg-update" messages. To reduce the amount of data sent, childN & childQ
+// are written as deltas from the previous snapshot for the same position.
+class SearchReportFormatter {
+ public:
+  // Maximum number of consecutive reports for a position that send only the
+  // childN & childQ values that changed. After this many delta reports, the
+  // full arrays are sent again so that a frontend that missed a report (for
+  // example because the page was reloaded) resynchronizes.
+  static constexpr int kMaxDeltaReports = 10;
+
+  SearchReportFormatter();
+
+  // Replaces the contents of `out` with the JSON object for `snapshot`.
+  void Format(const SearchSnapshot& snapshot, std::string* out);
+
+ private:
+  std::string prev_id_;
+  std::array<int, kNumMoves> prev_child_N_;
+  std::array<int, kNumMoves> prev_child_Q_;
+  int num_delta_reports_ = 0;
+};
+
+}  // namespace minigo
+
+#endif  // CC_MINIGUI_SEARCH_REPORT_H_
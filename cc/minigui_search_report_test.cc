@@ -0,0 +1,195 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/minigui_search_report.h"
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "cc/json.h"
+#include "cc/test_utils.h"
+#include "cc/zobrist.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+std::vector<Coord> Moves(const std::vector<std::string>& strs) {
+  std::vector<Coord> moves;
+  for (const auto& str : strs) {
+    moves.push_back(Coord::FromString(str));
+  }
+  return moves;
+}
+
+SearchSnapshot EmptySnapshot(const std::string& id) {
+  SearchSnapshot snapshot;
+  snapshot.id = id;
+  snapshot.child_N.fill(0);
+  snapshot.child_Q.fill(0);
+  return snapshot;
+}
+
+TEST(SearchReportTest, TakeSearchSnapshot) {
+  std::array<float, kNumMoves> probs;
+  probs.fill(1.0 / kNumMoves);
+
+  MctsNode::EdgeStats root_stats;
+  MctsNode root(&root_stats, TestablePosition(""));
+  root.IncorporateResults(0, probs, 0, &root);
+
+  auto* a = root.MaybeAddChild(Coord::FromString("C3"));
+  a->IncorporateResults(0, probs, 0.5, &root);
+  a->BackupValue(0.5, &root);
+  auto* b = a->MaybeAddChild(Coord::FromString("D4"));
+  b->IncorporateResults(0, probs, 0.5, &root);
+  auto* c = root.MaybeAddChild(Coord::FromString("E5"));
+  c->IncorporateResults(0, probs, -0.5, &root);
+
+  SearchSnapshot snapshot;
+  TakeSearchSnapshot(root, "x", Moves({"C3", "D4", "A1"}), true, &snapshot);
+
+  EXPECT_EQ("x", snapshot.id);
+  EXPECT_EQ(5, snapshot.n);
+  EXPECT_EQ(3, snapshot.child_N[Coord::FromString("C3")]);
+  EXPECT_EQ(1, snapshot.child_N[Coord::FromString("E5")]);
+  EXPECT_EQ(0, snapshot.child_N[Coord::FromString("A1")]);
+  EXPECT_EQ(static_cast<int>(std::round(root.child_Q(c->move) * 1000)),
+            snapshot.child_Q[c->move]);
+
+  // The variations are ordered by visit count.
+  ASSERT_EQ(2, snapshot.num_variations);
+  EXPECT_EQ(a->move, snapshot.variations[0].c);
+  EXPECT_EQ(3, snapshot.variations[0].n);
+  EXPECT_EQ(Moves({"C3", "D4"}), snapshot.variations[0].moves);
+  EXPECT_EQ(c->move, snapshot.variations[1].c);
+  EXPECT_EQ(Moves({"E5"}), snapshot.variations[1].moves);
+
+  // The live variation stops at the first move that isn't in the tree.
+  ASSERT_TRUE(snapshot.has_live);
+  EXPECT_EQ(3, snapshot.live.n);
+  EXPECT_EQ(Moves({"C3", "D4"}), snapshot.live.moves);
+
+  ASSERT_TRUE(snapshot.has_tree_stats);
+  EXPECT_EQ(4, snapshot.tree_stats.num_nodes);
+  EXPECT_TRUE(snapshot.force_full);
+
+  // Taking another snapshot reuses the buffers.
+  TakeSearchSnapshot(root, "x", {}, false, &snapshot);
+  EXPECT_EQ(2, snapshot.num_variations);
+  EXPECT_FALSE(snapshot.has_live);
+  EXPECT_FALSE(snapshot.has_tree_stats);
+  EXPECT_FALSE(snapshot.force_full);
+}
+
+TEST(SearchReportTest, DeltaReports) {
+  SearchReportFormatter formatter;
+  std::string out;
+
+  // The first report for a position sends the full arrays.
+  auto snapshot = EmptySnapshot("x");
+  snapshot.child_N[3] = 2;
+  snapshot.child_Q[3] = 500;
+  formatter.Format(snapshot, &out);
+  auto j = nlohmann::json::parse(out);
+  EXPECT_EQ("x", j["id"]);
+  ASSERT_EQ(kNumMoves, j["childN"].size());
+  ASSERT_EQ(kNumMoves, j["childQ"].size());
+  EXPECT_EQ(2, j["childN"][3]);
+  EXPECT_EQ(500, j["childQ"][3]);
+  EXPECT_EQ(0, j.count("childNDiff"));
+
+  // Later reports only send the values that changed, as [index, value] pairs.
+  snapshot.child_N[3] = 3;
+  snapshot.child_N[5] = 1;
+  snapshot.child_Q[5] = -250;
+  formatter.Format(snapshot, &out);
+  j = nlohmann::json::parse(out);
+  EXPECT_EQ(0, j.count("childN"));
+  EXPECT_EQ(0, j.count("childQ"));
+  EXPECT_EQ(std::vector<int>({3, 3, 5, 1}),
+            j["childNDiff"].get<std::vector<int>>());
+  EXPECT_EQ(std::vector<int>({5, -250}),
+            j["childQDiff"].get<std::vector<int>>());
+
+  // Nothing is sent for arrays that haven't changed.
+  formatter.Format(snapshot, &out);
+  j = nlohmann::json::parse(out);
+  EXPECT_EQ(0, j.count("childNDiff"));
+  EXPECT_EQ(0, j.count("childQDiff"));
+  EXPECT_EQ(0, j.count("childN"));
+
+  // The full arrays are sent again for a different position.
+  auto other = EmptySnapshot("y");
+  formatter.Format(other, &out);
+  j = nlohmann::json::parse(out);
+  EXPECT_EQ(kNumMoves, j["childN"].size());
+
+  // Switching back to the first position also sends the full arrays.
+  formatter.Format(snapshot, &out);
+  j = nlohmann::json::parse(out);
+  EXPECT_EQ(kNumMoves, j["childN"].size());
+  formatter.Format(snapshot, &out);
+  j = nlohmann::json::parse(out);
+  EXPECT_EQ(0, j.count("childN"));
+
+  // And when forced.
+  snapshot.force_full = true;
+  formatter.Format(snapshot, &out);
+  j = nlohmann::json::parse(out);
+  EXPECT_EQ(kNumMoves, j["childN"].size());
+}
+
+TEST(SearchReportTest, FullReportsAreSentPeriodically) {
+  SearchReportFormatter formatter;
+  std::string out;
+  auto snapshot = EmptySnapshot("x");
+  formatter.Format(snapshot, &out);
+  for (int i = 0; i < SearchReportFormatter::kMaxDeltaReports; ++i) {
+    snapshot.child_N[0] += 1;
+    formatter.Format(snapshot, &out);
+    auto j = nlohmann::json::parse(out);
+    EXPECT_EQ(0, j.count("childN")) << i;
+    EXPECT_EQ(1, j.count("childNDiff")) << i;
+  }
+  formatter.Format(snapshot, &out);
+  auto j = nlohmann::json::parse(out);
+  EXPECT_EQ(kNumMoves, j["childN"].size());
+}
+
+TEST(SearchReportTest, NonFiniteValuesAreValidJson) {
+  SearchReportFormatter formatter;
+  std::string out;
+  auto snapshot = EmptySnapshot("x");
+  snapshot.q = std::numeric_limits<float>::quiet_NaN();
+  snapshot.has_live = true;
+  snapshot.live.q = std::numeric_limits<float>::infinity();
+  snapshot.live.moves = Moves({"C3"});
+  formatter.Format(snapshot, &out);
+  auto j = nlohmann::json::parse(out);
+  EXPECT_TRUE(j["q"].is_null());
+  EXPECT_TRUE(j["variations"]["live"]["q"].is_null());
+}
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  return RUN_ALL_TESTS();
+}
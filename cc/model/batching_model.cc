@@ -19,7 +19,10 @@
 #include "absl/memory/memory.h"
 #include "absl/time/clock.h"
 #include "cc/logging.h"
-#include "wtf/macros.h"
+#include "cc/memory_accounting.h"
+#include "cc/metrics.h"
+#include "cc/thread.h"
+#include "cc/tracing.h"
 
 namespace minigo {
 
@@ -44,17 +47,19 @@ void ModelBatcher::EndGame() {
   MaybeRunBatchesLocked();
 }
 
-void ModelBatcher::RunMany(ModelBatcher* other_batcher,
+bool ModelBatcher::RunMany(ModelBatcher* other_batcher,
                            const std::vector<const ModelInput*>& inputs,
                            std::vector<ModelOutput*>* outputs,
-                           std::string* model_name) {
+                           std::string* model_name, absl::Time deadline) {
   WTF_SCOPE("ModelBatcher::RunMany", size_t)(inputs.size());
 
   absl::Notification notification;
 
   {
-    absl::MutexLock lock(&mutex_);
-    queue_.push({other_batcher, &inputs, outputs, model_name, &notification});
+    TimedMutexLock lock(&mutex_);
+    stats_.lock_wait_time += lock.wait_time();
+    queue_.push_back({other_batcher, &inputs, outputs, model_name,
+                      &notification, absl::Now()});
     if (other_batcher != nullptr) {
       other_batcher->num_waiting_ += 1;
     }
@@ -62,11 +67,35 @@ void ModelBatcher::RunMany(ModelBatcher* other_batcher,
   }
 
   if (other_batcher != nullptr) {
-    absl::MutexLock lock(&other_batcher->mutex_);
+    TimedMutexLock lock(&other_batcher->mutex_);
+    other_batcher->stats_.lock_wait_time += lock.wait_time();
     other_batcher->MaybeRunBatchesLocked();
   }
 
+  if (notification.WaitForNotificationWithDeadline(deadline)) {
+    return true;
+  }
+
+  // The deadline passed before the request was run. If it's still queued,
+  // remove it so that it never runs.
+  {
+    absl::MutexLock lock(&mutex_);
+    for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+      if (it->notification == &notification) {
+        queue_.erase(it);
+        if (other_batcher != nullptr) {
+          other_batcher->num_waiting_ -= 1;
+        }
+        stats_.num_cancelled += 1;
+        return false;
+      }
+    }
+  }
+
+  // The request is part of a batch that's already running. The batch holds
+  // pointers to our inputs & outputs, so we must wait for it to finish.
   notification.WaitForNotification();
+  return true;
 }
 
 BatchingModelStats ModelBatcher::FlushStats() {
@@ -84,7 +113,8 @@ size_t ModelBatcher::GetBatchSize() const {
 void ModelBatcher::MaybeRunBatchesLocked() {
   while (!queue_.empty()) {
     auto queue_size = queue_.size();
-    if (queue_size < GetBatchSize()) {
+    bool small_batch = queue_size < GetBatchSize();
+    if (small_batch) {
       // The queue doesn't have enough requests to fill a batch: see if we
       // can run a smaller batch instead.
       //
@@ -108,12 +138,26 @@ void ModelBatcher::MaybeRunBatchesLocked() {
       }
     }
 
-    RunBatch();
+    RunBatch(small_batch);
   }
 }
 
-void ModelBatcher::RunBatch() {
+void ModelBatcher::RunBatch(bool small_batch) {
   WTF_SCOPE0("ModelBatcher::RunBatch");
+  static auto* queue_wait_hist = metrics::GetHistogram(
+      "batcher_queue_wait_us",
+      "Time inference requests spend queued before their batch runs.");
+  static auto* batch_size_hist = metrics::GetHistogram(
+      "batcher_batch_size", "Number of inferences in each batch.");
+  static auto* run_many_hist = metrics::GetHistogram(
+      "batcher_run_many_us", "Time taken to run inference on each batch.");
+  static auto* num_full_batches = metrics::GetCounter(
+      "batcher_batches_total{reason=\"full\"}",
+      "Number of batches run, by the reason the batch was run.");
+  static auto* num_small_batches = metrics::GetCounter(
+      "batcher_batches_total{reason=\"small\"}",
+      "Number of batches run, by the reason the batch was run.");
+
   auto run_batch_start_time = absl::Now();
 
   auto batch_size = GetBatchSize();
@@ -132,14 +176,24 @@ void ModelBatcher::RunBatch() {
     std::copy_n(inference.outputs->begin(), num_features,
                 std::back_inserter(outputs));
     inferences.push_back(inference);
+    auto queue_wait = run_batch_start_time - inference.enqueue_time;
+    queue_wait_hist->RecordDuration(queue_wait);
+    stats_.queue_wait_us.RecordDuration(queue_wait);
 
-    queue_.pop();
+    queue_.pop_front();
   }
 
   num_batches_ += 1;
   num_inferences_ += inputs.size();
   auto num_inferences_in_batch = inputs.size();
 
+  // The features & outputs themselves are owned by the clients, so the batch
+  // only accounts for its arrays of pointers to them.
+  memory::TrackedBytes<memory::Category::kModelBuffers> batch_bytes;
+  batch_bytes.Set(inputs.capacity() * sizeof(inputs[0]) +
+                  outputs.capacity() * sizeof(outputs[0]) +
+                  inferences.capacity() * sizeof(inferences[0]));
+
   // Unlock the mutex while running inference. This allows more inferences
   // to be enqueued while inference is running.
   mutex_.Unlock();
@@ -150,6 +204,9 @@ void ModelBatcher::RunBatch() {
   MG_CHECK(inputs.size() == outputs.size());
   model_impl_->RunMany(inputs, &outputs, &model_name);
   auto run_many_time = absl::Now() - run_many_start_time;
+  batch_size_hist->Record(num_inferences_in_batch);
+  run_many_hist->RecordDuration(run_many_time);
+  (small_batch ? num_small_batches : num_full_batches)->Increment();
 
   for (auto& inference : inferences) {
     if (inference.model_name != nullptr) {
@@ -174,6 +231,13 @@ void ModelBatcher::RunBatch() {
       (absl::Now() - run_batch_start_time) / model_impl_->buffer_count();
   stats_.run_many_time += (run_many_time) / model_impl_->buffer_count();
   stats_.num_inferences += num_inferences_in_batch;
+  stats_.batch_size.Record(num_inferences_in_batch);
+  stats_.run_many_us.RecordDuration(run_many_time);
+  if (small_batch) {
+    stats_.num_small_batches += 1;
+  } else {
+    stats_.num_full_batches += 1;
+  }
 }
 
 }  // namespace internal
@@ -185,7 +249,16 @@ BatchingModel::BatchingModel(std::shared_ptr<internal::ModelBatcher> batcher)
 void BatchingModel::RunMany(const std::vector<const ModelInput*>& inputs,
                             std::vector<ModelOutput*>* outputs,
                             std::string* model) {
-  batcher_->RunMany(other_batcher_.get(), inputs, outputs, model);
+  batcher_->RunMany(other_batcher_.get(), inputs, outputs, model,
+                    absl::InfiniteFuture());
+}
+
+bool BatchingModel::RunManyWithDeadline(
+    const std::vector<const ModelInput*>& inputs,
+    std::vector<ModelOutput*>* outputs, std::string* model,
+    absl::Time deadline) {
+  return batcher_->RunMany(other_batcher_.get(), inputs, outputs, model,
+                           deadline);
 }
 
 void BatchingModel::StartGame() { batcher_->StartGame(); }
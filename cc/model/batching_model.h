@@ -16,8 +16,8 @@
 #define CC_MODEL_BATCHING_MODEL_H_
 
 #include <atomic>
+#include <deque>
 #include <memory>
-#include <queue>
 #include <string>
 #include <vector>
 
@@ -25,6 +25,7 @@
 #include "absl/synchronization/mutex.h"
 #include "absl/synchronization/notification.h"
 #include "absl/time/time.h"
+#include "cc/metrics.h"
 #include "cc/model/model.h"
 
 namespace minigo {
@@ -33,9 +34,28 @@ struct BatchingModelStats {
   explicit BatchingModelStats(size_t buffer_count)
       : buffer_count(buffer_count) {}
   size_t num_inferences = 0;
+  size_t num_cancelled = 0;
   size_t buffer_count = 0;
   absl::Duration run_batch_time;
   absl::Duration run_many_time;
+
+  // Time RunMany callers spent blocked waiting to acquire the batcher's lock.
+  absl::Duration lock_wait_time;
+
+  // Number of batches that were run because the queue had enough requests to
+  // fill a batch, and number of smaller batches that were run because all the
+  // batcher's clients were either queued or waiting for their opponent.
+  size_t num_full_batches = 0;
+  size_t num_small_batches = 0;
+
+  // Number of inferences in each batch.
+  metrics::Distribution batch_size;
+
+  // Time in microseconds that each request spent queued before its batch ran.
+  metrics::Distribution queue_wait_us;
+
+  // Time in microseconds that the model took to run each batch.
+  metrics::Distribution run_many_us;
 };
 
 namespace internal {
@@ -55,6 +75,7 @@ class ModelBatcher {
     std::vector<ModelOutput*>* outputs;
     std::string* model_name;
     absl::Notification* notification;
+    absl::Time enqueue_time;
   };
 
   // model_impl: the model that will evaluate the batched inferences.
@@ -68,20 +89,29 @@ class ModelBatcher {
 
   void StartGame() LOCKS_EXCLUDED(&mutex_);
   void EndGame() LOCKS_EXCLUDED(&mutex_);
-  void RunMany(ModelBatcher* other_batcher,
+
+  // Queues an inference request and blocks until it has been run as part of a
+  // batch, or until `deadline` passes. Returns false if the request was
+  // cancelled because it was still queued when the deadline passed. A request
+  // that has already been included in a running batch can't be cancelled, so
+  // RunMany waits for it to finish and returns true.
+  bool RunMany(ModelBatcher* other_batcher,
                const std::vector<const ModelInput*>& inputs,
-               std::vector<ModelOutput*>* outputs, std::string* model_name);
+               std::vector<ModelOutput*>* outputs, std::string* model_name,
+               absl::Time deadline);
   BatchingModelStats FlushStats() LOCKS_EXCLUDED(&mutex_);
 
  private:
   size_t GetBatchSize() const EXCLUSIVE_LOCKS_REQUIRED(&mutex_);
 
   void MaybeRunBatchesLocked() EXCLUSIVE_LOCKS_REQUIRED(&mutex_);
-  void RunBatch() EXCLUSIVE_LOCKS_REQUIRED(&mutex_);
+  // `small_batch` is true if the batch is being run by the small batch rule in
+  // MaybeRunBatchesLocked rather than because the queue is full.
+  void RunBatch(bool small_batch) EXCLUSIVE_LOCKS_REQUIRED(&mutex_);
 
   absl::Mutex mutex_;
   std::unique_ptr<Model> model_impl_;
-  std::queue<InferenceRequest> queue_ GUARDED_BY(&mutex_);
+  std::deque<InferenceRequest> queue_ GUARDED_BY(&mutex_);
   BatchingModelStats stats_ GUARDED_BY(&mutex_);
 
   // Number of clients of this batcher that are playing in a two player game
@@ -112,6 +142,11 @@ class BatchingModel : public Model {
                std::vector<ModelOutput*>* outputs,
                std::string* model_name) override;
 
+  bool RunManyWithDeadline(const std::vector<const ModelInput*>& inputs,
+                           std::vector<ModelOutput*>* outputs,
+                           std::string* model_name,
+                           absl::Time deadline) override;
+
   void StartGame();
   void EndGame();
   void SetOther(BatchingModel* other);
@@ -22,6 +22,7 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/memory/memory.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
 #include "cc/model/buffered_model.h"
 #include "cc/model/model.h"
 #include "gmock/gmock.h"
@@ -208,6 +209,10 @@ class BatchingModelTest : public ::testing::Test {
     model_factory_->FlushBatch(model_descriptor, expected_batch_size);
   }
 
+  std::vector<std::pair<std::string, BatchingModelStats>> FlushStats() {
+    return batcher_->FlushStats();
+  }
+
  private:
   // Owned by batcher_.
   WaitingModelFactory* model_factory_ = nullptr;
@@ -302,5 +307,91 @@ TEST_F(BatchingModelTest, EvalDoubleBuffer) {
   }
 }
 
+TEST_F(BatchingModelTest, CancelQueuedRequest) {
+  InitFactory(1);
+
+  ModelInput input_a, input_b;
+  ModelOutput output_a, output_b;
+  std::vector<const ModelInput*> inputs_a = {&input_a};
+  std::vector<const ModelInput*> inputs_b = {&input_b};
+  std::vector<ModelOutput*> outputs_a = {&output_a};
+  std::vector<ModelOutput*> outputs_b = {&output_b};
+
+  auto model_a = NewModel("a");
+  auto model_b = NewModel("a");
+  StartGame(model_a.get(), model_a.get());
+  StartGame(model_b.get(), model_b.get());
+
+  // There are two active games, so a batch can't run until both have made an
+  // inference request. model_a's request should be cancelled when its
+  // deadline passes.
+  EXPECT_FALSE(model_a->RunManyWithDeadline(inputs_a, &outputs_a, nullptr,
+                                            absl::Now() + absl::Milliseconds(1)));
+
+  // Cancelling model_a's request should have removed it from the queue: the
+  // batcher should now be waiting for model_a to make another request before
+  // running model_b's request.
+  std::thread thread([&] {
+    EXPECT_TRUE(model_b->RunManyWithDeadline(inputs_b, &outputs_b, nullptr,
+                                             absl::InfiniteFuture()));
+  });
+
+  // Ending model_a's game unblocks model_b's request, which should be run on
+  // its own. If model_b's request is already queued, the batch runs on the
+  // thread that ends the game, so end it on another thread to avoid blocking
+  // the FlushBatch call that lets the batch finish.
+  std::thread end_game([&] { EndGame(model_a.get(), model_a.get()); });
+  FlushBatch("a", 1);
+  end_game.join();
+  thread.join();
+  EndGame(model_b.get(), model_b.get());
+}
+
+TEST_F(BatchingModelTest, FlushStats) {
+  InitFactory(1);
+
+  ModelInput input;
+  ModelOutput output;
+  std::vector<const ModelInput*> inputs = {&input};
+  std::vector<ModelOutput*> outputs = {&output};
+
+  // In a two player game where both players use the same model, black's
+  // request is run as a small batch because the batcher knows that white is
+  // waiting for it.
+  auto black = NewModel("a");
+  auto white = NewModel("a");
+  StartGame(black.get(), white.get());
+  std::thread thread([&] { black->RunMany(inputs, &outputs, nullptr); });
+  FlushBatch("a", 1);
+  thread.join();
+  EndGame(black.get(), white.get());
+
+  // In a self-play game, a single request fills the batch.
+  auto model = NewModel("a");
+  StartGame(model.get(), model.get());
+  thread = std::thread([&] { model->RunMany(inputs, &outputs, nullptr); });
+  FlushBatch("a", 1);
+  thread.join();
+  EndGame(model.get(), model.get());
+
+  auto all_stats = FlushStats();
+  ASSERT_EQ(1, all_stats.size());
+  EXPECT_EQ("a", all_stats[0].first);
+  const auto& stats = all_stats[0].second;
+  EXPECT_EQ(2, stats.num_inferences);
+  EXPECT_EQ(1, stats.num_full_batches);
+  EXPECT_EQ(1, stats.num_small_batches);
+  EXPECT_EQ(2, stats.batch_size.count());
+  EXPECT_EQ(1, stats.batch_size.Percentile(100));
+  EXPECT_EQ(2, stats.queue_wait_us.count());
+  EXPECT_EQ(2, stats.run_many_us.count());
+
+  // Flushing the stats resets them.
+  all_stats = FlushStats();
+  ASSERT_EQ(1, all_stats.size());
+  EXPECT_EQ(0, all_stats[0].second.batch_size.count());
+  EXPECT_EQ(0, all_stats[0].second.num_full_batches);
+}
+
 }  // namespace
 }  // namespace minigo
@@ -18,7 +18,8 @@ namespace minigo {
 
 BufferedModel::BufferedModel(std::vector<std::unique_ptr<Model>> impls)
     : Model(impls[0]->name(), impls[0]->feature_descriptor(),
-            static_cast<int>(impls.size())) {
+            static_cast<int>(impls.size())),
+      impls_(impls.size()) {
   for (auto& x : impls) {
     // Make sure all impls use the same name & input features.
     MG_CHECK(x->name() == name());
@@ -26,7 +27,7 @@ BufferedModel::BufferedModel(std::vector<std::unique_ptr<Model>> impls)
              feature_descriptor().set_bytes);
     MG_CHECK(x->feature_descriptor().set_floats ==
              feature_descriptor().set_floats);
-    impls_.Push(std::move(x));
+    MG_CHECK(impls_.TryPush(std::move(x)));
   }
 }
 
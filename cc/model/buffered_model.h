@@ -20,7 +20,7 @@
 #include <vector>
 
 #include "cc/model/model.h"
-#include "cc/thread_safe_queue.h"
+#include "cc/mpmc_queue.h"
 
 namespace minigo {
 
@@ -33,7 +33,7 @@ class BufferedModel : public Model {
                std::string* model_name) override;
 
  private:
-  ThreadSafeQueue<std::unique_ptr<Model>> impls_;
+  MpmcQueue<std::unique_ptr<Model>> impls_;
 };
 
 }  // namespace minigo
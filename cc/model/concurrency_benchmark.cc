@@ -0,0 +1,314 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Multi-threaded benchmarks for the structures shared between all game
+// threads: ThreadSafeInferenceCache and the ModelBatcher behind
+// BatchingModel.
+//
+// Each benchmark iteration starts its own threads, which all run a fixed
+// amount of work. Google Benchmark's own ->Threads() isn't used because a
+// thread that has finished its iterations must also stop being a client of the
+// batcher, otherwise the remaining threads would wait forever for it to
+// submit its next inference request.
+//
+// Besides throughput, every benchmark reports the p50 & p99 latency of the
+// individual operations and the average time spent waiting to acquire locks.
+//
+// Run with:
+//   bazel run -c opt cc/model:concurrency_benchmark
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "benchmark/benchmark.h"
+#include "cc/constants.h"
+#include "cc/model/batching_model.h"
+#include "cc/model/inference_cache.h"
+#include "cc/model/model.h"
+#include "cc/random.h"
+#include "cc/symmetries.h"
+#include "cc/zobrist.h"
+
+namespace minigo {
+namespace {
+
+// Inference cache parameters. The cache is large enough relative to the set
+// of hot keys that lookups hit at close to the requested ratio, even though
+// every miss merges a new key into the cache. The actual hit ratio is
+// reported by the benchmark.
+constexpr int kCacheCapacity = 1 << 16;
+constexpr int kNumHotKeys = 1 << 10;
+constexpr int kCacheOpsPerThread = 1024;
+
+// Only the latency of every kLatencySampleRate'th cache operation is
+// measured, to keep the cost of reading the clock out of the throughput.
+constexpr int kLatencySampleRate = 16;
+
+// Batcher parameters. Each RunMany call requests kVirtualLosses inferences,
+// like an MctsPlayer with the default number of virtual losses.
+constexpr int kVirtualLosses = 8;
+constexpr int kRunsPerClient = 64;
+
+// Collects latency samples and reports their percentiles.
+class Latencies {
+ public:
+  void Add(absl::Duration d) {
+    samples_.push_back(absl::ToInt64Nanoseconds(d));
+  }
+
+  void Append(const Latencies& other) {
+    samples_.insert(samples_.end(), other.samples_.begin(),
+                    other.samples_.end());
+  }
+
+  void Clear() { samples_.clear(); }
+
+  // Sets the p50_ns & p99_ns counters.
+  void SetCounters(benchmark::State& state) {
+    if (samples_.empty()) {
+      return;
+    }
+    std::sort(samples_.begin(), samples_.end());
+    state.counters["p50_ns"] = samples_[samples_.size() * 50 / 100];
+    state.counters["p99_ns"] = samples_[samples_.size() * 99 / 100];
+  }
+
+ private:
+  std::vector<int64_t> samples_;
+};
+
+// Runs `fn(i)` on `num_threads` threads, where `i` is the thread's index.
+// Returns the wall time between starting the threads and the last one
+// finishing.
+template <typename F>
+absl::Duration RunThreads(int num_threads, const F& fn) {
+  absl::Notification start;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&start, &fn, i]() {
+      start.WaitForNotification();
+      fn(i);
+    });
+  }
+
+  auto start_time = absl::Now();
+  start.Notify();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return absl::Now() - start_time;
+}
+
+// Reports the average lock wait time per operation.
+void SetLockWaitCounter(benchmark::State& state, absl::Duration lock_wait_time,
+                        int64_t num_ops) {
+  state.counters["lock_wait_ns/op"] =
+      absl::ToDoubleNanoseconds(lock_wait_time) / std::max<int64_t>(1, num_ops);
+}
+
+// Benchmark arguments: {num_threads, num_shards, hit_percent}.
+// Every operation looks up a key in the cache and, on a miss, merges it into
+// the cache as if inference had been run.
+void BM_InferenceCache(benchmark::State& state) {
+  int num_threads = state.range(0);
+  int num_shards = state.range(1);
+  int hit_percent = state.range(2);
+
+  ThreadSafeInferenceCache cache(kCacheCapacity, num_shards);
+  Random rnd(614944751, 0);
+  std::vector<InferenceCache::Key> hot_keys;
+  ModelOutput output;
+  for (int i = 0; i < kNumHotKeys; ++i) {
+    hot_keys.push_back(InferenceCache::Key::CreateTestKey(
+        rnd.UniformUint64(), rnd.UniformUint64()));
+    cache.Merge(hot_keys.back(), symmetry::kIdentity, symmetry::kIdentity,
+                &output);
+  }
+  auto initial_stats = cache.GetStats();
+
+  std::vector<Latencies> thread_latencies(num_threads);
+  Latencies latencies;
+  int stream = 1;
+  for (auto _ : state) {
+    auto elapsed = RunThreads(num_threads, [&](int thread_id) {
+      // Use a different random stream for every thread of every iteration, so
+      // that keys that missed in one iteration aren't looked up again in the
+      // next.
+      Random rnd(614944751, stream + thread_id);
+      auto* samples = &thread_latencies[thread_id];
+      ModelOutput output;
+      for (int i = 0; i < kCacheOpsPerThread; ++i) {
+        auto key = rnd.UniformInt(0, 99) < hit_percent
+                       ? hot_keys[rnd.UniformInt(0, kNumHotKeys - 1)]
+                       : InferenceCache::Key::CreateTestKey(
+                             rnd.UniformUint64(), rnd.UniformUint64());
+
+        bool sample = i % kLatencySampleRate == 0;
+        absl::Time start;
+        if (sample) {
+          start = absl::Now();
+        }
+        if (!cache.TryGet(key, symmetry::kIdentity, symmetry::kIdentity,
+                          &output)) {
+          cache.Merge(key, symmetry::kIdentity, symmetry::kIdentity, &output);
+        }
+        if (sample) {
+          samples->Add(absl::Now() - start);
+        }
+      }
+    });
+    state.SetIterationTime(absl::ToDoubleSeconds(elapsed));
+    stream += num_threads;
+
+    for (auto& samples : thread_latencies) {
+      latencies.Append(samples);
+      samples.Clear();
+    }
+  }
+
+  auto stats = cache.GetStats();
+  auto num_hits = stats.num_hits - initial_stats.num_hits;
+  auto num_misses = stats.num_complete_misses + stats.num_symmetry_misses -
+                    initial_stats.num_complete_misses -
+                    initial_stats.num_symmetry_misses;
+  int64_t num_ops = state.iterations() * num_threads * kCacheOpsPerThread;
+  state.SetItemsProcessed(num_ops);
+  state.counters["hit_ratio"] =
+      static_cast<double>(num_hits) / std::max<size_t>(1, num_hits + num_misses);
+  latencies.SetCounters(state);
+  SetLockWaitCounter(
+      state, stats.lock_wait_time - initial_stats.lock_wait_time, num_ops);
+}
+BENCHMARK(BM_InferenceCache)
+    ->Apply([](benchmark::internal::Benchmark* b) {
+      for (int num_threads = 1; num_threads <= 128; num_threads *= 2) {
+        for (int num_shards : {1, 8, 64}) {
+          for (int hit_percent : {0, 50, 90}) {
+            b->Args({num_threads, num_shards, hit_percent});
+          }
+        }
+      }
+    })
+    ->ArgNames({"threads", "shards", "hit%"})
+    ->UseManualTime();
+
+// A model that returns immediately, so that the benchmark measures only the
+// batcher's overhead.
+class ZeroLatencyModel : public Model {
+ public:
+  explicit ZeroLatencyModel(int buffer_count)
+      : Model("zero_latency", FeatureDescriptor::Create<AgzFeatures>(),
+              buffer_count) {}
+
+  void RunMany(const std::vector<const ModelInput*>& inputs,
+               std::vector<ModelOutput*>* outputs,
+               std::string* model_name) override {
+    for (auto* output : *outputs) {
+      output->value = 0;
+    }
+    if (model_name != nullptr) {
+      *model_name = name();
+    }
+  }
+};
+
+// Benchmark arguments: {num_clients, buffer_count}.
+// Every client plays a game that makes kRunsPerClient RunMany calls.
+void BM_BatchingModel(benchmark::State& state) {
+  int num_clients = state.range(0);
+  int buffer_count = state.range(1);
+
+  auto batcher = std::make_shared<internal::ModelBatcher>(
+      absl::make_unique<ZeroLatencyModel>(buffer_count));
+  std::vector<std::unique_ptr<BatchingModel>> clients;
+  for (int i = 0; i < num_clients; ++i) {
+    clients.push_back(absl::make_unique<BatchingModel>(batcher));
+  }
+
+  std::vector<ModelInput> input_storage(kVirtualLosses);
+  std::vector<const ModelInput*> inputs;
+  for (const auto& input : input_storage) {
+    inputs.push_back(&input);
+  }
+
+  std::vector<Latencies> thread_latencies(num_clients);
+  Latencies latencies;
+  batcher->FlushStats();
+  for (auto _ : state) {
+    // Start all the games before any client makes a request, like a selfplay
+    // run that starts many games in parallel.
+    for (auto& client : clients) {
+      client->StartGame();
+    }
+    auto elapsed = RunThreads(num_clients, [&](int thread_id) {
+      auto* client = clients[thread_id].get();
+      auto* samples = &thread_latencies[thread_id];
+      std::vector<ModelOutput> output_storage(kVirtualLosses);
+      std::vector<ModelOutput*> outputs;
+      for (auto& output : output_storage) {
+        outputs.push_back(&output);
+      }
+      for (int i = 0; i < kRunsPerClient; ++i) {
+        auto start = absl::Now();
+        client->RunMany(inputs, &outputs, nullptr);
+        samples->Add(absl::Now() - start);
+      }
+      client->EndGame();
+    });
+    state.SetIterationTime(absl::ToDoubleSeconds(elapsed));
+
+    for (auto& samples : thread_latencies) {
+      latencies.Append(samples);
+      samples.Clear();
+    }
+  }
+
+  auto stats = batcher->FlushStats();
+  int64_t num_runs = state.iterations() * num_clients * kRunsPerClient;
+  state.SetItemsProcessed(num_runs * kVirtualLosses);
+  latencies.SetCounters(state);
+  SetLockWaitCounter(state, stats.lock_wait_time, num_runs);
+  state.counters["batch_size"] = stats.batch_size.mean();
+  state.counters["small_batches"] =
+      stats.num_small_batches /
+      std::max<double>(1, stats.num_full_batches + stats.num_small_batches);
+}
+BENCHMARK(BM_BatchingModel)
+    ->Apply([](benchmark::internal::Benchmark* b) {
+      for (int num_clients = 1; num_clients <= 128; num_clients *= 2) {
+        for (int buffer_count : {1, 2, 4}) {
+          b->Args({num_clients, buffer_count});
+        }
+      }
+    })
+    ->ArgNames({"clients", "buffers"})
+    ->UseManualTime();
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  ::benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
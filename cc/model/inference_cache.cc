@@ -17,6 +17,8 @@
 #include <tuple>
 
 #include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "cc/thread.h"
 
 namespace minigo {
 
@@ -69,7 +71,8 @@ std::ostream& operator<<(std::ostream& os, const InferenceCache::Stats& stats) {
             << " hits:" << stats.num_hits
             << " complete_misses:" << stats.num_complete_misses
             << " symmetry_misses:" << stats.num_symmetry_misses
-            << " hit_rate:" << (100 * hit_rate) << "%";
+            << " hit_rate:" << (100 * hit_rate) << "%"
+            << " lock_wait:" << stats.lock_wait_time;
 }
 
 size_t BasicInferenceCache::CalculateCapacity(size_t size_mb) {
@@ -100,6 +103,7 @@ void BasicInferenceCache::Clear() {
   list_.prev = &list_;
   list_.next = &list_;
   map_.clear();
+  UpdateMemoryAccounting();
 }
 
 void BasicInferenceCache::Merge(Key key, symmetry::Symmetry canonical_sym,
@@ -131,6 +135,7 @@ void BasicInferenceCache::Merge(Key key, symmetry::Symmetry canonical_sym,
     elem->valid_symmetry_bits = sym_bit;
     elem->num_valid_symmetries = 1;
     stats_.size += 1;
+    UpdateMemoryAccounting();
   } else {
     // The element was already in the cache.
     Unlink(elem);
@@ -194,6 +199,17 @@ BasicInferenceCache::Stats BasicInferenceCache::GetStats() const {
   return stats_;
 }
 
+ThreadSafeInferenceCache::Shard::Shard(size_t capacity, int index)
+    : cache(capacity) {
+  auto label = absl::StrCat("{shard=\"", index, "\"}");
+  num_hits = metrics::GetCounter(
+      absl::StrCat("inference_cache_hits_total", label),
+      "Number of inference cache lookups that hit.");
+  num_misses = metrics::GetCounter(
+      absl::StrCat("inference_cache_misses_total", label),
+      "Number of inference cache lookups that missed.");
+}
+
 ThreadSafeInferenceCache::ThreadSafeInferenceCache(size_t total_capacity,
                                                    int num_shards) {
   shards_.reserve(num_shards);
@@ -203,7 +219,7 @@ ThreadSafeInferenceCache::ThreadSafeInferenceCache(size_t total_capacity,
     auto b = (i + 1) * total_capacity / num_shards;
     auto shard_capacity = b - a;
     shard_capacity_sum += shard_capacity;
-    shards_.push_back(absl::make_unique<Shard>(shard_capacity));
+    shards_.push_back(absl::make_unique<Shard>(shard_capacity, i));
   }
   MG_CHECK(shard_capacity_sum == total_capacity);
 }
@@ -219,7 +235,8 @@ void ThreadSafeInferenceCache::Merge(Key key, symmetry::Symmetry canonical_sym,
                                      symmetry::Symmetry inference_sym,
                                      ModelOutput* output) {
   auto* shard = shards_[key.Shard(shards_.size())].get();
-  absl::MutexLock lock(&shard->mutex);
+  TimedMutexLock lock(&shard->mutex);
+  shard->lock_wait_time += lock.wait_time();
   shard->cache.Merge(key, canonical_sym, inference_sym, output);
 }
 
@@ -227,8 +244,11 @@ bool ThreadSafeInferenceCache::TryGet(Key key, symmetry::Symmetry canonical_sym,
                                       symmetry::Symmetry inference_sym,
                                       ModelOutput* output) {
   auto* shard = shards_[key.Shard(shards_.size())].get();
-  absl::MutexLock lock(&shard->mutex);
-  return shard->cache.TryGet(key, canonical_sym, inference_sym, output);
+  TimedMutexLock lock(&shard->mutex);
+  shard->lock_wait_time += lock.wait_time();
+  bool hit = shard->cache.TryGet(key, canonical_sym, inference_sym, output);
+  (hit ? shard->num_hits : shard->num_misses)->Increment();
+  return hit;
 }
 
 InferenceCache::Stats ThreadSafeInferenceCache::GetStats() const {
@@ -241,6 +261,7 @@ InferenceCache::Stats ThreadSafeInferenceCache::GetStats() const {
     result.num_hits += s.num_hits;
     result.num_complete_misses += s.num_complete_misses;
     result.num_symmetry_misses += s.num_symmetry_misses;
+    result.lock_wait_time += shard->lock_wait_time;
   }
   return result;
 }
@@ -23,8 +23,11 @@
 #include "absl/container/node_hash_map.h"
 #include "absl/strings/str_format.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "cc/constants.h"
 #include "cc/coord.h"
+#include "cc/memory_accounting.h"
+#include "cc/metrics.h"
 #include "cc/model/model.h"
 #include "cc/position.h"
 #include "cc/symmetries.h"
@@ -101,6 +104,10 @@ class InferenceCache {
     size_t num_hits = 0;
     size_t num_complete_misses = 0;
     size_t num_symmetry_misses = 0;
+
+    // Total time spent waiting to acquire locks. Always zero for caches that
+    // aren't thread safe.
+    absl::Duration lock_wait_time;
   };
 
   virtual ~InferenceCache();
@@ -169,6 +176,11 @@ class BasicInferenceCache : public InferenceCache {
     uint8_t num_valid_symmetries;
   };
 
+  void UpdateMemoryAccounting() {
+    map_bytes_.Set(map_.size() * sizeof(Map::value_type) +
+                   map_.capacity() * (sizeof(Map::value_type*) + 1));
+  }
+
   // Removes the given element from the LRU list.
   void Unlink(Element* elem) {
     elem->next->prev = elem->prev;
@@ -198,6 +210,9 @@ class BasicInferenceCache : public InferenceCache {
   Map map_;
 
   Stats stats_;
+
+  // Approximate memory used by map_.
+  memory::TrackedBytes<memory::Category::kInferenceCache> map_bytes_;
 };
 
 // Thread safe wrapper around BasicInferenceCache.
@@ -233,9 +248,12 @@ class ThreadSafeInferenceCache : public InferenceCache {
 
  private:
   struct Shard {
-    explicit Shard(size_t capacity) : cache(capacity) {}
+    Shard(size_t capacity, int index);
     absl::Mutex mutex;
     BasicInferenceCache cache;
+    absl::Duration lock_wait_time;
+    metrics::Counter* num_hits;
+    metrics::Counter* num_misses;
   };
 
   std::vector<std::unique_ptr<Shard>> shards_;
@@ -25,6 +25,13 @@ Model::Model(std::string name, const FeatureDescriptor& feature_desc,
       buffer_count_(buffer_count) {}
 Model::~Model() = default;
 
+bool Model::RunManyWithDeadline(const std::vector<const ModelInput*>& inputs,
+                                std::vector<ModelOutput*>* outputs,
+                                std::string* model_name, absl::Time deadline) {
+  RunMany(inputs, outputs, model_name);
+  return true;
+}
+
 void Model::GetOutputs(const std::vector<const ModelInput*>& inputs,
                        const Tensor<float>& policy, const Tensor<float>& value,
                        std::vector<ModelOutput*>* outputs) {
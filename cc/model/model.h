@@ -18,6 +18,7 @@
 #include <string>
 #include <vector>
 
+#include "absl/time/time.h"
 #include "cc/color.h"
 #include "cc/constants.h"
 #include "cc/inline_vector.h"
@@ -63,6 +64,16 @@ class Model {
                        std::vector<ModelOutput*>* outputs,
                        std::string* model_name) = 0;
 
+  // Like RunMany, but gives up on the inference if it hasn't started by
+  // `deadline`. Returns true if `outputs` were written, or false if the
+  // inference was cancelled.
+  // Inferences that have already started always run to completion. The default
+  // implementation can't cancel anything: it calls RunMany and returns true.
+  virtual bool RunManyWithDeadline(const std::vector<const ModelInput*>& inputs,
+                                   std::vector<ModelOutput*>* outputs,
+                                   std::string* model_name,
+                                   absl::Time deadline);
+
  private:
   const std::string name_;
   const FeatureDescriptor feature_desc_;
@@ -0,0 +1,225 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for the work done on the CPU for every inference: encoding the
+// input features, applying symmetries, decoding the model outputs and
+// calculating inference cache keys.
+// Every benchmark reports the time per position and, where it makes sense,
+// the number of bytes written per second.
+//
+// Run with:
+//   bazel run -c opt --define=board_size=9 cc/model:model_benchmark
+//   bazel run -c opt cc/model:model_benchmark
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/types/span.h"
+#include "benchmark/benchmark.h"
+#include "cc/benchmark_utils.h"
+#include "cc/constants.h"
+#include "cc/model/features.h"
+#include "cc/model/inference_cache.h"
+#include "cc/model/model.h"
+#include "cc/model/types.h"
+#include "cc/position.h"
+#include "cc/random.h"
+#include "cc/symmetries.h"
+#include "cc/zobrist.h"
+
+namespace minigo {
+namespace {
+
+// Only every kSampleStride'th position of each game is used as an input.
+constexpr int kSampleStride = 4;
+
+// Inputs for every sampled position in the benchmark games, with a full
+// position history where possible and symmetries chosen at random.
+class Corpus {
+ public:
+  Corpus() {
+    Random rnd(614944751, 1);
+    for (const auto& moves : LoadBenchmarkGames()) {
+      games_.push_back(absl::make_unique<std::vector<Position>>());
+      auto* positions = games_.back().get();
+      positions->reserve(moves.size() + 1);
+      positions->emplace_back(Color::kBlack);
+      for (const auto& move : moves) {
+        positions->push_back(positions->back());
+        positions->back().PlayMove(move.c, move.color);
+      }
+
+      for (size_t i = 0; i < positions->size(); i += kSampleStride) {
+        inputs_.emplace_back();
+        auto& input = inputs_.back();
+        input.sym = static_cast<symmetry::Symmetry>(
+            rnd.UniformInt(0, symmetry::kNumSymmetries - 1));
+        for (int j = 0; j < kMaxPositionHistory && j <= i; ++j) {
+          input.position_history.push_back(&(*positions)[i - j]);
+        }
+        prev_moves_.push_back(i > 0 ? moves[i - 1].c : Coord(Coord::kInvalid));
+      }
+    }
+  }
+
+  // Returns a batch of `batch_size` inputs, cycling through the corpus.
+  std::vector<const ModelInput*> GetBatch(int batch_size) const {
+    std::vector<const ModelInput*> batch;
+    for (int i = 0; i < batch_size; ++i) {
+      batch.push_back(&inputs_[i % inputs_.size()]);
+    }
+    return batch;
+  }
+
+  const std::vector<ModelInput>& inputs() const { return inputs_; }
+
+  // The move played to reach each input's current position.
+  const std::vector<Coord>& prev_moves() const { return prev_moves_; }
+
+ private:
+  std::vector<std::unique_ptr<std::vector<Position>>> games_;
+  std::vector<ModelInput> inputs_;
+  std::vector<Coord> prev_moves_;
+};
+
+const Corpus& GetCorpus() {
+  static const Corpus* corpus = new Corpus();
+  return *corpus;
+}
+
+// Reports the time per position and, if `bytes_per_position` is non-zero,
+// the bytes processed per second.
+void SetCounters(benchmark::State& state, int positions_per_iteration,
+                 int64_t bytes_per_position) {
+  int64_t num_positions = state.iterations() * positions_per_iteration;
+  state.SetItemsProcessed(num_positions);
+  if (bytes_per_position != 0) {
+    state.SetBytesProcessed(num_positions * bytes_per_position);
+  }
+  state.counters["time/position"] = benchmark::Counter(
+      positions_per_iteration,
+      benchmark::Counter::kIsIterationInvariantRate |
+          benchmark::Counter::kInvert);
+}
+
+void BatchSizes(benchmark::internal::Benchmark* b) {
+  b->RangeMultiplier(4)->Range(1, 1024);
+}
+
+template <typename F, typename T>
+void BM_SetFeatures(benchmark::State& state) {
+  int batch_size = state.range(0);
+  auto inputs = GetCorpus().GetBatch(batch_size);
+  BackedTensor<T> features(batch_size, kN, kN, F::kNumPlanes);
+
+  for (auto _ : state) {
+    F::Set(inputs, &features.tensor());
+    benchmark::ClobberMemory();
+  }
+  SetCounters(state, batch_size, kN * kN * F::kNumPlanes * sizeof(T));
+}
+BENCHMARK_TEMPLATE(BM_SetFeatures, AgzFeatures, uint8_t)->Apply(BatchSizes);
+BENCHMARK_TEMPLATE(BM_SetFeatures, AgzFeatures, float)->Apply(BatchSizes);
+BENCHMARK_TEMPLATE(BM_SetFeatures, ExtraFeatures, uint8_t)->Apply(BatchSizes);
+BENCHMARK_TEMPLATE(BM_SetFeatures, ExtraFeatures, float)->Apply(BatchSizes);
+
+// Applies the symmetry given by the benchmark's argument to a board with
+// `num_channels` channels. One channel is used for policy outputs and the
+// others for the input features.
+template <typename T, int num_channels>
+void BM_ApplySymmetry(benchmark::State& state) {
+  auto sym = static_cast<symmetry::Symmetry>(state.range(0));
+  std::ostringstream label;
+  label << sym;
+  state.SetLabel(label.str());
+
+  std::vector<T> src(kN * kN * num_channels);
+  std::vector<T> dst(src.size());
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = static_cast<T>(i % 2);
+  }
+
+  for (auto _ : state) {
+    symmetry::ApplySymmetry<kN, num_channels>(sym, src.data(), dst.data());
+    benchmark::ClobberMemory();
+  }
+  SetCounters(state, 1, src.size() * sizeof(T));
+}
+
+void AllSymmetries(benchmark::internal::Benchmark* b) {
+  b->DenseRange(0, symmetry::kNumSymmetries - 1);
+}
+BENCHMARK_TEMPLATE(BM_ApplySymmetry, float, 1)->Apply(AllSymmetries);
+BENCHMARK_TEMPLATE(BM_ApplySymmetry, uint8_t, AgzFeatures::kNumPlanes)
+    ->Apply(AllSymmetries);
+BENCHMARK_TEMPLATE(BM_ApplySymmetry, float, AgzFeatures::kNumPlanes)
+    ->Apply(AllSymmetries);
+BENCHMARK_TEMPLATE(BM_ApplySymmetry, uint8_t, ExtraFeatures::kNumPlanes)
+    ->Apply(AllSymmetries);
+BENCHMARK_TEMPLATE(BM_ApplySymmetry, float, ExtraFeatures::kNumPlanes)
+    ->Apply(AllSymmetries);
+
+void BM_GetOutputs(benchmark::State& state) {
+  int batch_size = state.range(0);
+  auto inputs = GetCorpus().GetBatch(batch_size);
+
+  Random rnd(614944751, 1);
+  BackedTensor<float> policy(batch_size, 1, 1, kNumMoves);
+  BackedTensor<float> value(batch_size, 1, 1, 1);
+  rnd.Uniform(0, 1,
+              absl::MakeSpan(policy.tensor().data, kNumMoves * batch_size));
+  rnd.Uniform(-1, 1, absl::MakeSpan(value.tensor().data, batch_size));
+
+  std::vector<ModelOutput> output_storage(batch_size);
+  std::vector<ModelOutput*> outputs;
+  for (auto& output : output_storage) {
+    outputs.push_back(&output);
+  }
+
+  for (auto _ : state) {
+    Model::GetOutputs(inputs, policy.tensor(), value.tensor(), &outputs);
+    benchmark::ClobberMemory();
+  }
+  SetCounters(state, batch_size, sizeof(ModelOutput));
+}
+BENCHMARK(BM_GetOutputs)->Apply(BatchSizes);
+
+// Constructs the inference cache key of every position in the corpus.
+void BM_InferenceCacheKey(benchmark::State& state) {
+  const auto& inputs = GetCorpus().inputs();
+  const auto& prev_moves = GetCorpus().prev_moves();
+
+  for (auto _ : state) {
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      InferenceCache::Key key(prev_moves[i], inputs[i].sym,
+                              *inputs[i].position_history[0]);
+      benchmark::DoNotOptimize(key);
+    }
+  }
+  SetCounters(state, inputs.size(), 0);
+}
+BENCHMARK(BM_InferenceCacheKey);
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  ::benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -169,6 +169,15 @@ void ReloadingModel::RunMany(const std::vector<const ModelInput*>& inputs,
   model_impl_->RunMany(inputs, outputs, model_name);
 }
 
+bool ReloadingModel::RunManyWithDeadline(
+    const std::vector<const ModelInput*>& inputs,
+    std::vector<ModelOutput*>* outputs, std::string* model_name,
+    absl::Time deadline) {
+  absl::MutexLock lock(&mutex_);
+  return model_impl_->RunManyWithDeadline(inputs, outputs, model_name,
+                                          deadline);
+}
+
 void ReloadingModel::UpdateImpl(std::unique_ptr<Model> model_impl) {
   absl::MutexLock lock(&mutex_);
   model_impl_ = std::move(model_impl);
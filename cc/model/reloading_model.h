@@ -43,6 +43,11 @@ class ReloadingModel : public Model {
                std::vector<ModelOutput*>* outputs,
                std::string* model_name) override;
 
+  bool RunManyWithDeadline(const std::vector<const ModelInput*>& inputs,
+                           std::vector<ModelOutput*>* outputs,
+                           std::string* model_name,
+                           absl::Time deadline) override;
+
   // Replaces the wrapped implementation with a new one constructed from the
   // given factory & model.
   // Called by ReloadingModelUpdater::Poll when it finds a new model.
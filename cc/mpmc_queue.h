@@ -0,0 +1,334 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_MPMC_QUEUE_H_
+#define CC_MPMC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace minigo {
+
+// A bounded multi-producer, multi-consumer FIFO queue, based on Dmitry
+// Vyukov's lock-free ring buffer design.
+//
+// Each slot in the ring has a sequence number that tells producers and
+// consumers whether it's ready to be written or read for the current lap
+// around the ring. Producers and consumers claim positions with a single
+// compare & swap on the queue's head or tail, so the TryPush & TryPop
+// operations never block and an uncontended operation touches only two cache
+// lines. TryPushN and TryPopN claim a run of positions with a single
+// compare & swap.
+//
+// The blocking Push, Pop and PopWithTimeout wrappers spin briefly before
+// sleeping on a condition variable. Threads that don't block pay only for an
+// atomic load to check whether there are any sleeping threads to wake.
+//
+// Unlike ThreadSafeQueue, the queue's capacity is fixed: TryPush fails and
+// Push blocks while the queue is full.
+template <typename T>
+class MpmcQueue {
+ public:
+  // The capacity is rounded up to the next power of two, and is at least 2.
+  explicit MpmcQueue(size_t capacity)
+      : mask_(RoundUpToPowerOfTwo(std::max<size_t>(capacity, 2)) - 1),
+        slots_(new Slot[mask_ + 1]) {
+    for (size_t i = 0; i <= mask_; ++i) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~MpmcQueue() {
+    auto head = head_.load(std::memory_order_acquire);
+    for (auto pos = tail_.load(std::memory_order_acquire); pos != head; ++pos) {
+      reinterpret_cast<T*>(&slots_[pos & mask_].storage)->~T();
+    }
+  }
+
+  MpmcQueue(const MpmcQueue&) = delete;
+  MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Returns the number of elements in the queue. Only approximate if other
+  // threads are pushing or popping.
+  size_t size() const {
+    auto tail = tail_.load(std::memory_order_acquire);
+    auto head = head_.load(std::memory_order_acquire);
+    return head > tail ? head - tail : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  // Pushes `x` if the queue isn't full. `x` is only moved from if the push
+  // succeeds.
+  bool TryPush(T&& x) { return TryPushN(&x, 1) == 1; }
+
+  bool TryPush(const T& x) {
+    T copy = x;
+    return TryPush(std::move(copy));
+  }
+
+  // Moves up to `n` elements from `xs` into the queue, stopping when the
+  // queue is full. Returns the number of elements pushed, which are always
+  // the first elements of `xs`. The elements are pushed contiguously: they
+  // aren't interleaved with elements pushed by other threads.
+  size_t TryPushN(T* xs, size_t n) {
+    auto k = TryPushNImpl(xs, n);
+    if (k != 0) {
+      Notify();
+    }
+    return k;
+  }
+
+  bool TryPop(T* x) { return TryPopN(x, 1) == 1; }
+
+  // Pops up to `n` elements into `xs`, stopping when the queue is empty.
+  // Returns the number of elements popped.
+  size_t TryPopN(T* xs, size_t n) {
+    auto k = TryPopNImpl(xs, n);
+    if (k != 0) {
+      Notify();
+    }
+    return k;
+  }
+
+  // Pushes `x`, blocking while the queue is full.
+  void Push(T x) {
+    Wait(
+        [this, &x](size_t* n) {
+          *n = TryPushNImpl(&x, 1);
+          return *n == 1;
+        },
+        absl::InfiniteFuture());
+  }
+
+  // Pushes all `n` elements of `xs`, blocking while the queue is full. If the
+  // queue fills up, the elements may be interleaved with those pushed by
+  // other threads.
+  void PushN(T* xs, size_t n) {
+    size_t num_pushed = 0;
+    Wait(
+        [this, xs, n, &num_pushed](size_t* k) {
+          *k = TryPushNImpl(xs + num_pushed, n - num_pushed);
+          num_pushed += *k;
+          return num_pushed == n;
+        },
+        absl::InfiniteFuture());
+  }
+
+  // Pops an element, blocking while the queue is empty.
+  T Pop() {
+    T x;
+    Wait(
+        [this, &x](size_t* n) {
+          *n = TryPopNImpl(&x, 1);
+          return *n == 1;
+        },
+        absl::InfiniteFuture());
+    return x;
+  }
+
+  // Pops between 1 and `n` elements into `xs`, blocking while the queue is
+  // empty. Returns the number of elements popped.
+  size_t PopN(T* xs, size_t n) {
+    size_t num_popped = 0;
+    Wait(
+        [this, xs, n, &num_popped](size_t* k) {
+          *k = num_popped = TryPopNImpl(xs, n);
+          return num_popped != 0;
+        },
+        absl::InfiniteFuture());
+    return num_popped;
+  }
+
+  // Pops an element, blocking for at most `timeout` while the queue is empty.
+  // Returns false if the queue was still empty after `timeout`.
+  bool PopWithTimeout(T* x, absl::Duration timeout) {
+    return Wait(
+        [this, x](size_t* n) {
+          *n = TryPopNImpl(x, 1);
+          return *n == 1;
+        },
+        absl::Now() + timeout);
+  }
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic<size_t> sequence;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  static size_t RoundUpToPowerOfTwo(size_t x) {
+    size_t result = 1;
+    while (result < x) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  // TryPushN & TryPopN without waking any blocked threads.
+  size_t TryPushNImpl(T* xs, size_t n) {
+    if (n == 0) {
+      return 0;
+    }
+    auto pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto k = CountSlots(pos, n, 0);
+      if (k == 0) {
+        // Either the queue is full or another producer claimed `pos`.
+        auto sequence =
+            slots_[pos & mask_].sequence.load(std::memory_order_acquire);
+        if (sequence < pos) {
+          return 0;
+        }
+        pos = head_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (head_.compare_exchange_weak(pos, pos + k,
+                                      std::memory_order_relaxed)) {
+        for (size_t i = 0; i < k; ++i) {
+          auto& slot = slots_[(pos + i) & mask_];
+          new (&slot.storage) T(std::move(xs[i]));
+          slot.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return k;
+      }
+    }
+  }
+
+  size_t TryPopNImpl(T* xs, size_t n) {
+    if (n == 0) {
+      return 0;
+    }
+    auto pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto k = CountSlots(pos, n, 1);
+      if (k == 0) {
+        // Either the queue is empty or another consumer claimed `pos`.
+        auto sequence =
+            slots_[pos & mask_].sequence.load(std::memory_order_acquire);
+        if (sequence < pos + 1) {
+          return 0;
+        }
+        pos = tail_.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (tail_.compare_exchange_weak(pos, pos + k,
+                                      std::memory_order_relaxed)) {
+        for (size_t i = 0; i < k; ++i) {
+          auto& slot = slots_[(pos + i) & mask_];
+          auto* ptr = reinterpret_cast<T*>(&slot.storage);
+          xs[i] = std::move(*ptr);
+          ptr->~T();
+          slot.sequence.store(pos + i + mask_ + 1, std::memory_order_release);
+        }
+        return k;
+      }
+    }
+  }
+
+  // Returns the number of consecutive slots, up to `n`, starting at `pos`
+  // that are ready for the current lap. Producers pass an `offset` of 0
+  // (the slot is empty) and consumers pass 1 (the slot is full).
+  size_t CountSlots(size_t pos, size_t n, size_t offset) const {
+    n = std::min(n, mask_ + 1);
+    size_t k = 0;
+    while (k < n && slots_[(pos + k) & mask_].sequence.load(
+                        std::memory_order_acquire) == pos + k + offset) {
+      ++k;
+    }
+    return k;
+  }
+
+  // Calls `f` until it returns true or `deadline` passes. Returns the result
+  // of the last call to `f`. `f` sets its argument to the number of elements
+  // it pushed or popped, so that Wait can wake threads blocked on the queue
+  // whenever progress is made.
+  template <typename F>
+  bool Wait(F f, absl::Time deadline) {
+    constexpr int kNumSpins = 64;
+    size_t n;
+    for (int i = 0; i < kNumSpins; ++i) {
+      bool done = f(&n);
+      if (n != 0) {
+        Notify();
+      }
+      if (done) {
+        return true;
+      }
+      std::this_thread::yield();
+    }
+
+    absl::MutexLock lock(&mutex_);
+    num_waiters_.fetch_add(1, std::memory_order_seq_cst);
+    bool done;
+    // Notify checks num_waiters_ after publishing its change to the queue,
+    // so if `f` fails here, the thread that makes it succeed will wake us.
+    for (;;) {
+      done = f(&n);
+      if (n != 0) {
+        // We already hold the mutex, so wake the other blocked threads
+        // directly.
+        cond_var_.SignalAll();
+      }
+      if (done || cond_var_.WaitWithDeadline(&mutex_, deadline)) {
+        break;
+      }
+    }
+    if (!done) {
+      // The deadline passed: give `f` one last chance.
+      done = f(&n);
+      if (n != 0) {
+        cond_var_.SignalAll();
+      }
+    }
+    num_waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return done;
+  }
+
+  void Notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_waiters_.load(std::memory_order_relaxed) != 0) {
+      absl::MutexLock lock(&mutex_);
+      cond_var_.SignalAll();
+    }
+  }
+
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+
+  // The next positions to push to and pop from. Kept on separate cache lines
+  // so that producers and consumers don't contend.
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+
+  alignas(64) std::atomic<int> num_waiters_{0};
+  absl::Mutex mutex_;
+  absl::CondVar cond_var_;
+};
+
+}  // namespace minigo
+
+#endif  // CC_MPMC_QUEUE_H_
@@ -0,0 +1,254 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks for the Position primitives, run over a corpus of mid and late
+// game positions taken from the SGF files in cc/testdata/benchmark.
+//
+// Run with:
+//   bazel run -c opt --define=board_size=9 cc:position_benchmark
+//   bazel run -c opt cc:position_benchmark
+
+#include <memory>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/memory/memory.h"
+#include "benchmark/benchmark.h"
+#include "cc/benchmark_utils.h"
+#include "cc/constants.h"
+#include "cc/logging.h"
+#include "cc/position.h"
+#include "cc/zobrist.h"
+
+namespace minigo {
+namespace {
+
+// Only every kSampleStride'th position of each game is added to the corpus.
+constexpr int kSampleStride = 4;
+
+// Positions between 40% and 70% of the way through a game are mid game
+// positions, positions after that are late game positions.
+enum Phase {
+  kMidGame,
+  kLateGame,
+};
+
+class BenchmarkPosition : public Position {
+ public:
+  explicit BenchmarkPosition(const Position& position) : Position(position) {}
+
+  using Position::UpdateLegalMoves;
+};
+
+// Superko history of a corpus position: the hashes of all positions played
+// before it.
+class ZobristHistory : public Position::ZobristHistory {
+ public:
+  bool HasPositionBeenPlayedBefore(zobrist::Hash stone_hash) const override {
+    return hashes_.contains(stone_hash);
+  }
+
+  void Add(zobrist::Hash stone_hash) { hashes_.insert(stone_hash); }
+
+ private:
+  absl::flat_hash_set<zobrist::Hash> hashes_;
+};
+
+struct CorpusPosition {
+  CorpusPosition(const Position& position, const ZobristHistory& history,
+                 Move next_move)
+      : position(position), history(history), next_move(next_move) {}
+
+  BenchmarkPosition position;
+  ZobristHistory history;
+
+  // The move played from this position in the game.
+  Move next_move;
+};
+
+using Corpus = std::vector<std::unique_ptr<CorpusPosition>>;
+
+void AddGame(const std::vector<Move>& moves, Corpus* mid_game,
+             Corpus* late_game) {
+  Position position(Color::kBlack);
+  ZobristHistory history;
+  for (size_t i = 0; i < moves.size(); ++i) {
+    int percent = static_cast<int>(100 * i / moves.size());
+    if (percent >= 40 && i % kSampleStride == 0) {
+      auto* corpus = percent < 70 ? mid_game : late_game;
+      corpus->push_back(
+          absl::make_unique<CorpusPosition>(position, history, moves[i]));
+    }
+    history.Add(position.stone_hash());
+    position.PlayMove(moves[i].c, moves[i].color, &history);
+  }
+}
+
+const Corpus& GetCorpus(Phase phase) {
+  static Corpus* corpora = []() {
+    auto* corpora = new Corpus[2];
+    for (const auto& moves : LoadBenchmarkGames()) {
+      AddGame(moves, &corpora[kMidGame], &corpora[kLateGame]);
+    }
+    MG_CHECK(!corpora[kMidGame].empty() && !corpora[kLateGame].empty());
+    return corpora;
+  }();
+  return corpora[phase];
+}
+
+// Returns the corpus for the game phase given by the benchmark's first
+// argument.
+const Corpus& GetCorpus(benchmark::State& state) {
+  auto phase = static_cast<Phase>(state.range(0));
+  state.SetLabel(phase == kMidGame ? "mid game" : "late game");
+  return GetCorpus(phase);
+}
+
+void BM_PlayMove(benchmark::State& state) {
+  const auto& corpus = GetCorpus(state);
+  bool superko = state.range(1) != 0;
+
+  // Copying a position is about as expensive as playing a move, so the copies
+  // are made outside the timed region.
+  std::vector<Position> positions;
+  for (auto _ : state) {
+    state.PauseTiming();
+    positions.clear();
+    for (const auto& p : corpus) {
+      positions.push_back(p->position);
+    }
+    state.ResumeTiming();
+
+    for (size_t i = 0; i < positions.size(); ++i) {
+      auto& p = *corpus[i];
+      positions[i].PlayMove(p.next_move.c, p.next_move.color,
+                            superko ? &p.history : nullptr);
+    }
+    benchmark::DoNotOptimize(positions.data());
+  }
+  state.SetItemsProcessed(state.iterations() * corpus.size());
+}
+BENCHMARK(BM_PlayMove)
+    ->Args({kMidGame, 0})
+    ->Args({kMidGame, 1})
+    ->Args({kLateGame, 0})
+    ->Args({kLateGame, 1});
+
+void BM_UndoMove(benchmark::State& state) {
+  const auto& corpus = GetCorpus(state);
+
+  std::vector<Position> positions;
+  std::vector<Position::UndoState> undos;
+  for (auto _ : state) {
+    state.PauseTiming();
+    positions.clear();
+    undos.clear();
+    for (const auto& p : corpus) {
+      positions.push_back(p->position);
+      undos.push_back(
+          positions.back().PlayMove(p->next_move.c, p->next_move.color));
+    }
+    state.ResumeTiming();
+
+    for (size_t i = 0; i < positions.size(); ++i) {
+      positions[i].UndoMove(undos[i]);
+    }
+    benchmark::DoNotOptimize(positions.data());
+  }
+  state.SetItemsProcessed(state.iterations() * corpus.size());
+}
+BENCHMARK(BM_UndoMove)->Arg(kMidGame)->Arg(kLateGame);
+
+void BM_UpdateLegalMoves(benchmark::State& state) {
+  const auto& corpus = GetCorpus(state);
+  bool superko = state.range(1) != 0;
+
+  for (auto _ : state) {
+    for (const auto& p : corpus) {
+      p->position.UpdateLegalMoves(superko ? &p->history : nullptr);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * corpus.size());
+}
+BENCHMARK(BM_UpdateLegalMoves)
+    ->Args({kMidGame, 0})
+    ->Args({kMidGame, 1})
+    ->Args({kLateGame, 0})
+    ->Args({kLateGame, 1});
+
+// Classifies every empty point of each position.
+void BM_ClassifyMove(benchmark::State& state) {
+  const auto& corpus = GetCorpus(state);
+
+  int64_t num_moves = 0;
+  for (auto _ : state) {
+    for (const auto& p : corpus) {
+      const auto& stones = p->position.stones();
+      for (int c = 0; c < kN * kN; ++c) {
+        if (stones[c].empty()) {
+          benchmark::DoNotOptimize(p->position.ClassifyMove(c));
+          num_moves += 1;
+        }
+      }
+    }
+  }
+  state.SetItemsProcessed(num_moves);
+}
+BENCHMARK(BM_ClassifyMove)->Arg(kMidGame)->Arg(kLateGame);
+
+void BM_CalculatePassAliveRegions(benchmark::State& state) {
+  const auto& corpus = GetCorpus(state);
+
+  for (auto _ : state) {
+    for (const auto& p : corpus) {
+      benchmark::DoNotOptimize(p->position.CalculatePassAliveRegions());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * corpus.size());
+}
+BENCHMARK(BM_CalculatePassAliveRegions)->Arg(kMidGame)->Arg(kLateGame);
+
+void BM_CalculateWholeBoardPassAlive(benchmark::State& state) {
+  const auto& corpus = GetCorpus(state);
+
+  for (auto _ : state) {
+    for (const auto& p : corpus) {
+      benchmark::DoNotOptimize(p->position.CalculateWholeBoardPassAlive());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * corpus.size());
+}
+BENCHMARK(BM_CalculateWholeBoardPassAlive)->Arg(kMidGame)->Arg(kLateGame);
+
+void BM_CalculateScore(benchmark::State& state) {
+  const auto& corpus = GetCorpus(state);
+
+  for (auto _ : state) {
+    for (const auto& p : corpus) {
+      benchmark::DoNotOptimize(p->position.CalculateScore(kDefaultKomi));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * corpus.size());
+}
+BENCHMARK(BM_CalculateScore)->Arg(kMidGame)->Arg(kLateGame);
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  ::benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -15,6 +15,7 @@
 #include <stdio.h>
 
 #include <atomic>
+#include <csignal>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -41,15 +42,17 @@
 #include "cc/init.h"
 #include "cc/logging.h"
 #include "cc/mcts_player.h"
+#include "cc/memory_accounting.h"
+#include "cc/metrics.h"
 #include "cc/model/batching_model.h"
 #include "cc/model/inference_cache.h"
 #include "cc/model/reloading_model.h"
 #include "cc/platform/utils.h"
 #include "cc/random.h"
 #include "cc/tf_utils.h"
+#include "cc/tracing.h"
 #include "cc/zobrist.h"
 #include "gflags/gflags.h"
-#include "wtf/macros.h"
 
 // Game options flags.
 DEFINE_double(resign_threshold, -0.999, "Resign threshold.");
@@ -67,6 +70,14 @@ DEFINE_int32(num_readouts, 100,
              "Number of readouts to make during tree search for each move.");
 DEFINE_int32(virtual_losses, 8,
              "Number of virtual losses when running tree search.");
+DEFINE_bool(adaptive_virtual_losses, false,
+            "If true, adapt the number of virtual losses per batch and their "
+            "weight to how often the search selects duplicate leaves, "
+            "starting from virtual_losses. Quiet positions use larger "
+            "batches, up to max_virtual_losses.");
+DEFINE_int32(max_virtual_losses, 64,
+             "Maximum number of virtual losses per batch when "
+             "adaptive_virtual_losses is true.");
 DEFINE_bool(inject_noise, true,
             "If true, inject noise into the root position at the start of "
             "each tree search.");
@@ -115,6 +126,27 @@ DEFINE_bool(
     "If true, subtract visits from all moves that weren't the best move until "
     "the uncertainty level compensates.");
 
+DEFINE_bool(prune_readouts, false,
+            "If true, stop searching as soon as the remaining readouts can't "
+            "change the most visited move. Only applies to moves that aren't "
+            "used as training targets (see fastplay_frequency) unless "
+            "prune_trainable_readouts is also true.");
+DEFINE_bool(prune_trainable_readouts, false,
+            "If true and prune_readouts is true, also prune the search of moves "
+            "that are used as training targets. This distorts the visit "
+            "distribution used as the policy target.");
+DEFINE_bool(gumbel_root, false,
+            "If true, use Gumbel root search with sequential halving instead "
+            "of PUCT with Dirichlet noise at the root, and train on the "
+            "improved policy instead of the visit counts. Works well with a "
+            "small num_readouts.");
+DEFINE_int32(gumbel_num_considered, 16,
+             "The number of root moves sampled by Gumbel root search.");
+DEFINE_double(gumbel_c_visit, 50,
+              "c_visit parameter of Gumbel root search's sigma transform.");
+DEFINE_double(gumbel_c_scale, 1.0,
+              "c_scale parameter of Gumbel root search's sigma transform.");
+
 // Selfplay flags.
 DEFINE_bool(run_forever, false,
             "When running 'selfplay' mode, whether to run forever. "
@@ -152,8 +184,27 @@ DEFINE_string(sgf_dir, "",
               "SGF directory for selfplay and puzzles. If empty in selfplay "
               "mode, no SGF is written.");
 DEFINE_string(bigtable_tag, "", "Used in Bigtable metadata");
-DEFINE_string(wtf_trace, "/tmp/minigo.wtf-trace",
-              "Output path for WTF traces.");
+DEFINE_string(trace_path, "",
+              "If non-empty, tracing is enabled and a Chrome trace is written "
+              "to this path on exit. Sending the process SIGUSR1 writes a "
+              "snapshot of the trace to <trace_path>.<n>.");
+DEFINE_int32(trace_buffer_size, 1 << 16,
+             "Number of trace events kept for each thread.");
+DEFINE_int32(trace_snapshots, 4,
+             "Number of trace snapshots kept before the oldest is "
+             "overwritten.");
+DEFINE_string(metrics_path, "",
+              "If non-empty, metrics are periodically exported to this path. "
+              "Paths ending in .jsonl have a line of JSON appended on every "
+              "export, other paths are overwritten in the Prometheus text "
+              "format.");
+DEFINE_double(metrics_interval, 60, "Seconds between metrics exports.");
+DEFINE_bool(async_logging, true,
+            "If true, log messages are written to stderr by a background "
+            "thread so that game threads never block on logging.");
+DEFINE_int32(log_buffer_size, 1 << 18,
+             "Size in bytes of each thread's asynchronous logging buffer. "
+             "Messages that don't fit are dropped.");
 
 namespace minigo {
 namespace {
@@ -208,12 +259,18 @@ void ParseOptionsFromFlags(Game::Options* game_options,
   player_options->value_init_penalty = FLAGS_value_init_penalty;
   player_options->policy_softmax_temp = FLAGS_policy_softmax_temp;
   player_options->virtual_losses = FLAGS_virtual_losses;
+  player_options->adaptive_virtual_losses = FLAGS_adaptive_virtual_losses;
+  player_options->max_virtual_losses = FLAGS_max_virtual_losses;
   player_options->random_seed = FLAGS_seed;
   player_options->random_symmetry = FLAGS_random_symmetry;
   player_options->num_readouts = FLAGS_num_readouts;
   player_options->fastplay_frequency = FLAGS_fastplay_frequency;
   player_options->fastplay_readouts = FLAGS_fastplay_readouts;
   player_options->target_pruning = FLAGS_target_pruning;
+  player_options->gumbel_root = FLAGS_gumbel_root;
+  player_options->gumbel_num_considered = FLAGS_gumbel_num_considered;
+  player_options->gumbel_c_visit = FLAGS_gumbel_c_visit;
+  player_options->gumbel_c_scale = FLAGS_gumbel_c_scale;
 }
 
 void LogEndGameInfo(const Game& game, absl::Duration game_time) {
@@ -328,6 +385,9 @@ class SelfPlayer {
     {
       absl::MutexLock lock(&mutex_);
       MG_LOG(INFO) << FormatWinStatsTable({{model_name_, win_stats_}});
+      if (FLAGS_prune_readouts) {
+        MG_LOG(INFO) << "Readouts saved by pruning: " << num_readouts_saved_;
+      }
     }
   }
 
@@ -344,6 +404,8 @@ class SelfPlayer {
       // different seed for each thread.
       game_options.resign_enabled = (*rnd)() >= FLAGS_disable_resign_pct;
 
+      prune_readouts = FLAGS_prune_readouts;
+      prune_trainable_readouts = FLAGS_prune_trainable_readouts;
       holdout_pct = FLAGS_holdout_pct;
       output_dir = FLAGS_output_dir;
       holdout_dir = FLAGS_holdout_dir;
@@ -352,6 +414,8 @@ class SelfPlayer {
 
     Game::Options game_options;
     MctsPlayer::Options player_options;
+    bool prune_readouts = false;
+    bool prune_trainable_readouts = false;
     float holdout_pct;
     std::string output_dir;
     std::string holdout_dir;
@@ -449,6 +513,13 @@ class SelfPlayer {
           player->root()->ClearChildren();
         }
 
+        // Only prune the search of moves that are training targets if
+        // explicitly requested: pruning distorts the visit distribution.
+        thread_options.player_options.prune_readouts =
+            thread_options.prune_readouts &&
+            (fastplay || thread_options.prune_trainable_readouts);
+        player->SetOptions(thread_options.player_options);
+
         // Choose the move to play, optionally adding noise.
         Coord move = Coord::kInvalid;
         {
@@ -475,15 +546,27 @@ class SelfPlayer {
               << absl::StreamFormat(
                      "  num_inferences: %d  buffer_count: %d  run_batch_total: "
                      "%.3fms  run_many_total : %.3fms  run_batch_per_inf: "
-                     "%.3fms  run_many_per_inf: %.3fms",
+                     "%.3fms  run_many_per_inf: %.3fms  lock_wait_total: "
+                     "%.3fms",
                      stats.num_inferences, stats.buffer_count,
                      absl::ToDoubleMilliseconds(stats.run_batch_time),
                      absl::ToDoubleMilliseconds(stats.run_many_time),
                      absl::ToDoubleMilliseconds(stats.run_batch_time /
                                                 stats.num_inferences),
                      absl::ToDoubleMilliseconds(stats.run_many_time /
-                                                stats.num_inferences));
+                                                stats.num_inferences),
+                     absl::ToDoubleMilliseconds(stats.lock_wait_time));
+          MG_LOG(INFO) << absl::StreamFormat(
+              "batches full: %d  small: %d  batch_size p50: %d  p99: %d  "
+              "queue_wait p50: %.3fms  p99: %.3fms  run_many p99: %.3fms",
+              stats.num_full_batches, stats.num_small_batches,
+              stats.batch_size.Percentile(50), stats.batch_size.Percentile(99),
+              stats.queue_wait_us.Percentile(50) / 1000.0,
+              stats.queue_wait_us.Percentile(99) / 1000.0,
+              stats.run_many_us.Percentile(99) / 1000.0);
           MG_LOG(INFO) << root->CalculateTreeStats().ToString();
+          MG_LOG(INFO) << "Memory: " << memory::FormatStats();
+          MG_LOG(INFO) << "Virtual losses: " << player->GetVirtualLossStats();
 
           if (!fastplay) {
             MG_LOG(INFO) << root->position.ToPrettyString(use_ansi_colors);
@@ -524,6 +607,10 @@ class SelfPlayer {
       if (thread_options.verbose) {
         MG_LOG(INFO) << "Inference history: "
                      << player->GetModelsUsedForInference();
+        if (thread_options.prune_readouts) {
+          MG_LOG(INFO) << "Readouts saved by pruning: "
+                       << player->num_readouts_saved();
+        }
       }
 
       {
@@ -532,6 +619,7 @@ class SelfPlayer {
         absl::MutexLock lock(&mutex_);
         LogEndGameInfo(*game, absl::Now() - game_start_time);
         win_stats_.Update(*game);
+        num_readouts_saved_ += player->num_readouts_saved();
         auto stats = variety_tracker_.GetStats();
         MG_LOG(INFO) << "Total positions played: " << stats.total_positions;
         MG_LOG(INFO) << "Unique positions played: "
@@ -542,6 +630,15 @@ class SelfPlayer {
       }
 
       // Write the outputs.
+      static auto* write_examples_hist = metrics::GetHistogram(
+          "selfplay_write_examples_us",
+          "Time taken to write the training examples for each game.");
+      static auto* write_sgf_hist =
+          metrics::GetHistogram("selfplay_write_sgf_us",
+                                "Time taken to write the SGFs of each game.");
+      static auto* num_games_counter = metrics::GetCounter(
+          "selfplay_games_total", "Number of selfplay games finished.");
+      num_games_counter->Increment();
       auto now = absl::Now();
       auto output_name = GetOutputName(game_id_++);
 
@@ -553,11 +650,13 @@ class SelfPlayer {
       auto example_dir =
           is_holdout ? thread_options.holdout_dir : thread_options.output_dir;
       if (!example_dir.empty()) {
+        metrics::ScopedTimer timer(write_examples_hist);
         tf_utils::WriteGameExamples(GetOutputDir(now, example_dir), output_name,
                                     player->model()->feature_descriptor(),
                                     *game);
       }
       if (use_bigtable) {
+        metrics::ScopedTimer timer(write_examples_hist);
         const auto& gcp_project_name = bigtable_spec[0];
         const auto& instance_name = bigtable_spec[1];
         const auto& table_name = bigtable_spec[2];
@@ -569,6 +668,7 @@ class SelfPlayer {
       game->AddComment(
           absl::StrCat("Inferences: ", player->GetModelsUsedForInference()));
       if (!thread_options.sgf_dir.empty()) {
+        metrics::ScopedTimer timer(write_sgf_hist);
         WriteSgf(
             GetOutputDir(now, file::JoinPath(thread_options.sgf_dir, "clean")),
             output_name, *game, false);
@@ -638,6 +738,9 @@ class SelfPlayer {
   // Stats about how every game was won.
   WinStats win_stats_ GUARDED_BY(&mutex_);
 
+  // Total number of readouts skipped because of prune_readouts.
+  int64_t num_readouts_saved_ GUARDED_BY(&mutex_) = 0;
+
   uint64_t flags_timestamp_ = 0;
 
   std::atomic<size_t> game_id_{0};
@@ -655,6 +758,33 @@ int main(int argc, char* argv[]) {
   minigo::Init(&argc, &argv);
   minigo::zobrist::Init(FLAGS_seed);
 
+  if (FLAGS_async_logging) {
+    minigo::logging::EnableAsync(FLAGS_log_buffer_size);
+    minigo::metrics::Registry::Get()->AddCollector(
+        [](minigo::metrics::Registry* registry) {
+          registry
+              ->GetGauge("log_messages_dropped",
+                         "Number of log messages dropped because the "
+                         "logging thread's buffer was full.")
+              ->Set(minigo::logging::GetNumDroppedMessages());
+        });
+  }
+
+  std::unique_ptr<minigo::metrics::Exporter> metrics_exporter;
+  if (!FLAGS_metrics_path.empty()) {
+    metrics_exporter = absl::make_unique<minigo::metrics::Exporter>(
+        FLAGS_metrics_path, absl::Seconds(FLAGS_metrics_interval));
+  }
+
+  std::unique_ptr<minigo::tracing::SignalSnapshotter> trace_snapshotter;
+  if (!FLAGS_trace_path.empty()) {
+    minigo::tracing::Enable(FLAGS_trace_buffer_size);
+#ifdef SIGUSR1
+    trace_snapshotter = absl::make_unique<minigo::tracing::SignalSnapshotter>(
+        SIGUSR1, FLAGS_trace_path, FLAGS_trace_snapshots);
+#endif
+  }
+
   WTF_THREAD_ENABLE("Main");
   {
     WTF_SCOPE0("Selfplay");
@@ -662,9 +792,11 @@ int main(int argc, char* argv[]) {
     player.Run();
   }
 
-#ifdef WTF_ENABLE
-  MG_CHECK(wtf::Runtime::GetInstance()->SaveToFile(FLAGS_wtf_trace));
-#endif
+  if (!FLAGS_trace_path.empty()) {
+    MG_CHECK(minigo::tracing::WriteChromeTrace(FLAGS_trace_path));
+  }
+
+  minigo::logging::Flush();
 
   return 0;
 }
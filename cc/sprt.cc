@@ -0,0 +1,96 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/sprt.h"
+
+#include <cmath>
+#include <sstream>
+
+#include "absl/strings/str_format.h"
+#include "cc/logging.h"
+
+namespace minigo {
+
+double Sprt::EloToScore(double elo) {
+  return 1 / (1 + std::pow(10.0, -elo / 400));
+}
+
+Sprt::Sprt(const Options& options)
+    : options_(options),
+      lower_bound_(std::log(options.beta / (1 - options.alpha))),
+      upper_bound_(std::log((1 - options.beta) / options.alpha)),
+      win_llr_(std::log(EloToScore(options.elo1) / EloToScore(options.elo0))),
+      loss_llr_(std::log((1 - EloToScore(options.elo1)) /
+                         (1 - EloToScore(options.elo0)))) {
+  MG_CHECK(options.elo0 < options.elo1);
+  MG_CHECK(options.alpha > 0 && options.alpha < 1);
+  MG_CHECK(options.beta > 0 && options.beta < 1);
+}
+
+void Sprt::Update(bool a_won) {
+  if (a_won) {
+    num_a_wins_ += 1;
+  } else {
+    num_b_wins_ += 1;
+  }
+}
+
+double Sprt::llr() const {
+  // Go games can't be drawn, so each game is a Bernoulli trial.
+  return num_a_wins_ * win_llr_ + num_b_wins_ * loss_llr_;
+}
+
+Sprt::Decision Sprt::decision() const {
+  auto x = llr();
+  if (x >= upper_bound_) {
+    return Decision::kAcceptH1;
+  }
+  if (x <= lower_bound_) {
+    return Decision::kAcceptH0;
+  }
+  return Decision::kContinue;
+}
+
+double Sprt::los() const {
+  int n = num_games();
+  if (n == 0) {
+    return 0.5;
+  }
+  return 0.5 * (1 + std::erf((num_a_wins_ - num_b_wins_) / std::sqrt(2.0 * n)));
+}
+
+std::string Sprt::ToString() const {
+  std::ostringstream oss;
+  oss << decision();
+  return absl::StrFormat(
+      "SPRT elo0:%.1f elo1:%.1f alpha:%.3f beta:%.3f  games:%d (%d-%d)  "
+      "LLR:%.3f [%.3f, %.3f]  LOS:%.2f%%  decision:%s",
+      options_.elo0, options_.elo1, options_.alpha, options_.beta, num_games(),
+      num_a_wins_, num_b_wins_, llr(), lower_bound_, upper_bound_, 100 * los(),
+      oss.str());
+}
+
+std::ostream& operator<<(std::ostream& os, Sprt::Decision decision) {
+  switch (decision) {
+    case Sprt::Decision::kContinue:
+      return os << "continue";
+    case Sprt::Decision::kAcceptH0:
+      return os << "H0";
+    case Sprt::Decision::kAcceptH1:
+      return os << "H1";
+  }
+  return os << "<unknown>";
+}
+
+}  // namespace minigo
@@ -0,0 +1,93 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_SPRT_H_
+#define CC_SPRT_H_
+
+#include <ostream>
+#include <string>
+
+namespace minigo {
+
+// Sequential probability ratio test for deciding whether model A is stronger
+// than model B from a stream of game results, stopping as soon as the result
+// is statistically decided.
+//
+// The two hypotheses are:
+//   H0: A is elo0 Elo stronger than B.
+//   H1: A is elo1 Elo stronger than B.
+// Where elo0 < elo1. The test is stopped as soon as the log-likelihood ratio
+// of the observed results under H1 vs H0 leaves the interval
+// [log(beta / (1 - alpha)), log((1 - beta) / alpha)], where alpha and beta are
+// the desired false positive & false negative rates respectively.
+class Sprt {
+ public:
+  struct Options {
+    double elo0 = 0;
+    double elo1 = 35;
+    double alpha = 0.05;
+    double beta = 0.05;
+  };
+
+  enum class Decision {
+    // Not enough games have been played to accept either hypothesis.
+    kContinue,
+
+    // H0 was accepted: A is no more than elo0 Elo stronger than B.
+    kAcceptH0,
+
+    // H1 was accepted: A is at least elo1 Elo stronger than B.
+    kAcceptH1,
+  };
+
+  // Returns the expected score of a player that is `elo` Elo stronger than
+  // their opponent.
+  static double EloToScore(double elo);
+
+  explicit Sprt(const Options& options);
+
+  // Records the result of a single game.
+  void Update(bool a_won);
+
+  Decision decision() const;
+  double llr() const;
+  double lower_bound() const { return lower_bound_; }
+  double upper_bound() const { return upper_bound_; }
+
+  // Likelihood of superiority: the probability that A is stronger than B
+  // given the results so far, under a normal approximation.
+  double los() const;
+
+  int num_a_wins() const { return num_a_wins_; }
+  int num_b_wins() const { return num_b_wins_; }
+  int num_games() const { return num_a_wins_ + num_b_wins_; }
+  const Options& options() const { return options_; }
+
+  std::string ToString() const;
+
+ private:
+  const Options options_;
+  const double lower_bound_;
+  const double upper_bound_;
+  const double win_llr_;
+  const double loss_llr_;
+  int num_a_wins_ = 0;
+  int num_b_wins_ = 0;
+};
+
+std::ostream& operator<<(std::ostream& os, Sprt::Decision decision);
+
+}  // namespace minigo
+
+#endif  // CC_SPRT_H_
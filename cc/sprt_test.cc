@@ -0,0 +1,72 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/sprt.h"
+
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+TEST(SprtTest, EloToScore) {
+  EXPECT_NEAR(0.5, Sprt::EloToScore(0), 1e-6);
+  EXPECT_NEAR(0.909, Sprt::EloToScore(400), 1e-3);
+  EXPECT_NEAR(1, Sprt::EloToScore(100) + Sprt::EloToScore(-100), 1e-6);
+}
+
+TEST(SprtTest, Continue) {
+  Sprt sprt(Sprt::Options{});
+  EXPECT_EQ(Sprt::Decision::kContinue, sprt.decision());
+  EXPECT_EQ(0, sprt.llr());
+  EXPECT_EQ(0.5, sprt.los());
+
+  // A handful of even results shouldn't decide anything.
+  for (int i = 0; i < 5; ++i) {
+    sprt.Update(true);
+    sprt.Update(false);
+  }
+  EXPECT_EQ(Sprt::Decision::kContinue, sprt.decision());
+  EXPECT_EQ(10, sprt.num_games());
+}
+
+TEST(SprtTest, AcceptH1) {
+  Sprt sprt(Sprt::Options{});
+  int num_games = 0;
+  while (sprt.decision() == Sprt::Decision::kContinue) {
+    // A wins three games out of every four.
+    sprt.Update(num_games % 4 != 0);
+    num_games += 1;
+    ASSERT_LT(num_games, 1000);
+  }
+  EXPECT_EQ(Sprt::Decision::kAcceptH1, sprt.decision());
+  EXPECT_GE(sprt.llr(), sprt.upper_bound());
+  EXPECT_GT(sprt.los(), 0.95);
+}
+
+TEST(SprtTest, AcceptH0) {
+  Sprt sprt(Sprt::Options{});
+  int num_games = 0;
+  while (sprt.decision() == Sprt::Decision::kContinue) {
+    // A wins one game out of every four.
+    sprt.Update(num_games % 4 == 0);
+    num_games += 1;
+    ASSERT_LT(num_games, 1000);
+  }
+  EXPECT_EQ(Sprt::Decision::kAcceptH0, sprt.decision());
+  EXPECT_LE(sprt.llr(), sprt.lower_bound());
+  EXPECT_LT(sprt.los(), 0.05);
+}
+
+}  // namespace
+}  // namespace minigo
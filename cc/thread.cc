@@ -14,6 +14,7 @@
 
 #include "cc/thread.h"
 
+#include "absl/time/clock.h"
 #include "cc/logging.h"
 
 namespace minigo {
@@ -31,4 +32,14 @@ void Thread::Join() {
 
 void LambdaThread::Run() { closure_(); }
 
+TimedMutexLock::TimedMutexLock(absl::Mutex* mu) : mu_(mu) {
+  if (!mu_->TryLock()) {
+    auto start = absl::Now();
+    mu_->Lock();
+    wait_time_ = absl::Now() - start;
+  }
+}
+
+TimedMutexLock::~TimedMutexLock() { mu_->Unlock(); }
+
 }  // namespace minigo
@@ -15,6 +15,10 @@
 #include <functional>
 #include <thread>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
 namespace minigo {
 
 class Thread {
@@ -41,4 +45,23 @@ class LambdaThread : public Thread {
   std::function<void()> closure_;
 };
 
+// Like absl::MutexLock but also measures how long the calling thread was
+// blocked waiting to acquire the mutex. The clock is only read when the mutex
+// is contended, so an uncontended TimedMutexLock costs no more than a
+// MutexLock.
+class SCOPED_LOCKABLE TimedMutexLock {
+ public:
+  explicit TimedMutexLock(absl::Mutex* mu) EXCLUSIVE_LOCK_FUNCTION(mu);
+  ~TimedMutexLock() UNLOCK_FUNCTION();
+
+  TimedMutexLock(const TimedMutexLock&) = delete;
+  TimedMutexLock& operator=(const TimedMutexLock&) = delete;
+
+  absl::Duration wait_time() const { return wait_time_; }
+
+ private:
+  absl::Mutex* const mu_;
+  absl::Duration wait_time_;
+};
+
 }  // namespace minigo
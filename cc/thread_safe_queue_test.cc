@@ -14,7 +14,9 @@
 
 #include "cc/thread_safe_queue.h"
 
+#include <algorithm>
 #include <map>
+#include <memory>
 #include <thread>
 #include <vector>
 
@@ -24,6 +26,7 @@
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "cc/logging.h"
+#include "cc/mpmc_queue.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -130,5 +133,200 @@ TEST(CoordTest, Multithreading) {
   EXPECT_THAT(popped, ::testing::ContainerEq(pushed));
 }
 
+TEST(MpmcQueueTest, Capacity) {
+  EXPECT_EQ(2, MpmcQueue<int>(0).capacity());
+  EXPECT_EQ(4, MpmcQueue<int>(3).capacity());
+  EXPECT_EQ(8, MpmcQueue<int>(8).capacity());
+
+  MpmcQueue<int> q(4);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(q.TryPush(i));
+  }
+  EXPECT_FALSE(q.TryPush(4));
+  EXPECT_EQ(4, q.size());
+
+  // Popping an element makes room for another, and the queue is still a FIFO
+  // after wrapping around the ring.
+  EXPECT_EQ(0, q.Pop());
+  EXPECT_TRUE(q.TryPush(4));
+  for (int i = 1; i <= 4; ++i) {
+    EXPECT_EQ(i, q.Pop());
+  }
+  EXPECT_TRUE(q.empty());
+}
+
+TEST(MpmcQueueTest, BatchOperations) {
+  MpmcQueue<int> q(8);
+
+  // Only the elements that fit are pushed.
+  std::vector<int> xs = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+  EXPECT_EQ(8, q.TryPushN(xs.data(), xs.size()));
+  EXPECT_EQ(0, q.TryPushN(xs.data() + 8, 2));
+
+  std::vector<int> ys(5, -1);
+  EXPECT_EQ(5, q.TryPopN(ys.data(), ys.size()));
+  EXPECT_THAT(ys, ::testing::ElementsAre(0, 1, 2, 3, 4));
+
+  EXPECT_EQ(2, q.TryPushN(xs.data() + 8, 2));
+
+  ys.assign(10, -1);
+  EXPECT_EQ(5, q.TryPopN(ys.data(), ys.size()));
+  ys.resize(5);
+  EXPECT_THAT(ys, ::testing::ElementsAre(5, 6, 7, 8, 9));
+  EXPECT_EQ(0, q.TryPopN(ys.data(), ys.size()));
+}
+
+TEST(MpmcQueueTest, PopWithTimeout) {
+  MpmcQueue<int> q(4);
+  int x;
+  auto start = absl::Now();
+  EXPECT_FALSE(q.PopWithTimeout(&x, absl::Milliseconds(2)));
+  EXPECT_LT(absl::Milliseconds(1), absl::Now() - start);
+
+  q.Push(-123);
+  EXPECT_TRUE(q.PopWithTimeout(&x, absl::Milliseconds(2)));
+  EXPECT_EQ(-123, x);
+}
+
+TEST(MpmcQueueTest, MoveOnlyObject) {
+  MpmcQueue<std::unique_ptr<int>> q(4);
+  q.Push(std::unique_ptr<int>(new int(42)));
+  q.Push(std::unique_ptr<int>(new int(43)));
+  EXPECT_EQ(42, *q.Pop());
+  // The remaining element is destroyed with the queue.
+}
+
+// Verify that blocking pushes & pops work with many producers and consumers
+// sharing a small queue.
+TEST(MpmcQueueTest, Multithreading) {
+  constexpr int kNumThreads = 4;
+  constexpr int kNumPerThread = 10000;
+  constexpr int kBatchSize = 3;
+  MpmcQueue<int> q(16);
+
+  std::vector<std::thread> producers;
+  for (int i = 0; i < kNumThreads; ++i) {
+    producers.emplace_back([&q, i]() {
+      std::vector<int> batch;
+      for (int j = 0; j < kNumPerThread; ++j) {
+        batch.push_back(i * kNumPerThread + j);
+        if (batch.size() == kBatchSize || j + 1 == kNumPerThread) {
+          q.PushN(batch.data(), batch.size());
+          batch.clear();
+        }
+      }
+    });
+  }
+
+  absl::Mutex m;
+  std::map<int, int> popped;
+  std::vector<std::thread> consumers;
+  for (int i = 0; i < kNumThreads; ++i) {
+    consumers.emplace_back([&]() {
+      // Each consumer pops the same number of elements, so no consumer waits
+      // forever for elements that another consumer popped.
+      std::vector<int> my_popped;
+      int xs[kBatchSize];
+      while (my_popped.size() < kNumPerThread) {
+        auto n = std::min<size_t>(kBatchSize, kNumPerThread - my_popped.size());
+        n = q.PopN(xs, n);
+        my_popped.insert(my_popped.end(), xs, xs + n);
+      }
+
+      absl::MutexLock lock(&m);
+      for (int x : my_popped) {
+        popped[x] += 1;
+      }
+    });
+  }
+
+  for (auto& t : producers) {
+    t.join();
+  }
+  for (auto& t : consumers) {
+    t.join();
+  }
+
+  std::map<int, int> pushed;
+  for (int i = 0; i < kNumThreads * kNumPerThread; ++i) {
+    pushed[i] = 1;
+  }
+  EXPECT_THAT(popped, ::testing::ContainerEq(pushed));
+  EXPECT_TRUE(q.empty());
+}
+
+// Compares the throughput of ThreadSafeQueue and MpmcQueue with the same
+// number of producers & consumers. The results are only logged: timings are
+// too noisy for the test to make any assertions about them.
+template <typename Queue>
+absl::Duration MeasureThroughput(Queue* q, int num_threads, int num_per_thread,
+                                 int batch_size) {
+  auto start = absl::Now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([=]() {
+      std::vector<int> xs(batch_size);
+      for (int j = 0; j < num_per_thread; j += batch_size) {
+        q->PushN(xs.data(), batch_size);
+      }
+    });
+    threads.emplace_back([=]() {
+      // Like the producers, each consumer handles exactly num_per_thread
+      // elements.
+      std::vector<int> xs(batch_size);
+      for (int j = 0; j < num_per_thread;) {
+        j += q->PopN(xs.data(), std::min(batch_size, num_per_thread - j));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  return absl::Now() - start;
+}
+
+// Gives ThreadSafeQueue the same batch interface as MpmcQueue, one element
+// per lock acquisition.
+class BatchedThreadSafeQueue {
+ public:
+  void PushN(int* xs, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      q_.Push(xs[i]);
+    }
+  }
+
+  size_t PopN(int* xs, size_t n) {
+    xs[0] = q_.Pop();
+    size_t i = 1;
+    while (i < n && q_.TryPop(&xs[i])) {
+      ++i;
+    }
+    return i;
+  }
+
+ private:
+  ThreadSafeQueue<int> q_;
+};
+
+TEST(MpmcQueueTest, Throughput) {
+  constexpr int kNumPerThread = 1 << 16;
+  for (int num_threads : {1, 4}) {
+    for (int batch_size : {1, 16}) {
+      BatchedThreadSafeQueue thread_safe_queue;
+      MpmcQueue<int> mpmc_queue(1024);
+      auto a = MeasureThroughput(&thread_safe_queue, num_threads,
+                                 kNumPerThread, batch_size);
+      auto b = MeasureThroughput(&mpmc_queue, num_threads, kNumPerThread,
+                                 batch_size);
+      auto items = static_cast<double>(num_threads) * kNumPerThread;
+      MG_LOG(INFO) << num_threads << " producers & consumers, batch size "
+                   << batch_size << ": ThreadSafeQueue "
+                   << absl::ToDoubleNanoseconds(a) / items
+                   << "ns/item, MpmcQueue "
+                   << absl::ToDoubleNanoseconds(b) / items << "ns/item";
+    }
+  }
+}
+
 }  // namespace
 }  // namespace minigo
@@ -0,0 +1,258 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/tracing.h"
+
+#include <algorithm>
+#include <csignal>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "cc/file/utils.h"
+#include "cc/json.h"
+#include "cc/logging.h"
+
+namespace minigo {
+namespace tracing {
+
+namespace internal {
+std::atomic<bool> enabled{false};
+}  // namespace internal
+
+namespace {
+
+struct Event {
+  const char* name;
+  int64_t begin_ns;
+  int64_t end_ns;
+  int64_t arg;
+  bool has_arg;
+};
+
+// The events recorded by a single thread.
+struct ThreadBuffer {
+  explicit ThreadBuffer(int tid) : tid(tid) {}
+
+  const int tid;
+
+  absl::Mutex mutex;
+  std::string name GUARDED_BY(&mutex);
+
+  // A ring buffer of events. It's allocated when the thread records its first
+  // event, so that threads that only set their name don't use any memory.
+  std::vector<Event> events GUARDED_BY(&mutex);
+  size_t capacity GUARDED_BY(&mutex) = 0;
+  uint64_t num_recorded GUARDED_BY(&mutex) = 0;
+};
+
+class Tracer {
+ public:
+  static Tracer* Get() {
+    static auto* tracer = new Tracer();
+    return tracer;
+  }
+
+  void set_events_per_thread(size_t events_per_thread) {
+    MG_CHECK(events_per_thread > 0);
+    absl::MutexLock lock(&mutex_);
+    events_per_thread_ = events_per_thread;
+  }
+
+  // Returns the calling thread's buffer, creating it if necessary. Buffers
+  // are never freed, so that events recorded by threads that have exited are
+  // still written to the trace.
+  ThreadBuffer* GetThreadBuffer() {
+    static thread_local ThreadBuffer* buffer = nullptr;
+    if (buffer == nullptr) {
+      absl::MutexLock lock(&mutex_);
+      int tid = static_cast<int>(buffers_.size()) + 1;
+      buffers_.push_back(absl::make_unique<ThreadBuffer>(tid));
+      buffer = buffers_.back().get();
+    }
+    return buffer;
+  }
+
+  void RecordEvent(const Event& event) {
+    auto* buffer = GetThreadBuffer();
+    absl::MutexLock lock(&buffer->mutex);
+    if (buffer->capacity == 0) {
+      buffer->capacity = events_per_thread();
+      buffer->events.resize(buffer->capacity);
+    }
+    buffer->events[buffer->num_recorded % buffer->capacity] = event;
+    buffer->num_recorded += 1;
+  }
+
+  std::string ExportChromeTrace() {
+    std::vector<ThreadBuffer*> buffers;
+    {
+      absl::MutexLock lock(&mutex_);
+      for (const auto& buffer : buffers_) {
+        buffers.push_back(buffer.get());
+      }
+    }
+
+    // Event names are usually shared by many events, so only escape each one
+    // once.
+    absl::flat_hash_map<const char*, std::string> escaped_names;
+    auto escape = [&escaped_names](const char* name) -> const std::string& {
+      auto it = escaped_names.find(name);
+      if (it == escaped_names.end()) {
+        it = escaped_names.emplace(name, nlohmann::json(name).dump()).first;
+      }
+      return it->second;
+    };
+
+    std::string result = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    const char* separator = "\n";
+    std::vector<Event> events;
+    for (auto* buffer : buffers) {
+      std::string thread_name;
+      {
+        // Copy the events out of the buffer so that the thread isn't blocked
+        // while they're formatted.
+        absl::MutexLock lock(&buffer->mutex);
+        thread_name = buffer->name;
+        events.clear();
+        auto n = std::min<uint64_t>(buffer->num_recorded, buffer->capacity);
+        for (uint64_t i = buffer->num_recorded - n; i < buffer->num_recorded;
+             ++i) {
+          events.push_back(buffer->events[i % buffer->capacity]);
+        }
+      }
+
+      if (!thread_name.empty()) {
+        absl::StrAppend(&result, separator,
+                        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,",
+                        "\"tid\":", buffer->tid, ",\"args\":{\"name\":",
+                        nlohmann::json(thread_name).dump(), "}}");
+        separator = ",\n";
+      }
+
+      // Timestamps are in microseconds since the tracer was created.
+      for (const auto& event : events) {
+        absl::StrAppendFormat(
+            &result,
+            "%s{\"name\":%s,\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+            "\"dur\":%.3f",
+            separator, escape(event.name), buffer->tid,
+            (event.begin_ns - start_ns_) / 1000.0,
+            (event.end_ns - event.begin_ns) / 1000.0);
+        if (event.has_arg) {
+          absl::StrAppend(&result, ",\"args\":{\"value\":", event.arg, "}");
+        }
+        absl::StrAppend(&result, "}");
+        separator = ",\n";
+      }
+    }
+    absl::StrAppend(&result, "\n]}\n");
+    return result;
+  }
+
+ private:
+  Tracer() : start_ns_(absl::GetCurrentTimeNanos()) {}
+
+  size_t events_per_thread() {
+    absl::MutexLock lock(&mutex_);
+    return events_per_thread_;
+  }
+
+  const int64_t start_ns_;
+
+  absl::Mutex mutex_;
+  size_t events_per_thread_ GUARDED_BY(&mutex_) = 1 << 16;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_ GUARDED_BY(&mutex_);
+};
+
+// Number of signals received by the SignalSnapshotter's handler.
+volatile std::sig_atomic_t num_signals = 0;
+
+void SignalHandler(int) { num_signals = num_signals + 1; }
+
+}  // namespace
+
+namespace internal {
+
+void RecordEvent(const char* name, int64_t begin_ns, int64_t end_ns,
+                 int64_t arg, bool has_arg) {
+  Tracer::Get()->RecordEvent({name, begin_ns, end_ns, arg, has_arg});
+}
+
+}  // namespace internal
+
+void Enable(size_t events_per_thread) {
+  Tracer::Get()->set_events_per_thread(events_per_thread);
+  internal::enabled = true;
+}
+
+void Disable() { internal::enabled = false; }
+
+void SetThreadName(std::string name) {
+  auto* buffer = Tracer::Get()->GetThreadBuffer();
+  absl::MutexLock lock(&buffer->mutex);
+  buffer->name = std::move(name);
+}
+
+std::string ExportChromeTrace() { return Tracer::Get()->ExportChromeTrace(); }
+
+bool WriteChromeTrace(const std::string& path) {
+  return file::WriteFile(path, ExportChromeTrace());
+}
+
+SignalSnapshotter::SignalSnapshotter(int signum, std::string path,
+                                     int num_snapshots)
+    : signum_(signum), path_(std::move(path)), num_snapshots_(num_snapshots) {
+  MG_CHECK(num_snapshots_ > 0);
+  MG_CHECK(std::signal(signum_, SignalHandler) != SIG_ERR);
+
+  // Signal handlers are very restricted in what they can do, so the handler
+  // just counts the signals and this thread writes the snapshots.
+  std::sig_atomic_t prev_num_signals = num_signals;
+  thread_ = std::thread([this, prev_num_signals]() mutable {
+    absl::MutexLock lock(&mutex_);
+    while (!mutex_.AwaitWithTimeout(absl::Condition(&stop_),
+                                    absl::Milliseconds(100))) {
+      if (num_signals == prev_num_signals) {
+        continue;
+      }
+      prev_num_signals = num_signals;
+      mutex_.Unlock();
+      auto snapshot_path =
+          absl::StrCat(path_, ".", num_written_++ % num_snapshots_);
+      if (WriteChromeTrace(snapshot_path)) {
+        MG_LOG(INFO) << "Wrote trace snapshot to " << snapshot_path;
+      } else {
+        MG_LOG(ERROR) << "Error writing trace snapshot to " << snapshot_path;
+      }
+      mutex_.Lock();
+    }
+  });
+}
+
+SignalSnapshotter::~SignalSnapshotter() {
+  std::signal(signum_, SIG_DFL);
+  {
+    absl::MutexLock lock(&mutex_);
+    stop_ = true;
+  }
+  thread_.join();
+}
+
+}  // namespace tracing
+}  // namespace minigo
@@ -0,0 +1,163 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_TRACING_H_
+#define CC_TRACING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "absl/base/attributes.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+// A low overhead tracer that writes traces in the Chrome trace event format,
+// which can be viewed in chrome://tracing or https://ui.perfetto.dev.
+//
+// Code is instrumented with scoped events:
+//
+//   void ModelBatcher::RunBatch() {
+//     MG_TRACE_SCOPE("ModelBatcher::RunBatch");
+//     ...
+//   }
+//
+//   MG_TRACE_SCOPE_ARG("TfDualNet::Run", inputs.size());
+//
+// Event names must be string literals (or otherwise outlive the tracer): only
+// the pointer is recorded.
+//
+// Tracing is disabled by default, in which case a scoped event costs a single
+// relaxed atomic load. Once enabled, every thread records its events into its
+// own fixed size ring buffer, so long running processes keep only the most
+// recent events.
+//
+// For compatibility with code written against the Web Tracing Framework, the
+// WTF_SCOPE0, WTF_SCOPE and WTF_THREAD_ENABLE macros are also defined.
+
+namespace minigo {
+namespace tracing {
+
+namespace internal {
+
+extern std::atomic<bool> enabled;
+
+// Records a complete event in the calling thread's ring buffer.
+void RecordEvent(const char* name, int64_t begin_ns, int64_t end_ns,
+                 int64_t arg, bool has_arg);
+
+}  // namespace internal
+
+// Starts recording events. Each thread keeps at most `events_per_thread`
+// events. Changing `events_per_thread` only affects threads that haven't
+// recorded any events yet.
+void Enable(size_t events_per_thread = 1 << 16);
+
+// Stops recording events. Events that have already been recorded are kept.
+void Disable();
+
+inline bool IsEnabled() {
+  return internal::enabled.load(std::memory_order_relaxed);
+}
+
+// Sets the name that the calling thread is displayed with in the trace.
+void SetThreadName(std::string name);
+
+// Returns all the recorded events in the Chrome trace event JSON format.
+std::string ExportChromeTrace();
+
+// Writes all the recorded events to `path` in the Chrome trace event JSON
+// format. Returns true on success.
+ABSL_MUST_USE_RESULT bool WriteChromeTrace(const std::string& path);
+
+// Records the time between its construction and destruction as a trace event.
+class ScopedEvent {
+ public:
+  explicit ScopedEvent(const char* name)
+      : name_(IsEnabled() ? name : nullptr),
+        begin_ns_(name_ != nullptr ? absl::GetCurrentTimeNanos() : 0) {}
+
+  ScopedEvent(const char* name, int64_t arg) : ScopedEvent(name) {
+    SetArg(arg);
+  }
+
+  ~ScopedEvent() {
+    if (name_ != nullptr) {
+      internal::RecordEvent(name_, begin_ns_, absl::GetCurrentTimeNanos(),
+                            arg_, has_arg_);
+    }
+  }
+
+  // Attaches an integer argument to the event, shown as `args.value` in the
+  // trace viewer.
+  void SetArg(int64_t arg) {
+    arg_ = arg;
+    has_arg_ = true;
+  }
+
+  ScopedEvent(const ScopedEvent&) = delete;
+  ScopedEvent& operator=(const ScopedEvent&) = delete;
+
+ private:
+  const char* name_;
+  int64_t begin_ns_;
+  int64_t arg_ = 0;
+  bool has_arg_ = false;
+};
+
+// Writes a new snapshot of the trace every time the process receives a signal.
+// Snapshots are written to "<path>.0", "<path>.1", ... "<path>.<n-1>", where n
+// is `num_snapshots`, after which the oldest snapshot is overwritten.
+// Only one SignalSnapshotter may exist at a time.
+class SignalSnapshotter {
+ public:
+  SignalSnapshotter(int signum, std::string path, int num_snapshots);
+  ~SignalSnapshotter();
+
+ private:
+  const int signum_;
+  const std::string path_;
+  const int num_snapshots_;
+  int num_written_ = 0;
+
+  absl::Mutex mutex_;
+  bool stop_ GUARDED_BY(&mutex_) = false;
+  std::thread thread_;
+};
+
+}  // namespace tracing
+}  // namespace minigo
+
+#define MG_TRACE_CONCAT_IMPL(a, b) a##b
+#define MG_TRACE_CONCAT(a, b) MG_TRACE_CONCAT_IMPL(a, b)
+#define MG_TRACE_VAR MG_TRACE_CONCAT(mg_trace_scope_, __LINE__)
+
+#define MG_TRACE_SCOPE(name) ::minigo::tracing::ScopedEvent MG_TRACE_VAR(name)
+#define MG_TRACE_SCOPE_ARG(name, arg) \
+  ::minigo::tracing::ScopedEvent MG_TRACE_VAR(name, arg)
+
+// Web Tracing Framework compatible macros.
+// WTF_SCOPE takes the types of the event's arguments and is followed by their
+// values, e.g. `WTF_SCOPE("Session::Run", size_t)(batch_size)`. Only a single
+// integer argument is supported.
+#define WTF_SCOPE0(name) MG_TRACE_SCOPE(name)
+#define WTF_SCOPE(name, ...) \
+  MG_TRACE_SCOPE(name);      \
+  MG_TRACE_VAR.SetArg
+#define WTF_THREAD_ENABLE(name) ::minigo::tracing::SetThreadName(name)
+
+#endif  // CC_TRACING_H_
@@ -0,0 +1,124 @@
+// Copyright 2019 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/tracing.h"
+
+#include <csignal>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cc/file/path.h"
+#include "cc/file/utils.h"
+#include "cc/json.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace tracing {
+namespace {
+
+// Returns all the complete events called `name` in the exported trace.
+std::vector<nlohmann::json> GetEvents(const std::string& name) {
+  auto trace = nlohmann::json::parse(ExportChromeTrace());
+  std::vector<nlohmann::json> result;
+  for (const auto& event : trace["traceEvents"]) {
+    if (event["ph"] == "X" && event["name"] == name) {
+      result.push_back(event);
+    }
+  }
+  return result;
+}
+
+TEST(TracingTest, ScopedEvents) {
+  Enable();
+  std::thread thread([]() {
+    WTF_THREAD_ENABLE("TestThread");
+    MG_TRACE_SCOPE("outer");
+    WTF_SCOPE("inner", size_t)(42);
+  });
+  thread.join();
+
+  auto outer = GetEvents("outer");
+  auto inner = GetEvents("inner");
+  ASSERT_EQ(1, outer.size());
+  ASSERT_EQ(1, inner.size());
+  EXPECT_EQ(42, inner[0]["args"]["value"]);
+  EXPECT_EQ(outer[0]["tid"], inner[0]["tid"]);
+  EXPECT_LE(outer[0]["ts"].get<double>(), inner[0]["ts"].get<double>());
+  EXPECT_GE(outer[0]["dur"].get<double>(), inner[0]["dur"].get<double>());
+
+  // The thread's name is written as a metadata event.
+  auto trace = nlohmann::json::parse(ExportChromeTrace());
+  bool found_thread_name = false;
+  for (const auto& event : trace["traceEvents"]) {
+    if (event["ph"] == "M" && event["tid"] == outer[0]["tid"]) {
+      EXPECT_EQ("thread_name", event["name"]);
+      EXPECT_EQ("TestThread", event["args"]["name"]);
+      found_thread_name = true;
+    }
+  }
+  EXPECT_TRUE(found_thread_name);
+}
+
+TEST(TracingTest, Disabled) {
+  Disable();
+  { MG_TRACE_SCOPE("disabled"); }
+  Enable();
+  EXPECT_TRUE(GetEvents("disabled").empty());
+}
+
+TEST(TracingTest, RingBufferKeepsMostRecentEvents) {
+  Enable(4);
+  std::thread thread([]() {
+    for (int i = 0; i < 10; ++i) {
+      MG_TRACE_SCOPE_ARG("ring", i);
+    }
+  });
+  thread.join();
+  Enable();
+
+  auto events = GetEvents("ring");
+  ASSERT_EQ(4, events.size());
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(6 + i, events[i]["args"]["value"]);
+  }
+}
+
+TEST(TracingTest, SignalSnapshotter) {
+  Enable();
+  { MG_TRACE_SCOPE("snapshot"); }
+
+  auto path = file::JoinPath(::testing::TempDir(), "trace.json");
+  auto snapshot_path = path + ".0";
+  remove(snapshot_path.c_str());
+
+  SignalSnapshotter snapshotter(SIGUSR1, path, 2);
+  std::raise(SIGUSR1);
+
+  std::string contents;
+  auto deadline = absl::Now() + absl::Seconds(10);
+  while (!file::ReadFile(snapshot_path, &contents) && absl::Now() < deadline) {
+    absl::SleepFor(absl::Milliseconds(10));
+  }
+  auto trace = nlohmann::json::parse(contents);
+  bool found = false;
+  for (const auto& event : trace["traceEvents"]) {
+    found |= event["name"] == "snapshot";
+  }
+  EXPECT_TRUE(found);
+}
+
+}  // namespace
+}  // namespace tracing
+}  // namespace minigo
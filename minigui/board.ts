@@ -105,6 +105,9 @@ class Board extends View {
   update(update: Position | Position.Update) {
     let anythingChanged = false;
     let keys = new Set<string>(Object.keys(update));
+    // Diffs modify the same properties as the full arrays.
+    if (keys.has('childNDiff')) { keys.add('childN'); }
+    if (keys.has('childQDiff')) { keys.add('childQ'); }
     for (let layer of this.layers) {
       if (layer.update(keys)) {
         anythingChanged = true;
@@ -57,6 +57,7 @@ class Position {
     numNodes: 0,
     numLeafNodes: 0,
     maxDepth: 0,
+    numBytes: 0,
   }
 
   constructor(j: Position.Definition) {
@@ -167,6 +168,21 @@ class Position {
       this.childQ = [];
       for (let q of update.childQ) { this.childQ.push(q / 1000); }
     }
+    // The diffs are flattened arrays of [index, value] pairs that only hold
+    // the values that changed since the previous update. They are ignored if
+    // we never received the full array to apply them to.
+    if (update.childNDiff !== undefined && this.childN != null) {
+      let diff = update.childNDiff;
+      for (let i = 0; i < diff.length; i += 2) {
+        this.childN[diff[i]] = diff[i + 1];
+      }
+    }
+    if (update.childQDiff !== undefined && this.childQ != null) {
+      let diff = update.childQDiff;
+      for (let i = 0; i < diff.length; i += 2) {
+        this.childQ[diff[i]] = diff[i + 1] / 1000;
+      }
+    }
     if (update.treeStats !== undefined) { this.treeStats = update.treeStats; }
     if (update.variations !== undefined) {
       this.variations.clear();
@@ -233,6 +249,7 @@ namespace Position {
     numNodes: number;
     numLeafNodes: number;
     maxDepth: number;
+    numBytes: number;
   }
 
   export interface Update {
@@ -241,6 +258,8 @@ namespace Position {
     q?: number;
     childN?: number[];
     childQ?: number[];
+    childNDiff?: number[];
+    childQDiff?: number[];
     treeStats?: TreeStats;
     variations?: {
       [index:string]: {
@@ -65,6 +65,12 @@ define(["require", "exports", "./base", "./layer", "./util", "./view"], function
         update(update) {
             let anythingChanged = false;
             let keys = new Set(Object.keys(update));
+            if (keys.has('childNDiff')) {
+                keys.add('childN');
+            }
+            if (keys.has('childQDiff')) {
+                keys.add('childQ');
+            }
             for (let layer of this.layers) {
                 if (layer.update(keys)) {
                     anythingChanged = true;
@@ -19,6 +19,7 @@ define(["require", "exports", "./base", "./util"], function (require, exports, b
                 numNodes: 0,
                 numLeafNodes: 0,
                 maxDepth: 0,
+                numBytes: 0,
             };
             this.id = j.id;
             this.moveNum = j.moveNum;
@@ -126,6 +127,18 @@ define(["require", "exports", "./base", "./util"], function (require, exports, b
                     this.childQ.push(q / 1000);
                 }
             }
+            if (update.childNDiff !== undefined && this.childN != null) {
+                let diff = update.childNDiff;
+                for (let i = 0; i < diff.length; i += 2) {
+                    this.childN[diff[i]] = diff[i + 1];
+                }
+            }
+            if (update.childQDiff !== undefined && this.childQ != null) {
+                let diff = update.childQDiff;
+                for (let i = 0; i < diff.length; i += 2) {
+                    this.childQ[diff[i]] = diff[i + 1] / 1000;
+                }
+            }
             if (update.treeStats !== undefined) {
                 this.treeStats = update.treeStats;
             }
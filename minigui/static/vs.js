@@ -53,6 +53,8 @@ define(["require", "exports", "./position", "./gtp_socket", "./base", "./graph",
             this.capturesElem = util.getElement(`${gtpCol}-captures`);
             this.timeElapsedElem = util.getElement(`${gtpCol}-time-elapsed`);
             this.timeTotalElem = util.getElement(`${gtpCol}-time-total`);
+            this.treeSizeElem = util.getElement(`${gtpCol}-tree-size`);
+            this.updateTreeSizeDisplay(0);
         }
         addPosition(position) {
             if (this.latestPosition == null) {
@@ -76,6 +78,9 @@ define(["require", "exports", "./position", "./gtp_socket", "./base", "./graph",
             if (this.activePosition == this.latestPosition) {
                 this.board.update(update);
             }
+            if (update.treeStats !== undefined) {
+                this.updateTreeSizeDisplay(update.treeStats.numBytes);
+            }
         }
         selectMove(moveNum) {
             if (this.activePosition == null) {
@@ -119,6 +124,10 @@ define(["require", "exports", "./position", "./gtp_socket", "./base", "./graph",
             this.timeElapsedElem.innerText = this.formatDuration(elapsed);
             this.timeTotalElem.innerText = this.formatDuration(total);
         }
+        updateTreeSizeDisplay(numBytes) {
+            let mb = numBytes / (1024 * 1024);
+            this.treeSizeElem.innerText = `tree: ${mb.toFixed(1)} MB`;
+        }
         formatDuration(durationSecs) {
             durationSecs = Math.floor(durationSecs);
             let s = durationSecs % 60;
@@ -34,6 +34,7 @@ class Player {
   capturesElem: HTMLElement;
   timeElapsedElem: HTMLElement;
   timeTotalElem: HTMLElement;
+  treeSizeElem: HTMLElement;
 
   private genmoveTimerId = 0;
   private genmoveStartTimeSecs = 0;
@@ -93,6 +94,8 @@ class Player {
     this.capturesElem = util.getElement(`${gtpCol}-captures`);
     this.timeElapsedElem = util.getElement(`${gtpCol}-time-elapsed`);
     this.timeTotalElem = util.getElement(`${gtpCol}-time-total`);
+    this.treeSizeElem = util.getElement(`${gtpCol}-tree-size`);
+    this.updateTreeSizeDisplay(0);
   }
 
   addPosition(position: Position) {
@@ -117,6 +120,9 @@ class Player {
     if (this.activePosition == this.latestPosition) {
       this.board.update(update);
     }
+    if (update.treeStats !== undefined) {
+      this.updateTreeSizeDisplay(update.treeStats.numBytes);
+    }
   }
 
   selectMove(moveNum: number) {
@@ -170,6 +176,11 @@ class Player {
     this.timeTotalElem.innerText = this.formatDuration(total);
   }
 
+  private updateTreeSizeDisplay(numBytes: number) {
+    let mb = numBytes / (1024 * 1024);
+    this.treeSizeElem.innerText = `tree: ${mb.toFixed(1)} MB`;
+  }
+
   private formatDuration(durationSecs: number) {
     durationSecs = Math.floor(durationSecs);
     let s = durationSecs % 60;